@@ -0,0 +1,69 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_BENCHMARKUTILS_H
+#define PCL_AGGREGATOR_CORE_BENCHMARKUTILS_H
+
+#include "SyntheticClouds.h"
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#include <benchmark/benchmark.h>
+#include <cstddef>
+#include <cstdint>
+
+// smallest and largest clouds of the size sweeps
+#define BENCHMARK_MIN_POINTS (1 << 12)
+#define BENCHMARK_MAX_POINTS (1 << 20)
+// ratio between the sizes of the sweeps
+#define BENCHMARK_SIZE_MULTIPLIER 4
+
+namespace pcl_aggregator {
+    namespace benchmarks {
+
+        /*! \brief Backend a benchmark runs on, passed as its second argument. */
+        enum BenchmarkBackend {
+            BENCHMARK_BACKEND_CPU = 0,
+            BENCHMARK_BACKEND_CUDA = 1
+        };
+
+        /*! \brief Point the backend selection at the backend of a benchmark, from its second argument.
+         *
+         * @param state The state of the benchmark.
+         * @return Flag denoting if the backend is available. The benchmark is skipped otherwise.
+         */
+        inline bool selectBackend(benchmark::State& state) {
+
+            if(state.range(1) == BENCHMARK_BACKEND_CUDA) {
+                if(!compute::ComputeBackend::isCudaAvailable()) {
+                    state.SkipWithError("no CUDA device");
+                    return false;
+                }
+                compute::ComputeBackend::setPreference(compute::BackendPreference::CUDA);
+                state.SetLabel("cuda");
+            } else {
+                compute::ComputeBackend::setPreference(compute::BackendPreference::CPU);
+                state.SetLabel("cpu");
+            }
+
+            return true;
+        }
+
+        /*! \brief Report the points processed by a benchmark, for a points per second rate. */
+        inline void setPointsProcessed(benchmark::State& state, std::size_t pointsPerIteration) {
+            state.SetItemsProcessed((std::int64_t) state.iterations() * (std::int64_t) pointsPerIteration);
+            state.SetBytesProcessed((std::int64_t) state.iterations() * (std::int64_t) pointsPerIteration *
+                                    (std::int64_t) sizeof(pcl::PointXYZRGBL));
+        }
+
+        /*! \brief Sweep a benchmark over the cloud sizes, on both backends. */
+        inline void sizesAndBackends(benchmark::internal::Benchmark* b) {
+            for(int backend : {BENCHMARK_BACKEND_CPU, BENCHMARK_BACKEND_CUDA}) {
+                for(std::int64_t n = BENCHMARK_MIN_POINTS; n <= BENCHMARK_MAX_POINTS; n *= BENCHMARK_SIZE_MULTIPLIER)
+                    b->Args({n, backend});
+            }
+        }
+
+    } // pcl_aggregator
+} // benchmarks
+
+#endif //PCL_AGGREGATOR_CORE_BENCHMARKUTILS_H
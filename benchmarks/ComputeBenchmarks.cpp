@@ -0,0 +1,159 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include "BenchmarkUtils.h"
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#include <pcl_aggregator_core/compute/Deskew.h>
+#include <pcl_aggregator_core/utils/PoseBuffer.h>
+
+// voxel size of the downsampling benchmarks, like the stream downsampling
+#define BENCHMARK_LEAF_SIZE 0.1f
+
+namespace pcl_aggregator {
+    namespace benchmarks {
+
+        static void BM_SetPointCloudLabel(benchmark::State& state) {
+            if(!selectBackend(state))
+                return;
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud = makeScan(n);
+            compute::ComputeBackend& backend = compute::ComputeBackend::select(n);
+
+            std::uint32_t label = 0;
+            for(auto _ : state) {
+                backend.setPointCloudLabel(cloud, label++);
+                benchmark::ClobberMemory();
+            }
+
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_SetPointCloudLabel)->Apply(sizesAndBackends)->Unit(benchmark::kMicrosecond);
+
+        static void BM_TransformPointCloud(benchmark::State& state) {
+            if(!selectBackend(state))
+                return;
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud = makeScan(n);
+            compute::ComputeBackend& backend = compute::ComputeBackend::select(n);
+
+            // a small rotation, so the points stay finite over the iterations
+            Eigen::Affine3d tf = Eigen::Affine3d::Identity();
+            tf.rotate(Eigen::AngleAxisd(0.001, Eigen::Vector3d::UnitZ()));
+
+            for(auto _ : state) {
+                backend.transformPointCloud(cloud, tf);
+                benchmark::ClobberMemory();
+            }
+
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_TransformPointCloud)->Apply(sizesAndBackends)->Unit(benchmark::kMicrosecond);
+
+        static void BM_ConcatenatePointClouds(benchmark::State& state) {
+            if(!selectBackend(state))
+                return;
+
+            // a frame appended to a merged PointCloud of the same size
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr merged = makeScan(n, 1, 1);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr frame = makeScan(n, 2, 2);
+            merged->points.reserve(2 * n);
+            compute::ComputeBackend& backend = compute::ComputeBackend::select(n);
+
+            for(auto _ : state) {
+                backend.concatenatePointClouds(merged, *frame);
+                benchmark::ClobberMemory();
+                // shrinking keeps the capacity, so no iteration reallocates
+                merged->resize(n);
+            }
+
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_ConcatenatePointClouds)->Apply(sizesAndBackends)->Unit(benchmark::kMicrosecond);
+
+        static void BM_IngestPointCloud(benchmark::State& state) {
+            if(!selectBackend(state))
+                return;
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr merged = makeScan(n, 1, 1);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr frame = makeScan(n, 0, 2);
+            merged->points.reserve(2 * n);
+            compute::ComputeBackend& backend = compute::ComputeBackend::select(n);
+
+            Eigen::Affine3d tf = Eigen::Affine3d::Identity();
+            tf.translate(Eigen::Vector3d(0.5, 0.0, 1.2));
+
+            for(auto _ : state) {
+                backend.ingestPointCloud(merged, *frame, 2, tf);
+                benchmark::ClobberMemory();
+                merged->resize(n);
+            }
+
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_IngestPointCloud)->Apply(sizesAndBackends)->Unit(benchmark::kMicrosecond);
+
+        static void BM_IngestPointCloudDeskew(benchmark::State& state) {
+            if(!selectBackend(state))
+                return;
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr merged(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr frame = makeScan(n);
+            merged->points.reserve(n);
+            compute::ComputeBackend& backend = compute::ComputeBackend::select(n);
+
+            // the robot turns and drives forward over the scan
+            utils::PoseBuffer poses;
+            Eigen::Affine3d end = Eigen::Affine3d::Identity();
+            end.translate(Eigen::Vector3d(1.0, 0.0, 0.0));
+            end.rotate(Eigen::AngleAxisd(0.1, Eigen::Vector3d::UnitZ()));
+            poses.addPose(0, Eigen::Affine3d::Identity());
+            poses.addPose(DESKEW_DEFAULT_SCAN_DURATION_US, end);
+
+            compute::DeskewParams params;
+            params.timing = compute::DeskewTiming::INDEX;
+            compute::DeskewTable table;
+            compute::Deskew::buildTable(poses, 0, params, Eigen::Affine3d::Identity(), Eigen::Affine3d::Identity(),
+                                        frame->width, frame->size(), table);
+
+            for(auto _ : state) {
+                backend.ingestPointCloud(merged, *frame, 1, table);
+                benchmark::ClobberMemory();
+                merged->clear();
+            }
+
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_IngestPointCloudDeskew)->Apply(sizesAndBackends)->Unit(benchmark::kMicrosecond);
+
+        static void BM_VoxelDownsample(benchmark::State& state) {
+            if(!selectBackend(state))
+                return;
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr source = makeMergedCloud(n, 8);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            compute::ComputeBackend& backend = compute::ComputeBackend::select(n);
+
+            for(auto _ : state) {
+                // the filter works in-place, so each iteration starts from the full cloud
+                state.PauseTiming();
+                *cloud = *source;
+                state.ResumeTiming();
+
+                backend.voxelDownsample(cloud, BENCHMARK_LEAF_SIZE);
+                benchmark::ClobberMemory();
+            }
+
+            state.counters["points_out"] = (double) cloud->size();
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_VoxelDownsample)->Apply(sizesAndBackends)->Unit(benchmark::kMillisecond);
+
+    } // pcl_aggregator
+} // benchmarks
@@ -0,0 +1,117 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include "BenchmarkUtils.h"
+#include <pcl_aggregator_core/entities/StampedPointCloud.h>
+#include <pcl_aggregator_core/entities/VoxelHashMap.h>
+#include <pcl_aggregator_core/managers/StreamManager.h>
+#include <set>
+
+// scans on the merged PointClouds of the removal benchmarks
+#define BENCHMARK_SCANS 32
+// scans aged on each iteration of the removal benchmarks
+#define BENCHMARK_AGED_SCANS 4
+
+namespace pcl_aggregator {
+    namespace benchmarks {
+
+        /*! \brief The labels of the oldest scans of makeMergedCloud. */
+        static std::set<std::uint32_t> getAgedLabels() {
+            std::set<std::uint32_t> labels;
+            for(std::uint32_t l = 1; l <= BENCHMARK_AGED_SCANS; l++)
+                labels.insert(l);
+            return labels;
+        }
+
+        static void BM_StampedPointCloudDownsample(benchmark::State& state) {
+            if(!selectBackend(state))
+                return;
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr source = makeMergedCloud(n, BENCHMARK_SCANS);
+            entities::StampedPointCloud cloud("benchmark");
+
+            for(auto _ : state) {
+                state.PauseTiming();
+                cloud.setPointCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr(
+                        new pcl::PointCloud<pcl::PointXYZRGBL>(*source)), false);
+                state.ResumeTiming();
+
+                cloud.downsample(STREAM_DOWNSAMPLING_LEAF_SIZE);
+            }
+
+            state.counters["points_out"] = (double) cloud.getSize();
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_StampedPointCloudDownsample)->Apply(sizesAndBackends)->Unit(benchmark::kMillisecond);
+
+        static void BM_RemovePointsWithLabels(benchmark::State& state) {
+            if(!selectBackend(state))
+                return;
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr source = makeMergedCloud(n, BENCHMARK_SCANS);
+            std::set<std::uint32_t> labels = getAgedLabels();
+            entities::StampedPointCloud cloud("benchmark");
+
+            for(auto _ : state) {
+                // indexed on set, like the merged PointClouds built by appends
+                state.PauseTiming();
+                cloud.setPointCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr(
+                        new pcl::PointCloud<pcl::PointXYZRGBL>(*source)), false);
+                state.ResumeTiming();
+
+                cloud.removePointsWithLabels(labels);
+            }
+
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_RemovePointsWithLabels)->Apply(sizesAndBackends)->Unit(benchmark::kMicrosecond);
+
+        static void BM_VoxelHashMapInsert(benchmark::State& state) {
+
+            // a new scan over an existing map of the same size: most voxels are already there
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr map = makeMergedCloud(n, BENCHMARK_SCANS);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr scan = makeScan(n, BENCHMARK_SCANS + 1, BENCHMARK_SCANS + 1);
+            entities::VoxelHashMap voxels(STREAM_DOWNSAMPLING_LEAF_SIZE);
+
+            for(auto _ : state) {
+                state.PauseTiming();
+                voxels.clear();
+                voxels.insertPointCloud(*map);
+                state.ResumeTiming();
+
+                voxels.insertPointCloud(*scan);
+            }
+
+            state.counters["voxels"] = (double) voxels.size();
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_VoxelHashMapInsert)->RangeMultiplier(BENCHMARK_SIZE_MULTIPLIER)
+                ->Range(BENCHMARK_MIN_POINTS, BENCHMARK_MAX_POINTS)->Unit(benchmark::kMicrosecond);
+
+        static void BM_VoxelHashMapRemoveLabels(benchmark::State& state) {
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr map = makeMergedCloud(n, BENCHMARK_SCANS);
+            std::set<std::uint32_t> labels = getAgedLabels();
+            entities::VoxelHashMap voxels(STREAM_DOWNSAMPLING_LEAF_SIZE);
+
+            for(auto _ : state) {
+                state.PauseTiming();
+                voxels.clear();
+                voxels.insertPointCloud(*map);
+                state.ResumeTiming();
+
+                benchmark::DoNotOptimize(voxels.removeLabels(labels));
+            }
+
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_VoxelHashMapRemoveLabels)->RangeMultiplier(BENCHMARK_SIZE_MULTIPLIER)
+                ->Range(BENCHMARK_MIN_POINTS, BENCHMARK_MAX_POINTS)->Unit(benchmark::kMicrosecond);
+
+    } // pcl_aggregator
+} // benchmarks
@@ -0,0 +1,81 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include "BenchmarkUtils.h"
+#include <pcl_aggregator_core/managers/PointCloudsManager.h>
+#include <pcl_aggregator_core/utils/CloudSerializer.h>
+#include <vector>
+
+// max age of the points fed by the manager benchmarks, in seconds: nothing ages during a run
+#define BENCHMARK_MAX_AGE 3600.0
+
+namespace pcl_aggregator {
+    namespace benchmarks {
+
+        /*! \brief Feed the same scan to a stream on every iteration, through the whole ingest path.
+         *
+         * Timed on the caller's thread: the stream merge and the merged PointCloud update. The merged PointCloud
+         * downsamples on every update, so its size stays that of the scan downsampled.
+         */
+        static void runAddCloud(benchmark::State& state, bool voxelMap) {
+            if(!selectBackend(state))
+                return;
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr scan = makeScan(n);
+
+            managers::PointCloudsManager manager(1, BENCHMARK_MAX_AGE, 0);
+            manager.setMergeBatching(1);
+            if(voxelMap)
+                manager.setVoxelMapEnabled(true);
+
+            managers::StreamHandle stream = manager.registerStream("benchmark");
+            manager.setTransform(stream, Eigen::Affine3d::Identity());
+
+            for(auto _ : state) {
+                state.PauseTiming();
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr frame = manager.acquireFrame(stream);
+                *frame = *scan;
+                state.ResumeTiming();
+
+                manager.addCloud(stream, std::move(frame));
+            }
+
+            state.counters["merged_points"] = (double) manager.getMergedCloudSnapshot()->size();
+            state.counters["memory_bytes"] = (double) manager.getMemoryUsage().total;
+            setPointsProcessed(state, n);
+        }
+
+        static void BM_AddCloud(benchmark::State& state) {
+            runAddCloud(state, false);
+        }
+        BENCHMARK(BM_AddCloud)->Apply(sizesAndBackends)->Unit(benchmark::kMillisecond);
+
+        static void BM_AddCloudVoxelMap(benchmark::State& state) {
+            runAddCloud(state, true);
+        }
+        BENCHMARK(BM_AddCloudVoxelMap)->Apply(sizesAndBackends)->Unit(benchmark::kMillisecond);
+
+        static void BM_EncodeCloud(benchmark::State& state) {
+
+            std::size_t n = (std::size_t) state.range(0);
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud = makeMergedCloud(n, 8);
+
+            utils::CloudEncoding encoding;
+            utils::CloudMessageHeader header;
+            std::vector<std::uint8_t> out;
+
+            for(auto _ : state) {
+                utils::CloudSerializer::encode(header, *cloud, {}, encoding, out);
+                benchmark::DoNotOptimize(out.data());
+            }
+
+            state.counters["bytes_per_point"] = (double) out.size() / (double) n;
+            setPointsProcessed(state, n);
+        }
+        BENCHMARK(BM_EncodeCloud)->RangeMultiplier(BENCHMARK_SIZE_MULTIPLIER)
+                ->Range(BENCHMARK_MIN_POINTS, BENCHMARK_MAX_POINTS)->Unit(benchmark::kMicrosecond);
+
+    } // pcl_aggregator
+} // benchmarks
@@ -0,0 +1,480 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include "SyntheticClouds.h"
+#include <pcl_aggregator_core/managers/PointCloudsManager.h>
+#include <pcl/io/pcd_io.h>
+#include <eigen3/Eigen/Geometry>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// time between two samples of the merged PointCloud and the memory, in milliseconds
+#define REPLAY_DEFAULT_SAMPLE_INTERVAL_MS 1000
+// max age of the replayed points, in seconds
+#define REPLAY_DEFAULT_MAX_AGE 10.0
+// frames fed after their time by more than this are reported late, in microseconds
+#define REPLAY_LATE_THRESHOLD_US 1000
+// speed of the robot carrying the synthetic sensors, in meters per second
+#define REPLAY_SYNTHETIC_SPEED 1.0
+
+namespace pcl_aggregator {
+    namespace benchmarks {
+
+        /*! \brief A frame of a recording. */
+        struct ReplayFrame {
+            /*! \brief Time of the frame on the recording, in microseconds. */
+            std::uint64_t timestamp;
+            /*! \brief Path of the PCD file. Empty for synthetic frames. */
+            std::string path;
+        };
+
+        /*! \brief A sensor of a recording, fed by its own thread like a driver would. */
+        struct ReplayStream {
+            std::string topic;
+            Eigen::Affine3d transform = Eigen::Affine3d::Identity();
+            std::vector<ReplayFrame> frames;
+            managers::StreamHandle handle;
+            /*! \brief Time each addCloud took, in microseconds. */
+            std::vector<double> latencies;
+            /*! \brief Frames fed after their time. */
+            std::size_t lateFrames = 0;
+            /*! \brief Frames which could not be loaded. */
+            std::size_t failedFrames = 0;
+        };
+
+        /*! \brief State of the replay at a point in time. */
+        struct ReplaySample {
+            double elapsedMs;
+            std::size_t mergedPoints;
+            std::size_t memoryBytes;
+            std::size_t residentBytes;
+        };
+
+        /*! \brief Settings of a replay, from the command line. */
+        struct ReplayOptions {
+            std::string manifest;
+            std::string csvPath;
+            /*! \brief Speed of the replay over the recording. 0 feeds as fast as possible. */
+            double rate = 1.0;
+            double maxAge = REPLAY_DEFAULT_MAX_AGE;
+            unsigned int sampleIntervalMs = REPLAY_DEFAULT_SAMPLE_INTERVAL_MS;
+            std::size_t mergeBatch = 1;
+            bool voxelMap = false;
+            bool asyncIngest = false;
+            bool deviceResident = false;
+            /*! \brief Synthetic sensors, used when there is no manifest. */
+            std::size_t syntheticSensors = 0;
+            double syntheticRate = 10.0;
+            std::size_t syntheticPoints = 65536;
+            double syntheticSeconds = 10.0;
+        };
+
+        static void printUsage(const char* program) {
+            std::cerr << "Usage: " << program << " [options] <manifest>\n"
+                      << "       " << program << " [options] --synthetic <sensors> <hz> <points> <seconds>\n\n"
+                      << "The manifest has one line per frame, \"<timestamp_us> <topic> <pcd path>\", and optionally\n"
+                      << "\"transform <topic> <x> <y> <z> <qx> <qy> <qz> <qw>\" lines with the sensor transforms.\n"
+                      << "Relative paths are taken from the directory of the manifest. Lines starting with # are skipped.\n\n"
+                      << "Options:\n"
+                      << "  --rate <factor>      replay speed, 0 is as fast as possible (default 1)\n"
+                      << "  --max-age <s>        max age of the points (default " << REPLAY_DEFAULT_MAX_AGE << ")\n"
+                      << "  --interval <ms>      sampling interval (default " << REPLAY_DEFAULT_SAMPLE_INTERVAL_MS << ")\n"
+                      << "  --merge-batch <n>    stream updates per global downsample (default 1)\n"
+                      << "  --voxel-map          keep the merged PointCloud on the voxel map\n"
+                      << "  --async              asynchronous ingest. The latencies are then of the enqueue only\n"
+                      << "  --device-resident    keep the PointClouds on the GPU\n"
+                      << "  --csv <path>         write the samples there instead of to the standard output\n";
+        }
+
+        static int parseOptions(int argc, char** argv, ReplayOptions& options) {
+
+            for(int i = 1; i < argc; i++) {
+                std::string arg = argv[i];
+                // the options with a value
+                auto next = [&](const char* name) -> const char* {
+                    if(i + 1 >= argc) {
+                        std::cerr << name << " needs a value!" << std::endl;
+                        return nullptr;
+                    }
+                    return argv[++i];
+                };
+                const char* value = nullptr;
+
+                if(arg == "--rate") {
+                    if((value = next("--rate")) == nullptr) return -1;
+                    options.rate = std::atof(value);
+                } else if(arg == "--max-age") {
+                    if((value = next("--max-age")) == nullptr) return -1;
+                    options.maxAge = std::atof(value);
+                } else if(arg == "--interval") {
+                    if((value = next("--interval")) == nullptr) return -1;
+                    options.sampleIntervalMs = (unsigned int) std::max(1, std::atoi(value));
+                } else if(arg == "--merge-batch") {
+                    if((value = next("--merge-batch")) == nullptr) return -1;
+                    options.mergeBatch = (std::size_t) std::max(1, std::atoi(value));
+                } else if(arg == "--csv") {
+                    if((value = next("--csv")) == nullptr) return -1;
+                    options.csvPath = value;
+                } else if(arg == "--voxel-map") {
+                    options.voxelMap = true;
+                } else if(arg == "--async") {
+                    options.asyncIngest = true;
+                } else if(arg == "--device-resident") {
+                    options.deviceResident = true;
+                } else if(arg == "--synthetic") {
+                    if(i + 4 >= argc) {
+                        std::cerr << "--synthetic needs the sensors, rate, points and seconds!" << std::endl;
+                        return -1;
+                    }
+                    options.syntheticSensors = (std::size_t) std::max(1, std::atoi(argv[++i]));
+                    options.syntheticRate = std::max(0.1, std::atof(argv[++i]));
+                    options.syntheticPoints = (std::size_t) std::max(1, std::atoi(argv[++i]));
+                    options.syntheticSeconds = std::max(0.1, std::atof(argv[++i]));
+                } else if(!arg.empty() && arg[0] != '-' && options.manifest.empty()) {
+                    options.manifest = arg;
+                } else {
+                    std::cerr << "Unknown argument " << arg << std::endl;
+                    return -1;
+                }
+            }
+
+            if(options.manifest.empty() == (options.syntheticSensors == 0)) {
+                std::cerr << "Give either a manifest or --synthetic!" << std::endl;
+                return -1;
+            }
+
+            return 0;
+        }
+
+        static ReplayStream& getStream(std::vector<ReplayStream>& streams, const std::string& topic) {
+            for(auto& stream : streams) {
+                if(stream.topic == topic)
+                    return stream;
+            }
+            streams.emplace_back();
+            streams.back().topic = topic;
+            return streams.back();
+        }
+
+        static int parseManifest(const std::string& path, std::vector<ReplayStream>& streams) {
+
+            std::ifstream manifest(path);
+            if(!manifest.is_open()) {
+                std::cerr << "Could not open the manifest " << path << std::endl;
+                return -1;
+            }
+
+            std::string directory;
+            std::size_t slash = path.find_last_of('/');
+            if(slash != std::string::npos)
+                directory = path.substr(0, slash + 1);
+
+            std::string line;
+            std::size_t lineNumber = 0;
+            while(std::getline(manifest, line)) {
+                lineNumber++;
+                if(line.empty() || line[0] == '#')
+                    continue;
+
+                std::istringstream fields(line);
+                std::string first;
+                fields >> first;
+
+                if(first == "transform") {
+                    std::string topic;
+                    double x, y, z, qx, qy, qz, qw;
+                    if(!(fields >> topic >> x >> y >> z >> qx >> qy >> qz >> qw)) {
+                        std::cerr << path << ":" << lineNumber << ": malformed transform" << std::endl;
+                        return -1;
+                    }
+                    ReplayStream& stream = getStream(streams, topic);
+                    stream.transform = Eigen::Affine3d::Identity();
+                    stream.transform.translate(Eigen::Vector3d(x, y, z));
+                    stream.transform.rotate(Eigen::Quaterniond(qw, qx, qy, qz).normalized());
+                    continue;
+                }
+
+                ReplayFrame frame;
+                std::string topic;
+                frame.timestamp = std::strtoull(first.c_str(), nullptr, 10);
+                if(!(fields >> topic >> frame.path)) {
+                    std::cerr << path << ":" << lineNumber << ": malformed frame" << std::endl;
+                    return -1;
+                }
+                if(frame.path[0] != '/')
+                    frame.path = directory + frame.path;
+
+                getStream(streams, topic).frames.push_back(std::move(frame));
+            }
+
+            for(auto& stream : streams) {
+                std::sort(stream.frames.begin(), stream.frames.end(), [](const ReplayFrame& a, const ReplayFrame& b) {
+                    return a.timestamp < b.timestamp;
+                });
+            }
+
+            return 0;
+        }
+
+        static void makeSyntheticStreams(const ReplayOptions& options, std::vector<ReplayStream>& streams) {
+
+            std::uint64_t period = (std::uint64_t) (1e6 / options.syntheticRate);
+            std::uint64_t duration = (std::uint64_t) (options.syntheticSeconds * 1e6);
+
+            for(std::size_t s = 0; s < options.syntheticSensors; s++) {
+                ReplayStream& stream = getStream(streams, "/synthetic_" + std::to_string(s));
+                // the sensors look to different sides and fire out of phase
+                stream.transform.rotate(Eigen::AngleAxisd(2.0 * M_PI * (double) s / (double) options.syntheticSensors,
+                                                          Eigen::Vector3d::UnitZ()));
+                for(std::uint64_t t = period * s / options.syntheticSensors; t < duration; t += period)
+                    stream.frames.push_back({t, ""});
+            }
+        }
+
+        /*! \brief Load or generate a frame of a stream. */
+        static pcl::PointCloud<pcl::PointXYZRGBL>::Ptr loadFrame(managers::PointCloudsManager& manager,
+                                                                 ReplayStream& stream, std::size_t index,
+                                                                 const ReplayOptions& options) {
+
+            const ReplayFrame& frame = stream.frames[index];
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud;
+
+            if(frame.path.empty()) {
+                // the robot drives forward, so the map grows and ages
+                cloud = makeScan(options.syntheticPoints, 0, (std::uint32_t) index);
+                float offset = (float) (REPLAY_SYNTHETIC_SPEED * (double) frame.timestamp * 1e-6);
+                for(auto& point : cloud->points)
+                    point.x += offset;
+            } else {
+                cloud = manager.acquireFrame(stream.handle);
+                if(pcl::io::loadPCDFile<pcl::PointXYZRGBL>(frame.path, *cloud) < 0) {
+                    std::cerr << "Could not load " << frame.path << std::endl;
+                    return nullptr;
+                }
+            }
+
+            cloud->header.stamp = frame.timestamp;
+            return cloud;
+        }
+
+        /*! \brief Feed the frames of a stream at the times of the recording, timing each addCloud. */
+        static void feedStream(managers::PointCloudsManager& manager, ReplayStream& stream,
+                               std::chrono::steady_clock::time_point start, std::uint64_t firstTimestamp,
+                               const ReplayOptions& options) {
+
+            stream.latencies.reserve(stream.frames.size());
+
+            for(std::size_t i = 0; i < stream.frames.size(); i++) {
+
+                // loaded ahead of its time, so the loading is not timed
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud = loadFrame(manager, stream, i, options);
+                if(cloud == nullptr) {
+                    stream.failedFrames++;
+                    continue;
+                }
+
+                if(options.rate > 0) {
+                    auto offset = std::chrono::microseconds((long long) ((double) (stream.frames[i].timestamp -
+                                                                                    firstTimestamp) / options.rate));
+                    auto due = start + offset;
+                    std::this_thread::sleep_until(due);
+                    if(std::chrono::steady_clock::now() - due > std::chrono::microseconds(REPLAY_LATE_THRESHOLD_US))
+                        stream.lateFrames++;
+                }
+
+                auto begin = std::chrono::steady_clock::now();
+                manager.addCloud(stream.handle, std::move(cloud));
+                auto end = std::chrono::steady_clock::now();
+
+                stream.latencies.push_back(std::chrono::duration<double, std::micro>(end - begin).count());
+            }
+        }
+
+        /*! \brief Get the resident memory of the process, in bytes. 0 if unknown. */
+        static std::size_t getResidentBytes() {
+            std::ifstream statm("/proc/self/statm");
+            std::size_t pages = 0, resident = 0;
+            if(!(statm >> pages >> resident))
+                return 0;
+            return resident * (std::size_t) sysconf(_SC_PAGESIZE);
+        }
+
+        /*! \brief Get a quantile of sorted values, by the nearest rank. */
+        static double getQuantile(const std::vector<double>& sorted, double q) {
+            if(sorted.empty())
+                return 0;
+            std::size_t rank = (std::size_t) std::ceil(q * (double) sorted.size());
+            return sorted[std::min(sorted.size() - 1, rank > 0 ? rank - 1 : 0)];
+        }
+
+        static void printLatencies(const std::string& name, std::vector<double> latencies, std::size_t late,
+                                   std::size_t failed) {
+            std::sort(latencies.begin(), latencies.end());
+            std::printf("%-24s %8zu frames  p50 %9.3f ms  p99 %9.3f ms  max %9.3f ms  %zu late  %zu failed\n",
+                        name.c_str(), latencies.size(), getQuantile(latencies, 0.5) * 1e-3,
+                        getQuantile(latencies, 0.99) * 1e-3, latencies.empty() ? 0.0 : latencies.back() * 1e-3,
+                        late, failed);
+        }
+
+        static int runReplay(const ReplayOptions& options) {
+
+            std::vector<ReplayStream> streams;
+            if(!options.manifest.empty()) {
+                if(parseManifest(options.manifest, streams) < 0)
+                    return 1;
+            } else {
+                makeSyntheticStreams(options, streams);
+            }
+
+            std::uint64_t firstTimestamp = UINT64_MAX;
+            for(const auto& stream : streams) {
+                if(!stream.frames.empty())
+                    firstTimestamp = std::min(firstTimestamp, stream.frames.front().timestamp);
+            }
+            if(firstTimestamp == UINT64_MAX) {
+                std::cerr << "There are no frames to replay!" << std::endl;
+                return 1;
+            }
+
+            managers::PointCloudsManager::setMetricsEnabled(true);
+            managers::PointCloudsManager manager(streams.size(), options.maxAge, 0);
+            manager.setMergeBatching(options.mergeBatch);
+            if(options.voxelMap)
+                manager.setVoxelMapEnabled(true);
+            if(options.asyncIngest)
+                manager.setAsyncIngest(true);
+            if(options.deviceResident)
+                manager.setDeviceResident(true);
+
+            // frames of streams without a transform would wait for one forever
+            for(auto& stream : streams) {
+                stream.handle = manager.registerStream(stream.topic);
+                manager.setTransform(stream.handle, stream.transform);
+            }
+
+            // sample the merged PointCloud and the memory while the streams are fed
+            std::vector<ReplaySample> samples;
+            std::mutex samplerMutex;
+            std::condition_variable samplerCondition;
+            bool replaying = true;
+            auto start = std::chrono::steady_clock::now();
+
+            auto takeSample = [&]() {
+                ReplaySample sample{};
+                sample.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                             start).count();
+                sample.mergedPoints = manager.getMergedCloudSnapshot()->size();
+                sample.memoryBytes = manager.getMemoryUsage().total;
+                sample.residentBytes = getResidentBytes();
+                samples.push_back(sample);
+            };
+
+            std::thread sampler([&]() {
+                std::unique_lock<std::mutex> lock(samplerMutex);
+                while(!samplerCondition.wait_for(lock, std::chrono::milliseconds(options.sampleIntervalMs),
+                                                 [&] { return !replaying; })) {
+                    takeSample();
+                }
+            });
+
+            std::vector<std::thread> feeders;
+            feeders.reserve(streams.size());
+            for(auto& stream : streams)
+                feeders.emplace_back(feedStream, std::ref(manager), std::ref(stream), start, firstTimestamp,
+                                     std::cref(options));
+            for(auto& feeder : feeders)
+                feeder.join();
+
+            {
+                std::lock_guard<std::mutex> lock(samplerMutex);
+                replaying = false;
+            }
+            samplerCondition.notify_all();
+            sampler.join();
+            takeSample();
+
+            double elapsed = samples.back().elapsedMs;
+
+            // report
+            std::printf("replayed %zu streams in %.1f s\n\n", streams.size(), elapsed * 1e-3);
+            std::printf("addCloud latency\n");
+            std::vector<double> all;
+            std::size_t late = 0, failed = 0;
+            for(const auto& stream : streams) {
+                printLatencies(stream.topic, stream.latencies, stream.lateFrames, stream.failedFrames);
+                all.insert(all.end(), stream.latencies.begin(), stream.latencies.end());
+                late += stream.lateFrames;
+                failed += stream.failedFrames;
+            }
+            printLatencies("all", all, late, failed);
+
+            // with asynchronous ingest the merge happens on the pool, so its time comes from the stream metrics
+            managers::PointCloudsManagerMetrics metrics = manager.getMetrics();
+            std::printf("\nstream ingest time (power of two buckets)\n");
+            for(const auto& stream : metrics.streams) {
+                auto histogram = stream.second.histograms.find("ingest_time_ns");
+                if(histogram == stream.second.histograms.end() || histogram->second.count == 0)
+                    continue;
+                std::printf("%-24s p50 <= %9.3f ms  p99 <= %9.3f ms\n", stream.first.c_str(),
+                            (double) histogram->second.getQuantile(0.5) * 1e-6,
+                            (double) histogram->second.getQuantile(0.99) * 1e-6);
+            }
+
+            std::size_t peakResident = 0, peakPoints = 0;
+            for(const auto& sample : samples) {
+                peakResident = std::max(peakResident, sample.residentBytes);
+                peakPoints = std::max(peakPoints, sample.mergedPoints);
+            }
+            std::printf("\nmerged points: %zu final, %zu peak\n", samples.back().mergedPoints, peakPoints);
+            std::printf("point memory: %.1f MiB final\n", (double) samples.back().memoryBytes / (1 << 20));
+            std::printf("resident memory: %.1f MiB peak\n", (double) peakResident / (1 << 20));
+            std::printf("dropped frames: %zu\n", manager.getDroppedFrames());
+
+            // the time series
+            FILE* csv = stdout;
+            if(!options.csvPath.empty()) {
+                csv = std::fopen(options.csvPath.c_str(), "w");
+                if(csv == nullptr) {
+                    std::cerr << "Could not open " << options.csvPath << std::endl;
+                    return 1;
+                }
+            } else {
+                std::printf("\n");
+            }
+            std::fprintf(csv, "elapsed_ms,merged_points,memory_bytes,resident_bytes\n");
+            for(const auto& sample : samples)
+                std::fprintf(csv, "%.1f,%zu,%zu,%zu\n", sample.elapsedMs, sample.mergedPoints, sample.memoryBytes,
+                             sample.residentBytes);
+            if(csv != stdout)
+                std::fclose(csv);
+
+            return 0;
+        }
+
+    } // pcl_aggregator
+} // benchmarks
+
+int main(int argc, char** argv) {
+
+    pcl_aggregator::benchmarks::ReplayOptions options;
+    if(pcl_aggregator::benchmarks::parseOptions(argc, argv, options) < 0) {
+        pcl_aggregator::benchmarks::printUsage(argv[0]);
+        return 1;
+    }
+
+    return pcl_aggregator::benchmarks::runReplay(options);
+}
@@ -0,0 +1,86 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_SYNTHETICCLOUDS_H
+#define PCL_AGGREGATOR_CORE_SYNTHETICCLOUDS_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+
+// closest and farthest point of the generated scans, in meters
+#define BENCHMARK_MIN_RANGE 1.0f
+#define BENCHMARK_MAX_RANGE 60.0f
+
+namespace pcl_aggregator {
+    namespace benchmarks {
+
+        /*! \brief Generate a scan of a spinning lidar: points on the rays of a sensor at the origin, at random ranges.
+         *
+         * Seeded, so every run of a benchmark works on the same points.
+         *
+         * @param nPoints The number of points.
+         * @param label The label of the points.
+         * @param seed The seed of the generator.
+         * @return The scan, unorganized.
+         */
+        inline pcl::PointCloud<pcl::PointXYZRGBL>::Ptr makeScan(std::size_t nPoints, std::uint32_t label = 0,
+                                                                std::uint32_t seed = 42) {
+
+            std::mt19937 generator(seed);
+            std::uniform_real_distribution<float> azimuth((float) -M_PI, (float) M_PI);
+            std::uniform_real_distribution<float> elevation(-0.4f, 0.3f);
+            std::uniform_real_distribution<float> range(BENCHMARK_MIN_RANGE, BENCHMARK_MAX_RANGE);
+
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            cloud->resize(nPoints);
+
+            for(auto& point : cloud->points) {
+                float a = azimuth(generator);
+                float e = elevation(generator);
+                float r = range(generator);
+                point.x = r * std::cos(e) * std::cos(a);
+                point.y = r * std::cos(e) * std::sin(a);
+                point.z = r * std::sin(e);
+                point.r = (std::uint8_t) (r * 4.0f);
+                point.g = 128;
+                point.b = 255;
+                point.label = label;
+            }
+
+            return cloud;
+        }
+
+        /*! \brief Generate a merged PointCloud of several scans, each with its own label, one after the other.
+         *
+         * @param nPoints The total number of points.
+         * @param nScans The number of scans. Their labels are 1 to nScans.
+         * @return The PointCloud.
+         */
+        inline pcl::PointCloud<pcl::PointXYZRGBL>::Ptr makeMergedCloud(std::size_t nPoints, std::size_t nScans) {
+
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            cloud->points.reserve(nPoints);
+
+            std::size_t perScan = (nPoints + nScans - 1) / nScans;
+            for(std::size_t s = 0; s < nScans && cloud->size() < nPoints; s++) {
+                std::size_t n = std::min(perScan, nPoints - cloud->size());
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr scan = makeScan(n, (std::uint32_t) (s + 1),
+                                                                        (std::uint32_t) s);
+                cloud->points.insert(cloud->points.end(), scan->points.begin(), scan->points.end());
+            }
+            cloud->width = cloud->points.size();
+            cloud->height = 1;
+
+            return cloud;
+        }
+
+    } // pcl_aggregator
+} // benchmarks
+
+#endif //PCL_AGGREGATOR_CORE_SYNTHETICCLOUDS_H
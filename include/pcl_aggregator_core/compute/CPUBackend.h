@@ -0,0 +1,76 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CPUBACKEND_H
+#define PCL_AGGREGATOR_CORE_CPUBACKEND_H
+
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#include <opencv2/opencv.hpp>
+
+// below this number of points per thread the work runs on the calling thread only
+#define CPU_BACKEND_MIN_POINTS_PER_THREAD 32768
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        /*! \brief CPU Backend
+         *         Multithreaded implementation of the point cloud operations.
+         *
+         * The transforms use AVX2 (picked at run time) or NEON when available, scalar code otherwise.
+         * Large clouds are split over the hardware threads.
+         */
+        class CPUBackend : public ComputeBackend {
+
+            public:
+                const char* getName() const override;
+
+                void setPointCloudLabel(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud,
+                                        std::uint32_t label) override;
+
+                void transformPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud,
+                                         const Eigen::Affine3d& transform) override;
+
+                int concatenatePointClouds(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud1,
+                                           const pcl::PointCloud<pcl::PointXYZRGBL>& cloud2) override;
+
+                int ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                     const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                     std::uint32_t label, const Eigen::Affine3d& transform,
+                                     const PointFilter *filter = nullptr) override;
+
+                int ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                     const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                     std::uint32_t label, const DeskewTable& table,
+                                     const PointFilter *filter = nullptr) override;
+
+                int voxelDownsample(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, float leafSize,
+                                    std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns = nullptr) override;
+
+                int alignPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                    const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                    const RegistrationParams& params, RegistrationResult& result) override;
+
+                /*! \brief Deproject a depth image and an optional color image into a PointCloud.
+                 *
+                 * Same point set as the GPU deprojection: only the pixels with a depth in range become points.
+                 * Here they come in pixel order; the GPU compaction leaves them in no particular order.
+                 *
+                 * @param colorImage The BGR8 color image, of the same size as the depth image. May be empty.
+                 * @param depthImage The 16-bit or float depth image.
+                 * @param K The camera intrinsic matrix.
+                 * @param minDepth The minimum admissible depth, in meters.
+                 * @param maxDepth The maximum admissible depth, in meters.
+                 * @param destination The PointCloud which receives the points, replacing its points.
+                 * @param depthUnit Meters per unit of 16-bit depth images.
+                 * @return 0 on success, negative on error.
+                 */
+                static int deprojectImages(const cv::Mat& colorImage, const cv::Mat& depthImage,
+                                           const Eigen::Matrix3d& K, float minDepth, float maxDepth,
+                                           pcl::PointCloud<pcl::PointXYZRGBL>& destination, float depthUnit);
+        };
+
+    } // pcl_aggregator
+} // compute
+
+#endif //PCL_AGGREGATOR_CORE_CPUBACKEND_H
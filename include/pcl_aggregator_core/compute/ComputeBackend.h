@@ -0,0 +1,176 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_COMPUTEBACKEND_H
+#define PCL_AGGREGATOR_CORE_COMPUTEBACKEND_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl_aggregator_core/compute/Registration.h>
+#include <pcl_aggregator_core/compute/Deskew.h>
+#include <pcl_aggregator_core/compute/PointFilter.h>
+#include <eigen3/Eigen/Dense>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// clouds smaller than this run on the CPU even with a device, as the launch and transfer latency dominates
+#define COMPUTE_DEFAULT_CUDA_MIN_POINTS 16384
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        /*! \brief A copy of a range of points to another position of the same cloud. The ranges must not overlap. */
+        struct PointRangeMove {
+            /*! \brief Index of the first point to copy. */
+            std::size_t source;
+            /*! \brief Index which receives the first point. */
+            std::size_t destination;
+            /*! \brief Number of points to copy. */
+            std::size_t count;
+        };
+
+        /*! \brief Which backend runs the point cloud operations. */
+        enum class BackendPreference {
+            /*! \brief The GPU when there is a device and the cloud is large enough, the CPU otherwise. */
+            AUTO,
+            /*! \brief Always the CPU. */
+            CPU,
+            /*! \brief The GPU whenever there is a device. */
+            CUDA
+        };
+
+        /*! \brief Compute Backend
+         *         Implementation of the operations on host PointClouds.
+         *
+         * The callers pick one per operation with select(), so the same code runs with or without a GPU.
+         */
+        class ComputeBackend {
+
+            public:
+                virtual ~ComputeBackend() = default;
+
+                /*! \brief Get the name of the backend, for logging. */
+                virtual const char* getName() const = 0;
+
+                /*! \brief Set a label to all PointCloud's points.
+                 *
+                 * @param cloud The PointCloud smart pointer to assign the label to.
+                 * @param label The 32-bit unsigned integer label.
+                 */
+                virtual void setPointCloudLabel(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud,
+                                                std::uint32_t label) = 0;
+
+                /*! \brief Transform all the points of a PointCloud using an affine transformation.
+                 *
+                 * @param cloud The PointCloud to transform in-place.
+                 * @param transform The affine transform to apply.
+                 */
+                virtual void transformPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud,
+                                                 const Eigen::Affine3d& transform) = 0;
+
+                /*! \brief Concatenate the points of cloud2 into cloud1.
+                 *
+                 * @param cloud1 The PointCloud which will receive the points.
+                 * @param cloud2 The PointCloud which gives the points.
+                 * @return 0 on success, negative on error.
+                 */
+                virtual int concatenatePointClouds(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud1,
+                                                   const pcl::PointCloud<pcl::PointXYZRGBL>& cloud2) = 0;
+
+                /*! \brief Label, transform and append the points of a raw PointCloud to another in a single pass.
+                 *
+                 * With a filter, the points it drops are never transformed nor appended: the destination only
+                 * grows by the points kept, in their order.
+                 *
+                 * @param destination The PointCloud which will receive the points.
+                 * @param source The raw PointCloud, in the sensor frame.
+                 * @param label The 32-bit unsigned integer label to stamp on the new points.
+                 * @param transform The affine transform to apply to the new points.
+                 * @param filter Optionally the filter the raw points have to pass.
+                 * @return 0 on success, negative on error.
+                 */
+                virtual int ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                             const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                             std::uint32_t label, const Eigen::Affine3d& transform,
+                                             const PointFilter *filter = nullptr) = 0;
+
+                /*! \brief Label, deskew and append the points of a raw PointCloud to another in a single pass.
+                 *
+                 * Like the rigid ingestion, with each point transformed by the blend of the table around its time.
+                 *
+                 * @param destination The PointCloud which will receive the points.
+                 * @param source The raw PointCloud, in the sensor frame.
+                 * @param label The 32-bit unsigned integer label to stamp on the new points.
+                 * @param table The transforms of the scan over its duration.
+                 * @param filter Optionally the filter the raw points have to pass.
+                 * @return 0 on success, negative on error.
+                 */
+                virtual int ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                             const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                             std::uint32_t label, const DeskewTable& table,
+                                             const PointFilter *filter = nullptr) = 0;
+
+                /*! \brief Apply a voxel grid filter to a PointCloud, in-place.
+                 *
+                 * Each voxel is replaced by the centroid of its points, labelled with the label with most points
+                 * on the voxel. The centroids come out grouped by label.
+                 *
+                 * @param cloud The PointCloud to downsample.
+                 * @param leafSize The voxel size.
+                 * @param labelRuns Optionally receives the (label, number of points) runs of the output, in order.
+                 * @return 0 on success, negative on error.
+                 */
+                virtual int voxelDownsample(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, float leafSize,
+                                            std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns = nullptr) = 0;
+
+                /*! \brief Align a PointCloud with another, with point-to-plane ICP.
+                 *
+                 * The target is hashed into cells of params.cellSize with a plane fitted on each, so it is best
+                 * cropped to the submap around the source first.
+                 *
+                 * @param source The PointCloud to align.
+                 * @param target The PointCloud to align to.
+                 * @param params The settings of the registration.
+                 * @param result Receives the correction to apply to the source, starting from its current transform.
+                 * @return 0 on success, negative on error.
+                 */
+                virtual int alignPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                            const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                            const RegistrationParams& params, RegistrationResult& result) = 0;
+
+                /*! \brief Get the backend for an operation on a number of points.
+                 *
+                 * Follows the preference, falling back to the CPU when there is no device or the library was
+                 * built without CUDA.
+                 *
+                 * @param nPoints The number of points the operation works on.
+                 * @return The backend. Lives for the whole process.
+                 */
+                static ComputeBackend& select(std::size_t nPoints);
+
+                /*! \brief Get the CPU backend. Always available. */
+                static ComputeBackend& getCPU();
+
+                /*! \brief Check if the library was built with CUDA and there is a device to run on. */
+                static bool isCudaAvailable();
+
+                /*! \brief Set which backend select() prefers, process-wide. */
+                static void setPreference(BackendPreference preference);
+
+                /*! \brief Get which backend select() prefers. */
+                static BackendPreference getPreference();
+
+                /*! \brief Set the smallest cloud which goes to the GPU under the AUTO preference, process-wide. */
+                static void setCudaMinPoints(std::size_t nPoints);
+
+                /*! \brief Get the smallest cloud which goes to the GPU under the AUTO preference. */
+                static std::size_t getCudaMinPoints();
+        };
+
+    } // pcl_aggregator
+} // compute
+
+#endif //PCL_AGGREGATOR_CORE_COMPUTEBACKEND_H
@@ -0,0 +1,123 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_DESKEW_H
+#define PCL_AGGREGATOR_CORE_DESKEW_H
+
+#include <pcl_aggregator_core/utils/PoseBuffer.h>
+#include <eigen3/Eigen/Dense>
+#include <cstddef>
+#include <cstdint>
+
+#ifdef __CUDACC__
+#define DESKEW_HOST_DEVICE __host__ __device__
+#else
+#define DESKEW_HOST_DEVICE
+#endif
+
+// most pieces the motion of a scan is split into. the transform of each point is blended between the two around it
+#define DESKEW_MAX_SEGMENTS 32
+// time a scan takes by default, in microseconds: a 10 Hz spinning lidar
+#define DESKEW_DEFAULT_SCAN_DURATION_US 100000
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        /*! \brief How the time of each point of a scan is found. */
+        enum class DeskewTiming {
+            /*! \brief The points are in firing order: the time is the index of the point over the scan. */
+            INDEX,
+            /*! \brief The columns are in firing order, like organized lidar scans: the time is the column of the
+             *         point over the width. Same as INDEX for unorganized clouds. */
+            COLUMN
+        };
+
+        /*! \brief Settings of the motion compensation of a stream. */
+        struct DeskewParams {
+            /*! \brief Time from the first point of a scan to the last, in microseconds. */
+            std::uint64_t scanDuration = DESKEW_DEFAULT_SCAN_DURATION_US;
+            /*! \brief How the time of each point is found. */
+            DeskewTiming timing = DeskewTiming::COLUMN;
+            /*! \brief The stamp of the scans is the time of their last point, instead of their first. */
+            bool stampAtScanEnd = false;
+        };
+
+        /*! \brief Transforms of a scan over its duration, as rows of 3x4 matrices in single precision.
+         *
+         * Passed by value to the kernels, so it is fixed size. Each point takes the blend of the two transforms
+         * around its time.
+         */
+        struct DeskewTable {
+            float transforms[DESKEW_MAX_SEGMENTS + 1][3][4];
+            /*! \brief Number of pieces. There are segments + 1 transforms. */
+            std::uint32_t segments;
+            /*! \brief Points per row, for the COLUMN timing. */
+            std::uint32_t width;
+            /*! \brief Number of points of the scan, for the INDEX timing. */
+            std::uint64_t count;
+            DeskewTiming timing;
+
+            /*! \brief Transform the coordinates of the point of some index of the scan, in-place. */
+            DESKEW_HOST_DEVICE inline void apply(std::size_t index, float& x, float& y, float& z) const {
+
+                float t;
+                if(this->timing == DeskewTiming::COLUMN)
+                    t = this->width > 1 ? (float) (index % this->width) / (float) (this->width - 1) : 0.0f;
+                else
+                    t = this->count > 1 ? (float) index / (float) (this->count - 1) : 0.0f;
+
+                float position = t * (float) this->segments;
+                std::uint32_t segment = (std::uint32_t) position;
+                if(segment >= this->segments)
+                    segment = this->segments - 1;
+                float w = position - (float) segment;
+
+                const float (*a)[4] = this->transforms[segment];
+                const float (*b)[4] = this->transforms[segment + 1];
+
+                float p[3] = {x, y, z};
+                float out[3];
+                for(int r = 0; r < 3; r++) {
+                    float pa = a[r][0] * p[0] + a[r][1] * p[1] + a[r][2] * p[2] + a[r][3];
+                    float pb = b[r][0] * p[0] + b[r][1] * p[1] + b[r][2] * p[2] + b[r][3];
+                    out[r] = pa + w * (pb - pa);
+                }
+                x = out[0];
+                y = out[1];
+                z = out[2];
+            }
+        };
+
+        /*! \brief Deskew
+         *         Motion compensation of the scans of a moving sensor.
+         *
+         * Each point is brought to the pose of the sensor at the stamp of its scan, from the pose at its own time.
+         */
+        class Deskew {
+
+            public:
+                /*! \brief Sample the motion of a scan into a table, with the rigid transforms of the stream on top.
+                 *
+                 * Transform k is prefix * T(stamp)^-1 * T(t_k) * sensorTransform, with T the pose of the robot base
+                 * and t_k evenly spaced over the scan.
+                 *
+                 * @param poses The poses of the robot base.
+                 * @param stamp UNIX timestamp of the scan, in microseconds.
+                 * @param params The settings of the stream.
+                 * @param prefix The transform applied after the deskew, e.g. the registration correction.
+                 * @param sensorTransform The transform from the sensor frame to the robot base frame.
+                 * @param width Points per row of the scan.
+                 * @param count Number of points of the scan.
+                 * @param table Receives the table.
+                 * @return 0 on success, -1 if there are no poses.
+                 */
+                static int buildTable(const utils::PoseBuffer& poses, std::uint64_t stamp, const DeskewParams& params,
+                                      const Eigen::Affine3d& prefix, const Eigen::Affine3d& sensorTransform,
+                                      std::uint32_t width, std::size_t count, DeskewTable& table);
+        };
+
+    } // pcl_aggregator
+} // compute
+
+#endif //PCL_AGGREGATOR_CORE_DESKEW_H
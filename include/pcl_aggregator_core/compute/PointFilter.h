@@ -0,0 +1,125 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_POINTFILTER_H
+#define PCL_AGGREGATOR_CORE_POINTFILTER_H
+
+#include <eigen3/Eigen/Dense>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef __CUDACC__
+#define POINT_FILTER_HOST_DEVICE __host__ __device__
+#else
+#define POINT_FILTER_HOST_DEVICE
+#endif
+
+// most self-body boxes of a stream
+#define POINT_FILTER_MAX_MASKS 8
+// neighbors a point needs within the outlier radius to be kept, by default
+#define POINT_FILTER_DEFAULT_MIN_NEIGHBORS 2
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        /*! \brief Settings of the filtering of the raw frames of a stream, before they are merged.
+         *
+         * The boxes are in the robot base frame, the frame the sensor transform goes to. The default settings
+         * keep every point.
+         */
+        struct PointFilterParams {
+            /*! \brief Points closer to the sensor are dropped, in meters. 0 keeps them all. */
+            float minRange = 0.0f;
+            /*! \brief Points farther from the sensor are dropped, in meters. 0 keeps them all. */
+            float maxRange = 0.0f;
+            /*! \brief Only the points inside are kept. Empty keeps them all. */
+            Eigen::AlignedBox3f cropBox;
+            /*! \brief The points inside any of them are dropped, like the returns on the robot body. */
+            std::vector<Eigen::AlignedBox3f> selfMasks;
+            /*! \brief Radius of the outlier removal, in meters. 0 disables it. */
+            float outlierRadius = 0.0f;
+            /*! \brief Neighbors a point needs within the outlier radius to be kept. */
+            std::uint32_t outlierMinNeighbors = POINT_FILTER_DEFAULT_MIN_NEIGHBORS;
+        };
+
+        /*! \brief A box in the sensor frame: the transform to the frame of the box and its half sizes. */
+        struct FilterBox {
+            float transform[3][4] = {};
+            float halfExtents[3] = {};
+
+            /*! \brief Check if a point of the sensor frame is inside. */
+            POINT_FILTER_HOST_DEVICE inline bool contains(float x, float y, float z) const {
+                for(int r = 0; r < 3; r++) {
+                    float v = this->transform[r][0] * x + this->transform[r][1] * y + this->transform[r][2] * z +
+                              this->transform[r][3];
+                    if(v < -this->halfExtents[r] || v > this->halfExtents[r])
+                        return false;
+                }
+                return true;
+            }
+        };
+
+        /*! \brief The filter of a stream, tested on the points in the sensor frame.
+         *
+         * Passed by value to the kernels, so it is fixed size. The boxes of the settings are brought to the sensor
+         * frame once, when the filter is built, so each point is tested before it is transformed.
+         */
+        struct PointFilter {
+            float minRangeSquared = 0.0f;
+            /*! \brief 0 is no limit. */
+            float maxRangeSquared = 0.0f;
+            bool cropEnabled = false;
+            FilterBox cropBox;
+            std::uint32_t nMasks = 0;
+            FilterBox masks[POINT_FILTER_MAX_MASKS];
+            /*! \brief 0 is no outlier removal. */
+            float outlierRadius = 0.0f;
+            std::uint32_t outlierMinNeighbors = 0;
+
+            /*! \brief Check if a point of the sensor frame passes the range, crop and self-body tests.
+             *
+             * The points with a non-finite coordinate never do.
+             */
+            POINT_FILTER_HOST_DEVICE inline bool keep(float x, float y, float z) const {
+
+                // x - x is 0 only for finite values
+                if(x - x != 0.0f || y - y != 0.0f || z - z != 0.0f)
+                    return false;
+
+                float rangeSquared = x * x + y * y + z * z;
+                if(rangeSquared < this->minRangeSquared)
+                    return false;
+                if(this->maxRangeSquared > 0.0f && rangeSquared > this->maxRangeSquared)
+                    return false;
+
+                if(this->cropEnabled && !this->cropBox.contains(x, y, z))
+                    return false;
+
+                for(std::uint32_t m = 0; m < this->nMasks; m++) {
+                    if(this->masks[m].contains(x, y, z))
+                        return false;
+                }
+
+                return true;
+            }
+
+            /*! \brief Check if any point can be dropped, i.e. the filter has to run at all. */
+            bool isActive() const;
+
+            /*! \brief Build the filter of a stream.
+             *
+             * @param params The settings of the filter.
+             * @param sensorTransform The transform from the sensor frame to the robot base frame.
+             * @param filter Receives the filter.
+             * @return 0 on success, negative if the settings are not valid.
+             */
+            static int build(const PointFilterParams& params, const Eigen::Affine3d& sensorTransform,
+                             PointFilter& filter);
+        };
+
+    } // pcl_aggregator
+} // compute
+
+#endif //PCL_AGGREGATOR_CORE_POINTFILTER_H
@@ -0,0 +1,126 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_REGISTRATION_H
+#define PCL_AGGREGATOR_CORE_REGISTRATION_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <eigen3/Eigen/Dense>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+// side of the target cells a plane is fitted to, in meters
+#define REGISTRATION_DEFAULT_CELL_SIZE 0.5f
+// smallest pose update taken as converged, in meters and radians
+#define REGISTRATION_DEFAULT_TRANSLATION_EPSILON 1e-4
+#define REGISTRATION_DEFAULT_ROTATION_EPSILON 1e-4
+// longest a registration may take, in microseconds
+#define REGISTRATION_DEFAULT_TIME_BUDGET_US 20000
+// the submap is the bounding box of the source grown by this margin, in meters
+#define REGISTRATION_DEFAULT_SUBMAP_MARGIN 2.0f
+// fewer target points than this on a cell give no plane
+#define REGISTRATION_MIN_CELL_POINTS 5
+// fewer correspondences than this leave the pose as it is
+#define REGISTRATION_MIN_CORRESPONDENCES 32
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        /*! \brief Settings of a point-to-plane ICP registration. */
+        struct RegistrationParams {
+            /*! \brief Side of the target cells a plane is fitted to. */
+            float cellSize = REGISTRATION_DEFAULT_CELL_SIZE;
+            /*! \brief Farthest a source point may be from the centroid of its cell. */
+            float maxCorrespondenceDistance = 1.0f;
+            /*! \brief Most Gauss-Newton iterations. */
+            unsigned int maxIterations = 10;
+            /*! \brief Translation update under which the registration converged. */
+            double translationEpsilon = REGISTRATION_DEFAULT_TRANSLATION_EPSILON;
+            /*! \brief Rotation update under which the registration converged. */
+            double rotationEpsilon = REGISTRATION_DEFAULT_ROTATION_EPSILON;
+            /*! \brief Longest the registration may take. It stops with the pose reached when over. */
+            std::chrono::microseconds timeBudget{REGISTRATION_DEFAULT_TIME_BUDGET_US};
+            /*! \brief Margin around the source the submap is taken from. */
+            float submapMargin = REGISTRATION_DEFAULT_SUBMAP_MARGIN;
+        };
+
+        /*! \brief Outcome of a registration. */
+        struct RegistrationResult {
+            /*! \brief Correction to apply to the source, to align it with the target. */
+            Eigen::Affine3d transform = Eigen::Affine3d::Identity();
+            /*! \brief The last update was under the epsilons. */
+            bool converged = false;
+            /*! \brief Iterations ran. */
+            unsigned int iterations = 0;
+            /*! \brief Mean squared point-to-plane distance on the last iteration. */
+            double fitness = 0;
+            /*! \brief Correspondences found on the last iteration. */
+            std::size_t correspondences = 0;
+        };
+
+        /*! \brief Point-to-plane normal equations, summed over the correspondences in single precision.
+         *
+         * The Jacobian of each correspondence is [p x n, n] for a left update of the pose.
+         */
+        struct NormalEquations {
+            /*! \brief Upper triangle of J^T J, by rows. */
+            float hessian[21];
+            /*! \brief J^T r. */
+            float gradient[6];
+            /*! \brief Sum of the squared residuals. */
+            float error;
+            /*! \brief Number of correspondences. */
+            std::uint32_t count;
+        };
+
+        /*! \brief Registration
+         *         Gauss-Newton loop of the point-to-plane ICP, shared by the backends.
+         *
+         * The backends fit the target planes and sum the normal equations, where the points live. The 6x6 system
+         * is solved here in double precision.
+         */
+        class Registration {
+
+            public:
+                /*! \brief Sums the normal equations of the source under a pose. Returns 0 on success, negative on error. */
+                typedef std::function<int(const Eigen::Affine3d& pose, NormalEquations& equations)> Accumulate;
+
+                /*! \brief Iterate until convergence, the iteration limit or the time budget.
+                 *
+                 * @param params The settings.
+                 * @param accumulate Sums the normal equations.
+                 * @param result Receives the correction, starting from its current transform.
+                 * @return 0 on success, negative on error.
+                 */
+                static int iterate(const RegistrationParams& params, const Accumulate& accumulate,
+                                   RegistrationResult& result);
+
+                /*! \brief Add the contribution of a correspondence to the normal equations.
+                 *
+                 * @param p The source point, under the current pose.
+                 * @param n The normal of the target plane.
+                 * @param residual The signed distance of the point to the plane.
+                 * @param equations The equations to add to.
+                 */
+                static void addCorrespondence(const Eigen::Vector3f& p, const Eigen::Vector3f& n, float residual,
+                                              NormalEquations& equations);
+
+                /*! \brief Zero normal equations. */
+                static NormalEquations zero();
+
+                /*! \brief Get the bounding box of a PointCloud grown by a margin: the submap to register it against.
+                 *
+                 * @param cloud The PointCloud.
+                 * @param margin The margin, in meters.
+                 */
+                static Eigen::AlignedBox3f getSubmapBox(const pcl::PointCloud<pcl::PointXYZRGBL>& cloud, float margin);
+        };
+
+    } // pcl_aggregator
+} // compute
+
+#endif //PCL_AGGREGATOR_CORE_REGISTRATION_H
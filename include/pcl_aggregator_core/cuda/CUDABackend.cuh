@@ -0,0 +1,55 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CUDA_BACKEND_CUH
+#define PCL_AGGREGATOR_CORE_CUDA_BACKEND_CUH
+
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        /*! \brief CUDA Backend
+         *         Runs the point cloud operations on the GPU, staged through the StreamContext of the calling thread.
+         */
+        class CUDABackend : public compute::ComputeBackend {
+
+            public:
+                const char* getName() const override;
+
+                void setPointCloudLabel(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud,
+                                        std::uint32_t label) override;
+
+                void transformPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud,
+                                         const Eigen::Affine3d& transform) override;
+
+                int concatenatePointClouds(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud1,
+                                           const pcl::PointCloud<pcl::PointXYZRGBL>& cloud2) override;
+
+                int ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                     const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                     std::uint32_t label, const Eigen::Affine3d& transform,
+                                     const compute::PointFilter *filter = nullptr) override;
+
+                int ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                     const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                     std::uint32_t label, const compute::DeskewTable& table,
+                                     const compute::PointFilter *filter = nullptr) override;
+
+                int voxelDownsample(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, float leafSize,
+                                    std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns = nullptr) override;
+
+                int alignPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                    const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                    const compute::RegistrationParams& params,
+                                    compute::RegistrationResult& result) override;
+
+                /*! \brief Check if there is a CUDA device. Queried once. */
+                static bool isDeviceAvailable();
+        };
+
+    } // pcl_aggregator
+} // cuda
+
+#endif //PCL_AGGREGATOR_CORE_CUDA_BACKEND_CUH
@@ -0,0 +1,48 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CUDA_DEVICES_CUH
+#define PCL_AGGREGATOR_CORE_CUDA_DEVICES_CUH
+
+#include <cuda_runtime.h>
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        /*! \brief Get the number of CUDA devices. Queried once, 0 without a driver. */
+        int getDeviceCount();
+
+        /*! \brief Get the device of the calling thread. 0 without a device. */
+        int getCurrentDevice();
+
+        /*! \brief Let a device access the memory of a peer directly, if the hardware allows it. Done once per pair.
+         *
+         * Copies between devices work either way, but without peer access the driver stages them through the host.
+         *
+         * @param device The device which will access the memory.
+         * @param peer The device which owns the memory.
+         * @return If peer access is enabled.
+         */
+        bool enablePeerAccess(int device, int peer);
+
+        /*! \brief Makes a device the current one of the thread for a scope. */
+        class DeviceScope {
+
+            private:
+                /*! \brief The device to restore, or negative if it was not changed. */
+                int previous = -1;
+
+            public:
+                /*! \brief Switch to a device. Negative keeps the current one. */
+                explicit DeviceScope(int device);
+                ~DeviceScope();
+
+                DeviceScope(const DeviceScope&) = delete;
+                DeviceScope& operator=(const DeviceScope&) = delete;
+        };
+
+    } // pcl_aggregator
+} // cuda
+
+#endif //PCL_AGGREGATOR_CORE_CUDA_DEVICES_CUH
@@ -0,0 +1,42 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CUDA_METRICS_CUH
+#define PCL_AGGREGATOR_CORE_CUDA_METRICS_CUH
+
+#include <cuda_runtime.h>
+#include <pcl_aggregator_core/utils/Metrics.h>
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        /*! \brief Measures the GPU time of the work queued on a stream between construction and end().
+         *
+         * Only creates and records events when the metrics are enabled. The time goes to the kernel time
+         * histogram of the current registry when the timer is destroyed.
+         */
+        class KernelTimer {
+
+            private:
+                utils::MetricsRegistry* registry = nullptr;
+                cudaStream_t stream;
+                cudaEvent_t startEvent;
+                cudaEvent_t stopEvent;
+                bool ended = false;
+
+            public:
+                explicit KernelTimer(cudaStream_t stream);
+                ~KernelTimer();
+
+                KernelTimer(const KernelTimer&) = delete;
+                KernelTimer& operator=(const KernelTimer&) = delete;
+
+                /*! \brief Mark the end of the measured work on the stream. */
+                void end();
+        };
+
+    } // pcl_aggregator
+} // cuda
+
+#endif //PCL_AGGREGATOR_CORE_CUDA_METRICS_CUH
@@ -9,6 +9,10 @@
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <eigen3/Eigen/Dense>
+#include <pcl_aggregator_core/cuda/DevicePointCloud.cuh>
+#include <pcl_aggregator_core/compute/Deskew.h>
+#include <pcl_aggregator_core/compute/PointFilter.h>
+#include <set>
 
 namespace pcl_aggregator {
     namespace cuda {
@@ -35,6 +39,69 @@ namespace pcl_aggregator {
             __host__ int concatenatePointCloudsCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud1,
                                                      const pcl::PointCloud<pcl::PointXYZRGBL>& cloud2);
 
+            /*! \brief Label, transform and append the points of a raw PointCloud to another in a single GPU pass.
+             *
+             * Only the new points are uploaded and downloaded, instead of one round trip per operation.
+             *
+             * With a filter, the whole frame is uploaded and filtered first, and only the kept points come back.
+             *
+             * @param destination The PointCloud which will receive the points.
+             * @param source The raw PointCloud, in the sensor frame.
+             * @param label The 32-bit unsigned integer label to stamp on the new points.
+             * @param transform The affine transform to apply to the new points.
+             * @param filter Optionally the filter the raw points have to pass.
+             * @return 0 on success, negative on error.
+             */
+            __host__ int ingestPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                              const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                              std::uint32_t label, const Eigen::Affine3d& transform,
+                                              const compute::PointFilter *filter = nullptr);
+
+            /*! \brief Label, deskew and append the points of a raw PointCloud to another in a single GPU pass.
+             *
+             * Same staging as the rigid ingestion. The table goes with the kernel arguments, so nothing more is
+             * uploaded.
+             *
+             * @param destination The PointCloud which will receive the points.
+             * @param source The raw PointCloud, in the sensor frame.
+             * @param label The 32-bit unsigned integer label to stamp on the new points.
+             * @param table The transforms of the scan over its duration.
+             * @param filter Optionally the filter the raw points have to pass.
+             * @return 0 on success, negative on error.
+             */
+            __host__ int ingestPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                              const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                              std::uint32_t label, const compute::DeskewTable& table,
+                                              const compute::PointFilter *filter = nullptr);
+
+            /*! \brief Upload a raw PointCloud and filter it on the device.
+             *
+             * Each chunk is tested as it lands, then the radius outliers are dropped among the points kept, and the
+             * kept points are listed in order. The coordinates stay in the sensor frame.
+             *
+             * @param source The raw PointCloud.
+             * @param filter The filter.
+             * @param d_xyz Device array of source.size() coordinates, which receives the raw coordinates.
+             * @param d_rgba Device array of source.size() colors, which receives the raw colors.
+             * @param d_kept Device array of source.size() indices, which receives the indices of the kept points.
+             * @param nKept Receives the number of points kept.
+             * @return 0 on success, negative on error.
+             */
+            __host__ int filterPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                              const compute::PointFilter& filter, float4 *d_xyz,
+                                              std::uint32_t *d_rgba, std::uint32_t *d_kept, std::size_t& nKept);
+
+            /*! \brief Remove the points with any of the given labels from a device-resident PointCloud.
+             *
+             * Stream compaction in a single pass over the points: flag, scan and scatter. The order of the
+             * kept points is preserved.
+             *
+             * @param cloud The device PointCloud to remove the points from.
+             * @param labels The labels to remove.
+             * @return 0 on success, negative on error.
+             */
+            __host__ int removePointsWithLabelsCuda(DevicePointCloud& cloud, const std::set<std::uint32_t>& labels);
+
             /*! \brief The kernel which sets the label on an individual point.
              *
              * @param points An array of points got from the PointCloud.
@@ -46,20 +113,152 @@ namespace pcl_aggregator {
             /*! \brief The kernel which transforms a given point.
              *
              * @param points An array of points got from the PointCloud.
-             * @param transform The transform to apply in homogenous coordinates (4x4 matrix of rotation and translation).
+             * @param transform The transform to apply, in single precision.
+             * @param num_points The number of elements of the "points" array.
+             */
+            __global__ void transformPointKernel(pcl::PointXYZRGBL *points, PointTransform transform, int num_points);
+
+            /*! \brief The kernel which labels, transforms and writes a point to the destination array.
+             *
+             * The source and destination arrays may be the same, to ingest in-place.
+             *
+             * @param source Array of raw points.
+             * @param destination Array of points which receives the ingested points.
+             * @param label The label to assign.
+             * @param transform The transform to apply, in single precision.
+             * @param num_points The number of points to ingest.
+             */
+            __global__ void ingestPointsKernel(const pcl::PointXYZRGBL *source, pcl::PointXYZRGBL *destination,
+                                               std::uint32_t label, PointTransform transform, std::size_t num_points);
+
+            /*! \brief The kernel which labels, deskews and writes a point to the destination array.
+             *
+             * The source and destination arrays may be the same, to ingest in-place.
+             *
+             * @param source Array of raw points.
+             * @param destination Array of points which receives the ingested points.
+             * @param label The label to assign.
+             * @param table The transforms of the scan over its duration.
+             * @param first_index Index of the first point of the arrays over the scan.
+             * @param num_points The number of points to ingest.
+             */
+            __global__ void ingestDeskewPointsKernel(const pcl::PointXYZRGBL *source, pcl::PointXYZRGBL *destination,
+                                                     std::uint32_t label, compute::DeskewTable table,
+                                                     std::size_t first_index, std::size_t num_points);
+
+            /*! \brief The kernel which scatters raw points to arrays, flagging the ones which pass a filter.
+             *
+             * @param points Array of raw points.
              * @param num_points The number of elements of the "points" array.
+             * @param filter The filter.
+             * @param xyz Array which receives the coordinates.
+             * @param rgba Array which receives the colors.
+             * @param keep Array which receives 1 for the points which pass the filter and 0 otherwise.
+             */
+            __global__ void unpackFilterPointsKernel(const pcl::PointXYZRGBL *points, std::size_t num_points,
+                                                     compute::PointFilter filter, float4 *xyz, std::uint32_t *rgba,
+                                                     std::uint32_t *keep);
+
+            /*! \brief The kernel which computes the cell of each kept point, for the radius outlier removal.
+             *
+             * @param xyz Array of coordinates.
+             * @param keep The flags of the points kept.
+             * @param num_points The number of points.
+             * @param inverse_cell_size The inverse of the outlier radius.
+             * @param keys Array which receives the cell keys. The points not kept get VOXEL_KEY_INVALID.
+             * @param indices Array which receives the index of each point.
+             */
+            __global__ void filterCellKeysKernel(const float4 *xyz, const std::uint32_t *keep, std::size_t num_points,
+                                                 float inverse_cell_size, unsigned long long *keys,
+                                                 std::uint32_t *indices);
+
+            /*! \brief The kernel which flags the points with enough neighbors within the outlier radius.
+             *
+             * @param xyz Array of coordinates.
+             * @param keys Sorted array of the cell keys, from filterCellKeysKernel.
+             * @param indices Array of the point indices, in the order of the keys.
+             * @param num_points The number of points.
+             * @param inverse_cell_size The inverse of the outlier radius.
+             * @param radius_squared The squared outlier radius.
+             * @param min_neighbors The neighbors a point needs to be kept.
+             * @param inliers Array which receives 1 for the points kept and 0 otherwise, by point index.
+             */
+            __global__ void countNeighborsKernel(const float4 *xyz, const unsigned long long *keys,
+                                                 const std::uint32_t *indices, std::size_t num_points,
+                                                 float inverse_cell_size, float radius_squared,
+                                                 std::uint32_t min_neighbors, std::uint32_t *inliers);
+
+            /*! \brief The kernel which writes the index of each kept point to its compacted position.
+             *
+             * @param keep The flags of the points kept.
+             * @param positions The exclusive prefix sum of the flags.
+             * @param num_points The number of points.
+             * @param kept Array which receives the indices of the kept points.
+             */
+            __global__ void listKeptPointsKernel(const std::uint32_t *keep, const std::uint32_t *positions,
+                                                 std::size_t num_points, std::uint32_t *kept);
+
+            /*! \brief The kernel which labels, transforms and writes the kept raw points to the destination array.
+             *
+             * @param xyz Array of raw coordinates.
+             * @param rgba Array of raw colors.
+             * @param kept Array of the indices of the kept points.
+             * @param num_points The number of points to ingest.
+             * @param label The label to assign.
+             * @param transform The transform to apply, in single precision.
+             * @param destination Array of points which receives the ingested points.
+             */
+            __global__ void gatherIngestPointsKernel(const float4 *xyz, const std::uint32_t *rgba,
+                                                     const std::uint32_t *kept, std::size_t num_points,
+                                                     std::uint32_t label, PointTransform transform,
+                                                     pcl::PointXYZRGBL *destination);
+
+            /*! \brief The kernel which labels, deskews and writes the kept raw points to the destination array.
+             *
+             * The time of each point comes from its index on the raw scan.
+             *
+             * @param xyz Array of raw coordinates.
+             * @param rgba Array of raw colors.
+             * @param kept Array of the indices of the kept points.
+             * @param num_points The number of points to ingest.
+             * @param label The label to assign.
+             * @param table The transforms of the scan over its duration.
+             * @param destination Array of points which receives the ingested points.
+             */
+            __global__ void gatherIngestDeskewPointsKernel(const float4 *xyz, const std::uint32_t *rgba,
+                                                           const std::uint32_t *kept, std::size_t num_points,
+                                                           std::uint32_t label, compute::DeskewTable table,
+                                                           pcl::PointXYZRGBL *destination);
+
+            /*! \brief The kernel which flags if a point is kept, i.e., its label is not in the given array.
+             *
+             * @param point_labels The array of labels of the points.
+             * @param num_points The number of elements of the "point_labels" array.
+             * @param labels Sorted array of the labels to remove.
+             * @param num_labels The number of elements of the "labels" array.
+             * @param keep Array which receives 1 for the points to keep and 0 otherwise.
              */
-            __global__ void transformPointKernel(pcl::PointXYZRGBL *points, Eigen::Matrix4d transform, int num_points);
+            __global__ void markPointsToKeepKernel(const std::uint32_t *point_labels, std::size_t num_points,
+                                                   const std::uint32_t *labels, std::size_t num_labels,
+                                                   std::uint32_t *keep);
 
-            /*! \brief The kernel which concatenates a point on cloud2 to cloud1.
+            /*! \brief The kernel which writes a kept point to its compacted position.
              *
-             * @param cloud1 Array of points of the cloud1.
-             * @param cloud1_original_size The size of cloud1 before concatenation.
-             * @param cloud2 Array of points of the cloud2.
-             * @param cloud2_size The size of cloud2.
+             * @param xyz Array of coordinates.
+             * @param rgba Array of colors.
+             * @param labels Array of labels.
+             * @param num_points The number of points.
+             * @param keep The flags computed by markPointsToKeepKernel.
+             * @param positions The exclusive prefix sum of the flags.
+             * @param output_xyz Array which receives the kept coordinates.
+             * @param output_rgba Array which receives the kept colors.
+             * @param output_labels Array which receives the kept labels.
              */
-            __global__ void concatenatePointCloudsKernel(pcl::PointXYZRGBL* cloud1, std::size_t cloud1_original_size,
-                                                         pcl::PointXYZRGBL* cloud2, std::size_t cloud2_size);
+            __global__ void compactPointsKernel(const float4 *xyz, const std::uint32_t *rgba,
+                                                const std::uint32_t *labels, std::size_t num_points,
+                                                const std::uint32_t *keep, const std::uint32_t *positions,
+                                                float4 *output_xyz, std::uint32_t *output_rgba,
+                                                std::uint32_t *output_labels);
 
         }
     } // pcl_aggregator
@@ -0,0 +1,89 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CUDA_REGISTRATION_CUH
+#define PCL_AGGREGATOR_CORE_CUDA_REGISTRATION_CUH
+
+#include <cuda_runtime.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl_aggregator_core/compute/Registration.h>
+#include <pcl_aggregator_core/cuda/DevicePointCloud.cuh>
+#include <cstdint>
+
+namespace pcl_aggregator {
+    namespace cuda {
+        namespace pointclouds {
+
+            /*! \brief Running sums of the target points falling on a cell, relative to the corner of the cell. */
+            struct CellMoments {
+                float sx, sy, sz;
+                float sxx, sxy, sxz, syy, syz, szz;
+                /*! \brief Number of points accumulated. */
+                std::uint32_t count;
+            };
+
+            /*! \brief Plane fitted to the target points of a cell. */
+            struct CellPlane {
+                /*! \brief Centroid of the points. */
+                float4 centroid;
+                /*! \brief Unit normal of the plane. The fourth coordinate is 0 when the cell has no plane. */
+                float4 normal;
+            };
+
+            /*! \brief Align a host PointCloud with another on the GPU, with point-to-plane ICP.
+             *
+             * @param source The PointCloud to align.
+             * @param target The PointCloud to align to.
+             * @param params The settings of the registration.
+             * @param result Receives the correction, starting from its current transform.
+             * @return 0 on success, negative on error.
+             */
+            __host__ int alignPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                             const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                             const compute::RegistrationParams& params,
+                                             compute::RegistrationResult& result);
+
+            /*! \brief Align a device-resident PointCloud with another, with point-to-plane ICP. No points cross the bus.
+             *
+             * The target is hashed into cells with the voxel keys, and each cell gets a plane. The source points
+             * search the 27 cells around them for the closest centroid. The normal equations are summed on the GPU in
+             * single precision, so each iteration only brings back a few floats.
+             *
+             * @param source The device PointCloud to align. Must live on the device of the target.
+             * @param target The device PointCloud to align to.
+             * @param params The settings of the registration.
+             * @param result Receives the correction, starting from its current transform.
+             * @return 0 on success, negative on error.
+             */
+            __host__ int alignPointCloudCuda(const DevicePointCloud& source, const DevicePointCloud& target,
+                                             const compute::RegistrationParams& params,
+                                             compute::RegistrationResult& result);
+
+            /*! \brief The kernel which starts the moments of a target point, in cell key order.
+             *
+             * @param xyz Array of coordinates.
+             * @param indices Array of point indices ordered by cell key.
+             * @param num_points The number of elements of the "indices" array.
+             * @param cellSize The side of the cells.
+             * @param moments Array which receives the moments.
+             */
+            __global__ void initCellMomentsKernel(const float4 *xyz, const std::uint32_t *indices,
+                                                  std::size_t num_points, float cellSize, CellMoments *moments);
+
+            /*! \brief The kernel which fits the plane of a cell from its moments.
+             *
+             * @param keys Array of cell keys.
+             * @param moments Array of moments of the cells.
+             * @param num_cells The number of cells.
+             * @param cellSize The side of the cells.
+             * @param planes Array which receives the planes.
+             */
+            __global__ void cellPlanesKernel(const unsigned long long *keys, const CellMoments *moments,
+                                             std::size_t num_cells, float cellSize, CellPlane *planes);
+        }
+    } // pcl_aggregator
+} // cuda
+
+#endif //PCL_AGGREGATOR_CORE_CUDA_REGISTRATION_CUH
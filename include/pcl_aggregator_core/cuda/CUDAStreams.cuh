@@ -0,0 +1,275 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CUDA_STREAMS_CUH
+#define PCL_AGGREGATOR_CORE_CUDA_STREAMS_CUH
+
+#include <cuda_runtime.h>
+#include <pcl/point_types.h>
+#include <pcl_aggregator_core/cuda/CUDADevices.cuh>
+#include <array>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <vector>
+
+// streams of a context. chunk i is uploaded while chunk i-1 runs and chunk i-2 is downloaded
+#define CUDA_PIPELINE_STAGES 3
+// bytes moved per pipeline stage
+#define CUDA_PIPELINE_CHUNK_BYTES (2 * 1024 * 1024)
+// smallest pinned buffer handed out by the pool
+#define PINNED_POOL_MIN_BUFFER_BYTES (64 * 1024)
+// pinned bytes kept by the pool for reuse. beyond this, released buffers are freed
+#define PINNED_POOL_MAX_CACHED_BYTES (256 * 1024 * 1024)
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        /*! \brief Process-wide cache of page-locked host buffers.
+         *
+         * Allocating pinned memory is expensive, so the buffers are kept by power of two size classes
+         * and handed out again.
+         */
+        class PinnedBufferPool {
+
+            private:
+                std::mutex mutex;
+                /*! \brief Free buffers, by capacity. */
+                std::map<std::size_t, std::vector<void*>> freeBuffers;
+                /*! \brief Bytes on the free lists. */
+                std::size_t cachedBytes = 0;
+
+                PinnedBufferPool() = default;
+
+            public:
+                ~PinnedBufferPool();
+
+                PinnedBufferPool(const PinnedBufferPool&) = delete;
+                PinnedBufferPool& operator=(const PinnedBufferPool&) = delete;
+
+                /*! \brief Get the pool of the process. */
+                static PinnedBufferPool& getInstance();
+
+                /*! \brief Take a buffer of at least the given size.
+                 *
+                 * @param bytes The minimum size.
+                 * @param capacity Receives the actual size of the buffer.
+                 * @return The buffer, or null if pinned memory could not be allocated.
+                 */
+                void* acquire(std::size_t bytes, std::size_t* capacity);
+
+                /*! \brief Give back a buffer taken with acquire. */
+                void release(void* buffer, std::size_t capacity);
+
+                /*! \brief Free all the cached buffers. */
+                void trim();
+
+                /*! \brief Get the number of bytes cached for reuse. */
+                std::size_t getCachedBytes();
+        };
+
+        /*! \brief A pinned host buffer from the pool, given back on destruction. */
+        class PinnedBuffer {
+
+            private:
+                void* buffer = nullptr;
+                std::size_t capacity = 0;
+
+            public:
+                PinnedBuffer() = default;
+                ~PinnedBuffer();
+
+                PinnedBuffer(const PinnedBuffer&) = delete;
+                PinnedBuffer& operator=(const PinnedBuffer&) = delete;
+                PinnedBuffer(PinnedBuffer&& other) noexcept;
+                PinnedBuffer& operator=(PinnedBuffer&& other) noexcept;
+
+                /*! \brief Make sure the buffer holds at least the given size. The contents are not kept.
+                 *
+                 * @return 0 on success, negative on error.
+                 */
+                int reserve(std::size_t bytes);
+
+                /*! \brief Get the buffer. May be null. */
+                void* data() const;
+
+                /*! \brief Get the size of the buffer. */
+                std::size_t getCapacity() const;
+        };
+
+        /*! \brief Long-lived CUDA streams and pinned staging buffers of one producer, like a StreamManager.
+         *
+         * Transfers are split in chunks dealt round-robin over the streams through pinned staging buffers,
+         * so the copy of a chunk to the staging buffer, its DMA and the kernels of the neighbouring chunks overlap.
+         * The calls return when the work is done, so the host memory can be reused right away. Thread-safe.
+         *
+         * The streams belong to one device, and the transfers run on it whichever the current device of the caller.
+         */
+        class StreamContext {
+
+            public:
+                /*! \brief Queues the work on a device chunk of points.
+                 *
+                 * Receives the chunk, its number of points, the index of its first point and the stream to queue on.
+                 */
+                typedef std::function<void(pcl::PointXYZRGBL*, std::size_t, std::size_t, cudaStream_t)> PointsLaunch;
+
+            private:
+                /*! \brief Serializes the transfers, as the staging buffers are shared. */
+                std::mutex mutex;
+                /*! \brief The device owning the streams and the device staging buffers. */
+                int device = 0;
+                std::array<cudaStream_t, CUDA_PIPELINE_STAGES> streams{};
+                /*! \brief Pinned buffer of each stage. */
+                std::array<PinnedBuffer, CUDA_PIPELINE_STAGES> staging;
+                /*! \brief Device buffer of each stage, for host-to-host processing. */
+                std::array<void*, CUDA_PIPELINE_STAGES> d_staging{};
+
+                /*! \brief Allocate the pinned staging buffers, if not yet allocated.
+                 *
+                 * @return If they are available. Otherwise the transfers use the pageable memory directly.
+                 */
+                bool ensurePinnedStaging();
+
+                /*! \brief Allocate the device staging buffers, if not yet allocated. */
+                int ensureDeviceStaging();
+
+                /*! \brief Wait for the work on all the streams. */
+                int synchronize();
+
+                /*! \brief Upload host memory in chunks, queuing work after each chunk.
+                 *
+                 * @param d_destination Device memory receiving the data, or null to use the device staging buffers.
+                 * @param source Host memory to upload.
+                 * @param destination Host memory receiving the chunks back after the work, or null to not download.
+                 * @param bytes Number of bytes.
+                 * @param chunkBytes Bytes per chunk.
+                 * @param launch Queues the work on a chunk, with its device address, size and offset in bytes. May be null.
+                 * @return 0 on success, negative on error.
+                 */
+                int pipeline(void* d_destination, const void* source, void* destination, std::size_t bytes,
+                             std::size_t chunkBytes,
+                             const std::function<void(void*, std::size_t, std::size_t, cudaStream_t)>& launch);
+
+                /*! \brief Download device memory in chunks, optionally producing each chunk first.
+                 *
+                 * @param destination Host memory receiving the data.
+                 * @param d_source Device memory to download, or null to produce the chunks on the device staging buffers.
+                 * @param bytes Number of bytes.
+                 * @param chunkBytes Bytes per chunk.
+                 * @param produce With a null source, queues the writing of a chunk, with its device address, size and
+                 *                offset in bytes.
+                 * @return 0 on success, negative on error.
+                 */
+                int drain(void* destination, const void* d_source, std::size_t bytes, std::size_t chunkBytes,
+                          const std::function<void(void*, std::size_t, std::size_t, cudaStream_t)>& produce);
+
+            public:
+                /*! \brief Create the streams of a context.
+                 *
+                 * @param device The CUDA device to run on. Negative is the current device of the calling thread.
+                 */
+                explicit StreamContext(int device = -1);
+                ~StreamContext();
+
+                StreamContext(const StreamContext&) = delete;
+                StreamContext& operator=(const StreamContext&) = delete;
+
+                /*! \brief Get the main stream, for the work which is not split in chunks. */
+                cudaStream_t getStream() const;
+
+                /*! \brief Get the device the streams belong to. */
+                int getDevice() const;
+
+                /*! \brief Get the bytes of the staging buffers held, pinned on the host and on the device. */
+                std::size_t getStagingBytes();
+
+                /*! \brief Copy host memory to the device.
+                 *
+                 * @return 0 on success, negative on error.
+                 */
+                int upload(void* d_destination, const void* source, std::size_t bytes);
+
+                /*! \brief Copy device memory to the host.
+                 *
+                 * @return 0 on success, negative on error.
+                 */
+                int download(void* destination, const void* d_source, std::size_t bytes);
+
+                /*! \brief Copy host points to the device, running work on each chunk once it lands.
+                 *
+                 * @param d_destination Device array receiving the points, or null to land each chunk on a staging
+                 *                      buffer, for work which moves the points elsewhere.
+                 * @param source Host array of points.
+                 * @param n Number of points.
+                 * @param launch The work on each chunk.
+                 * @return 0 on success, negative on error.
+                 */
+                int uploadPoints(pcl::PointXYZRGBL* d_destination, const pcl::PointXYZRGBL* source, std::size_t n,
+                                 const PointsLaunch& launch);
+
+                /*! \brief Copy points produced on the device to the host, chunk by chunk.
+                 *
+                 * Each chunk is written by the work to a staging buffer and downloaded while the next one is produced.
+                 *
+                 * @param destination Host array receiving the points.
+                 * @param n Number of points.
+                 * @param produce The work writing each chunk.
+                 * @return 0 on success, negative on error.
+                 */
+                int downloadPoints(pcl::PointXYZRGBL* destination, std::size_t n, const PointsLaunch& produce);
+
+                /*! \brief Run work on host points on the device: upload, launch and download each chunk.
+                 *
+                 * @param source Host array of points.
+                 * @param destination Host array receiving the processed points. May be the same as source.
+                 * @param n Number of points.
+                 * @param launch The work on each chunk.
+                 * @return 0 on success, negative on error.
+                 */
+                int processPoints(const pcl::PointXYZRGBL* source, pcl::PointXYZRGBL* destination, std::size_t n,
+                                  const PointsLaunch& launch);
+
+                /*! \brief Get the context of the current thread.
+                 *
+                 * The one set by a StreamScope, or else a context owned by the thread.
+                 */
+                static StreamContext& getCurrent();
+
+                /*! \brief Set the context of the current thread.
+                 *
+                 * @return The previous one. May be null.
+                 */
+                static StreamContext* setCurrent(StreamContext* context);
+        };
+
+        /*! \brief Makes a context, and its device, the current ones of the thread for a scope.
+         *
+         * The kernels, thrust algorithms and allocations of the scope then run on the device of the context.
+         */
+        class StreamScope {
+
+            private:
+                DeviceScope deviceScope;
+                StreamContext* previous;
+
+            public:
+                explicit StreamScope(StreamContext* context) :
+                deviceScope(context != nullptr ? context->getDevice() : -1) {
+                    this->previous = StreamContext::setCurrent(context);
+                }
+
+                ~StreamScope() {
+                    StreamContext::setCurrent(this->previous);
+                }
+
+                StreamScope(const StreamScope&) = delete;
+                StreamScope& operator=(const StreamScope&) = delete;
+        };
+
+    } // pcl_aggregator
+} // cuda
+
+#endif //PCL_AGGREGATOR_CORE_CUDA_STREAMS_CUH
@@ -0,0 +1,108 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CUDA_VOXELGRID_CUH
+#define PCL_AGGREGATOR_CORE_CUDA_VOXELGRID_CUH
+
+#include <cuda_runtime.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <pcl_aggregator_core/cuda/DevicePointCloud.cuh>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// key given to points which can't be voxelized (non-finite or out of the key range). sorts last.
+#define VOXEL_KEY_INVALID 0xFFFFFFFFFFFFFFFFULL
+// bits used by each axis on the voxel key
+#define VOXEL_KEY_AXIS_BITS 21
+
+namespace pcl_aggregator {
+    namespace cuda {
+        namespace pointclouds {
+
+            /*! \brief Running sums of the points falling on a voxel. */
+            struct VoxelAccumulator {
+                float x;
+                float y;
+                float z;
+                float r;
+                float g;
+                float b;
+                /*! \brief Number of points accumulated. */
+                std::uint32_t count;
+                /*! \brief The label with most points on the voxel. */
+                std::uint32_t label;
+                /*! \brief Number of points with that label. */
+                std::uint32_t labelCount;
+            };
+
+            /*! \brief Apply a voxel grid filter to a host PointCloud on the GPU, in-place.
+             *
+             * Each voxel is replaced by the centroid of its points. The label of the centroid is the label
+             * with most points on the voxel (like pcl::VoxelGrid), so points keep aging with the scan they came from.
+             * The centroids come out grouped by label.
+             *
+             * @param cloud The PointCloud to downsample.
+             * @param leafSize The voxel size.
+             * @param labelRuns Optionally receives the (label, number of points) runs of the output, in order.
+             * @return 0 on success, negative on error.
+             */
+            __host__ int voxelDownsampleCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, float leafSize,
+                                             std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns = nullptr);
+
+            /*! \brief Apply a voxel grid filter to a device-resident PointCloud, in-place. No points cross the bus.
+             *
+             * @param cloud The device PointCloud to downsample.
+             * @param leafSize The voxel size.
+             * @param labelRuns Optionally receives the (label, number of points) runs of the output, in order.
+             * @return 0 on success, negative on error.
+             */
+            __host__ int voxelDownsampleCuda(DevicePointCloud& cloud, float leafSize,
+                                             std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns = nullptr);
+
+            /*! \brief The kernel which computes the voxel key of a point.
+             *
+             * @param xyz Array of coordinates.
+             * @param point_labels Array of labels of the points.
+             * @param num_points The number of points.
+             * @param inverseLeafSize The inverse of the voxel size.
+             * @param keys Array which receives the voxel key of each point.
+             * @param labels Array which receives the label of each point, to be sorted with the keys.
+             * @param indices Array which receives the index of each point.
+             */
+            __global__ void computeVoxelKeysKernel(const float4 *xyz, const std::uint32_t *point_labels,
+                                                   std::size_t num_points, float inverseLeafSize,
+                                                   unsigned long long *keys, std::uint32_t *labels,
+                                                   std::uint32_t *indices);
+
+            /*! \brief The kernel which starts the accumulator of a point, in voxel key order.
+             *
+             * @param xyz Array of coordinates.
+             * @param rgba Array of packed colors.
+             * @param sorted_labels Array of labels ordered by voxel key.
+             * @param indices Array of point indices ordered by voxel key.
+             * @param num_points The number of elements of the "indices" array.
+             * @param accumulators Array which receives the accumulators.
+             */
+            __global__ void initVoxelAccumulatorsKernel(const float4 *xyz, const std::uint32_t *rgba,
+                                                        const std::uint32_t *sorted_labels,
+                                                        const std::uint32_t *indices, std::size_t num_points,
+                                                        VoxelAccumulator *accumulators);
+
+            /*! \brief The kernel which turns the accumulator of a voxel into its centroid point.
+             *
+             * @param accumulators Array of voxel accumulators.
+             * @param num_voxels The number of voxels.
+             * @param xyz Array which receives the coordinates of the centroids.
+             * @param rgba Array which receives the packed colors of the centroids.
+             * @param labels Array which receives the labels of the centroids.
+             */
+            __global__ void voxelCentroidsKernel(const VoxelAccumulator *accumulators, std::size_t num_voxels,
+                                                 float4 *xyz, std::uint32_t *rgba, std::uint32_t *labels);
+        }
+    } // pcl_aggregator
+} // cuda
+
+#endif //PCL_AGGREGATOR_CORE_CUDA_VOXELGRID_CUH
@@ -9,22 +9,99 @@
 #include <opencv2/opencv.hpp>
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
+#include <eigen3/Eigen/Dense>
+#include <pcl_aggregator_core/cuda/CUDAStreams.cuh>
 #include <cstdlib>
+#include <cstddef>
+
+// meters per unit of 16-bit depth images, as given by most depth cameras
+#define DEPROJECTION_DEFAULT_DEPTH_UNIT 0.001f
 
 namespace pcl_aggregator {
     namespace cuda {
         namespace rgbd {
 
+            /*! \brief Pinhole camera parameters, passed by value to the kernel. */
+            struct DeprojectionIntrinsics {
+                /*! \brief Inverse of the horizontal focal length. */
+                float invFx;
+                /*! \brief Inverse of the vertical focal length. */
+                float invFy;
+                /*! \brief Horizontal principal point. */
+                float cx;
+                /*! \brief Vertical principal point. */
+                float cy;
+            };
+
+            /*! \brief Persistent state to deproject the images of one camera.
+             *
+             * The device buffers and the streams are kept between frames and only grow, so a steady stream
+             * of frames allocates nothing. Keep one per camera.
+             */
+            class DeprojectionContext {
+
+                private:
+                    /*! \brief Streams and pinned staging of this camera. */
+                    StreamContext streams;
+
+                    /*! \brief Device copy of the color image, BGR8 packed by rows. */
+                    unsigned char *d_colorImage = nullptr;
+                    /*! \brief Bytes allocated for the color image. */
+                    std::size_t colorCapacity = 0;
+
+                    /*! \brief Device copy of the depth image, packed by rows. */
+                    unsigned char *d_depthImage = nullptr;
+                    /*! \brief Bytes allocated for the depth image. */
+                    std::size_t depthCapacity = 0;
+
+                    /*! \brief The deprojected points. */
+                    pcl::PointXYZRGBL *d_points = nullptr;
+                    /*! \brief Bytes allocated for the points. */
+                    std::size_t pointsCapacity = 0;
+
+                    /*! \brief Number of valid points written by the kernel. */
+                    unsigned int *d_nValidPoints = nullptr;
+
+                    /*! \brief Grow a device buffer to hold a number of bytes. Its contents are not kept. */
+                    static int ensureCapacity(void **buffer, std::size_t *capacity, std::size_t bytes);
+
+                public:
+                    DeprojectionContext();
+                    ~DeprojectionContext();
+
+                    DeprojectionContext(const DeprojectionContext&) = delete;
+                    DeprojectionContext& operator=(const DeprojectionContext&) = delete;
+
+                    /*! \brief Deproject a depth image and its color image to a colored PointCloud.
+                     *
+                     * Pixels with depth outside [minDepth, maxDepth] or not finite are dropped on the device,
+                     * and only the valid points are copied back. The points are in the camera optical frame.
+                     *
+                     * @param colorImage Color image BGR8 of the same size as the depth image. If empty, points are white.
+                     * @param depthImage Depth image, 16-bit unsigned (scaled by depthUnit) or 32-bit float in meters.
+                     * @param K Camera intrinsic matrix.
+                     * @param minDepth Minimum admissible depth in meters.
+                     * @param maxDepth Maximum admissible depth in meters.
+                     * @param destination Receives the points, replacing its contents.
+                     * @param depthUnit Meters per unit of 16-bit depth images.
+                     * @return 0 on success, negative on error.
+                     */
+                    int deproject(const cv::Mat& colorImage, const cv::Mat& depthImage, const Eigen::Matrix3d& K,
+                                  float minDepth, float maxDepth, pcl::PointCloud<pcl::PointXYZRGBL>& destination,
+                                  float depthUnit = DEPROJECTION_DEFAULT_DEPTH_UNIT);
+            };
+
             /*! \brief Use CUDA to parallelize the deprojection of a depth image to a colored pointcloud.
              *
              * The points will be rejected if they surpass the depth limits imposed by minDepth and maxDepth.
+             * Allocates the device buffers on each call: keep a DeprojectionContext per camera instead for streams.
              *
              * @param colorImage Color image as OpenCV matrix BGR8.
-             * @param depthImage Depth image as OpenCV matrix.
+             * @param depthImage Depth image as OpenCV matrix, 16-bit in millimeters or 32-bit float in meters.
              * @param K Camera intrinsic matrix as Eigen matrix.
              * @param minDepth Minimum admissible depth. Check the camera's datasheet.
              * @param maxDepth Maximum admissible depth. Check the camera's datasheet.
-             * @param destination
+             * @param destination Receives the points.
              */
             __host__ void deprojectImages(const cv::Mat& colorImage, const cv::Mat& depthImage, const Eigen::Matrix3d& K,
                                           double minDepth, double maxDepth,
@@ -33,22 +110,27 @@ namespace pcl_aggregator {
 
             /*! \brief The deprojection kernel, responsible by deprojecting an individual pixel.
              *
-             * All pointers passed here must be in device memory.
+             * All pointers passed here must be in device memory. Each warp reserves room for its valid points
+             * with a single atomic, so the output is compact.
              *
-             * @param colorImage Color image in raw format in OpenCV ordering (row-major) BGR8.
+             * @tparam DepthT Type of the depth pixels.
+             * @param colorImage Color image in raw format in OpenCV ordering (row-major) BGR8. May be null.
              * @param depthImage Depth image in raw format in OpenCV ordering (row-major).
              * @param width Width of the images in pixels.
              * @param height Height of the images in pixels.
-             * @param K Camera's intrinsic matrix.
+             * @param intrinsics Camera's intrinsic parameters.
+             * @param depthScale Meters per unit of depth.
              * @param minDepth Minimum admissible depth.
              * @param maxDepth Maximum admissible depth.
              * @param pointArray Array of colored points.
-             * @param nValidPoints Pointer shared among threads. Each threads knows how many points have been inserted, thus inserting the next one immediately after.
+             * @param nValidPoints Counter of the points written.
              */
-            __global__ void deprojectImagesKernel(unsigned char *colorImage, unsigned char *depthImage, unsigned int width,
-                                                  unsigned int height, const Eigen::Matrix3d& K_inv,
-                                                  double minDepth, double maxDepth, pcl::PointXYZRGBL *pointArray,
-                                                  unsigned long long *nValidPoints);
+            template <typename DepthT>
+            __global__ void deprojectImagesKernel(const unsigned char *colorImage, const DepthT *depthImage,
+                                                  unsigned int width, unsigned int height,
+                                                  DeprojectionIntrinsics intrinsics, float depthScale,
+                                                  float minDepth, float maxDepth, pcl::PointXYZRGBL *pointArray,
+                                                  unsigned int *nValidPoints);
         }
     } // pcl_aggregator
 } // cuda
@@ -0,0 +1,177 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_DEVICE_MEMORY_POOL_CUH
+#define PCL_AGGREGATOR_CORE_DEVICE_MEMORY_POOL_CUH
+
+#include <cuda_runtime.h>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef __CUDACC__
+#include <thrust/device_malloc_allocator.h>
+#include <thrust/device_vector.h>
+#endif
+
+// smallest block handed out by the device memory pool
+#define DEVICE_MEMORY_POOL_MIN_BLOCK_BYTES 512
+// VRAM the pool may take from the driver, in bytes. 0 is no limit
+#define DEVICE_MEMORY_POOL_DEFAULT_MAX_BYTES 0
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        /*! \brief Usage of the device memory pool. */
+        struct DeviceMemoryPoolStats {
+            /*! \brief Bytes taken from the driver, in use or cached. */
+            std::size_t allocatedBytes = 0;
+            /*! \brief Highest allocatedBytes seen. */
+            std::size_t peakAllocatedBytes = 0;
+            /*! \brief Bytes handed out and not yet released. */
+            std::size_t inUseBytes = 0;
+            /*! \brief Highest inUseBytes seen. */
+            std::size_t peakInUseBytes = 0;
+            /*! \brief Bytes kept for reuse. */
+            std::size_t cachedBytes = 0;
+            /*! \brief The VRAM cap. 0 is no limit. */
+            std::size_t maxBytes = 0;
+            /*! \brief Allocations served from the cache. */
+            std::uint64_t hits = 0;
+            /*! \brief Allocations which went to the driver. */
+            std::uint64_t misses = 0;
+
+            /*! \brief Get the fraction of the allocations served from the cache. */
+            double getHitRate() const {
+                std::uint64_t total = this->hits + this->misses;
+                return total == 0 ? 0.0 : (double) this->hits / (double) total;
+            }
+        };
+
+        /*! \brief Process-wide caching allocator of device memory.
+         *
+         * cudaMalloc and cudaFree are expensive and synchronize the device, so the blocks are kept by power of two
+         * size classes and handed out again. A released block may be reused at once: release it only after the
+         * work using it has completed.
+         *
+         * Blocks are allocated on the current device of the calling thread and only handed out again on that device.
+         * The statistics and the cap cover all the devices.
+         */
+        class DeviceMemoryPool {
+
+            private:
+                std::mutex mutex;
+                /*! \brief Free blocks, by device and size class. */
+                std::map<std::pair<int,std::size_t>, std::vector<void*>> freeBlocks;
+                /*! \brief Device and size class of each block in use. */
+                std::unordered_map<void*, std::pair<int,std::size_t>> usedBlocks;
+                DeviceMemoryPoolStats stats;
+
+                DeviceMemoryPool();
+
+                /*! \brief Free the cached blocks. Must be called with the mutex held. */
+                void releaseCached();
+
+            public:
+                ~DeviceMemoryPool();
+
+                DeviceMemoryPool(const DeviceMemoryPool&) = delete;
+                DeviceMemoryPool& operator=(const DeviceMemoryPool&) = delete;
+
+                /*! \brief Get the pool of the process. */
+                static DeviceMemoryPool& getInstance();
+
+                /*! \brief Take a block of at least the given size, on the current device.
+                 *
+                 * @param bytes The minimum size.
+                 * @return The block, or null if over the cap or out of device memory.
+                 */
+                void* allocate(std::size_t bytes);
+
+                /*! \brief Give back a block taken with allocate. Null is ignored. */
+                void release(void* block);
+
+                /*! \brief Set the VRAM cap. Cached blocks are freed to fit it.
+                 *
+                 * @param bytes The most bytes taken from the driver. 0 is no limit.
+                 */
+                void setMaxBytes(std::size_t bytes);
+
+                /*! \brief Free all the cached blocks. */
+                void trim();
+
+                /*! \brief Get the usage statistics. */
+                DeviceMemoryPoolStats getStats();
+
+                /*! \brief Zero the hit and miss counters and bring the peaks down to the current usage. */
+                void resetStats();
+        };
+
+#ifdef __CUDACC__
+        /*! \brief Allocator of thrust containers drawing from the device memory pool. */
+        template <typename T>
+        class PoolAllocator : public thrust::device_malloc_allocator<T> {
+
+            public:
+                typedef thrust::device_malloc_allocator<T> super_t;
+                typedef typename super_t::pointer pointer;
+                typedef typename super_t::size_type size_type;
+
+                template <typename U>
+                struct rebind {
+                    typedef PoolAllocator<U> other;
+                };
+
+                PoolAllocator() = default;
+
+                template <typename U>
+                PoolAllocator(const PoolAllocator<U>&) {}
+
+                pointer allocate(size_type n) {
+                    void* block = DeviceMemoryPool::getInstance().allocate(n * sizeof(T));
+                    if(block == nullptr && n > 0)
+                        throw std::bad_alloc();
+                    return pointer(static_cast<T*>(block));
+                }
+
+                void deallocate(pointer p, size_type) {
+                    DeviceMemoryPool::getInstance().release(thrust::raw_pointer_cast(p));
+                }
+        };
+
+        /*! \brief Device vector drawing from the device memory pool. */
+        template <typename T>
+        using PoolVector = thrust::device_vector<T, PoolAllocator<T>>;
+
+        /*! \brief Allocator of the temporary storage of thrust algorithms, like sorts and scans.
+         *
+         * Pass it to the execution policy: thrust::cuda::par(allocator).on(stream).
+         */
+        class ThrustTempAllocator {
+
+            public:
+                typedef char value_type;
+
+                char* allocate(std::ptrdiff_t n) {
+                    void* block = DeviceMemoryPool::getInstance().allocate((std::size_t) n);
+                    if(block == nullptr && n > 0)
+                        throw std::bad_alloc();
+                    return static_cast<char*>(block);
+                }
+
+                void deallocate(char* p, std::size_t) {
+                    DeviceMemoryPool::getInstance().release(p);
+                }
+        };
+#endif
+
+    } // pcl_aggregator
+} // cuda
+
+#endif //PCL_AGGREGATOR_CORE_DEVICE_MEMORY_POOL_CUH
@@ -0,0 +1,280 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_DEVICEPOINTCLOUD_CUH
+#define PCL_AGGREGATOR_CORE_DEVICEPOINTCLOUD_CUH
+
+#include <cuda_runtime.h>
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <eigen3/Eigen/Dense>
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace pcl_aggregator {
+    namespace cuda {
+        namespace pointclouds {
+
+            using compute::PointRangeMove;
+
+            /*! \brief An affine transform in single precision: the top 3x4 block of the homogeneous matrix.
+             *
+             * Passed to the kernels by value, so each launch reads it from the constant bank and concurrent
+             * launches with different transforms don't race on a shared symbol.
+             */
+            struct PointTransform {
+                float m[3][4];
+
+                /*! \brief Round a double precision transform. */
+                __host__ static PointTransform fromAffine(const Eigen::Affine3d& tf) {
+                    PointTransform result{};
+                    for(int r = 0; r < 3; r++) {
+                        for(int c = 0; c < 4; c++)
+                            result.m[r][c] = (float) tf.matrix()(r, c);
+                    }
+                    return result;
+                }
+
+                /*! \brief Transform a point, keeping its fourth coordinate. */
+                __host__ __device__ float4 apply(float4 p) const {
+                    float4 result;
+                    result.x = m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3];
+                    result.y = m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3];
+                    result.z = m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3];
+                    result.w = p.w;
+                    return result;
+                }
+            };
+
+            /*! \brief Growable PointCloud buffer living in device memory.
+             *
+             * Keeps the points on the GPU between operations, so appends, transforms and labelling
+             * only move the points involved instead of the whole cloud. The capacity grows by doubling,
+             * making appends amortized O(new points). All operations are ordered on the stream of the buffer, while
+             * the host transfers are staged through the StreamContext of the calling thread.
+             *
+             * The points are kept as a structure of arrays (coordinates, colors and labels), so the kernels only read
+             * the fields they use. They are converted from and to pcl::PointXYZRGBL when crossing the bus.
+             *
+             * The buffer lives on the current device of the thread which creates it. The host transfers expect the
+             * current StreamContext to be on that device.
+             */
+            class DevicePointCloud {
+
+                private:
+                    /*! \brief Device array of coordinates. The fourth is kept as the host gave it. */
+                    float4 *d_xyz = nullptr;
+                    /*! \brief Device array of packed colors. */
+                    std::uint32_t *d_rgba = nullptr;
+                    /*! \brief Device array of labels. */
+                    std::uint32_t *d_labels = nullptr;
+                    /*! \brief Number of valid points in the device arrays. */
+                    std::size_t nPoints = 0;
+                    /*! \brief Number of points the device arrays can hold without reallocating. */
+                    std::size_t capacity = 0;
+                    /*! \brief CUDA stream where all the operations on this buffer are ordered. */
+                    cudaStream_t stream = nullptr;
+                    /*! \brief If the stream was created by this buffer, to be destroyed with it. */
+                    bool ownsStream = true;
+                    /*! \brief The device holding the arrays and the stream. */
+                    int device = 0;
+
+                    /*! \brief Check if the current StreamContext is on the device of the buffer, complaining if not. */
+                    bool isContextOnDevice() const;
+
+                public:
+                    /*! \brief Create an empty buffer.
+                     *
+                     * @param stream Stream to order the operations on, which must outlive the buffer. If null, one is created.
+                     */
+                    explicit DevicePointCloud(cudaStream_t stream = nullptr);
+                    ~DevicePointCloud();
+
+                    DevicePointCloud(const DevicePointCloud&) = delete;
+                    DevicePointCloud& operator=(const DevicePointCloud&) = delete;
+
+                    /*! \brief Get the number of points on the device. */
+                    std::size_t size() const;
+                    /*! \brief Check if there are no points on the device. */
+                    bool empty() const;
+                    /*! \brief Get the number of points which fit on the current allocation. */
+                    std::size_t getCapacity() const;
+                    /*! \brief Get the raw device pointer to the coordinates. */
+                    float4 *getXYZ() const;
+                    /*! \brief Get the raw device pointer to the packed colors. */
+                    std::uint32_t *getRGBA() const;
+                    /*! \brief Get the raw device pointer to the labels. */
+                    std::uint32_t *getLabels() const;
+                    /*! \brief Get the stream the operations of this buffer are ordered on. */
+                    cudaStream_t getStream() const;
+                    /*! \brief Get the device of the buffer. */
+                    int getDevice() const;
+
+                    /*! \brief Make sure the buffer can hold at least the given number of points.
+                     *
+                     * Grows the capacity geometrically, keeping the points already on the device.
+                     *
+                     * @param n The number of points to hold.
+                     * @return 0 on success, negative on error.
+                     */
+                    int reserve(std::size_t n);
+
+                    /*! \brief Set the number of valid points. Growing leaves the new points uninitialized.
+                     *
+                     * @param n The new number of points.
+                     * @return 0 on success, negative on error.
+                     */
+                    int resize(std::size_t n);
+
+                    /*! \brief Drop all the points. The allocation is kept for reuse. */
+                    void clear();
+
+                    /*! \brief Append the points of a host PointCloud. Only the new points are copied.
+                     *
+                     * @param cloud The PointCloud which gives the points.
+                     * @return 0 on success, negative on error.
+                     */
+                    int append(const pcl::PointCloud<pcl::PointXYZRGBL>& cloud);
+
+                    /*! \brief Label, transform and append the points of a raw host PointCloud in a single pass.
+                     *
+                     * Each uploaded chunk is processed while being scattered to the arrays of the buffer.
+                     *
+                     * With a filter, the raw points are filtered on the device first and only the kept points are
+                     * appended.
+                     *
+                     * @param source The raw PointCloud, in the sensor frame.
+                     * @param label The 32-bit unsigned integer label to stamp on the new points.
+                     * @param tf The affine transform to apply to the new points.
+                     * @param filter Optionally the filter the raw points have to pass.
+                     * @return 0 on success, negative on error.
+                     */
+                    int ingest(const pcl::PointCloud<pcl::PointXYZRGBL>& source, std::uint32_t label,
+                               const Eigen::Affine3d& tf, const compute::PointFilter *filter = nullptr);
+
+                    /*! \brief Append the points of another device buffer, without crossing the host.
+                     *
+                     * A buffer on another device is copied peer-to-peer.
+                     *
+                     * @param other The buffer which gives the points.
+                     * @return 0 on success, negative on error.
+                     */
+                    int appendDevice(const DevicePointCloud& other);
+
+                    /*! \brief Replace the device points with the points of a host PointCloud.
+                     *
+                     * @param cloud The PointCloud to upload.
+                     * @return 0 on success, negative on error.
+                     */
+                    int upload(const pcl::PointCloud<pcl::PointXYZRGBL>& cloud);
+
+                    /*! \brief Copy the device points to a host PointCloud, replacing its points.
+                     *
+                     * @param cloud The PointCloud which will receive the points.
+                     * @return 0 on success, negative on error.
+                     */
+                    int download(pcl::PointCloud<pcl::PointXYZRGBL>& cloud) const;
+
+                    /*! \brief Copy ranges of points to other positions of the buffer, in order.
+                     *
+                     * @param moves The copies to perform.
+                     * @return 0 on success, negative on error.
+                     */
+                    int moveRanges(const std::vector<PointRangeMove>& moves);
+
+                    /*! \brief Set a label to a range of points.
+                     *
+                     * @param label The 32-bit unsigned integer label.
+                     * @param start Index of the first point of the range.
+                     * @param count Number of points of the range.
+                     * @return 0 on success, negative on error.
+                     */
+                    int setLabel(std::uint32_t label, std::size_t start, std::size_t count);
+
+                    /*! \brief Transform a range of points using an affine transformation.
+                     *
+                     * @param tf The affine transform to apply.
+                     * @param start Index of the first point of the range.
+                     * @param count Number of points of the range.
+                     * @return 0 on success, negative on error.
+                     */
+                    int transform(const Eigen::Affine3d& tf, std::size_t start, std::size_t count);
+            };
+
+            /*! \brief The kernel which scatters points to the arrays of a device PointCloud.
+             *
+             * @param points Array of points.
+             * @param num_points The number of elements of the "points" array.
+             * @param xyz Array which receives the coordinates.
+             * @param rgba Array which receives the colors.
+             * @param labels Array which receives the labels.
+             */
+            __global__ void unpackPointsKernel(const pcl::PointXYZRGBL *points, std::size_t num_points,
+                                               float4 *xyz, std::uint32_t *rgba, std::uint32_t *labels);
+
+            /*! \brief The kernel which gathers the arrays of a device PointCloud into points.
+             *
+             * @param xyz Array of coordinates.
+             * @param rgba Array of colors.
+             * @param labels Array of labels.
+             * @param num_points The number of points.
+             * @param points Array which receives the points.
+             */
+            __global__ void packPointsKernel(const float4 *xyz, const std::uint32_t *rgba, const std::uint32_t *labels,
+                                             std::size_t num_points, pcl::PointXYZRGBL *points);
+
+            /*! \brief The kernel which labels, transforms and scatters raw points to the arrays of a device PointCloud.
+             *
+             * @param points Array of raw points.
+             * @param num_points The number of elements of the "points" array.
+             * @param label The label to assign.
+             * @param transform The transform to apply.
+             * @param xyz Array which receives the coordinates.
+             * @param rgba Array which receives the colors.
+             * @param labels Array which receives the labels.
+             */
+            __global__ void ingestPointsSoAKernel(const pcl::PointXYZRGBL *points, std::size_t num_points,
+                                                  std::uint32_t label, PointTransform transform,
+                                                  float4 *xyz, std::uint32_t *rgba, std::uint32_t *labels);
+
+            /*! \brief The kernel which labels, transforms and scatters the kept raw points to the arrays of a device PointCloud.
+             *
+             * @param raw_xyz Array of raw coordinates.
+             * @param raw_rgba Array of raw colors.
+             * @param kept Array of the indices of the kept points, in order.
+             * @param num_points The number of kept points.
+             * @param label The label to assign.
+             * @param transform The transform to apply.
+             * @param xyz Array which receives the coordinates.
+             * @param rgba Array which receives the colors.
+             * @param labels Array which receives the labels.
+             */
+            __global__ void gatherIngestPointsSoAKernel(const float4 *raw_xyz, const std::uint32_t *raw_rgba,
+                                                        const std::uint32_t *kept, std::size_t num_points,
+                                                        std::uint32_t label, PointTransform transform,
+                                                        float4 *xyz, std::uint32_t *rgba, std::uint32_t *labels);
+
+            /*! \brief The kernel which sets a label on an array of labels.
+             *
+             * @param labels Array of labels.
+             * @param label The label to assign.
+             * @param num_points The number of elements of the "labels" array.
+             */
+            __global__ void fillLabelsKernel(std::uint32_t *labels, std::uint32_t label, std::size_t num_points);
+
+            /*! \brief The kernel which transforms an array of coordinates.
+             *
+             * @param xyz Array of coordinates.
+             * @param transform The transform to apply.
+             * @param num_points The number of elements of the "xyz" array.
+             */
+            __global__ void transformXYZKernel(float4 *xyz, PointTransform transform, std::size_t num_points);
+
+        }
+    } // pcl_aggregator
+} // cuda
+
+#endif //PCL_AGGREGATOR_CORE_DEVICEPOINTCLOUD_CUH
@@ -0,0 +1,85 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CHECKPOINT_H
+#define PCL_AGGREGATOR_CORE_CHECKPOINT_H
+
+#include <pcl_aggregator_core/entities/VoxelHashMap.h>
+#include <cstdint>
+#include <type_traits>
+
+// first bytes of every checkpoint: "PCCK"
+#define CHECKPOINT_MAGIC 0x4b434350u
+// version of the checkpoint layout, bumped on any change to the records below
+#define CHECKPOINT_FORMAT_VERSION 1
+// longest topic name a checkpoint keeps, counting the terminator
+#define CHECKPOINT_TOPIC_SIZE 256
+// alignment of each section on the file, so the records can be used right off the mapping
+#define CHECKPOINT_SECTION_ALIGNMENT 64
+
+namespace pcl_aggregator {
+    namespace entities {
+
+        /*! \brief Where an array of records lies on a checkpoint. */
+        struct CheckpointSection {
+            /*! \brief Offset of the first record from the start of the file, in bytes. */
+            std::uint64_t offset = 0;
+            /*! \brief Number of records. */
+            std::uint64_t count = 0;
+            /*! \brief Size of each record, to tell checkpoints of another build apart. */
+            std::uint64_t recordSize = 0;
+        };
+
+        /*! \brief First bytes of a checkpoint. */
+        struct CheckpointHeader {
+            std::uint32_t magic = CHECKPOINT_MAGIC;
+            std::uint32_t formatVersion = CHECKPOINT_FORMAT_VERSION;
+            std::uint64_t headerSize = 0;
+            /*! \brief UNIX timestamp of the checkpoint, in milliseconds. */
+            std::uint64_t createdAt = 0;
+            /*! \brief The merged PointCloud was kept on the voxel map. */
+            std::uint32_t voxelMap = 0;
+            std::uint32_t reserved = 0;
+            /*! \brief Voxel size of each level of detail, as floats. */
+            CheckpointSection levels;
+            /*! \brief The voxels of the merged PointCloud, as VoxelRecords. Empty unless on the voxel map. */
+            CheckpointSection voxels;
+            /*! \brief The points of the flat merged PointCloud, as PointXYZRGBLs. Empty on the voxel map. */
+            CheckpointSection points;
+            /*! \brief The scans waiting to age, as CheckpointScans. */
+            CheckpointSection scans;
+            /*! \brief The streams, as CheckpointStreams. */
+            CheckpointSection streams;
+        };
+
+        /*! \brief A scan waiting to age. */
+        struct CheckpointScan {
+            /*! \brief UNIX timestamp of the expiry, in milliseconds. */
+            std::uint64_t expiry;
+            /*! \brief The label of the scan. */
+            std::uint32_t label;
+            /*! \brief The stream of the scan, as an index on the streams section. */
+            std::uint32_t stream;
+        };
+
+        /*! \brief A stream and its sensor transform. */
+        struct CheckpointStream {
+            /*! \brief The topic name, null-terminated. */
+            char topic[CHECKPOINT_TOPIC_SIZE];
+            /*! \brief The transform from the sensor frame to the robot base frame, column-major. */
+            double transform[16];
+            /*! \brief The transform was set. */
+            std::uint32_t transformSet;
+            std::uint32_t reserved;
+        };
+
+        static_assert(std::is_trivially_copyable<CheckpointHeader>::value, "Checkpoint records are copied as bytes");
+        static_assert(std::is_trivially_copyable<CheckpointScan>::value, "Checkpoint records are copied as bytes");
+        static_assert(std::is_trivially_copyable<CheckpointStream>::value, "Checkpoint records are copied as bytes");
+        static_assert(std::is_trivially_copyable<VoxelRecord>::value, "Checkpoint records are copied as bytes");
+
+    } // pcl_aggregator
+} // entities
+
+#endif //PCL_AGGREGATOR_CORE_CHECKPOINT_H
@@ -0,0 +1,139 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_SPATIALINDEX_H
+#define PCL_AGGREGATOR_CORE_SPATIALINDEX_H
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <eigen3/Eigen/Dense>
+#include <pcl_aggregator_core/entities/VoxelHashMap.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// side of the cells of the spatial index, in meters
+#define SPATIAL_INDEX_DEFAULT_CELL_SIZE 1.0f
+
+namespace pcl_aggregator {
+    namespace entities {
+
+        /*! \brief A convex volume bounded by planes, like the view of a camera.
+         *
+         * A point is inside when n.dot(p) + d >= 0 on every plane (n, d).
+         */
+        struct Frustum {
+            /*! \brief The planes, with the normals pointing inwards. */
+            std::array<Eigen::Vector4f,6> planes;
+            /*! \brief The corners, bounding the volume. */
+            std::array<Eigen::Vector3f,8> corners;
+
+            /*! \brief Build the frustum of a pinhole camera.
+             *
+             * The camera looks along its z axis, with x to the right and y down, like optical frames.
+             *
+             * @param cameraPose Pose of the camera in the frame of the points.
+             * @param horizontalFov Horizontal field of view, in radians.
+             * @param verticalFov Vertical field of view, in radians.
+             * @param nearDistance Distance of the near plane, in meters.
+             * @param farDistance Distance of the far plane, in meters.
+             */
+            static Frustum fromPerspective(const Eigen::Affine3d& cameraPose, double horizontalFov, double verticalFov,
+                                           double nearDistance, double farDistance);
+
+            /*! \brief Check if a point is inside. */
+            bool contains(const Eigen::Vector3f& p) const;
+        };
+
+        /*! \brief Zero-copy result of a spatial query: the indices of the points inside, on a shared PointCloud. */
+        struct PointCloudView {
+            /*! \brief The queried PointCloud. Immutable, kept alive by the view. */
+            pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr cloud = nullptr;
+            /*! \brief Indices of the points inside the query, grouped by cell. */
+            std::vector<std::uint32_t> indices;
+
+            /*! \brief Get the number of points. */
+            std::size_t size() const;
+
+            /*! \brief Check if there are no points. */
+            bool empty() const;
+
+            /*! \brief Get the i-th point of the result. */
+            const pcl::PointXYZRGBL& operator[](std::size_t i) const;
+
+            /*! \brief Copy the points of the result into a compact PointCloud. */
+            pcl::PointCloud<pcl::PointXYZRGBL> toPointCloud() const;
+        };
+
+        /*! \brief Spatial Index
+         *         Immutable grid over a PointCloud, answering box, radius and frustum queries.
+         *
+         * The points are bucketed by cell in two counting passes. A query only visits the cells it overlaps (or the
+         * occupied cells, when they are fewer), and takes the cells entirely inside without testing their points,
+         * so it costs in proportion to the result instead of the PointCloud.
+         */
+        class SpatialIndex {
+
+            private:
+                /*! \brief The indexed PointCloud. */
+                pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr cloud;
+
+                /*! \brief The side of the cells. */
+                float cellSize;
+
+                /*! \brief Range of each occupied cell on the point order. */
+                std::unordered_map<VoxelKey,std::pair<std::uint32_t,std::uint32_t>,VoxelKeyHash> cells;
+
+                /*! \brief Indices of the points, grouped by cell. */
+                std::vector<std::uint32_t> order;
+
+                /*! \brief Get the cell of a position. */
+                VoxelKey getKey(const Eigen::Vector3f& p) const;
+
+                /*! \brief Get the bounds of a cell. */
+                Eigen::AlignedBox3f getCellBox(const VoxelKey& key) const;
+
+                /*! \brief Run a query over the cells of a key range.
+                 *
+                 * @param low The lowest cell of the range.
+                 * @param high The highest cell of the range.
+                 * @param classify Tells if the points of a cell box are all outside (-1), all inside (1) or maybe (0).
+                 * @param contains Tells if a point is inside.
+                 * @param view Receives the indices.
+                 */
+                template <typename Classify, typename Contains>
+                void query(const VoxelKey& low, const VoxelKey& high, const Classify& classify,
+                           const Contains& contains, PointCloudView& view) const;
+
+            public:
+                /*! \brief Index a PointCloud.
+                 *
+                 * @param cloud The PointCloud. Must not change while indexed.
+                 * @param cellSize The side of the cells.
+                 */
+                explicit SpatialIndex(pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr cloud,
+                                      float cellSize = SPATIAL_INDEX_DEFAULT_CELL_SIZE);
+
+                /*! \brief Get the indexed PointCloud. */
+                const pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr& getPointCloud() const;
+
+                /*! \brief Get the side of the cells. */
+                float getCellSize() const;
+
+                /*! \brief Get the points inside an axis-aligned box. */
+                PointCloudView queryBox(const Eigen::AlignedBox3f& box) const;
+
+                /*! \brief Get the points within a distance of a center. */
+                PointCloudView queryRadius(const Eigen::Vector3f& center, float radius) const;
+
+                /*! \brief Get the points inside a frustum. */
+                PointCloudView queryFrustum(const Frustum& frustum) const;
+        };
+
+    } // pcl_aggregator
+} // entities
+
+#endif //PCL_AGGREGATOR_CORE_SPATIALINDEX_H
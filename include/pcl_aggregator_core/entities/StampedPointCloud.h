@@ -7,17 +7,35 @@
 
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
-#include <pcl/filters/voxel_grid.h>
 #include <eigen3/Eigen/Dense>
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+#include <pcl_aggregator_core/cuda/DevicePointCloud.cuh>
+#endif
 #include <cstdint>
 #include <set>
 #include <mutex>
+#include <memory>
+#include <vector>
+#include <unordered_map>
 
 #define POINTCLOUD_ORIGIN_NONE "none"
+// above this number of label runs the index is dropped, and rebuilt on the next downsample or removal
+#define POINTCLOUD_MAX_LABEL_SEGMENTS 4096
 
 namespace pcl_aggregator {
     namespace entities {
 
+        /*! \brief A run of consecutive points sharing a label. */
+        struct LabelSegment {
+            /*! \brief The label of the points. */
+            std::uint32_t label;
+            /*! \brief Index of the first point. */
+            std::size_t begin;
+            /*! \brief Number of points. */
+            std::size_t count;
+        };
+
         /*! \brief Stamped Point Cloud
          *         A PointCloud with an associated timestamp. Also has other utilities.
          */
@@ -39,27 +57,119 @@ namespace pcl_aggregator {
                 // the name of the topic the pointcloud came from
                 std::string originTopic = POINTCLOUD_ORIGIN_NONE;
 
+                /*! \brief Hash of the origin topic name, so the labels don't hash the name again. */
+                std::size_t originTopicHash = 0;
+
                 /*! \brief Label used to identify each PointCloud, for example on removal */
                 std::uint32_t label;
 
                 /*! \brief Mutex to contain access to this PointCloud. */
                 std::mutex cloudMutex;
 
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                /*! \brief Device copy of the points. Only present when the PointCloud is device-resident. */
+                std::unique_ptr<cuda::pointclouds::DevicePointCloud> deviceCloud = nullptr;
+#endif
+
+                /*! \brief The host points are outdated relative to the device copy. */
+                bool hostStale = false;
+
+                /*! \brief The device copy is outdated relative to the host points. */
+                bool deviceStale = false;
+
+                /*! \brief The label runs of the points, in order. Lets removals skip the points which are kept. */
+                std::vector<LabelSegment> segments;
+
+                /*! \brief The label runs describe the current points. */
+                bool segmentsValid = true;
+
+                /*! \brief Number of points of each label on the label runs, kept along with them. */
+                std::unordered_map<std::uint32_t,std::size_t> labelCounts;
+
                 /*! \brief Generate a label to the PointCloud based on the origin topic name and timestamp. */
                 std::uint32_t generateLabel();
 
+                /*! \brief Bring the host points up to date with the device copy. Expects cloudMutex to be held. */
+                void syncHost();
+
+                /*! \brief Bring the device copy up to date with the host points. Expects cloudMutex to be held. */
+                void syncDevice();
+
+                /*! \brief Remove the points with the given labels. Expects cloudMutex to be held.
+                 *
+                 * With a valid label index only the removed ranges are touched: they are filled with the kept
+                 * points from the tail of the cloud, so the work depends on the removed points and not on the size.
+                 */
+                void compactLabels(const std::set<std::uint32_t>& labels);
+
+                /*! \brief Append host points to the authoritative copy. Expects cloudMutex to be held. */
+                int appendHostPoints(const pcl::PointCloud<pcl::PointXYZRGBL>& other);
+
+                /*! \brief Get the number of points of the authoritative copy. Expects cloudMutex to be held. */
+                std::size_t getCurrentSize() const;
+
+                /*! \brief Get the number of points covered by the label index. */
+                std::size_t getSegmentsEnd() const;
+
+                /*! \brief Empty the label index, along with the number of points of each label. */
+                void clearSegments();
+
+                /*! \brief Add a run of points to the end of the label index. */
+                void pushSegment(std::uint32_t label, std::size_t count);
+
+                /*! \brief Index the label runs of host points appended to the end of the cloud. */
+                void indexSegments(const pcl::PointCloud<pcl::PointXYZRGBL>& appended);
+
+                /*! \brief Group the host points by label in a single counting pass and index the groups. */
+                void regroupByLabel();
+
             public:
                 StampedPointCloud(std::string originTopic);
                 ~StampedPointCloud();
 
                 /*! \brief Get the PointCloud timestamp. */
                 unsigned long long getTimestamp() const;
-                /*! \brief Get a smart pointer to the PointCloud. */
+                /*! \brief Get a smart pointer to the PointCloud.
+                 *
+                 * When device-resident, the points are downloaded first and the host copy becomes the
+                 * authoritative one, as the caller may modify it. For the same reason the label index is dropped.
+                 */
                 typename pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& getPointCloud();
+                /*! \brief Get a copy of the points. Does not invalidate the device copy. */
+                pcl::PointCloud<pcl::PointXYZRGBL> getPointCloudCopy();
+                /*! \brief Get the number of points, without downloading them. */
+                std::size_t getSize();
+                /*! \brief Get the bytes taken by the points, on the host and on the device, counting the capacity
+                 * reserved for them and the label index.
+                 */
+                std::size_t getMemoryUsage();
+                /*! \brief Get the number of points of a label from the label index, without visiting the points.
+                 *
+                 * @param label The label.
+                 * @param count Receives the number of points. 0 if the label has none.
+                 * @return False if the label index was dropped, and the count is not known.
+                 */
+                bool getLabelSize(std::uint32_t label, std::size_t& count);
+                /*! \brief Get the bytes taken by the points themselves, without the capacity reserved beyond them. */
+                std::size_t getPointsMemoryUsage();
+                /*! \brief Give the capacity reserved beyond the host points back, when it is a real margin over them,
+                 * like after a large removal.
+                 *
+                 * @param maxSlack The capacity kept beyond the points, as a fraction of them.
+                 * @return True if the capacity was given back.
+                 */
+                bool shrinkToFit(float maxSlack);
                 /*! \brief Get the origin topic name. */
                 std::string getOriginTopic() const;
                 /*! \brief Get the label of the PointCloud. Should be unique. */
                 std::uint32_t getLabel() const;
+                /*! \brief Generate the label of a PointCloud from its origin topic and timestamp, without allocating.
+                 *
+                 * @param topicHash The std::hash of the origin topic name.
+                 * @param timestamp The timestamp of the PointCloud.
+                 * @return The 32-bit label.
+                 */
+                static std::uint32_t generateLabel(std::size_t topicHash, unsigned long long timestamp);
                 /*! \brief Set the PointCloud's timestamp. */
                 void setTimestamp(unsigned long long t);
                 /*! \brief Set the PointCloud by smart pointer. This method moves the pointer, does not copy it or increment use count.
@@ -72,6 +182,49 @@ namespace pcl_aggregator {
                  */
                 void setOriginTopic(const std::string& origin);
 
+                /*! \brief Keep the points on the GPU between operations or bring them back to the host.
+                 *
+                 * When device-resident, appends, transforms and labelling only move the points involved,
+                 * and the points only go back to the host when they are read. Without a CUDA device the points stay on
+                 * the host.
+                 *
+                 * @param resident Keep the points on the device or not.
+                 */
+                void setDeviceResident(bool resident);
+                /*! \brief Check if the points are kept on the GPU. */
+                bool isDeviceResident();
+
+                /*! \brief Append the points of another PointCloud to this one.
+                 *
+                 * @param other The PointCloud which gives the points.
+                 * @return 0 on success, negative on error.
+                 */
+                int appendPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& other);
+
+                /*! \brief Append the points of another StampedPointCloud to this one.
+                 *
+                 * When both are device-resident the points don't cross the host, and are copied peer-to-peer if the
+                 * two live on different GPUs.
+                 *
+                 * @param other The StampedPointCloud which gives the points.
+                 * @return 0 on success, negative on error.
+                 */
+                int appendPointCloud(StampedPointCloud& other);
+
+                /*! \brief Drop all the points, on the host and on the device. */
+                void clear();
+
+                /*! \brief Label, transform and append the points of a raw PointCloud to this one in a single pass.
+                 *
+                 * @param source The raw PointCloud, in the sensor frame.
+                 * @param label The label to stamp on the new points.
+                 * @param tf The transform from the sensor frame to the robot base frame.
+                 * @param filter Optionally the filter the raw points have to pass. Only the points kept are appended.
+                 * @return 0 on success, negative on error.
+                 */
+                int ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& source, std::uint32_t label,
+                                     const Eigen::Affine3d& tf, const compute::PointFilter *filter = nullptr);
+
                 /*! \brief Check if the transform to the robot base frame was computed. */
                 bool isTransformComputed() const;
                 /*! \brief Apply the robot frame transform. */
@@ -101,9 +254,21 @@ namespace pcl_aggregator {
                  */
                 void removePointsWithLabels(const std::set<std::uint32_t>& labels);
 
-                /*! \brief Apply voxel grid filter to the PointCloud.
+                /*! \brief Remove the points farthest from a point, keeping the order of the others.
+                 *
+                 * The points are brought to the host, selected in a single pass and compacted in another.
+                 *
+                 * @param center The point to keep the points around, like the robot position.
+                 * @param n The number of points to remove.
+                 * @return The number of points removed.
+                 */
+                std::size_t removeFarthestPoints(const Eigen::Vector3f& center, std::size_t n);
+
+                /*! \brief Apply voxel grid filter to the PointCloud. Runs where the points live.
+                 *
+                 * Each voxel keeps the label with most points, so the centroids still age with their scan.
                  *
-                 * @param leafSize
+                 * @param leafSize The voxel size.
                  */
                 void downsample(float leafSize);
 
@@ -0,0 +1,240 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_VOXELHASHMAP_H
+#define PCL_AGGREGATOR_CORE_VOXELHASHMAP_H
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <eigen3/Eigen/Dense>
+#include <cstdint>
+#include <cstddef>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace pcl_aggregator {
+    namespace entities {
+
+        /*! \brief Integer coordinates of a voxel. */
+        struct VoxelKey {
+            std::int32_t x;
+            std::int32_t y;
+            std::int32_t z;
+
+            bool operator==(const VoxelKey& other) const {
+                return x == other.x && y == other.y && z == other.z;
+            }
+        };
+
+        /*! \brief Spatial hash of voxel coordinates. */
+        struct VoxelKeyHash {
+
+            std::size_t operator()(const VoxelKey& key) const {
+                // large primes spread neighbouring voxels over the buckets
+                return ((std::size_t) key.x * 73856093) ^ ((std::size_t) key.y * 19349663) ^
+                       ((std::size_t) key.z * 83492791);
+            }
+        };
+
+        /*! \brief Running sums of the points observed on a voxel. */
+        struct Voxel {
+            float sumX = 0;
+            float sumY = 0;
+            float sumZ = 0;
+            float sumR = 0;
+            float sumG = 0;
+            float sumB = 0;
+            /*! \brief Number of points accumulated. */
+            std::uint32_t count = 0;
+            /*! \brief Label of the scan which owns the voxel. The voxel ages with it. */
+            std::uint32_t label = 0;
+            /*! \brief Insertion which last touched the voxel. */
+            std::uint64_t generation = 0;
+        };
+
+        /*! \brief A voxel with its coordinates, laid out flat for storing. */
+        struct VoxelRecord {
+            VoxelKey key;
+            Voxel voxel;
+        };
+
+        /*! \brief A coarser resolution of a voxel map, aggregating blocks of its voxels. */
+        struct VoxelLevel {
+            /*! \brief Side of the voxels, in voxels of the map. */
+            std::uint32_t factor = 1;
+            /*! \brief The aggregated voxels. Each keeps the label of the last voxel merged into it. */
+            std::unordered_map<VoxelKey,Voxel,VoxelKeyHash> voxels;
+            /*! \brief Cached flat version of the level. */
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr flattened = nullptr;
+            /*! \brief The level changed since it was last flattened. */
+            bool flattenedStale = true;
+        };
+
+        /*! \brief Voxel Hash Map
+         *         Persistent voxelized PointCloud, keyed by voxel coordinates.
+         *
+         * Inserting a PointCloud only updates the voxels it touches and removing labels only drops the voxels
+         * those labels own, so updates cost O(frame) instead of O(map).
+         * Each voxel is owned by the latest scan which observed it. The flat PointCloud is built lazily when read.
+         *
+         * Coarser levels of detail can be kept along: each coarse voxel holds the sums of the block of voxels under
+         * it, updated by the difference whenever one of them changes, so they cost O(changed voxels) too.
+         */
+        class VoxelHashMap {
+
+            private:
+                /*! \brief The voxel size. Changed under mapMutex, read with the keys of the voxels of the map. */
+                std::atomic<float> leafSize;
+
+                /*! \brief The voxels, by coordinates. */
+                std::unordered_map<VoxelKey,Voxel,VoxelKeyHash> voxels;
+
+                /*! \brief Voxels owned by each label. */
+                std::unordered_map<std::uint32_t,std::unordered_set<VoxelKey,VoxelKeyHash>> labelVoxels;
+
+                /*! \brief Counter of insertions, used to tell voxels touched by the current insertion. */
+                std::uint64_t generation = 0;
+
+                /*! \brief Cached flat version of the map. */
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr flattened = nullptr;
+
+                /*! \brief The map changed since it was last flattened. */
+                bool flattenedStale = true;
+
+                /*! \brief The coarser levels, from the finest. */
+                std::vector<VoxelLevel> levels;
+
+                /*! \brief Mutex to contain access to the map. */
+                std::mutex mapMutex;
+
+                /*! \brief Move the ownership of a voxel to another label. Expects mapMutex to be held. */
+                void setOwner(const VoxelKey& key, Voxel& voxel, std::uint32_t label);
+
+                /*! \brief Build the flat PointCloud if the map changed. Expects mapMutex to be held. */
+                void flatten();
+
+                /*! \brief Add the sums of a voxel to its blocks on the coarser levels. Expects mapMutex to be held. */
+                void addToLevels(const VoxelKey& key, const Voxel& voxel);
+
+                /*! \brief Take the sums of a voxel out of its blocks on the coarser levels. Expects mapMutex to be held. */
+                void removeFromLevels(const VoxelKey& key, const Voxel& voxel);
+
+                /*! \brief Get the flat version of a level, building it if the level changed. Expects mapMutex to be held. */
+                const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& flattenLevel(std::size_t level);
+
+            public:
+                explicit VoxelHashMap(float leafSize);
+
+                /*! \brief Get the voxel size. */
+                float getLeafSize() const;
+
+                /*! \brief Change the voxel size, voxelizing the current centroids again.
+                 *
+                 * Refining the voxels can't bring back the points already merged, so it suits an empty map best.
+                 *
+                 * @param leafSize The new voxel size.
+                 */
+                void setLeafSize(float leafSize);
+
+                /*! \brief Keep coarser levels of detail along with the map.
+                 *
+                 * The levels are built from the current voxels, then kept up to date on each change.
+                 *
+                 * @param factors Side of the voxels of each level, in voxels of the map. Levels of factor 1 or less
+                 *                are skipped.
+                 */
+                void setLevels(const std::vector<std::uint32_t>& factors);
+
+                /*! \brief Get the number of levels of detail, counting the map itself as level 0. */
+                std::size_t getLevelCount();
+
+                /*! \brief Get the voxel size of a level of detail. The coarsest when out of range. */
+                float getLevelLeafSize(std::size_t level);
+
+                /*! \brief Get the coordinates of the voxel a point falls on. */
+                VoxelKey getKey(const pcl::PointXYZRGBL& point) const;
+
+                /*! \brief Get the number of voxels. */
+                std::size_t size();
+
+                /*! \brief Check if the map has no voxels. */
+                bool empty();
+
+                /*! \brief Get the approximate memory used by the map, in bytes: the voxels, the buckets, the label
+                 * index and the cached flat versions.
+                 */
+                std::size_t getMemoryUsage();
+
+                /*! \brief Get the number of voxels owned by a label, from the label index. */
+                std::size_t getLabelSize(std::uint32_t label);
+
+                /*! \brief Insert the points of a PointCloud. Only the voxels the points fall on are updated.
+                 *
+                 * A voxel observed by a new scan is reset and owned by it. Each point goes to the scan of its own label,
+                 * so inserting several scans at once is inserting them one after the other.
+                 *
+                 * @param cloud The PointCloud to insert.
+                 */
+                void insertPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& cloud);
+
+                /*! \brief Remove the voxels owned by the given labels.
+                 *
+                 * @param labels The labels to remove.
+                 * @return The number of voxels removed.
+                 */
+                std::size_t removeLabels(const std::set<std::uint32_t>& labels);
+
+                /*! \brief Remove the voxels farthest from a point, regardless of their labels.
+                 *
+                 * Selects the voxels in a single pass over the map, without sorting it.
+                 *
+                 * @param center The point to keep the voxels around, like the robot position.
+                 * @param n The number of voxels to remove.
+                 * @return The number of voxels removed.
+                 */
+                std::size_t evictFarthest(const Eigen::Vector3f& center, std::size_t n);
+
+                /*! \brief Remove all the voxels. */
+                void clear();
+
+                /*! \brief Copy the voxels out, like for a checkpoint. */
+                std::vector<VoxelRecord> getVoxels();
+
+                /*! \brief Replace the voxels with stored ones, like from a checkpoint. The coarser levels are rebuilt.
+                 *
+                 * @param records The voxels. Read in place, so they may live on a mapped file.
+                 * @param count The number of voxels.
+                 */
+                void loadVoxels(const VoxelRecord* records, std::size_t count);
+
+                /*! \brief Get the flat version of the map. The returned PointCloud is not changed by later updates. */
+                pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr getPointCloud();
+
+                /*! \brief Get a copy of the flat version of the map. */
+                pcl::PointCloud<pcl::PointXYZRGBL> getPointCloudCopy();
+
+                /*! \brief Get the flat version of a level of detail. The coarsest when out of range. */
+                pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr getPointCloud(std::size_t level);
+
+                /*! \brief Get a copy of the flat version of a level of detail. The coarsest when out of range. */
+                pcl::PointCloud<pcl::PointXYZRGBL> getPointCloudCopy(std::size_t level);
+
+                /*! \brief Get the centroids of the voxels inside a box, like the submap around a new scan.
+                 *
+                 * Visits the voxels of the box when it is smaller than the map, the map otherwise.
+                 *
+                 * @param box The box, in the frame of the map.
+                 * @return The centroids inside the box.
+                 */
+                pcl::PointCloud<pcl::PointXYZRGBL> getPointsInBox(const Eigen::AlignedBox3f& box);
+        };
+
+    } // pcl_aggregator
+} // entities
+
+#endif //PCL_AGGREGATOR_CORE_VOXELHASHMAP_H
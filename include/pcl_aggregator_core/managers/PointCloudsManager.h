@@ -7,23 +7,117 @@
 
 #include <memory>
 #include <unordered_map>
+#include <map>
+#include <deque>
+#include <set>
+#include <vector>
+#include <string>
 #include <cstddef>
+#include <cstdint>
 #include <mutex>
 #include <thread>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
-#include <pcl_aggregator_core/cuda/CUDAPointClouds.cuh>
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+#include <pcl_aggregator_core/cuda/CUDAStreams.cuh>
+#include <pcl_aggregator_core/cuda/DeviceMemoryPool.cuh>
+#endif
 #include <pcl_aggregator_core/managers/StreamManager.h>
 #include <pcl_aggregator_core/entities/StampedPointCloud.h>
+#include <pcl_aggregator_core/entities/VoxelHashMap.h>
+#include <pcl_aggregator_core/entities/SpatialIndex.h>
+#include <pcl_aggregator_core/entities/Checkpoint.h>
+#include <pcl_aggregator_core/utils/ThreadPool.h>
+#include <pcl_aggregator_core/utils/TimingWheel.h>
+#include <pcl_aggregator_core/utils/Metrics.h>
+#include <pcl_aggregator_core/utils/CloudSerializer.h>
 
 #define GLOBAL_ICP_MAX_CORRESPONDENCE_DISTANCE 1
 #define GLOBAL_ICP_MAX_ITERATIONS 5
 
 #define VOXEL_LEAF_SIZE 0.2f
 
+// capacity the flat merged PointCloud keeps beyond its points when over the memory budget, as a fraction of them
+#define MEMORY_MAX_CAPACITY_SLACK 0.25f
+
+// stream updates coalesced before the merged PointCloud is downsampled and published. 1 is no batching
+#define MERGE_DEFAULT_MAX_UPDATES 1
+// longest a coalesced stream update waits for the downsample, in milliseconds
+#define MERGE_DEFAULT_WINDOW_MS 100
+
 namespace pcl_aggregator {
     namespace managers {
 
+        /*! \brief Metrics of a PointCloudsManager and of each of its streams. */
+        struct PointCloudsManagerMetrics {
+            /*! \brief Merged PointCloud work: merging, global downsampling, removal and eviction. */
+            utils::MetricsSnapshot global;
+            /*! \brief Per-stream work, keyed by topic name. */
+            std::map<std::string, utils::MetricsSnapshot> streams;
+            /*! \brief Frames dropped by full ingest queues, per topic. */
+            std::map<std::string, std::size_t> droppedFrames;
+        };
+
+        /*! \brief Which points go first when the memory budget is crossed. */
+        enum class EvictionPolicy {
+            /*! \brief The oldest scans, ahead of their age. */
+            OLDEST_SCANS,
+            /*! \brief The points farthest from the robot. Needs the robot pose. */
+            FARTHEST_FROM_ROBOT
+        };
+
+        /*! \brief Bytes taken by the points of a PointCloudsManager, on the host and on the device. */
+        struct PointCloudsManagerMemory {
+            /*! \brief The merged PointCloud. */
+            std::size_t merged = 0;
+            /*! \brief The PointCloud of each stream, keyed by topic name. */
+            std::map<std::string, std::size_t> streams;
+            /*! \brief Buffers cached for reuse by the process: pinned staging and device memory. */
+            std::size_t pools = 0;
+            /*! \brief All of the above. */
+            std::size_t total = 0;
+            /*! \brief The configured budget. 0 is no limit. */
+            std::size_t budget = 0;
+        };
+
+        /*! \brief A stream registered on a PointCloudsManager, to feed it without looking the topic up.
+         *
+         * Cheap to copy. Valid for the lifetime of the PointCloudsManager which returned it.
+         */
+        class StreamHandle {
+            private:
+                /*! \brief The StreamManager of the stream. Owned by the PointCloudsManager. */
+                StreamManager* stream = nullptr;
+
+                explicit StreamHandle(StreamManager* stream) : stream(stream) {}
+
+            public:
+                StreamHandle() = default;
+
+                /*! \brief Check if the handle points to a stream. Default-constructed handles don't. */
+                bool isValid() const {
+                    return this->stream != nullptr;
+                }
+
+            friend class PointCloudsManager;
+        };
+
+        /*! \brief Changes of the merged PointCloud up to a snapshot, kept for the delta exports. */
+        struct MergeJournalEntry {
+            /*! \brief The first snapshot with the changes. */
+            std::uint64_t version = 0;
+            /*! \brief Points appended, as they were merged, before the global downsample. */
+            pcl::PointCloud<pcl::PointXYZRGBL> addedPoints;
+            /*! \brief Labels removed. */
+            std::set<std::uint32_t> removedLabels;
+            /*! \brief A change deltas can't carry happened, like a clear or an eviction by distance. */
+            bool resync = false;
+        };
+
         /*!
          * \brief Manage PointClouds coming from several sensors, like several LiDARs and depth cameras.
          *
@@ -36,30 +130,184 @@ namespace pcl_aggregator {
                 size_t nSources;
                 /*! \brief The configured maximum point age. */
                 double maxAge;
-                /*! \brief Configured max memory to be consumed by a PointCloud in MB. */
+                /*! \brief Configured max memory to be consumed by the PointClouds in MB. 0 is no limit. */
                 size_t maxMemory;
+                /*! \brief Pool shared by the StreamManagers to run their removal and callback jobs, and by the expirations. */
+                std::shared_ptr<utils::ThreadPool> threadPool;
+                /*! \brief The expiry jobs this manager submitted to the pool. Waited for on destruction. */
+                std::unique_ptr<utils::TaskGroup> jobs;
+                /*! \brief Wheel all the streams register their PointClouds on to expire. */
+                std::shared_ptr<utils::TimingWheel> agingWheel;
                 /*! \brief Hash map of managers, one for each sensor (topic). */
                 std::unordered_map<std::string,std::unique_ptr<StreamManager>> streamManagers;
                 /*! \brief Smart pointer to the merged PointCloud. */
                 entities::StampedPointCloud mergedCloud;
+                /*! \brief Voxelized merged PointCloud, used instead of mergedCloud when the voxel map is enabled. */
+                entities::VoxelHashMap mergedVoxels;
+                /*! \brief Keep the merged PointCloud on a voxel hash map instead of a flat PointCloud. */
+                std::atomic<bool> voxelMapEnabled = false;
+
+                /*! \brief Voxel size of each level of detail, from the finest. Guarded by cloudMutex. */
+                std::vector<float> resolutionLevels = {VOXEL_LEAF_SIZE};
+                /*! \brief Voxel size of the merged PointCloud: the finest level. */
+                std::atomic<float> mergeLeafSize = VOXEL_LEAF_SIZE;
+                /*! \brief Coarser levels of the flat merged PointCloud, derived from the snapshot in levelsSource. */
+                std::vector<pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr> levelClouds;
+                /*! \brief The snapshot the coarser levels were derived from. */
+                pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr levelsSource = nullptr;
+                /*! \brief Mutex to manage access to the coarser levels of the flat merged PointCloud. */
+                std::mutex levelsMutex;
+
+                /*! \brief Keep the merged and per-stream PointClouds on the GPU. */
+                bool deviceResident = false;
+
+                /*! \brief Queue the fed PointClouds and merge them on the thread pool. */
+                bool asyncIngest = false;
+                /*! \brief Capacity of the ingest queue of each stream. */
+                std::size_t ingestQueueCapacity = STREAM_INGEST_QUEUE_CAPACITY;
+                /*! \brief What the streams do with new frames when their ingest queue is full. */
+                IngestOverflowPolicy overflowPolicy = IngestOverflowPolicy::DROP_OLDEST;
 
                 /*! \brief Mutex which manages concurrent access to the managers hash map. */
                 std::mutex managersMutex;
 
+                /*! \brief Read-only copy of the streams by topic name, replaced whenever one is added.
+                 * The lookups by name read it with a single lock-free atomic load, without taking managersMutex.
+                 */
+                std::atomic<const std::unordered_map<std::string,StreamManager*>*> streamRegistry;
+                /*! \brief Owns every copy of the registry published. A lookup may still be reading a replaced copy,
+                 * so they are only freed with the manager: streams are few and never removed. Guarded by managersMutex.
+                 */
+                std::vector<std::unique_ptr<const std::unordered_map<std::string,StreamManager*>>> registryCopies;
+
                 /*! \brief Mutex which manager concurrent access to the merged PointCloud pointer. */
                 std::mutex cloudMutex;
 
-                /*! \brief Thread which monitors the PointCloud's memory usage. */
-                std::thread memoryMonitoringThread;
-                /*!\brief Flag to determine if the thread should be stopped or not. */
-                bool keepThreadAlive = true;
+                /*! \brief Immutable copy of the merged PointCloud, rebuilt by the first read after each change. */
+                std::atomic<pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr> snapshot;
+                /*! \brief The merged PointCloud changed since the snapshot was built. Set under cloudMutex and
+                 * journalMutex.
+                 */
+                std::atomic<bool> snapshotStale = false;
+                /*! \brief Number of snapshots published. Snapshots are swapped under cloudMutex, so an older one
+                 * never replaces a newer one.
+                 */
+                std::atomic<std::uint64_t> snapshotVersion = 0;
+
+                /*! \brief Changes of each snapshot still covered by the delta exports, the oldest first. */
+                std::deque<MergeJournalEntry> journal;
+                /*! \brief Changes since the latest snapshot. */
+                MergeJournalEntry pendingJournal;
+                /*! \brief Snapshots the journal covers. 0 is no journal. */
+                std::size_t journalMaxVersions = 0;
+                /*! \brief The oldest version deltas can be exported from. */
+                std::uint64_t journalStart = 0;
+                /*! \brief Mutex to manage access to the journal. Held across each journaled change and each
+                 * snapshot, so every change lands on the entry of the first snapshot which has it.
+                 */
+                std::mutex journalMutex;
+
+                /*! \brief Spatial index of the latest snapshot queried. Built on the first query of each snapshot. */
+                std::shared_ptr<const entities::SpatialIndex> spatialIndex = nullptr;
+                /*! \brief Side of the cells of the spatial index. */
+                float spatialIndexCellSize = SPATIAL_INDEX_DEFAULT_CELL_SIZE;
+                /*! \brief Mutex to manage access to the spatial index and its settings. */
+                std::mutex spatialIndexMutex;
+
+                /*! \brief Metrics of the merged PointCloud work. */
+                utils::MetricsRegistry metrics;
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                /*! \brief CUDA streams and pinned staging of the merged PointCloud work. */
+                cuda::StreamContext streamContext;
+                /*! \brief Configured device of each stream, by topic name. */
+                std::unordered_map<std::string,int> deviceAffinity;
+                /*! \brief Device given to the next stream without configured affinity. */
+                int nextDevice = 0;
+#endif
+
+                /*! \brief Align each stream update to the merged PointCloud before appending it. */
+                bool globalRegistrationEnabled = false;
+                /*! \brief Settings of the global registration. Guarded by cloudMutex, like the flag. */
+                compute::RegistrationParams globalRegistrationParams;
+                /*! \brief The streams align their frames before handing them over. */
+                bool streamRegistrationEnabled = false;
+                /*! \brief Settings of the stream registration, for the streams added later. */
+                compute::RegistrationParams streamRegistrationParams;
+                /*! \brief The streams deskew their frames with their poses. */
+                bool deskewEnabled = false;
+                /*! \brief Settings of the deskew, for the streams added later. */
+                compute::DeskewParams deskewParams;
+
+                /*! \brief Which points go first when the memory budget is crossed. */
+                std::atomic<EvictionPolicy> evictionPolicy = EvictionPolicy::OLDEST_SCANS;
+                /*! \brief Position of the robot, to evict the points far from it. */
+                Eigen::Vector3f robotPosition = Eigen::Vector3f::Zero();
+                /*! \brief The robot pose was set. */
+                bool robotPoseSet = false;
+                /*! \brief Mutex to manage access to the robot pose. */
+                std::mutex robotPoseMutex;
+                /*! \brief Serializes the budget checks. Also taken to add and destroy streams, so they can be walked
+                 * without managersMutex, which may be held by a stream calling back into this instance.
+                 */
+                std::mutex governorMutex;
+                /*! \brief The manager is being destroyed, so no more scans are evicted. Guarded by governorMutex. */
+                bool stoppingStreams = false;
+
+                /*! \brief Stream updates coalesced per downsample and publish. */
+                std::size_t mergeMaxUpdates = MERGE_DEFAULT_MAX_UPDATES;
+                /*! \brief Longest a stream update waits for its downsample. */
+                std::chrono::milliseconds mergeWindow{MERGE_DEFAULT_WINDOW_MS};
+                /*! \brief Stream updates concatenated into the merged PointCloud but not yet downsampled. */
+                std::size_t pendingUpdates = 0;
+                /*! \brief When the oldest pending update was concatenated. */
+                std::chrono::steady_clock::time_point pendingSince;
+                /*! \brief Thread which downsamples and publishes the pending updates when their window ends. */
+                std::thread mergeFlushThread;
+                /*! \brief Flag to determine if the merge flush thread should be stopped or not. */
+                bool keepMergeFlushAlive = true;
+                /*! \brief Mutex to manage access to the pending updates, the batching settings and the flush flag. */
+                std::mutex mergeMutex;
+                /*! \brief Wakes the merge flush thread up on a new batch, a setting change or when it should stop. */
+                std::condition_variable mergeCondition;
 
                 /*! \brief Append the points of one PointCloud to the merged version of this manager.
+                 * The input is left untouched.
                  *
-                 * @param input The shared pointer to the input PointCloud.
+                 * @param input The input PointCloud, host or device-resident.
                  * @return Flag denoting if ICP was possible or not.
                  */
-                bool appendToMerged(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& input);
+                bool appendToMerged(entities::StampedPointCloud& input);
+
+                /*! \brief Align a stream update to the submap of the voxel map around it. Expects cloudMutex to be held.
+                 *
+                 * @param input The stream update. Transformed in-place when aligned.
+                 * @return Flag denoting if the registration converged.
+                 */
+                bool registerToMerged(entities::StampedPointCloud& input);
+
+                /*! \brief Publish the merged PointCloud as a new snapshot version. */
+                void publishSnapshot();
+
+                /*! \brief Publish the merged PointCloud as a new snapshot version, built on its first read.
+                 * Expects cloudMutex and then journalMutex to be held.
+                 */
+                void closeSnapshot();
+
+                /*! \brief Build the snapshot of the merged PointCloud if it changed since the last one.
+                 * Expects cloudMutex and then journalMutex to be held.
+                 */
+                void buildSnapshot();
+
+                /*! \brief Get the snapshot, building it first if the merged PointCloud changed.
+                 *
+                 * @param version Receives the version of the snapshot. Optional.
+                 * @return The snapshot. Never null.
+                 */
+                pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr loadSnapshot(std::uint64_t* version = nullptr);
+
+                /*! \brief Close the journal entry of a new snapshot. Expects journalMutex to be held. */
+                void closeJournal(std::uint64_t version);
 
                 /*! \brief Clear the points of the merged PointCloud. */
                 void clearMergedCloud();
@@ -68,22 +316,64 @@ namespace pcl_aggregator {
                  *
                  * @param topicName The name of the topic this StreamManager will manage.
                  * @param maxAge The point's maximum age for this sensor.
+                 * @return The StreamManager of the topic, new or existing.
+                 */
+                StreamManager* initStreamManager(const std::string& topicName, double maxAge);
+
+                /*! \brief Get the stream manager of a topic, creating it on the first use.
+                 * Existing streams are found on the registry, without taking managersMutex.
+                 *
+                 * @param topicName The name of the topic.
+                 * @return The StreamManager of the topic.
                  */
-                void initStreamManager(const std::string& topicName, double maxAge);
+                StreamManager* findStreamManager(const std::string& topicName);
 
                 /*! \brief Remove points with a given label from the merged PointCloud.
-                 * Used typically when points age, as a callback from the StreamManagers.
+                 * Used typically when points age. Does not publish. Takes cloudMutex and then journalMutex.
                  *
                  * @param label The label to remove.
                  */
                 void removePointsByLabel(const std::set<std::uint32_t>& labels);
 
-                /*! \brief Add the processed PointCloud of a given stream to the merged.
-                 * Used typically when the Stream finishes processing a new PointCloud.
+                /*! \brief Expire the PointClouds due on the aging wheel, from all the streams at once.
+                 * Each stream drops its own, then the merged PointCloud drops all of them in a single pass. Only
+                 * hands the batch over to the thread pool, so the wheel thread is not held up by the removal.
+                 *
+                 * @param expired The expired PointClouds, owned by their StreamManager.
+                 */
+                void expirePointClouds(std::vector<utils::WheelTimer>& expired);
+
+                /*! \brief Drop scans from their streams and from the merged PointCloud. Does not publish.
+                 * Expects governorMutex to be held, so the streams owning the scans are not destroyed meanwhile.
+                 *
+                 * @param scans The scans, owned by their StreamManager.
+                 */
+                void removeScans(std::vector<utils::WheelTimer>& scans);
+
+                /*! \brief Evict in bulk if the memory budget is crossed. Called after each insertion. */
+                void enforceMemoryBudget();
+
+                /*! \brief Get the bytes taken by the points and the buffers kept for them. Expects governorMutex to be held. */
+                PointCloudsManagerMemory computeMemoryUsage();
+
+                /*! \brief Apply the changes of a stream to the merged PointCloud.
+                 * Used as the delta callback of the StreamManagers: drops the aged labels and appends the new points,
+                 * then accounts the update to the merge batch.
                  *
-                 * @param cloud The PointCloud to add.
+                 * @param delta The changes of the stream.
+                 */
+                void applyStreamDelta(const StreamDelta& delta);
+
+                /*! \brief Account a stream update concatenated into the merged PointCloud, flushing the batch when full. */
+                void commitMergeUpdate();
+
+                /*! \brief Downsample and publish the merged PointCloud once for all the pending stream updates. */
+                void flushMergedUpdates();
+
+                /*! \brief Pick the CUDA device of a new stream: its configured affinity, or else round-robin.
+                 * Expects managersMutex to be held.
                  */
-                void addStreamPointCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud);
+                int pickStreamDevice(const std::string& topicName);
 
             public:
                 PointCloudsManager(size_t nSources, double maxAge, size_t maxMemory);
@@ -99,6 +389,30 @@ namespace pcl_aggregator {
                  */
                 void addCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud, const std::string& topicName);
 
+                /*! \brief Register a stream ahead of its first PointCloud, to feed it through the handle.
+                 *
+                 * Registering an existing topic returns the handle of its stream.
+                 *
+                 * @param topicName The name of the topic of the stream.
+                 * @return The handle of the stream.
+                 */
+                StreamHandle registerStream(const std::string& topicName);
+
+                /*! \brief Add a new PointCloud to a registered stream. Neither hashes the topic name nor locks.
+                 *
+                 * @param stream The handle of the stream.
+                 * @param cloud Smart pointer to the new pointcloud.
+                 */
+                void addCloud(const StreamHandle& stream, pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud);
+
+                /*! \brief Get an empty PointCloud to fill with a new frame of a registered stream, recycled from its
+                 *         previous frames. Fed back with addCloud, its buffer returns to the stream once merged.
+                 *
+                 * @param stream The handle of the stream.
+                 * @return The PointCloud smart pointer. A new one if the handle is not registered.
+                 */
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr acquireFrame(const StreamHandle& stream);
+
                 /*! \brief Set the transform of a given sensor, identified by the topic name, to the robot base frame.
                  *
                  * @param transform The affine transform between the sensor frame and the robot base frame.
@@ -106,15 +420,323 @@ namespace pcl_aggregator {
                  */
                 void setTransform(const Eigen::Affine3d& transform, const std::string& topicName);
 
+                /*! \brief Set the transform of a registered stream to the robot base frame.
+                 *
+                 * @param stream The handle of the stream.
+                 * @param transform The affine transform between the sensor frame and the robot base frame.
+                 */
+                void setTransform(const StreamHandle& stream, const Eigen::Affine3d& transform);
+
+                /*! \brief Add a pose of the robot base to a given sensor, identified by the topic name, to deskew its frames.
+                 *
+                 * @param pose The pose of the robot base, on a fixed frame like the odometry.
+                 * @param timestamp UNIX timestamp of the pose, in microseconds.
+                 * @param topicName The name of the topic of the sensor.
+                 */
+                void addPose(const Eigen::Affine3d& pose, std::uint64_t timestamp, const std::string& topicName);
+
+                /*! \brief Add a pose of the robot base to a registered stream, to deskew its frames.
+                 *
+                 * @param stream The handle of the stream.
+                 * @param pose The pose of the robot base, on a fixed frame like the odometry.
+                 * @param timestamp UNIX timestamp of the pose, in microseconds.
+                 */
+                void addPose(const StreamHandle& stream, const Eigen::Affine3d& pose, std::uint64_t timestamp);
+
+                /*! \brief Filter the raw frames of a given sensor, identified by the topic name, before merging them.
+                 *
+                 * @param params The settings of the filter, with the boxes on the robot base frame.
+                 * @param topicName The name of the topic of the sensor.
+                 * @return 0 on success, negative if the settings are not valid.
+                 */
+                int setPointFilter(const compute::PointFilterParams& params, const std::string& topicName);
+
+                /*! \brief Filter the raw frames of a registered stream before merging them.
+                 *
+                 * @param stream The handle of the stream.
+                 * @param params The settings of the filter, with the boxes on the robot base frame.
+                 * @return 0 on success, negative if the handle is not registered or the settings are not valid.
+                 */
+                int setPointFilter(const StreamHandle& stream, const compute::PointFilterParams& params);
+
+                /*! \brief Keep the merged and per-stream PointClouds on the GPU between frames.
+                 *
+                 * Appends then only upload the new points, and the points only come back to the host
+                 * when the merged PointCloud is read.
+                 *
+                 * @param resident Keep the points on the device or not.
+                 */
+                void setDeviceResident(bool resident);
+
+                /*! \brief Keep the merged and per-stream PointClouds on voxel hash maps instead of flat PointClouds.
+                 *
+                 * Each update then only touches the voxels of the new frame and the voxels of the aged labels,
+                 * instead of concatenating and downsampling the whole map. The current points are carried over.
+                 *
+                 * @param enabled Use the voxel hash maps or not.
+                 */
+                void setVoxelMapEnabled(bool enabled);
+
+                /*! \brief Return from addCloud right away, merging the PointClouds on the thread pool.
+                 *
+                 * Each stream gets a bounded ingest queue, drained in batches by one job at a time, so a slow
+                 * merge no longer holds up the callers.
+                 *
+                 * @param enabled Use asynchronous ingest or not.
+                 * @param capacity Max number of frames waiting on the queue of each stream.
+                 * @param policy What to do with new frames when a queue is full.
+                 */
+                void setAsyncIngest(bool enabled, std::size_t capacity = STREAM_INGEST_QUEUE_CAPACITY,
+                                    IngestOverflowPolicy policy = IngestOverflowPolicy::DROP_OLDEST);
+
+                /*! \brief Get the number of frames all the streams dropped because their ingest queue was full. */
+                std::size_t getDroppedFrames();
+
+                /*! \brief Coalesce the stream updates before downsampling and publishing the merged PointCloud.
+                 *
+                 * The points of each stream update are concatenated right away, but the global downsample and
+                 * the snapshot run once per batch: after maxUpdates updates, or when the oldest update waited the
+                 * window. Larger batches trade snapshot latency for throughput, as N sensors then cost one global
+                 * downsample per batch instead of N.
+                 *
+                 * @param maxUpdates Stream updates per batch. 1 downsamples on every update, the lowest latency.
+                 * @param window Longest a stream update waits for its downsample.
+                 */
+                void setMergeBatching(std::size_t maxUpdates,
+                                      std::chrono::milliseconds window = std::chrono::milliseconds(MERGE_DEFAULT_WINDOW_MS));
+
+                /*! \brief Align each stream update to the merged PointCloud before appending it, with point-to-plane ICP.
+                 *
+                 * The target is the submap of the merged PointCloud around the update, grown by the submap margin,
+                 * read off the voxels of the box. So the updates are only registered while the voxel map is enabled:
+                 * cropping the flat merged PointCloud would visit all of its points on every update. Each
+                 * registration stops early on convergence or when its time budget is over, so a frame costs at most
+                 * the budget.
+                 *
+                 * @param enabled Register the stream updates or not.
+                 * @param params The settings of the registration.
+                 */
+                void setGlobalRegistrationEnabled(bool enabled,
+                                                  const compute::RegistrationParams& params = getDefaultGlobalRegistrationParams());
+
+                /*! \brief Align the frames of each stream to the points of the stream before merging them.
+                 *
+                 * @param enabled Register the frames or not.
+                 * @param params The settings of the registration.
+                 */
+                void setStreamRegistrationEnabled(bool enabled,
+                                                  const compute::RegistrationParams& params = StreamManager::getDefaultRegistrationParams());
+
+                /*! \brief Compensate the motion of the robot over each frame of each stream, with the poses added.
+                 *
+                 * @param enabled Deskew the frames or not.
+                 * @param params The settings of the deskew.
+                 */
+                void setDeskewEnabled(bool enabled, const compute::DeskewParams& params = compute::DeskewParams());
+
+                /*! \brief Get the default settings of the global registration. */
+                static compute::RegistrationParams getDefaultGlobalRegistrationParams();
+
+                /*! \brief Choose which points go first when the memory budget is crossed.
+                 *
+                 * The budget, given on construction, covers the merged PointCloud and the PointClouds of the streams,
+                 * on the host and on the device, with the capacity reserved for them and the buffers cached for
+                 * reuse. It is checked whenever points are inserted. The cached buffers are freed first, then the
+                 * points over it are evicted at once from the merged PointCloud: whole scans, the oldest first and
+                 * each sized by its own points, or the points farthest from the robot pose. Only the merged
+                 * PointCloud is evicted, so it is never emptied for the memory the streams and the pools hold. The
+                 * flat merged PointCloud keeps some capacity beyond its points for the next appends to grow into,
+                 * so at the budget it is not reallocated on every frame.
+                 *
+                 * @param policy The eviction policy. The farthest points policy falls back to the oldest scans
+                 *               until the robot pose is set.
+                 */
+                void setEvictionPolicy(EvictionPolicy policy);
+
+                /*! \brief Set the robot pose, in the same frame as the merged PointCloud.
+                 *
+                 * @param pose The robot pose.
+                 */
+                void setRobotPose(const Eigen::Affine3d& pose);
+
+                /*! \brief Get the bytes taken by the points and the buffers kept for them, in total and by stream. */
+                PointCloudsManagerMemory getMemoryUsage();
+
+                /*! \brief Get a copy of the merged PointCloud. Blocks merging during the copy. */
                 pcl::PointCloud<pcl::PointXYZRGBL> getMergedCloud();
 
-            /*! \brief Memory monitoring routine.
+                /*! \brief Keep the merged PointCloud at several resolutions, for clients with different needs.
+                 *
+                 * The finest voxel size is the one the merged PointCloud is kept at. On the voxel map, each coarser
+                 * level aggregates blocks of its voxels and is updated with them, so the coarser sizes are rounded
+                 * to multiples of the finest. The flat PointCloud derives each level from the next finer one, once
+                 * per snapshot, when it is first read.
+                 *
+                 * @param leafSizes The voxel size of each level, from the finest.
+                 */
+                void setResolutionLevels(const std::vector<float>& leafSizes);
+
+                /*! \brief Get the voxel size of each level of detail, from the finest. */
+                std::vector<float> getResolutionLevels();
+
+                /*! \brief Get a copy of the merged PointCloud at a level of detail.
+                 *
+                 * @param level The level, 0 being the finest. The coarsest when out of range.
+                 */
+                pcl::PointCloud<pcl::PointXYZRGBL> getMergedCloud(std::size_t level);
+
+                /*! \brief Get the latest published version of the merged PointCloud at a level of detail.
+                 *
+                 * Immutable and shared, like getMergedCloudSnapshot(). No points are copied.
+                 *
+                 * @param level The level, 0 being the finest. The coarsest when out of range.
+                 * @return The snapshot. Never null.
+                 */
+                pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr getMergedCloudSnapshot(std::size_t level);
+
+                /*! \brief Get the latest published version of the merged PointCloud.
+                 *
+                 * The snapshot is immutable and shared. It is built by the first read after a change, so the merges
+                 * don't pay for it; the next reads take none of the locks of the manager and copy no points, so it suits frequent polling.
+                 * It stays valid while held, even as newer versions get published.
+                 *
+                 * @return The snapshot. Never null.
+                 */
+                pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr getMergedCloudSnapshot();
+
+                /*! \brief Get the version of the latest snapshot. Changes whenever a new one is published. */
+                std::uint64_t getSnapshotVersion() const;
+
+                /*! \brief Get the spatial index of the latest snapshot.
+                 *
+                 * The index is built by the first query after each snapshot, in one pass over its points, and then
+                 * shared by the next queries until a new snapshot is published. Like the snapshot, it stays valid
+                 * while held.
+                 *
+                 * @return The index. Never null.
+                 */
+                std::shared_ptr<const entities::SpatialIndex> getSpatialIndex();
+
+                /*! \brief Set the side of the cells of the spatial index. Larger cells suit larger queries. */
+                void setSpatialIndexCellSize(float cellSize);
+
+                /*! \brief Get the points of the merged PointCloud inside an axis-aligned box.
+                 *
+                 * @param box The box, in the frame of the merged PointCloud.
+                 * @return A view on the latest snapshot. No points are copied.
+                 */
+                entities::PointCloudView queryBox(const Eigen::AlignedBox3f& box);
+
+                /*! \brief Get the points of the merged PointCloud within a distance of a center, like the robot.
+                 *
+                 * @param center The center, in the frame of the merged PointCloud.
+                 * @param radius The distance, in meters.
+                 * @return A view on the latest snapshot. No points are copied.
+                 */
+                entities::PointCloudView queryRadius(const Eigen::Vector3f& center, float radius);
+
+                /*! \brief Get the points of the merged PointCloud inside the view of a camera.
+                 *
+                 * @param frustum The frustum, in the frame of the merged PointCloud.
+                 * @return A view on the latest snapshot. No points are copied.
+                 */
+                entities::PointCloudView queryFrustum(const entities::Frustum& frustum);
+
+                /*! \brief Journal the changes of the merged PointCloud, so exportDelta() can send only them.
+                 *
+                 * Each snapshot keeps the points appended and the labels removed for it. Changes deltas can't
+                 * carry, like a clear, an eviction by distance or a new voxel size, restart the journal, and the
+                 * deltas from before them fall back to full exports.
+                 *
+                 * @param maxVersions Snapshots to keep the changes of. 0 stops journaling.
+                 */
+                void setDeltaJournal(std::size_t maxVersions);
+
+                /*! \brief Encode the latest snapshot, for sending over a constrained link.
+                 *
+                 * @param out Receives the message. Tagged with the version of the snapshot.
+                 * @param encoding Precision and compression of the message.
+                 * @return Error code. 0 if successful, or an error of utils::CloudSerializer::encode().
+                 */
+                int exportSnapshot(std::vector<std::uint8_t>& out, const utils::CloudEncoding& encoding = utils::CloudEncoding());
+
+                /*! \brief Encode the changes since a snapshot version: the points added and the labels removed.
+                 *
+                 * The receiver removes the labels and then adds the points. The points are sent as they were
+                 * merged, so the receiver downsamples them like the merged PointCloud if it needs to. When the
+                 * journal doesn't reach back to the version, the whole latest snapshot is sent instead, which the
+                 * header of the message tells.
+                 *
+                 * @param sinceVersion The snapshot version the receiver is at.
+                 * @param out Receives the message. Tagged with the version it brings the receiver to.
+                 * @param encoding Precision and compression of the message.
+                 * @return Error code. 0 if successful, or an error of utils::CloudSerializer::encode().
+                 */
+                int exportDelta(std::uint64_t sinceVersion, std::vector<std::uint8_t>& out,
+                                const utils::CloudEncoding& encoding = utils::CloudEncoding());
+
+                /*! \brief Save the merged PointCloud, the scans waiting to age and the sensor transforms to a file.
+                 *
+                 * The file holds the in-memory records as flat arrays, so nothing is encoded. It is written through
+                 * a mapping next to the path and then renamed over it, so a crash midway leaves the previous
+                 * checkpoint whole. Merging waits while the merged PointCloud is copied.
+                 *
+                 * @param path Path of the checkpoint.
+                 * @return Error code. 0 if successful, -1 if the file couldn't be written, -2 if it couldn't be
+                 *         flushed or renamed into place.
+                 */
+                int saveCheckpoint(const std::string& path);
+
+                /*! \brief Resume from a checkpoint, replacing the merged PointCloud.
+                 *
+                 * The file is mapped and its records used in place, with nothing to parse: the points are copied
+                 * off the mapping and the voxels inserted in bulk. The streams are created with their sensor
+                 * transforms, unless already set, and the scans age from their saved deadlines, so the scans due
+                 * while stopped expire right away. Checkpoints are only read by builds with the same record layout.
+                 *
+                 * @param path Path of the checkpoint.
+                 * @return Error code. 0 if successful, -1 if the file couldn't be mapped, -2 if it isn't a valid
+                 *         checkpoint of this build.
+                 */
+                int loadCheckpoint(const std::string& path);
+
+                /*! \brief Start or stop collecting metrics, process-wide. When stopped, the probes cost a load each. */
+                static void setMetricsEnabled(bool enabled);
+
+                /*! \brief Copy the current metrics. Only reads atomics, ingestion is not blocked. */
+                PointCloudsManagerMetrics getMetrics();
+
+                /*! \brief Zero the metrics of the manager and of its streams. */
+                void resetMetrics();
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                /*! \brief Cap the device memory taken by the CUDA paths, process-wide.
+                 *
+                 * @param bytes The most bytes the device memory pool may hold. 0 is no limit.
+                 */
+                static void setDeviceMemoryLimit(std::size_t bytes);
+
+                /*! \brief Get the usage of the device memory pool, like its peak and hit rate. */
+                static cuda::DeviceMemoryPoolStats getDeviceMemoryStats();
+
+                /*! \brief Run the work of a stream on a given CUDA device.
+                 *
+                 * Without affinity the streams are dealt round-robin over the devices. Only applies to streams
+                 * created afterwards, i.e., before the first PointCloud or transform of the topic.
+                 *
+                 * @param topicName The name of the topic of the stream.
+                 * @param device The CUDA device.
+                 */
+                void setDeviceAffinity(const std::string& topicName, int device);
+#endif
+
+            /*! \brief Merge flush routine.
              *
-             * When a PointCloud reaches the defined max size, some points are removed. It runs contantly on a thread.
+             * Downsamples and publishes the pending stream updates when the window of the oldest one ends.
              *
              * @param instance Pointer to the PointCloudsManager instance.
-             * */
-            friend void memoryMonitoringRoutine(PointCloudsManager* instance);
+             */
+            friend void mergeFlushRoutine(PointCloudsManager* instance);
 
         };
 
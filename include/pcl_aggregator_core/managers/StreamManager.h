@@ -14,19 +14,74 @@
 #include <pcl/point_types.h>
 #include <pcl/point_cloud.h>
 #include <pcl/registration/icp.h>
+#include <pcl_aggregator_core/compute/Registration.h>
+#include <pcl_aggregator_core/compute/Deskew.h>
+#include <pcl_aggregator_core/compute/PointFilter.h>
 #include <pcl_aggregator_core/entities/StampedPointCloud.h>
+#include <pcl_aggregator_core/entities/VoxelHashMap.h>
 #include <pcl_aggregator_core/utils/Utils.h>
+#include <pcl_aggregator_core/utils/ThreadPool.h>
+#include <pcl_aggregator_core/utils/BoundedQueue.h>
+#include <pcl_aggregator_core/utils/Metrics.h>
+#include <pcl_aggregator_core/utils/TimingWheel.h>
+#include <pcl_aggregator_core/utils/PoseBuffer.h>
+#include <pcl_aggregator_core/utils/FramePool.h>
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+#include <pcl_aggregator_core/cuda/CUDAStreams.cuh>
+#endif
 #include <thread>
 #include <functional>
+#include <atomic>
+#include <condition_variable>
+#include <vector>
 
 #define STREAM_ICP_MAX_CORRESPONDENCE_DISTANCE 1
 #define STREAM_ICP_MAX_ITERATIONS 10
 
 #define STREAM_DOWNSAMPLING_LEAF_SIZE 0.1f
 
+// default number of frames waiting on the ingest queue of a stream
+#define STREAM_INGEST_QUEUE_CAPACITY 8
+// max frames merged before the stream PointCloud is downsampled and handed over
+#define STREAM_INGEST_MAX_BATCH 4
+
 namespace pcl_aggregator {
     namespace managers {
 
+        /*! \brief What to do with a new frame when the ingest queue of its stream is full. */
+        enum class IngestOverflowPolicy {
+            /*! \brief Drop the oldest queued frame to make room. */
+            DROP_OLDEST,
+            /*! \brief Drop the new frame. */
+            DROP_NEWEST,
+            /*! \brief Wait for room on the caller's thread. */
+            BLOCK
+        };
+
+        /*! \brief A frame waiting on the ingest queue, with its arrival time. */
+        struct IngestFrame {
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud = nullptr;
+            unsigned long long timestamp = 0;
+        };
+
+        /*! \brief A scan waiting to age. Its points are already on the merged PointCloud, so only these are kept. */
+        struct ScanRecord {
+            /*! \brief The time the scan arrived at. */
+            unsigned long long timestamp;
+            /*! \brief The label of the points of the scan. */
+            std::uint32_t label;
+        };
+
+        /*! \brief What changed on a stream since its previous delta. */
+        struct StreamDelta {
+            /*! \brief The points added: labelled, in the robot frame and downsampled. Host or device-resident.
+             * Null if only labels aged. Only valid during the callback.
+             */
+            entities::StampedPointCloud* points = nullptr;
+            /*! \brief The labels whose points aged and are to be dropped. */
+            std::set<std::uint32_t> removedLabels;
+        };
+
         /*! \brief Manager of a stream of PointClouds.
          *
          * Manages a stream of PointClouds coming from a single sensor.
@@ -39,30 +94,99 @@ namespace pcl_aggregator {
                 std::string topicName;
                 /*! \brief Shared pointer to the merged PointCloud generated by this manager. */
                 std::shared_ptr<entities::StampedPointCloud> cloud = nullptr;
+                /*! \brief Voxelized merged PointCloud, used instead of cloud when the voxel map is enabled. */
+                entities::VoxelHashMap voxels;
+                /*! \brief Keep the merged PointCloud on a voxel hash map instead of a flat PointCloud. */
+                std::atomic<bool> voxelMapEnabled = false;
                 /*! \brief Transform from the sensor frame to the robot base frame. */
                 Eigen::Affine3d sensorTransform;
                 /*! \brief Is the transform of the sensor to the robot frame set. */
                 bool sensorTransformSet = false;
 
-                /*! \brief A set containing the PointClouds managed by this class ordered and identified by timestamp. */
-                std::set<std::shared_ptr<entities::StampedPointCloud>,
-                    entities::CompareStampedPointCloudPointers> clouds;
+                /*! \brief Hash of the topic name, to label the scans without hashing the name on every frame. */
+                std::size_t topicHash;
+                /*! \brief The scans waiting to age, in arrival order. Keeps its capacity, so aging a scan doesn't free. */
+                std::vector<ScanRecord> scans;
                 /*! \brief Queue of PointClouds waiting for the transform to be set. */
                 std::queue<std::shared_ptr<entities::StampedPointCloud>> cloudsNotTransformed;
                 /*! \brief Maximum age points live for. After this time they will be removed. */
                 double maxAge;
 
-                /*! \brief Mutex to manage access to the clouds set. */
+                /*! \brief Mutex to manage access to the scans. */
                 std::mutex setMutex;
                 /*! \brief Mutex to manage access to the merged PointCloud. */
                 std::mutex cloudMutex;
                 /*! \brief Mutex to manage access to the sensor transform. */
                 std::mutex sensorTransformMutex;
 
-                /*! \brief Thread which monitors the current PointCloud's age. Started by the constructor. */
-                std::thread maxAgeWatcherThread;
-                /*!\brief Flag to determine if the age watcher thread should be stopped or not. */
-                bool keepAgeWatcherAlive = true;
+                /*! \brief Poses of the robot base over time, to deskew the frames with. */
+                utils::PoseBuffer poseBuffer;
+                /*! \brief Transform each point with the pose at its own time instead of the stamp of its frame. */
+                bool deskewEnabled = false;
+                /*! \brief Settings of the deskew. Guarded by the sensor transform mutex, like the flag. */
+                compute::DeskewParams deskewParams;
+                /*! \brief Settings of the filtering of the raw frames, on the robot base frame. */
+                compute::PointFilterParams filterParams;
+                /*! \brief The filter of the raw frames, on the sensor frame. Rebuilt when the sensor transform is set.
+                 * Guarded by the sensor transform mutex, like its settings. */
+                compute::PointFilter pointFilter;
+
+                /*! \brief Align each frame to the points of the stream before merging it. */
+                std::atomic<bool> registrationEnabled = false;
+                /*! \brief Settings of the registration. */
+                compute::RegistrationParams registrationParams;
+                /*! \brief Correction found by the last registration. Starts the next one, so a drifting sensor
+                 * transform is followed across frames.
+                 */
+                Eigen::Affine3d registrationCorrection = Eigen::Affine3d::Identity();
+                /*! \brief Mutex to manage access to the registration settings and correction. */
+                std::mutex registrationMutex;
+                /*! \brief The aligned frames still within the max age, the registration target with the flat
+                 * PointCloud, which only holds the current batch. Aged with the scans. Guarded by cloudMutex.
+                 */
+                entities::VoxelHashMap registrationSubmap;
+
+                /*! \brief Pool the removal and callback jobs run on. May be shared with other managers. */
+                std::shared_ptr<utils::ThreadPool> threadPool;
+                /*! \brief The jobs this manager submitted to the pool. Waited for on destruction. */
+                std::unique_ptr<utils::TaskGroup> jobs;
+
+                /*! \brief Frames waiting to be merged. Only present when the ingest is asynchronous. */
+                std::atomic<std::shared_ptr<utils::BoundedQueue<IngestFrame>>> ingestQueue;
+                /*! \brief What to do when the ingest queue is full. */
+                std::atomic<IngestOverflowPolicy> overflowPolicy = IngestOverflowPolicy::DROP_OLDEST;
+                /*! \brief A job draining the ingest queue is queued or running. */
+                std::atomic<bool> drainScheduled = false;
+                /*! \brief Number of frames dropped because the ingest queue was full. */
+                std::atomic<std::size_t> droppedFrames = 0;
+                /*! \brief Number of producers waiting for room on the ingest queue, with the blocking policy. */
+                std::atomic<std::size_t> blockedProducers = 0;
+                /*! \brief Mutex the blocked producers wait on. */
+                std::mutex ingestSpaceMutex;
+                /*! \brief Signaled by the drain after taking frames off the ingest queue, when producers are blocked. */
+                std::condition_variable ingestSpaceCondition;
+
+                /*! \brief Recycled frames, so the steady-state ingest reuses the point buffers of the previous frames. */
+                utils::FramePool framePool;
+                /*! \brief Hands the frames of the voxel map over to the delta callback. Reused across frames. */
+                entities::StampedPointCloud deltaPoints;
+                /*! \brief Empty PointCloud the delta points hold between frames, so the frames can go back to the pool. */
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr deltaPlaceholder;
+                /*! \brief Mutex to manage access to the delta points. */
+                std::mutex deltaMutex;
+
+                /*! \brief Metrics of this stream. Collected while utils::Metrics is enabled. */
+                utils::MetricsRegistry metrics;
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                /*! \brief CUDA streams and pinned staging of this stream, so its transfers overlap the other streams'. */
+                cuda::StreamContext streamContext;
+#endif
+
+                /*! \brief Wheel the PointClouds are registered on to expire. May be shared with other managers. */
+                std::shared_ptr<utils::TimingWheel> agingWheel;
+                /*! \brief The aging wheel was started by this manager, which handles the expirations itself. */
+                bool ownsAgingWheel = false;
 
                 /*! \brief Callback function to call when a PointCloud ages older than maxAge.
                  * May be useful to remove points from the PointCloudsManager's PointCloud.
@@ -76,6 +200,9 @@ namespace pcl_aggregator {
                  */
                 std::function<void(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud)> pointCloudReadyCallback = nullptr;
 
+                /*! \brief Callback function to call with the changes of the stream: the new points and the aged labels. */
+                std::function<void(const StreamDelta& delta)> deltaCallback = nullptr;
+
                 /*! \brief Compute the sensor transform. */
                 void computeTransform();
 
@@ -83,19 +210,77 @@ namespace pcl_aggregator {
 
                 void removePointClouds(std::set<std::uint32_t> labels);
 
+                /*! \brief Keep a scan for aging and register it on the aging wheel, to expire after the max age. */
+                void scheduleAging(const ScanRecord& scan);
+
+                /*! \brief Expire the PointClouds due on the private aging wheel and hand the labels over as a delta. */
+                void onPointCloudsExpired(std::vector<utils::WheelTimer>& expired);
+
+                /*! \brief Merge a frame into the stream PointCloud.
+                 *
+                 * @param newCloud The frame, in the sensor frame.
+                 * @param timestamp The time the frame arrived at.
+                 * @param publish Downsample and hand the merged PointCloud over after merging. Allows batching.
+                 */
+                void processCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr newCloud, unsigned long long timestamp,
+                                  bool publish);
+
+                /*! \brief Align a frame to the points of the stream and keep the correction for the next frames.
+                 *
+                 * @param frame The frame, already under the current correction. Transformed in-place.
+                 * @param target The points of the stream around the frame.
+                 * @param params The settings of the registration.
+                 */
+                void registerFrame(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& frame,
+                                   const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                   const compute::RegistrationParams& params);
+
+                /*! \brief Queue a frame on the ingest queue, applying the overflow policy, and schedule a drain. */
+                void enqueueCloud(const std::shared_ptr<utils::BoundedQueue<IngestFrame>>& queue,
+                                  pcl::PointCloud<pcl::PointXYZRGBL>::Ptr newCloud);
+
+                /*! \brief Merge the queued frames in batches until the queue is empty. Ran on the thread pool. */
+                void drainIngestQueue(std::shared_ptr<utils::BoundedQueue<IngestFrame>> queue);
+
             public:
-                StreamManager(const std::string& topicName, double maxAge);
+                /*!
+                 * @param topicName The name of the topic of the sensor.
+                 * @param maxAge The max age points live for.
+                 * @param threadPool Pool to run the removal and callback jobs on. A private one is started if null.
+                 * @param device The CUDA device running the work of this stream. Negative is the current device.
+                 *               Ignored without CUDA.
+                 * @param agingWheel Wheel to register the PointClouds on to expire. Its owner routes the expirations
+                 *                   to expirePointClouds and drops the labels downstream. A private one is started if null.
+                 */
+                StreamManager(const std::string& topicName, double maxAge,
+                              std::shared_ptr<utils::ThreadPool> threadPool = nullptr, int device = -1,
+                              std::shared_ptr<utils::TimingWheel> agingWheel = nullptr);
                 ~StreamManager();
 
                 bool operator==(const StreamManager& other) const;
 
+                /*! \brief Wait for the jobs submitted so far to end: the queued frames, the removals and the callbacks. */
+                void waitForJobs();
 
                 /*!
                  * \brief Feed a PointCloud to manage.
+                 *
+                 * With asynchronous ingest the PointCloud is only queued, and merged later on the thread pool.
+                 *
                  * @param newCloud The PointCloud smart pointer.
                  */
                 void addCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr newCloud);
 
+                /*!
+                 * \brief Get an empty PointCloud to fill with a new frame, recycled from the previous frames.
+                 *
+                 * Feeding it back with addCloud returns its buffer to the pool once merged, so a producer which
+                 * always takes its frames from here doesn't allocate on the steady state.
+                 *
+                 * @return The PointCloud smart pointer.
+                 */
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr acquireFrame();
+
                 /*!
                  * \brief Get the merged version of the still valid PointClouds fed into this manager.
                  * @return The merged PointCloud smart pointer.
@@ -108,6 +293,99 @@ namespace pcl_aggregator {
                  */
                 void setSensorTransform(const Eigen::Affine3d& transform);
 
+                /*!
+                 * \brief Get the transform between the sensor frame and the robot base frame.
+                 * @param transform Receives the transform, if set.
+                 * @return Flag denoting if the transform was set.
+                 */
+                bool getSensorTransform(Eigen::Affine3d& transform);
+
+                /*!
+                 * \brief Add a pose of the robot base, to deskew the frames with.
+                 * @param pose The pose of the robot base, on a fixed frame like the odometry.
+                 * @param timestamp UNIX timestamp of the pose, in microseconds.
+                 */
+                void addPose(const Eigen::Affine3d& pose, std::uint64_t timestamp);
+
+                /*!
+                 * \brief Compensate the motion of the robot over each frame, with the poses added.
+                 *
+                 * Each point is brought from the pose at its own time to the pose at the stamp of its frame, the
+                 * stamp of the pcl header in microseconds. Frames without poses are transformed rigidly.
+                 *
+                 * @param enabled Deskew the frames or not.
+                 * @param params The settings of the deskew.
+                 */
+                void setDeskewEnabled(bool enabled, const compute::DeskewParams& params = compute::DeskewParams());
+
+                /*!
+                 * \brief Filter the raw frames of this stream before merging them.
+                 *
+                 * The range limits are measured from the sensor, the boxes are on the robot base frame. The points
+                 * are tested before being transformed, so the dropped ones cost neither the transform nor the merge.
+                 * Frames received before the sensor transform is set are not filtered.
+                 *
+                 * @param params The settings of the filter. The default settings disable it.
+                 * @return 0 on success, negative if the settings are not valid.
+                 */
+                int setPointFilter(const compute::PointFilterParams& params);
+
+                /*!
+                 * \brief Keep the merged PointCloud of this stream on the GPU between frames.
+                 * @param resident Keep the points on the device or not.
+                 */
+                void setDeviceResident(bool resident);
+
+                /*!
+                 * \brief Keep the merged PointCloud of this stream on a voxel hash map instead of a flat PointCloud.
+                 *
+                 * New frames then only update the voxels they touch, and are handed to the PointCloud ready
+                 * callback on their own instead of with the whole merged PointCloud.
+                 *
+                 * @param enabled Use the voxel hash map or not.
+                 */
+                void setVoxelMapEnabled(bool enabled);
+
+                /*!
+                 * \brief Queue the fed PointClouds and merge them on the thread pool, instead of on the caller's thread.
+                 *
+                 * Frames queued when disabling are still merged.
+                 *
+                 * @param enabled Use asynchronous ingest or not.
+                 * @param capacity Max number of frames waiting on the queue.
+                 * @param policy What to do with new frames when the queue is full.
+                 */
+                void setAsyncIngest(bool enabled, std::size_t capacity = STREAM_INGEST_QUEUE_CAPACITY,
+                                    IngestOverflowPolicy policy = IngestOverflowPolicy::DROP_OLDEST);
+
+                /*!
+                 * \brief Align each frame to the points of the stream before merging it, with point-to-plane ICP.
+                 *
+                 * The target is the submap of the voxel map around the frame. The flat PointCloud is emptied on each
+                 * publish, so with it the aligned frames are kept on a voxel map of their own until they age, and
+                 * the submap comes from there. The correction found carries over to the next frames, and is dropped
+                 * with the kept frames when disabling.
+                 *
+                 * @param enabled Register the frames or not.
+                 * @param params The settings of the registration.
+                 */
+                void setRegistrationEnabled(bool enabled,
+                                            const compute::RegistrationParams& params = getDefaultRegistrationParams());
+
+                /*! \brief Get the number of frames dropped because the ingest queue was full. */
+                std::size_t getDroppedFrames() const;
+
+                /*! \brief Get the metrics of this stream. */
+                utils::MetricsRegistry& getMetrics();
+
+                /*! \brief Get the bytes taken by the points of this stream, on the host and on the device, with the
+                 * capacity reserved for them, the recycled frames and the staging buffers.
+                 */
+                std::size_t getMemoryUsage();
+
+                /*! \brief Get the default settings of the stream registration. */
+                static compute::RegistrationParams getDefaultRegistrationParams();
+
                 /*!
                  * \brief Get the max age points live for after being fed.
                  * @return The configured max points age.
@@ -138,6 +416,26 @@ namespace pcl_aggregator {
                  */
                 void setPointCloudReadyCallback(const std::function<void(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud)>& func);
 
+                /*! \brief Set the delta callback.
+                 *
+                 * Called with the points added since the previous call, once per published batch, and with the labels
+                 * to drop when points age. The stream empties its points after each published batch, so a consumer
+                 * only ever sees each point once. Device-resident points are handed over without downloading them.
+                 *
+                 * @param func The callback to set.
+                 */
+                void setDeltaCallback(const std::function<void(const StreamDelta& delta)>& func);
+
+                /*! \brief Drop the expired PointClouds from this stream and call the point aging callback.
+                 * The removal and the callback run as jobs on the thread pool.
+                 *
+                 * @param labels The labels of the expired PointClouds.
+                 */
+                void expirePointClouds(const std::set<std::uint32_t>& labels);
+
+                /*! \brief Get the CUDA device running the work of this stream. 0 without CUDA. */
+                int getDevice() const;
+
 
             /*!
              * \brief PointCloud transform routine.
@@ -159,15 +457,6 @@ namespace pcl_aggregator {
             friend void icpTransformPointCloudRoutine(const std::shared_ptr<entities::StampedPointCloud>& spcl,
                                                       const Eigen::Matrix4f& tf);
 
-            /*! \brief Max age watching routine.
-             *
-             * This routine is ran by a thread in background watching the age of the PointClouds
-             * contained in this StreamManager. Whenever a thread older than the max age is found it is removed.
-             *
-             * @param instance Pointer to the StreamManager instance
-             */
-            friend void maxAgeWatchingRoutine(StreamManager* instance);
-
         };
 
     } // pcl_aggregator
@@ -0,0 +1,158 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_BOUNDEDQUEUE_H
+#define PCL_AGGREGATOR_CORE_BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief Bounded Queue
+         *         Fixed capacity lock-free multi-producer multi-consumer FIFO queue.
+         *
+         * Each slot carries a sequence number telling producers and consumers whose turn it is, so pushing
+         * and popping only take a compare-and-swap on the position. Full and empty are reported instead of
+         * waited on.
+         *
+         * @tparam T The type of the elements. Must be default constructible and movable.
+         */
+        template <typename T>
+        class BoundedQueue {
+
+            private:
+                struct Slot {
+                    std::atomic<std::size_t> sequence;
+                    T value;
+                };
+
+                /*! \brief The slots, with a power of two count. */
+                std::unique_ptr<Slot[]> slots;
+
+                /*! \brief Slot count minus one, to wrap positions. */
+                std::size_t mask;
+
+                /*! \brief Next position to push to. Kept apart from the pop position to avoid false sharing. */
+                alignas(64) std::atomic<std::size_t> pushPosition;
+
+                /*! \brief Next position to pop from. */
+                alignas(64) std::atomic<std::size_t> popPosition;
+
+            public:
+                /*! \brief Create an empty queue.
+                 *
+                 * @param capacity Maximum number of elements. Rounded up to a power of two.
+                 */
+                explicit BoundedQueue(std::size_t capacity) {
+                    if(capacity == 0)
+                        throw std::invalid_argument("The queue capacity must be positive!");
+
+                    std::size_t slotCount = 1;
+                    while(slotCount < capacity)
+                        slotCount *= 2;
+
+                    this->slots = std::make_unique<Slot[]>(slotCount);
+                    this->mask = slotCount - 1;
+                    for(std::size_t i = 0; i < slotCount; i++)
+                        this->slots[i].sequence.store(i, std::memory_order_relaxed);
+
+                    this->pushPosition.store(0, std::memory_order_relaxed);
+                    this->popPosition.store(0, std::memory_order_relaxed);
+                }
+
+                BoundedQueue(const BoundedQueue&) = delete;
+                BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+                /*! \brief Push an element if there is room.
+                 *
+                 * @param value The element. Only moved from on success.
+                 * @return True if pushed, false if the queue is full.
+                 */
+                bool tryPush(T& value) {
+
+                    std::size_t position = this->pushPosition.load(std::memory_order_relaxed);
+
+                    while(true) {
+                        Slot& slot = this->slots[position & this->mask];
+                        std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                        auto difference = static_cast<std::ptrdiff_t>(sequence) - static_cast<std::ptrdiff_t>(position);
+
+                        if(difference == 0) {
+                            // the slot is free on this lap, claim it
+                            if(this->pushPosition.compare_exchange_weak(position, position + 1,
+                                                                        std::memory_order_relaxed)) {
+                                slot.value = std::move(value);
+                                slot.sequence.store(position + 1, std::memory_order_release);
+                                return true;
+                            }
+                        } else if(difference < 0) {
+                            // the slot still holds an element of the previous lap
+                            return false;
+                        } else {
+                            position = this->pushPosition.load(std::memory_order_relaxed);
+                        }
+                    }
+                }
+
+                /*! \brief Pop the oldest element if there is one.
+                 *
+                 * @param value Receives the element.
+                 * @return True if popped, false if the queue is empty.
+                 */
+                bool tryPop(T& value) {
+
+                    std::size_t position = this->popPosition.load(std::memory_order_relaxed);
+
+                    while(true) {
+                        Slot& slot = this->slots[position & this->mask];
+                        std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+                        auto difference = static_cast<std::ptrdiff_t>(sequence) -
+                                          static_cast<std::ptrdiff_t>(position + 1);
+
+                        if(difference == 0) {
+                            if(this->popPosition.compare_exchange_weak(position, position + 1,
+                                                                       std::memory_order_relaxed)) {
+                                value = std::move(slot.value);
+                                // leave the slot empty, not holding on to resources
+                                slot.value = T();
+                                slot.sequence.store(position + this->mask + 1, std::memory_order_release);
+                                return true;
+                            }
+                        } else if(difference < 0) {
+                            return false;
+                        } else {
+                            position = this->popPosition.load(std::memory_order_relaxed);
+                        }
+                    }
+                }
+
+                /*! \brief Check if the queue looks empty. Exact only when no push or pop is in progress. */
+                bool empty() const {
+                    return this->pushPosition.load(std::memory_order_seq_cst) ==
+                           this->popPosition.load(std::memory_order_seq_cst);
+                }
+
+                /*! \brief Get the number of elements, exact only when no push or pop is in progress. */
+                std::size_t getSize() const {
+                    std::size_t popped = this->popPosition.load(std::memory_order_relaxed);
+                    std::size_t pushed = this->pushPosition.load(std::memory_order_relaxed);
+                    return pushed > popped ? pushed - popped : 0;
+                }
+
+                /*! \brief Get the maximum number of elements. */
+                std::size_t getCapacity() const {
+                    return this->mask + 1;
+                }
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_BOUNDEDQUEUE_H
@@ -0,0 +1,114 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_CLOUDSERIALIZER_H
+#define PCL_AGGREGATOR_CORE_CLOUDSERIALIZER_H
+
+#include <pcl/point_types.h>
+#include <pcl/point_cloud.h>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+// first bytes of every message: "PCAG"
+#define CLOUD_SERIALIZER_MAGIC 0x47414350u
+// version of the wire format, bumped on any layout change
+#define CLOUD_SERIALIZER_FORMAT_VERSION 1
+// quantization step of the coordinates, in meters
+#define CLOUD_SERIALIZER_DEFAULT_PRECISION 0.001f
+// zstd level of the compressed messages. the low levels keep up with the ingest rate
+#define CLOUD_SERIALIZER_DEFAULT_COMPRESSION_LEVEL 3
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief Compression of the payload of a message. */
+        enum class CloudCompression {
+            /*! \brief The payload as is. */
+            NONE,
+            /*! \brief zstd. Only available when built with WITH_ZSTD. */
+            ZSTD
+        };
+
+        /*! \brief How a message is encoded. */
+        struct CloudEncoding {
+            /*! \brief Quantization step of the coordinates, in meters. Blocks span 65536 steps per axis. */
+            float precision = CLOUD_SERIALIZER_DEFAULT_PRECISION;
+            /*! \brief Compression of the payload. */
+            CloudCompression compression = CloudCompression::NONE;
+            /*! \brief Compression level, when compressed. */
+            int compressionLevel = CLOUD_SERIALIZER_DEFAULT_COMPRESSION_LEVEL;
+        };
+
+        /*! \brief What a message stands for. */
+        struct CloudMessageHeader {
+            /*! \brief The snapshot version the receiver is at after applying the message. */
+            std::uint64_t version = 0;
+            /*! \brief The snapshot version a delta applies on. Unused by full messages. */
+            std::uint64_t baseVersion = 0;
+            /*! \brief The message only carries the changes since the base version. Else, the whole PointCloud. */
+            bool delta = false;
+        };
+
+        /*! \brief A decoded message. */
+        struct CloudMessage {
+            CloudMessageHeader header;
+            /*! \brief The points: all of them, or those added since the base version. */
+            pcl::PointCloud<pcl::PointXYZRGBL> points;
+            /*! \brief Labels removed since the base version. Applied before adding the points. */
+            std::set<std::uint32_t> removedLabels;
+        };
+
+        /*! \brief Cloud Serializer
+         *         Compact wire format of the merged PointCloud, for constrained links.
+         *
+         * The points are grouped by block. Each block sends its origin once, and each point its offset from it,
+         * quantized to 16 bits per axis, 8-bit RGB and an index on the label dictionary of the message. That is
+         * 10 to 13 bytes a point, instead of the 48 of a PointXYZRGBL. The payload may be compressed on top.
+         *
+         * Layout, little-endian:
+         * - header: magic (u32), format version (u8), flags (u8: 1 delta, 2 zstd), reserved (u16),
+         *   version (u64), base version (u64), payload size before compression (u32), payload size (u32).
+         * - payload: precision (f32), labels (u32 count, u32 each), removed labels (u32 count, u32 each),
+         *   blocks (u32 count), then each block: key (3 x i32), points (u32 count), and each point:
+         *   offset (3 x u16), rgb (3 x u8), label index (u8, u16 or u32, the narrowest fitting the dictionary).
+         */
+        class CloudSerializer {
+
+            public:
+                /*! \brief Encode a message.
+                 *
+                 * Non-finite points are skipped. Each coordinate is off by half a step at most.
+                 *
+                 * @param header What the message stands for.
+                 * @param points The points to send.
+                 * @param removedLabels The labels to remove, for deltas.
+                 * @param encoding How to encode it.
+                 * @param out Receives the message, replacing its contents.
+                 * @return Error code. 0 if successful, -1 on invalid precision, -2 if the compression is not
+                 *         available, -3 if the compression failed.
+                 */
+                static int encode(const CloudMessageHeader& header, const pcl::PointCloud<pcl::PointXYZRGBL>& points,
+                                  const std::set<std::uint32_t>& removedLabels, const CloudEncoding& encoding,
+                                  std::vector<std::uint8_t>& out);
+
+                /*! \brief Decode a message.
+                 *
+                 * @param data The message.
+                 * @param size Size of the message, in bytes.
+                 * @param message Receives the contents.
+                 * @return Error code. 0 if successful, -1 if malformed or truncated, -2 if the format version or the
+                 *         compression is not supported, -3 if the decompression failed.
+                 */
+                static int decode(const std::uint8_t* data, std::size_t size, CloudMessage& message);
+
+                /*! \brief Check if a compression was built in. */
+                static bool isCompressionAvailable(CloudCompression compression);
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_CLOUDSERIALIZER_H
@@ -0,0 +1,62 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_FRAMEPOOL_H
+#define PCL_AGGREGATOR_CORE_FRAMEPOOL_H
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+// frames kept for reuse by default: a full ingest batch and the frame being merged
+#define FRAME_POOL_DEFAULT_CAPACITY 8
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief Frame Pool
+         *         Recycles PointClouds, so the point buffers keep the capacity of the previous frames.
+         *
+         * A frame only goes back to the pool when nobody else holds it, so the consumers of a frame may keep it.
+         */
+        class FramePool {
+
+            private:
+                /*! \brief The empty frames ready to be handed out. */
+                std::vector<pcl::PointCloud<pcl::PointXYZRGBL>::Ptr> frames;
+
+                /*! \brief Max number of frames kept. */
+                std::size_t capacity;
+
+                /*! \brief Mutex to manage access to the frames. */
+                std::mutex framesMutex;
+
+            public:
+                explicit FramePool(std::size_t capacity = FRAME_POOL_DEFAULT_CAPACITY);
+
+                /*! \brief Get an empty frame, recycled when there is one.
+                 *
+                 * @return The frame. Its buffer keeps the capacity it had when released.
+                 */
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr acquire();
+
+                /*! \brief Give a frame back, to reuse its buffer. Dropped if shared or if the pool is full.
+                 *
+                 * @param frame The frame. Reset in any case.
+                 */
+                void release(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& frame);
+
+                /*! \brief Get the number of frames ready to be handed out. */
+                std::size_t size();
+
+                /*! \brief Get the bytes kept by the frames ready to be handed out: the capacity of their points. */
+                std::size_t getMemoryUsage();
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_FRAMEPOOL_H
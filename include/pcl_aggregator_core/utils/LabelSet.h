@@ -0,0 +1,80 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_LABELSET_H
+#define PCL_AGGREGATOR_CORE_LABELSET_H
+
+#include <cstdint>
+#include <cstddef>
+#include <set>
+#include <vector>
+
+// marks a free slot. the label itself is tracked apart
+#define LABEL_SET_EMPTY_SLOT 0xFFFFFFFFU
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief Label Set
+         *         Flat open-addressing hash set of point labels.
+         *
+         * Meant for per-point membership tests: lookups probe a contiguous array instead of chasing tree nodes.
+         */
+        class LabelSet {
+
+            private:
+                /*! \brief The slots, with a power of two count. */
+                std::vector<std::uint32_t> slots;
+
+                /*! \brief Number of labels in the set. */
+                std::size_t count = 0;
+
+                /*! \brief Is the label used as the empty slot marker in the set. */
+                bool hasEmptyLabel = false;
+
+                /*! \brief Mix the bits of a label, so sequential labels don't cluster. */
+                static std::uint32_t mix(std::uint32_t label) {
+                    label ^= label >> 16;
+                    label *= 0x7feb352dU;
+                    label ^= label >> 15;
+                    label *= 0x846ca68bU;
+                    label ^= label >> 16;
+                    return label;
+                }
+
+                /*! \brief Grow the slots to the given count, reinserting the labels. */
+                void rehash(std::size_t newSlotCount);
+
+            public:
+                LabelSet();
+                explicit LabelSet(const std::set<std::uint32_t>& labels);
+
+                /*! \brief Insert a label. */
+                void insert(std::uint32_t label);
+
+                /*! \brief Get the number of labels in the set. */
+                std::size_t size() const;
+
+                /*! \brief Check if the set has no labels. */
+                bool empty() const;
+
+                /*! \brief Check if a label is in the set. */
+                bool contains(std::uint32_t label) const {
+                    if(label == LABEL_SET_EMPTY_SLOT)
+                        return this->hasEmptyLabel;
+
+                    std::size_t mask = this->slots.size() - 1;
+                    for(std::size_t i = mix(label) & mask;; i = (i + 1) & mask) {
+                        if(this->slots[i] == label)
+                            return true;
+                        if(this->slots[i] == LABEL_SET_EMPTY_SLOT)
+                            return false;
+                    }
+                }
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_LABELSET_H
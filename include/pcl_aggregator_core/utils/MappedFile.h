@@ -0,0 +1,80 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_MAPPEDFILE_H
+#define PCL_AGGREGATOR_CORE_MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief Mapped File
+         *         A file mapped into memory, unmapped on destruction.
+         *
+         * Read mappings are private and read-only, so the contents are paged in on first touch instead of read
+         * upfront. Write mappings are shared, so the stores land on the file.
+         */
+        class MappedFile {
+
+            private:
+                /*! \brief Start of the mapping. Null when nothing is mapped. */
+                std::uint8_t* address = nullptr;
+
+                /*! \brief Length of the mapping, in bytes. */
+                std::size_t length = 0;
+
+                /*! \brief Descriptor of the mapped file. */
+                int fd = -1;
+
+                /*! \brief The mapping is writable. */
+                bool writable = false;
+
+            public:
+                MappedFile() = default;
+                ~MappedFile();
+
+                MappedFile(const MappedFile&) = delete;
+                MappedFile& operator=(const MappedFile&) = delete;
+
+                /*! \brief Map a file to read it.
+                 *
+                 * @param path Path of the file.
+                 * @return Error code. 0 if successful, -1 if the file couldn't be opened, -2 if it couldn't be mapped.
+                 */
+                int openRead(const std::string& path);
+
+                /*! \brief Create or truncate a file to a size and map it to write it.
+                 *
+                 * @param path Path of the file.
+                 * @param size Size of the file, in bytes.
+                 * @return Error code. 0 if successful, -1 if the file couldn't be created, -2 if it couldn't be mapped.
+                 */
+                int create(const std::string& path, std::size_t size);
+
+                /*! \brief Flush the stores of a write mapping to the disk, waiting for them.
+                 *
+                 * @return Error code. 0 if successful, -1 otherwise.
+                 */
+                int sync();
+
+                /*! \brief Unmap and close the file. Called by the destructor. */
+                void close();
+
+                /*! \brief Get the start of the mapping. Null when nothing is mapped. */
+                std::uint8_t* data();
+
+                /*! \brief Get the start of the mapping. Null when nothing is mapped. */
+                const std::uint8_t* data() const;
+
+                /*! \brief Get the length of the mapping, in bytes. */
+                std::size_t size() const;
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_MAPPEDFILE_H
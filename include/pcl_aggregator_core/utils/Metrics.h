@@ -0,0 +1,268 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_METRICS_H
+#define PCL_AGGREGATOR_CORE_METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// one bucket per power of two, plus one for zero
+#define METRICS_HISTOGRAM_BUCKETS 65
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief Monotonic counters of the ingest path. */
+        enum class CounterMetric {
+            /*! \brief Bytes copied from the host to the device. */
+            H2D_BYTES,
+            /*! \brief Bytes copied from the device to the host. */
+            D2H_BYTES,
+            /*! \brief Bytes copied between devices. */
+            PEER_BYTES,
+            /*! \brief Frames fed. */
+            FRAMES_IN,
+            /*! \brief Points fed. */
+            POINTS_IN,
+            /*! \brief Points entering a voxel grid filter. */
+            DOWNSAMPLE_POINTS_IN,
+            /*! \brief Points leaving a voxel grid filter. */
+            DOWNSAMPLE_POINTS_OUT,
+            /*! \brief Points or voxels removed because their label aged. */
+            POINTS_AGED,
+            /*! \brief Points or voxels dropped to keep the memory budget. */
+            POINTS_EVICTED,
+            /*! \brief Bytes of the exported messages. */
+            EXPORTED_BYTES,
+            /*! \brief Frames allocated because the frame pool had none to recycle. */
+            FRAME_POOL_MISSES,
+            /*! \brief Raw points dropped by the stream filters before merging. */
+            POINTS_FILTERED,
+            COUNT
+        };
+
+        /*! \brief Distributions of the ingest path. Times are in nanoseconds. */
+        enum class HistogramMetric {
+            /*! \brief GPU time of a kernel sequence, measured with CUDA events. */
+            KERNEL_TIME_NS,
+            /*! \brief Wall time of a voxel grid filter. */
+            VOXELIZE_TIME_NS,
+            /*! \brief Wall time to merge a frame. */
+            INGEST_TIME_NS,
+            /*! \brief Wait to take a cloudMutex. */
+            CLOUD_LOCK_WAIT_NS,
+            /*! \brief Wait to take a setMutex. */
+            SET_LOCK_WAIT_NS,
+            /*! \brief Wait to take the managersMutex. */
+            MANAGERS_LOCK_WAIT_NS,
+            /*! \brief Frames waiting on an ingest queue, sampled on each push. */
+            QUEUE_DEPTH,
+            /*! \brief Stream updates coalesced into each global downsample. */
+            MERGE_BATCH_SIZE,
+            /*! \brief Wall time of a registration. */
+            REGISTRATION_TIME_NS,
+            COUNT
+        };
+
+        /*! \brief Point-in-time copy of a histogram. */
+        struct HistogramSnapshot {
+            /*! \brief Bucket i counts the values v with 2^(i-1) <= v < 2^i. Bucket 0 counts zeros. */
+            std::vector<std::uint64_t> buckets;
+            std::uint64_t count = 0;
+            std::uint64_t sum = 0;
+            std::uint64_t max = 0;
+
+            /*! \brief Get the mean of the values. */
+            double getMean() const;
+
+            /*! \brief Get an upper bound of a quantile, to the resolution of the buckets.
+             *
+             * @param q The quantile, between 0 and 1.
+             */
+            std::uint64_t getQuantile(double q) const;
+        };
+
+        /*! \brief Point-in-time copy of a registry, keyed by metric name. */
+        struct MetricsSnapshot {
+            std::map<std::string, std::uint64_t> counters;
+            std::map<std::string, HistogramSnapshot> histograms;
+        };
+
+        /*! \brief Lock-free histogram with power of two buckets. */
+        class Histogram {
+
+            private:
+                std::array<std::atomic<std::uint64_t>, METRICS_HISTOGRAM_BUCKETS> buckets{};
+                std::atomic<std::uint64_t> count{0};
+                std::atomic<std::uint64_t> sum{0};
+                std::atomic<std::uint64_t> max{0};
+
+            public:
+                /*! \brief Add a value. */
+                void record(std::uint64_t value);
+
+                /*! \brief Copy the current state. */
+                HistogramSnapshot getSnapshot() const;
+
+                /*! \brief Forget all the values. */
+                void reset();
+        };
+
+        /*! \brief Metrics Registry
+         *         The counters and histograms of one owner, like a stream or the merged PointCloud.
+         */
+        class MetricsRegistry {
+
+            private:
+                std::array<std::atomic<std::uint64_t>, static_cast<std::size_t>(CounterMetric::COUNT)> counters{};
+                std::array<Histogram, static_cast<std::size_t>(HistogramMetric::COUNT)> histograms;
+
+            public:
+                /*! \brief Add to a counter. */
+                void add(CounterMetric metric, std::uint64_t value) {
+                    this->counters[static_cast<std::size_t>(metric)].fetch_add(value, std::memory_order_relaxed);
+                }
+
+                /*! \brief Add a value to a histogram. */
+                void record(HistogramMetric metric, std::uint64_t value) {
+                    this->histograms[static_cast<std::size_t>(metric)].record(value);
+                }
+
+                /*! \brief Copy the current state. */
+                MetricsSnapshot getSnapshot() const;
+
+                /*! \brief Zero all the metrics. */
+                void reset();
+
+                /*! \brief Get the export name of a counter. */
+                static const char* getName(CounterMetric metric);
+
+                /*! \brief Get the export name of a histogram. */
+                static const char* getName(HistogramMetric metric);
+        };
+
+        /*! \brief Metrics
+         *         Global switch and per-thread target of the instrumentation.
+         *
+         * Instrumented code records to the registry set as current on its thread, so shared code like the CUDA
+         * functions is attributed to the stream running it. When disabled, each probe costs a relaxed load.
+         */
+        class Metrics {
+
+            private:
+                static std::atomic<bool> enabled;
+
+            public:
+                /*! \brief Check if the metrics are being collected. */
+                static bool isEnabled() {
+                    return enabled.load(std::memory_order_relaxed);
+                }
+
+                /*! \brief Start or stop collecting the metrics. Disabled by default. */
+                static void setEnabled(bool enable);
+
+                /*! \brief Get the registry the current thread records to. May be null. */
+                static MetricsRegistry* getCurrent();
+
+                /*! \brief Set the registry the current thread records to.
+                 *
+                 * @return The previous one.
+                 */
+                static MetricsRegistry* setCurrent(MetricsRegistry* registry);
+
+                /*! \brief Add to a counter of the current registry, if enabled. */
+                static void add(CounterMetric metric, std::uint64_t value) {
+                    if(!isEnabled())
+                        return;
+                    MetricsRegistry* registry = getCurrent();
+                    if(registry != nullptr)
+                        registry->add(metric, value);
+                }
+
+                /*! \brief Add a value to a histogram of the current registry, if enabled. */
+                static void record(HistogramMetric metric, std::uint64_t value) {
+                    if(!isEnabled())
+                        return;
+                    MetricsRegistry* registry = getCurrent();
+                    if(registry != nullptr)
+                        registry->record(metric, value);
+                }
+
+                /*! \brief Lock a mutex, recording the wait if enabled.
+                 *
+                 * @param mutex The mutex to lock.
+                 * @param metric The histogram receiving the wait.
+                 * @return The owning lock.
+                 */
+                template <typename Mutex>
+                static std::unique_lock<Mutex> lock(Mutex& mutex, HistogramMetric metric) {
+                    if(!isEnabled())
+                        return std::unique_lock<Mutex>(mutex);
+
+                    auto start = std::chrono::steady_clock::now();
+                    std::unique_lock<Mutex> lock(mutex);
+                    record(metric, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - start).count());
+                    return lock;
+                }
+        };
+
+        /*! \brief Makes a registry the current one of the thread for a scope. */
+        class MetricsScope {
+
+            private:
+                MetricsRegistry* previous;
+
+            public:
+                explicit MetricsScope(MetricsRegistry* registry) {
+                    this->previous = Metrics::setCurrent(registry);
+                }
+
+                ~MetricsScope() {
+                    Metrics::setCurrent(this->previous);
+                }
+
+                MetricsScope(const MetricsScope&) = delete;
+                MetricsScope& operator=(const MetricsScope&) = delete;
+        };
+
+        /*! \brief Records the wall time of a scope to a histogram of the current registry. */
+        class ScopedTimer {
+
+            private:
+                MetricsRegistry* registry = nullptr;
+                HistogramMetric metric;
+                std::chrono::steady_clock::time_point start;
+
+            public:
+                explicit ScopedTimer(HistogramMetric metric): metric(metric) {
+                    if(!Metrics::isEnabled())
+                        return;
+                    this->registry = Metrics::getCurrent();
+                    this->start = std::chrono::steady_clock::now();
+                }
+
+                ~ScopedTimer() {
+                    if(this->registry == nullptr)
+                        return;
+                    this->registry->record(this->metric, std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::steady_clock::now() - this->start).count());
+                }
+
+                ScopedTimer(const ScopedTimer&) = delete;
+                ScopedTimer& operator=(const ScopedTimer&) = delete;
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_METRICS_H
@@ -0,0 +1,75 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_POSEBUFFER_H
+#define PCL_AGGREGATOR_CORE_POSEBUFFER_H
+
+#include <eigen3/Eigen/Dense>
+#include <eigen3/Eigen/Geometry>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+
+// poses kept by default: 10 seconds of a 200 Hz odometry
+#define POSE_BUFFER_DEFAULT_CAPACITY 2000
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief A pose at a point in time. */
+        struct StampedPose {
+            /*! \brief UNIX timestamp, in microseconds. */
+            std::uint64_t timestamp;
+            Eigen::Vector3d translation;
+            Eigen::Quaterniond rotation;
+        };
+
+        /*! \brief Pose Buffer
+         *         Bounded history of timestamped poses, interpolated at any time in between.
+         *
+         * The translations are interpolated linearly and the rotations spherically. Times outside the history
+         * take the pose at its nearest end.
+         */
+        class PoseBuffer {
+
+            private:
+                /*! \brief The poses, the oldest first. */
+                std::deque<StampedPose> poses;
+
+                /*! \brief Max number of poses kept. The oldest go first. */
+                std::size_t capacity;
+
+                /*! \brief Mutex to manage access to the poses. */
+                mutable std::mutex posesMutex;
+
+            public:
+                explicit PoseBuffer(std::size_t capacity = POSE_BUFFER_DEFAULT_CAPACITY);
+
+                /*! \brief Add a pose. Poses older than the newest are put in order.
+                 *
+                 * @param timestamp UNIX timestamp of the pose, in microseconds.
+                 * @param pose The pose.
+                 */
+                void addPose(std::uint64_t timestamp, const Eigen::Affine3d& pose);
+
+                /*! \brief Get the pose at a time, interpolated between the poses around it.
+                 *
+                 * @param timestamp UNIX timestamp, in microseconds.
+                 * @param pose Receives the pose.
+                 * @return Flag denoting if there was any pose.
+                 */
+                bool getPose(std::uint64_t timestamp, Eigen::Affine3d& pose) const;
+
+                /*! \brief Get the number of poses. */
+                std::size_t size() const;
+
+                /*! \brief Drop all the poses. */
+                void clear();
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_POSEBUFFER_H
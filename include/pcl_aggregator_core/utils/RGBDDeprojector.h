@@ -9,7 +9,18 @@
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <opencv2/opencv.hpp>
-#include <pcl_aggregator_core/cuda/CUDAPointClouds.cuh>
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+#include <pcl_aggregator_core/cuda/CUDA_RGBD.cuh>
+#endif
+#include <functional>
+#include <memory>
+#include <mutex>
+
+// default admissible depth range, in meters
+#define RGBD_DEFAULT_MIN_DEPTH 0.1f
+#define RGBD_DEFAULT_MAX_DEPTH 10.0f
+// default meters per unit of 16-bit depth images
+#define RGBD_DEFAULT_DEPTH_UNIT 0.001f
 
 namespace pcl_aggregator {
     namespace utils {
@@ -31,9 +42,25 @@ namespace pcl_aggregator {
                 cv::Mat last_color_image;
                 bool isColorImageSet = false;
 
+                float minDepth = RGBD_DEFAULT_MIN_DEPTH;
+                float maxDepth = RGBD_DEFAULT_MAX_DEPTH;
+                float depthUnit = RGBD_DEFAULT_DEPTH_UNIT; // meters per unit of 16-bit depth images
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                /*! \brief Device buffers and stream of this camera, kept between frames. */
+                std::unique_ptr<cuda::rgbd::DeprojectionContext> context;
+#endif
+
+                /*! \brief Called with each new deprojected pointcloud. */
+                std::function<void(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr)> pointCloudCallback;
+
+                /*! \brief Protects the images, the parameters and the context. */
+                mutable std::mutex mutex;
+
                 /*!
                  * \brief Start deprojecting the images into the pointcloud of this instance.
                  * Does not need to receive or return anything, it just uses the instance properties.
+                 * Must be called with the mutex held.
                  */
                 void deprojectImages();
 
@@ -63,14 +90,35 @@ namespace pcl_aggregator {
                  */
                 void setCameraFrameId(const std::string& frame_id);
 
+                /*!
+                 * \brief Set the admissible depth range. Pixels outside it are dropped.
+                 * @param minDepth Minimum depth in meters.
+                 * @param maxDepth Maximum depth in meters.
+                 */
+                void setDepthRange(float minDepth, float maxDepth);
+
+                /*!
+                 * \brief Set the scale of 16-bit depth images. Float depth images are always in meters.
+                 * @param unit Meters per unit.
+                 */
+                void setDepthUnit(float unit);
+
+                /*!
+                 * \brief Set a callback called with each new pointcloud, like a binding to PointCloudsManager::addCloud.
+                 * Each frame gets a new pointcloud, which this instance does not modify afterwards.
+                 * @param callback The callback.
+                 */
+                void setPointCloudCallback(const std::function<void(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr)>& callback);
+
                 /*!
                  * \brief Add a depth image to the processing pipeline.
-                 * @param img The image to process.
+                 * Deprojects it with the latest color image, if it has the same size.
+                 * @param img The image to process, 16-bit or float.
                  */
                 void addDepthImage(cv::Mat img);
                 /*!
-                 * \brief Add a color image to the processing pipeline.
-                 * @param img The image to process.
+                 * \brief Add a color image to the processing pipeline. Used by the next depth image.
+                 * @param img The image to process, BGR8.
                  */
                 void addColorImage(cv::Mat img);
 
@@ -0,0 +1,107 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_THREADPOOL_H
+#define PCL_AGGREGATOR_CORE_THREADPOOL_H
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief Thread Pool
+         *         Fixed set of worker threads running jobs from a shared queue.
+         *
+         * Replaces starting a thread per job. Jobs still queued when the pool is destroyed are run before the
+         * workers stop.
+         */
+        class ThreadPool {
+
+            private:
+                /*! \brief The worker threads. */
+                std::vector<std::thread> workers;
+
+                /*! \brief Jobs waiting for a worker. */
+                std::deque<std::function<void()>> jobs;
+
+                /*! \brief Mutex to manage access to the job queue. */
+                std::mutex jobsMutex;
+
+                /*! \brief Signals the workers about new jobs or stopping. */
+                std::condition_variable jobsCondition;
+
+                /*! \brief Flag to determine if the workers should stop. */
+                bool stopping = false;
+
+                /*! \brief Routine ran by each worker. */
+                void workerRoutine();
+
+            public:
+                /*! \brief Start the workers.
+                 *
+                 * @param nThreads Number of workers. Zero uses one per hardware thread.
+                 */
+                explicit ThreadPool(std::size_t nThreads = 0);
+                ~ThreadPool();
+
+                ThreadPool(const ThreadPool&) = delete;
+                ThreadPool& operator=(const ThreadPool&) = delete;
+
+                /*! \brief Queue a job to run on a worker.
+                 *
+                 * @param job The job to run.
+                 */
+                void submit(std::function<void()> job);
+
+                /*! \brief Get the number of workers. */
+                std::size_t getThreadCount() const;
+        };
+
+        /*! \brief Task Group
+         *         Tracks the jobs submitted to a ThreadPool by one owner, so the owner can wait for them.
+         *
+         * Jobs usually capture their owner, which must not be destroyed before they end. The destructor waits.
+         */
+        class TaskGroup {
+
+            private:
+                /*! \brief The pool the jobs run on. */
+                ThreadPool& pool;
+
+                /*! \brief Number of jobs submitted and not yet ended. */
+                std::size_t pending = 0;
+
+                /*! \brief Mutex to manage access to the pending count. */
+                std::mutex pendingMutex;
+
+                /*! \brief Signals the end of the last pending job. */
+                std::condition_variable pendingCondition;
+
+            public:
+                explicit TaskGroup(ThreadPool& pool);
+                ~TaskGroup();
+
+                TaskGroup(const TaskGroup&) = delete;
+                TaskGroup& operator=(const TaskGroup&) = delete;
+
+                /*! \brief Queue a job on the pool as part of this group.
+                 *
+                 * @param job The job to run.
+                 */
+                void submit(std::function<void()> job);
+
+                /*! \brief Wait until all the jobs of the group end. */
+                void wait();
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_THREADPOOL_H
@@ -0,0 +1,154 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#ifndef PCL_AGGREGATOR_CORE_TIMINGWHEEL_H
+#define PCL_AGGREGATOR_CORE_TIMINGWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
+
+// granularity of the expirations, in milliseconds
+#define TIMING_WHEEL_DEFAULT_TICK_MS 1
+// number of buckets of the wheel. must be a power of two
+#define TIMING_WHEEL_DEFAULT_SLOTS 4096
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        /*! \brief A scan waiting to expire on a TimingWheel. */
+        struct WheelTimer {
+            /*! \brief UNIX timestamp of the expiry, in milliseconds. */
+            unsigned long long expiry;
+            /*! \brief The label of the scan. */
+            std::uint32_t label;
+            /*! \brief Who registered the scan, to route the expiry back. */
+            void* owner;
+        };
+
+        /*! \brief Timing Wheel
+         *         Hashed timing wheel expiring labelled scans at their deadline.
+         *
+         * Each timer lands on the bucket of its tick, so scheduling is O(1) and each tick only visits its own
+         * bucket. Timers further away than a full turn wait on their bucket for the next turns. Each bucket is kept in
+         * expiry order, so the timers due are always at its front. A thread sleeps until the next busy bucket and
+         * hands all the timers due at once to the expiry callback.
+         */
+        class TimingWheel {
+
+            private:
+                /*! \brief The buckets of timers, indexed by tick modulo their count. Each in expiry order. */
+                std::vector<std::deque<WheelTimer>> slots;
+
+                /*! \brief Duration of a tick, in milliseconds. */
+                unsigned long long tickMs;
+
+                /*! \brief The next tick to visit. */
+                unsigned long long cursor;
+
+                /*! \brief Number of timers on the wheel. */
+                std::size_t count = 0;
+
+                /*! \brief The tick the thread is sleeping until. */
+                unsigned long long wakeTick = 0;
+
+                /*! \brief Called with the timers due, on the thread of the wheel. */
+                std::function<void(std::vector<WheelTimer>& expired)> onExpired;
+
+                /*! \brief Mutex to manage access to the buckets. */
+                std::mutex wheelMutex;
+
+                /*! \brief Held while the expiry callback runs, so cancelling can wait for it. */
+                std::mutex fireMutex;
+
+                /*! \brief Wakes the thread up on earlier timers or stopping. */
+                std::condition_variable wheelCondition;
+
+                /*! \brief Thread advancing the wheel. */
+                std::thread wheelThread;
+
+                /*! \brief Flag to determine if the thread should stop. */
+                bool stopping = false;
+
+                /*! \brief Get the current tick. */
+                unsigned long long getCurrentTick() const;
+
+                /*! \brief Move the timers due up to the tick from the visited buckets. Expects wheelMutex to be held. */
+                void collectExpired(unsigned long long tick, std::vector<WheelTimer>& expired);
+
+                /*! \brief Get the tick of the next busy bucket. Expects wheelMutex to be held. */
+                unsigned long long getNextBusyTick() const;
+
+                /*! \brief Routine ran by the thread of the wheel. */
+                void wheelRoutine();
+
+            public:
+                /*! \brief Start the wheel.
+                 *
+                 * @param onExpired Called with the timers due, which it may take. Must not cancel timers. Holds up
+                 *                  the wheel and cancel() while it runs, so heavy work is best handed off.
+                 * @param tickMs Granularity of the expirations, in milliseconds.
+                 * @param slotCount Number of buckets. Rounded up to a power of two.
+                 */
+                explicit TimingWheel(std::function<void(std::vector<WheelTimer>& expired)> onExpired,
+                                     unsigned long long tickMs = TIMING_WHEEL_DEFAULT_TICK_MS,
+                                     std::size_t slotCount = TIMING_WHEEL_DEFAULT_SLOTS);
+                ~TimingWheel();
+
+                TimingWheel(const TimingWheel&) = delete;
+                TimingWheel& operator=(const TimingWheel&) = delete;
+
+                /*! \brief Register a scan to expire. A deadline already past expires on the next tick.
+                 *
+                 * @param expiry UNIX timestamp of the expiry, in milliseconds.
+                 * @param label The label of the scan.
+                 * @param owner Who registered the scan.
+                 */
+                void schedule(unsigned long long expiry, std::uint32_t label, void* owner);
+
+                /*! \brief Drop all the timers of an owner, waiting for an expiry callback in progress.
+                 *
+                 * After it returns the callback is not called with timers of the owner anymore.
+                 *
+                 * @param owner The owner of the timers.
+                 */
+                void cancel(const void* owner);
+
+                /*! \brief Take the timers off the wheel in expiry order, ahead of their deadline, for as long as asked.
+                 *
+                 * Walks the buckets from the next tick and only visits the timers it takes, so the cost follows the
+                 * timers taken, plus a pass over the buckets for each turn skipped to reach them. The timers taken
+                 * can't be cancelled anymore, so the caller keeps their owners alive until it is done with them.
+                 *
+                 * @param take Called with the next timer, before taking it. Returning false stops. Runs with the
+                 *             buckets locked, so it must not call into the wheel.
+                 * @param taken The vector which receives the timers, the earliest first.
+                 * @return The number of timers taken.
+                 */
+                std::size_t takeEarliest(const std::function<bool(const WheelTimer&)>& take,
+                                         std::vector<WheelTimer>& taken);
+
+                /*! \brief Copy all the timers on the wheel, like for a checkpoint. Visits all the timers.
+                 *
+                 * @param timers The vector which receives the timers.
+                 */
+                void getTimers(std::vector<WheelTimer>& timers);
+
+                /*! \brief Stop the thread. The timers left don't expire. Called by the destructor. */
+                void stop();
+
+                /*! \brief Get the number of timers on the wheel. */
+                std::size_t size();
+        };
+
+    } // pcl_aggregator
+} // utils
+
+#endif //PCL_AGGREGATOR_CORE_TIMINGWHEEL_H
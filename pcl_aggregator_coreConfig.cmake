@@ -8,8 +8,19 @@ if(NOT TARGET pcl_aggregator_core)
     find_package(PCL REQUIRED)
     find_package(OpenCV REQUIRED)
     find_package(Eigen3 REQUIRED)
-    find_package(CUDA REQUIRED)
 
-    target_include_directories(pcl_aggregator_core INTERFACE /usr/include/pcl_aggregator_core ${CUDA_INCLUDE_DIRS})
-    target_link_libraries(pcl_aggregator_core INTERFACE ${PCL_LIBRARIES} ${OpenCV_LIBRARIES} ${Eigen3_LIBRARIES} ${CUDA_LIBRARIES})
+    # must match the WITH_CUDA option the library was built with
+    if(NOT DEFINED PCL_AGGREGATOR_CORE_WITH_CUDA)
+        set(PCL_AGGREGATOR_CORE_WITH_CUDA ON)
+    endif()
+
+    target_include_directories(pcl_aggregator_core INTERFACE /usr/include/pcl_aggregator_core)
+    target_link_libraries(pcl_aggregator_core INTERFACE ${PCL_LIBRARIES} ${OpenCV_LIBRARIES} ${Eigen3_LIBRARIES})
+
+    if(PCL_AGGREGATOR_CORE_WITH_CUDA)
+        find_package(CUDA REQUIRED)
+        target_include_directories(pcl_aggregator_core INTERFACE ${CUDA_INCLUDE_DIRS})
+        target_link_libraries(pcl_aggregator_core INTERFACE ${CUDA_LIBRARIES})
+        target_compile_definitions(pcl_aggregator_core INTERFACE PCL_AGGREGATOR_WITH_CUDA)
+    endif()
 endif()
\ No newline at end of file
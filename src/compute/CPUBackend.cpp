@@ -0,0 +1,863 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/compute/CPUBackend.h>
+#include <pcl_aggregator_core/utils/Metrics.h>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CPU_BACKEND_AVX2
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define CPU_BACKEND_NEON
+#include <arm_neon.h>
+#endif
+
+// bits used by each axis on the voxel key, like the GPU filter
+#define CPU_VOXEL_KEY_AXIS_BITS 21
+// key given to points which can't be voxelized. sorts last
+#define CPU_VOXEL_KEY_INVALID 0xFFFFFFFFFFFFFFFFULL
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        /*! \brief An affine transform as the four columns of its matrix, in single precision. */
+        struct TransformColumns {
+            alignas(16) float columns[4][4];
+
+            explicit TransformColumns(const Eigen::Affine3d& tf) {
+                Eigen::Matrix4f matrix = tf.matrix().cast<float>();
+                for(int c = 0; c < 4; c++) {
+                    for(int r = 0; r < 4; r++)
+                        this->columns[c][r] = matrix(r, c);
+                }
+            }
+        };
+
+        /*! \brief Running sums of the points of a voxel with the same label. */
+        struct CPUVoxelAccumulator {
+            float x = 0;
+            float y = 0;
+            float z = 0;
+            float r = 0;
+            float g = 0;
+            float b = 0;
+            std::uint32_t count = 0;
+            std::uint32_t label = 0;
+            std::uint32_t labelCount = 0;
+        };
+
+        /*! \brief Voxel key, label and index of a point, to order the points by voxel. */
+        struct VoxelEntry {
+            unsigned long long key;
+            std::uint32_t label;
+            std::uint32_t index;
+
+            bool operator<(const VoxelEntry& other) const {
+                return key != other.key ? key < other.key : label < other.label;
+            }
+        };
+
+        /*! \brief Voxel key of integer cell coordinates, already shifted to be positive. */
+        static inline unsigned long long cpuVoxelKey(long long vx, long long vy, long long vz) {
+            return ((unsigned long long) vx << (2 * CPU_VOXEL_KEY_AXIS_BITS)) |
+                   ((unsigned long long) vy << CPU_VOXEL_KEY_AXIS_BITS) |
+                   (unsigned long long) vz;
+        }
+
+        /*! \brief Run a job over ranges of [0, n), split over the hardware threads when large enough.
+         *
+         * Threads of its own instead of the shared pool, as the callers may be pool jobs themselves.
+         *
+         * @param n The number of points.
+         * @param job Called with the begin and end of each range.
+         */
+        template <typename Job>
+        static void parallelFor(std::size_t n, const Job& job) {
+
+            std::size_t nThreads = std::max(1u, std::thread::hardware_concurrency());
+            nThreads = std::min(nThreads, n / CPU_BACKEND_MIN_POINTS_PER_THREAD);
+
+            if(nThreads <= 1) {
+                job(0, n);
+                return;
+            }
+
+            std::size_t chunk = (n + nThreads - 1) / nThreads;
+
+            std::vector<std::thread> workers;
+            workers.reserve(nThreads - 1);
+            for(std::size_t t = 1; t < nThreads; t++) {
+                std::size_t begin = t * chunk;
+                std::size_t end = std::min(n, begin + chunk);
+                if(begin < end)
+                    workers.emplace_back(job, begin, end);
+            }
+
+            // the calling thread takes the first range
+            job(0, std::min(n, chunk));
+
+            for(auto& worker : workers)
+                worker.join();
+        }
+
+        /*! \brief Transform the coordinates of a point. The fourth coordinate is kept. */
+        static inline void transformPointScalar(const pcl::PointXYZRGBL& source, pcl::PointXYZRGBL& destination,
+                                                const TransformColumns& m) {
+            float x = source.x;
+            float y = source.y;
+            float z = source.z;
+            destination.x = m.columns[0][0] * x + m.columns[1][0] * y + m.columns[2][0] * z + m.columns[3][0];
+            destination.y = m.columns[0][1] * x + m.columns[1][1] * y + m.columns[2][1] * z + m.columns[3][1];
+            destination.z = m.columns[0][2] * x + m.columns[1][2] * y + m.columns[2][2] * z + m.columns[3][2];
+            destination.data[3] = source.data[3];
+        }
+
+        /*! \brief Copy the color and stamp the label of an ingested point. */
+        template <bool Ingest>
+        static inline void finishPoint(const pcl::PointXYZRGBL& source, pcl::PointXYZRGBL& destination,
+                                       std::uint32_t label) {
+            if constexpr (Ingest) {
+                destination.rgba = source.rgba;
+                destination.label = label;
+            }
+        }
+
+        template <bool Ingest>
+        static void transformPointsScalar(const pcl::PointXYZRGBL *source, pcl::PointXYZRGBL *destination,
+                                          std::size_t n, const TransformColumns& m, std::uint32_t label) {
+            for(std::size_t i = 0; i < n; i++) {
+                transformPointScalar(source[i], destination[i], m);
+                finishPoint<Ingest>(source[i], destination[i], label);
+            }
+        }
+
+#ifdef CPU_BACKEND_AVX2
+        /*! \brief Transform two points per instruction, one on each 128-bit lane. */
+        template <bool Ingest>
+        __attribute__((target("avx2,fma")))
+        static void transformPointsAVX2(const pcl::PointXYZRGBL *source, pcl::PointXYZRGBL *destination,
+                                        std::size_t n, const TransformColumns& m, std::uint32_t label) {
+
+            // both lanes hold the same column
+            __m256 c0 = _mm256_broadcast_ps((const __m128 *) m.columns[0]);
+            __m256 c1 = _mm256_broadcast_ps((const __m128 *) m.columns[1]);
+            __m256 c2 = _mm256_broadcast_ps((const __m128 *) m.columns[2]);
+            __m256 c3 = _mm256_broadcast_ps((const __m128 *) m.columns[3]);
+
+            std::size_t i = 0;
+            for(; i + 2 <= n; i += 2) {
+                __m256 p = _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(source[i].data)),
+                                                _mm_loadu_ps(source[i + 1].data), 1);
+
+                __m256 r = _mm256_fmadd_ps(c0, _mm256_permute_ps(p, 0x00), c3);
+                r = _mm256_fmadd_ps(c1, _mm256_permute_ps(p, 0x55), r);
+                r = _mm256_fmadd_ps(c2, _mm256_permute_ps(p, 0xAA), r);
+                // keep the fourth coordinate as it was
+                r = _mm256_blend_ps(r, p, 0x88);
+
+                _mm_storeu_ps(destination[i].data, _mm256_castps256_ps128(r));
+                _mm_storeu_ps(destination[i + 1].data, _mm256_extractf128_ps(r, 1));
+
+                finishPoint<Ingest>(source[i], destination[i], label);
+                finishPoint<Ingest>(source[i + 1], destination[i + 1], label);
+            }
+
+            transformPointsScalar<Ingest>(source + i, destination + i, n - i, m, label);
+        }
+
+        static bool hasAVX2() {
+            static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+            return supported;
+        }
+#endif
+
+#ifdef CPU_BACKEND_NEON
+        template <bool Ingest>
+        static void transformPointsNEON(const pcl::PointXYZRGBL *source, pcl::PointXYZRGBL *destination,
+                                        std::size_t n, const TransformColumns& m, std::uint32_t label) {
+
+            float32x4_t c0 = vld1q_f32(m.columns[0]);
+            float32x4_t c1 = vld1q_f32(m.columns[1]);
+            float32x4_t c2 = vld1q_f32(m.columns[2]);
+            float32x4_t c3 = vld1q_f32(m.columns[3]);
+
+            for(std::size_t i = 0; i < n; i++) {
+                float32x4_t p = vld1q_f32(source[i].data);
+
+                float32x4_t r = vfmaq_laneq_f32(c3, c0, p, 0);
+                r = vfmaq_laneq_f32(r, c1, p, 1);
+                r = vfmaq_laneq_f32(r, c2, p, 2);
+                // keep the fourth coordinate as it was
+                r = vsetq_lane_f32(vgetq_lane_f32(p, 3), r, 3);
+
+                vst1q_f32(destination[i].data, r);
+                finishPoint<Ingest>(source[i], destination[i], label);
+            }
+        }
+#endif
+
+        /*! \brief Transform a range of points with the widest instructions available.
+         *
+         * @param source The points to transform.
+         * @param destination Receives the transformed points. May be the source.
+         * @param n The number of points.
+         * @param m The transform.
+         * @param label With Ingest, the label to stamp, the color being copied too.
+         */
+        template <bool Ingest>
+        static void transformPoints(const pcl::PointXYZRGBL *source, pcl::PointXYZRGBL *destination,
+                                    std::size_t n, const TransformColumns& m, std::uint32_t label) {
+#if defined(CPU_BACKEND_AVX2)
+            if(hasAVX2()) {
+                transformPointsAVX2<Ingest>(source, destination, n, m, label);
+                return;
+            }
+#elif defined(CPU_BACKEND_NEON)
+            transformPointsNEON<Ingest>(source, destination, n, m, label);
+            return;
+#endif
+            transformPointsScalar<Ingest>(source, destination, n, m, label);
+        }
+
+        /*! \brief Get the cell of a point on a grid, shifted to be positive.
+         *
+         * @return If the point falls inside the range of the keys.
+         */
+        static inline bool getCell(const pcl::PointXYZRGBL& p, float inverseCellSize,
+                                   long long& vx, long long& vy, long long& vz) {
+
+            const long long offset = 1LL << (CPU_VOXEL_KEY_AXIS_BITS - 1);
+            const long long limit = 1LL << CPU_VOXEL_KEY_AXIS_BITS;
+
+            vx = (long long) std::floor(p.x * inverseCellSize) + offset;
+            vy = (long long) std::floor(p.y * inverseCellSize) + offset;
+            vz = (long long) std::floor(p.z * inverseCellSize) + offset;
+
+            return vx >= 0 && vx < limit && vy >= 0 && vy < limit && vz >= 0 && vz < limit;
+        }
+
+        /*! \brief Drop the kept points with fewer kept neighbors than the filter asks for within its radius.
+         *
+         * The points are ordered by cells as large as the radius, so each one only visits the 27 cells around it,
+         * and stops as soon as it has enough neighbors.
+         *
+         * @param points The raw points.
+         * @param n The number of points.
+         * @param filter The filter, with the outlier removal.
+         * @param keep The flags of the points kept, updated in-place.
+         */
+        static void removeRadiusOutliers(const pcl::PointXYZRGBL *points, std::size_t n, const PointFilter& filter,
+                                         std::vector<std::uint8_t>& keep) {
+
+            const long long limit = 1LL << CPU_VOXEL_KEY_AXIS_BITS;
+            float inverseCellSize = 1.0f / filter.outlierRadius;
+            float radiusSquared = filter.outlierRadius * filter.outlierRadius;
+            std::uint32_t minNeighbors = filter.outlierMinNeighbors;
+
+            // cell key and index of each kept point, by cell
+            std::vector<std::pair<unsigned long long,std::uint32_t>> entries;
+            entries.reserve(n);
+            for(std::size_t i = 0; i < n; i++) {
+                if(!keep[i])
+                    continue;
+
+                long long vx, vy, vz;
+                if(!getCell(points[i], inverseCellSize, vx, vy, vz)) {
+                    // too far to have neighbors
+                    keep[i] = 0;
+                    continue;
+                }
+                entries.emplace_back(cpuVoxelKey(vx, vy, vz), (std::uint32_t) i);
+            }
+            std::sort(entries.begin(), entries.end());
+
+            std::vector<std::uint8_t> inlier(entries.size(), 0);
+            parallelFor(entries.size(), [&](std::size_t begin, std::size_t end) {
+                for(std::size_t j = begin; j < end; j++) {
+
+                    std::uint32_t index = entries[j].second;
+                    const pcl::PointXYZRGBL& p = points[index];
+                    long long vx, vy, vz;
+                    getCell(p, inverseCellSize, vx, vy, vz);
+
+                    std::uint32_t neighbors = 0;
+                    for(int dx = -1; dx <= 1 && neighbors < minNeighbors; dx++) {
+                        for(int dy = -1; dy <= 1 && neighbors < minNeighbors; dy++) {
+                            for(int dz = -1; dz <= 1 && neighbors < minNeighbors; dz++) {
+                                long long x = vx + dx;
+                                long long y = vy + dy;
+                                long long z = vz + dz;
+                                if(x < 0 || x >= limit || y < 0 || y >= limit || z < 0 || z >= limit)
+                                    continue;
+
+                                unsigned long long key = cpuVoxelKey(x, y, z);
+                                auto it = std::lower_bound(entries.begin(), entries.end(),
+                                                           std::make_pair(key, (std::uint32_t) 0));
+                                for(; it != entries.end() && it->first == key && neighbors < minNeighbors; ++it) {
+                                    if(it->second == index)
+                                        continue;
+                                    const pcl::PointXYZRGBL& q = points[it->second];
+                                    float ex = q.x - p.x;
+                                    float ey = q.y - p.y;
+                                    float ez = q.z - p.z;
+                                    if(ex * ex + ey * ey + ez * ez <= radiusSquared)
+                                        neighbors++;
+                                }
+                            }
+                        }
+                    }
+
+                    inlier[j] = neighbors >= minNeighbors ? 1 : 0;
+                }
+            });
+
+            // only now, so every point counted its neighbors among the same points
+            for(std::size_t j = 0; j < entries.size(); j++) {
+                if(!inlier[j])
+                    keep[entries[j].second] = 0;
+            }
+        }
+
+        /*! \brief Find the runs of consecutive points of a raw PointCloud which pass a filter.
+         *
+         * @param points The raw points, in the sensor frame.
+         * @param n The number of points.
+         * @param filter The filter.
+         * @param runs Receives the runs, with their place on the source and on the kept points.
+         * @return The number of points kept.
+         */
+        static std::size_t filterPoints(const pcl::PointXYZRGBL *points, std::size_t n, const PointFilter& filter,
+                                        std::vector<PointRangeMove>& runs) {
+
+            std::vector<std::uint8_t> keep(n);
+            parallelFor(n, [points, &filter, &keep](std::size_t begin, std::size_t end) {
+                for(std::size_t i = begin; i < end; i++)
+                    keep[i] = filter.keep(points[i].x, points[i].y, points[i].z) ? 1 : 0;
+            });
+
+            if(filter.outlierRadius > 0.0f)
+                removeRadiusOutliers(points, n, filter, keep);
+
+            runs.clear();
+            std::size_t nKept = 0;
+            for(std::size_t i = 0; i < n;) {
+                if(!keep[i]) {
+                    i++;
+                    continue;
+                }
+                std::size_t start = i;
+                while(i < n && keep[i])
+                    i++;
+                runs.push_back({start, nKept, i - start});
+                nKept += i - start;
+            }
+
+            utils::Metrics::add(utils::CounterMetric::POINTS_FILTERED, n - nKept);
+
+            return nKept;
+        }
+
+        /*! \brief Run a job over the kept points of a filtered PointCloud, split like parallelFor.
+         *
+         * @param runs The runs of kept points, from filterPoints.
+         * @param nKept The number of points kept.
+         * @param job Called with the source index, the destination index and the number of points of each piece.
+         */
+        template <typename Job>
+        static void parallelForRuns(const std::vector<PointRangeMove>& runs, std::size_t nKept, const Job& job) {
+            parallelFor(nKept, [&runs, &job](std::size_t begin, std::size_t end) {
+                // the first run ending after the beginning of the range
+                auto run = std::upper_bound(runs.begin(), runs.end(), begin,
+                                            [](std::size_t position, const PointRangeMove& r) {
+                                                return position < r.destination + r.count;
+                                            });
+                for(; run != runs.end() && run->destination < end; ++run) {
+                    std::size_t first = std::max(begin, run->destination);
+                    std::size_t last = std::min(end, run->destination + run->count);
+                    job(run->source + (first - run->destination), first, last - first);
+                }
+            });
+        }
+
+        const char* CPUBackend::getName() const {
+            return "cpu";
+        }
+
+        void CPUBackend::setPointCloudLabel(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, std::uint32_t label) {
+
+            if(cloud == nullptr || cloud->empty())
+                return;
+
+            pcl::PointXYZRGBL *points = cloud->points.data();
+            parallelFor(cloud->size(), [points, label](std::size_t begin, std::size_t end) {
+                for(std::size_t i = begin; i < end; i++)
+                    points[i].label = label;
+            });
+        }
+
+        void CPUBackend::transformPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud,
+                                             const Eigen::Affine3d& transform) {
+
+            if(cloud == nullptr || cloud->empty())
+                return;
+
+            TransformColumns m(transform);
+            pcl::PointXYZRGBL *points = cloud->points.data();
+            parallelFor(cloud->size(), [points, &m](std::size_t begin, std::size_t end) {
+                transformPoints<false>(points + begin, points + begin, end - begin, m, 0);
+            });
+        }
+
+        int CPUBackend::concatenatePointClouds(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud1,
+                                               const pcl::PointCloud<pcl::PointXYZRGBL>& cloud2) {
+
+            if(cloud1 == nullptr)
+                return -1;
+
+            if(cloud2.empty())
+                return 0;
+
+            std::size_t cloud1OriginalSize = cloud1->size();
+            cloud1->resize(cloud1OriginalSize + cloud2.size());
+
+            const pcl::PointXYZRGBL *source = cloud2.points.data();
+            pcl::PointXYZRGBL *destination = cloud1->points.data() + cloud1OriginalSize;
+            parallelFor(cloud2.size(), [source, destination](std::size_t begin, std::size_t end) {
+                std::copy(source + begin, source + end, destination + begin);
+            });
+
+            return 0;
+        }
+
+        int CPUBackend::ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                         const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                         std::uint32_t label, const Eigen::Affine3d& transform,
+                                         const PointFilter *filter) {
+
+            if(destination == nullptr)
+                return -1;
+
+            if(source.empty())
+                return 0;
+
+            TransformColumns m(transform);
+            const pcl::PointXYZRGBL *sourcePoints = source.points.data();
+            std::size_t destinationOriginalSize = destination->size();
+
+            // the dropped points are never transformed nor copied
+            if(filter != nullptr && filter->isActive()) {
+                std::vector<PointRangeMove> runs;
+                std::size_t nKept = filterPoints(sourcePoints, source.size(), *filter, runs);
+                destination->resize(destinationOriginalSize + nKept);
+
+                pcl::PointXYZRGBL *destinationPoints = destination->points.data() + destinationOriginalSize;
+                parallelForRuns(runs, nKept, [sourcePoints, destinationPoints, &m, label](std::size_t s, std::size_t d,
+                                                                                          std::size_t count) {
+                    transformPoints<true>(sourcePoints + s, destinationPoints + d, count, m, label);
+                });
+
+                return 0;
+            }
+
+            destination->resize(destinationOriginalSize + source.size());
+
+            // one pass: each point is read once and written once, already labelled and transformed
+            pcl::PointXYZRGBL *destinationPoints = destination->points.data() + destinationOriginalSize;
+            parallelFor(source.size(), [sourcePoints, destinationPoints, &m, label](std::size_t begin, std::size_t end) {
+                transformPoints<true>(sourcePoints + begin, destinationPoints + begin, end - begin, m, label);
+            });
+
+            return 0;
+        }
+
+        int CPUBackend::ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                         const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                         std::uint32_t label, const DeskewTable& table,
+                                         const PointFilter *filter) {
+
+            if(destination == nullptr)
+                return -1;
+
+            if(source.empty())
+                return 0;
+
+            const pcl::PointXYZRGBL *sourcePoints = source.points.data();
+            std::size_t destinationOriginalSize = destination->size();
+
+            if(filter != nullptr && filter->isActive()) {
+                std::vector<PointRangeMove> runs;
+                std::size_t nKept = filterPoints(sourcePoints, source.size(), *filter, runs);
+                destination->resize(destinationOriginalSize + nKept);
+
+                // the time of each point still comes from its place on the raw scan
+                pcl::PointXYZRGBL *destinationPoints = destination->points.data() + destinationOriginalSize;
+                parallelForRuns(runs, nKept, [sourcePoints, destinationPoints, &table, label](std::size_t s,
+                                                                                              std::size_t d,
+                                                                                              std::size_t count) {
+                    for(std::size_t k = 0; k < count; k++) {
+                        pcl::PointXYZRGBL& p = destinationPoints[d + k];
+                        p = sourcePoints[s + k];
+                        table.apply(s + k, p.x, p.y, p.z);
+                        p.label = label;
+                    }
+                });
+
+                return 0;
+            }
+
+            destination->resize(destinationOriginalSize + source.size());
+
+            pcl::PointXYZRGBL *destinationPoints = destination->points.data() + destinationOriginalSize;
+            parallelFor(source.size(), [sourcePoints, destinationPoints, &table, label](std::size_t begin, std::size_t end) {
+                for(std::size_t i = begin; i < end; i++) {
+                    pcl::PointXYZRGBL& p = destinationPoints[i];
+                    p = sourcePoints[i];
+                    table.apply(i, p.x, p.y, p.z);
+                    p.label = label;
+                }
+            });
+
+            return 0;
+        }
+
+        int CPUBackend::voxelDownsample(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, float leafSize,
+                                        std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns) {
+
+            if(labelRuns != nullptr)
+                labelRuns->clear();
+
+            if(cloud == nullptr || cloud->empty())
+                return 0;
+
+            if(leafSize <= 0.0f) {
+                std::cerr << "CPUBackend::voxelDownsample: the leaf size must be positive!" << std::endl;
+                return -1;
+            }
+
+            utils::ScopedTimer voxelizeTimer(utils::HistogramMetric::VOXELIZE_TIME_NS);
+
+            std::size_t nPoints = cloud->size();
+            const pcl::PointXYZRGBL *points = cloud->points.data();
+            float inverseLeafSize = 1.0f / leafSize;
+
+            // same keys as the GPU filter, so both give the same voxels
+            std::vector<VoxelEntry> entries(nPoints);
+            parallelFor(nPoints, [points, inverseLeafSize, &entries](std::size_t begin, std::size_t end) {
+
+                const long long offset = 1LL << (CPU_VOXEL_KEY_AXIS_BITS - 1);
+                const long long limit = 1LL << CPU_VOXEL_KEY_AXIS_BITS;
+
+                for(std::size_t i = begin; i < end; i++) {
+                    const pcl::PointXYZRGBL& p = points[i];
+                    entries[i].label = p.label;
+                    entries[i].index = (std::uint32_t) i;
+                    entries[i].key = CPU_VOXEL_KEY_INVALID;
+
+                    if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                        continue;
+
+                    long long vx = (long long) std::floor(p.x * inverseLeafSize) + offset;
+                    long long vy = (long long) std::floor(p.y * inverseLeafSize) + offset;
+                    long long vz = (long long) std::floor(p.z * inverseLeafSize) + offset;
+                    if(vx < 0 || vx >= limit || vy < 0 || vy >= limit || vz < 0 || vz >= limit)
+                        continue;
+
+                    entries[i].key = ((unsigned long long) vx << (2 * CPU_VOXEL_KEY_AXIS_BITS)) |
+                                     ((unsigned long long) vy << CPU_VOXEL_KEY_AXIS_BITS) |
+                                     (unsigned long long) vz;
+                }
+            });
+
+            // by voxel, and by label inside each voxel
+            std::sort(entries.begin(), entries.end());
+
+            std::vector<CPUVoxelAccumulator> voxels;
+            std::size_t i = 0;
+            while(i < nPoints && entries[i].key != CPU_VOXEL_KEY_INVALID) {
+
+                unsigned long long key = entries[i].key;
+                CPUVoxelAccumulator voxel;
+
+                while(i < nPoints && entries[i].key == key) {
+
+                    // the points of each label are together, the first label with most points wins
+                    std::uint32_t label = entries[i].label;
+                    std::uint32_t labelCount = 0;
+                    for(; i < nPoints && entries[i].key == key && entries[i].label == label; i++) {
+                        const pcl::PointXYZRGBL& p = points[entries[i].index];
+                        voxel.x += p.x;
+                        voxel.y += p.y;
+                        voxel.z += p.z;
+                        voxel.r += p.r;
+                        voxel.g += p.g;
+                        voxel.b += p.b;
+                        labelCount++;
+                    }
+
+                    voxel.count += labelCount;
+                    if(labelCount > voxel.labelCount) {
+                        voxel.label = label;
+                        voxel.labelCount = labelCount;
+                    }
+                }
+
+                voxels.push_back(voxel);
+            }
+
+            // group the centroids by label, so removing a label touches a contiguous range
+            std::stable_sort(voxels.begin(), voxels.end(), [](const CPUVoxelAccumulator& a, const CPUVoxelAccumulator& b) {
+                return a.label < b.label;
+            });
+
+            pcl::PointCloud<pcl::PointXYZRGBL>::VectorType centroids(voxels.size());
+            for(std::size_t v = 0; v < voxels.size(); v++) {
+
+                const CPUVoxelAccumulator& voxel = voxels[v];
+                float inverseCount = 1.0f / voxel.count;
+
+                centroids[v].x = voxel.x * inverseCount;
+                centroids[v].y = voxel.y * inverseCount;
+                centroids[v].z = voxel.z * inverseCount;
+                centroids[v].data[3] = 1.0f;
+                centroids[v].r = (std::uint8_t) (voxel.r * inverseCount + 0.5f);
+                centroids[v].g = (std::uint8_t) (voxel.g * inverseCount + 0.5f);
+                centroids[v].b = (std::uint8_t) (voxel.b * inverseCount + 0.5f);
+                centroids[v].a = 255;
+                centroids[v].label = voxel.label;
+
+                if(labelRuns != nullptr) {
+                    if(!labelRuns->empty() && labelRuns->back().first == voxel.label)
+                        labelRuns->back().second++;
+                    else
+                        labelRuns->emplace_back(voxel.label, 1);
+                }
+            }
+
+            utils::Metrics::add(utils::CounterMetric::DOWNSAMPLE_POINTS_IN, nPoints);
+            utils::Metrics::add(utils::CounterMetric::DOWNSAMPLE_POINTS_OUT, centroids.size());
+
+            cloud->points.swap(centroids);
+            cloud->width = cloud->points.size();
+            cloud->height = 1;
+
+            return 0;
+        }
+
+        /*! \brief Plane fitted to the target points of a registration cell. */
+        struct CPURegistrationCell {
+            Eigen::Vector3d sum = Eigen::Vector3d::Zero();
+            Eigen::Matrix3d squares = Eigen::Matrix3d::Zero();
+            std::uint32_t count = 0;
+            Eigen::Vector3f centroid;
+            Eigen::Vector3f normal;
+            bool planar = false;
+        };
+
+        int CPUBackend::alignPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                        const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                        const RegistrationParams& params, RegistrationResult& result) {
+
+            if(source.empty() || target.empty())
+                return 0;
+
+            if(params.cellSize <= 0.0f) {
+                std::cerr << "CPUBackend::alignPointCloud: the cell size must be positive!" << std::endl;
+                return -1;
+            }
+
+            const float inverseCellSize = 1.0f / params.cellSize;
+            const long long offset = 1LL << (CPU_VOXEL_KEY_AXIS_BITS - 1);
+            const long long limit = 1LL << CPU_VOXEL_KEY_AXIS_BITS;
+
+            // same cells as the GPU registration
+            std::unordered_map<unsigned long long, CPURegistrationCell> cells;
+            for(const auto& p : target.points) {
+
+                if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                    continue;
+
+                long long vx = (long long) std::floor(p.x * inverseCellSize) + offset;
+                long long vy = (long long) std::floor(p.y * inverseCellSize) + offset;
+                long long vz = (long long) std::floor(p.z * inverseCellSize) + offset;
+                if(vx < 0 || vx >= limit || vy < 0 || vy >= limit || vz < 0 || vz >= limit)
+                    continue;
+
+                Eigen::Vector3d point(p.x, p.y, p.z);
+                CPURegistrationCell& cell = cells[cpuVoxelKey(vx, vy, vz)];
+                cell.sum += point;
+                cell.squares += point * point.transpose();
+                cell.count++;
+            }
+
+            for(auto& entry : cells) {
+
+                CPURegistrationCell& cell = entry.second;
+                Eigen::Vector3d mean = cell.sum / cell.count;
+                cell.centroid = mean.cast<float>();
+
+                if(cell.count < REGISTRATION_MIN_CELL_POINTS)
+                    continue;
+
+                Eigen::Matrix3d covariance = cell.squares / cell.count - mean * mean.transpose();
+                Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> solver(covariance);
+                if(solver.info() != Eigen::Success)
+                    continue;
+
+                // the eigenvalues come in increasing order
+                cell.normal = solver.eigenvectors().col(0).cast<float>();
+                cell.planar = true;
+            }
+
+            const pcl::PointXYZRGBL *points = source.points.data();
+            const float maxDistanceSquared = params.maxCorrespondenceDistance * params.maxCorrespondenceDistance;
+
+            auto accumulate = [&](const Eigen::Affine3d& pose, NormalEquations& equations) {
+
+                Eigen::Affine3f tf = pose.cast<float>();
+                std::mutex equationsMutex;
+
+                parallelFor(source.size(), [&](std::size_t begin, std::size_t end) {
+
+                    NormalEquations local = Registration::zero();
+
+                    for(std::size_t i = begin; i < end; i++) {
+
+                        const pcl::PointXYZRGBL& point = points[i];
+                        if(!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+                            continue;
+
+                        Eigen::Vector3f p = tf * Eigen::Vector3f(point.x, point.y, point.z);
+                        long long vx = (long long) std::floor(p.x() * inverseCellSize) + offset;
+                        long long vy = (long long) std::floor(p.y() * inverseCellSize) + offset;
+                        long long vz = (long long) std::floor(p.z() * inverseCellSize) + offset;
+
+                        // the closest centroid of the 27 cells around the point
+                        const CPURegistrationCell *best = nullptr;
+                        float bestDistance = maxDistanceSquared;
+                        for(long long x = vx - 1; x <= vx + 1; x++) {
+                            for(long long y = vy - 1; y <= vy + 1; y++) {
+                                for(long long z = vz - 1; z <= vz + 1; z++) {
+                                    if(x < 0 || x >= limit || y < 0 || y >= limit || z < 0 || z >= limit)
+                                        continue;
+
+                                    auto it = cells.find(cpuVoxelKey(x, y, z));
+                                    if(it == cells.end() || !it->second.planar)
+                                        continue;
+
+                                    float distance = (p - it->second.centroid).squaredNorm();
+                                    if(distance < bestDistance) {
+                                        bestDistance = distance;
+                                        best = &it->second;
+                                    }
+                                }
+                            }
+                        }
+
+                        if(best == nullptr)
+                            continue;
+
+                        Registration::addCorrespondence(p, best->normal, best->normal.dot(p - best->centroid), local);
+                    }
+
+                    std::lock_guard<std::mutex> lock(equationsMutex);
+                    for(int k = 0; k < 21; k++)
+                        equations.hessian[k] += local.hessian[k];
+                    for(int k = 0; k < 6; k++)
+                        equations.gradient[k] += local.gradient[k];
+                    equations.error += local.error;
+                    equations.count += local.count;
+                });
+
+                return 0;
+            };
+
+            return Registration::iterate(params, accumulate, result);
+        }
+
+        /*! \brief Deproject the pixels of an image with the given depth type. */
+        template <typename DepthT>
+        static void deprojectRows(const cv::Mat& colorImage, const cv::Mat& depthImage, const Eigen::Matrix3d& K,
+                                  float depthScale, float minDepth, float maxDepth,
+                                  pcl::PointCloud<pcl::PointXYZRGBL>& destination) {
+
+            float invFx = (float) (1.0 / K(0, 0));
+            float invFy = (float) (1.0 / K(1, 1));
+            auto cx = (float) K(0, 2);
+            auto cy = (float) K(1, 2);
+
+            bool hasColor = !colorImage.empty();
+
+            for(int row = 0; row < depthImage.rows; row++) {
+
+                const DepthT *depthRow = depthImage.ptr<DepthT>(row);
+                const unsigned char *colorRow = hasColor ? colorImage.ptr<unsigned char>(row) : nullptr;
+
+                for(int col = 0; col < depthImage.cols; col++) {
+
+                    float z = (float) depthRow[col] * depthScale;
+                    // also rejects NaN
+                    if(!(z > 0.0f && z >= minDepth && z <= maxDepth && std::isfinite(z)))
+                        continue;
+
+                    pcl::PointXYZRGBL point;
+                    point.x = ((float) col - cx) * z * invFx;
+                    point.y = ((float) row - cy) * z * invFy;
+                    point.z = z;
+                    point.data[3] = 1.0f;
+                    if(colorRow != nullptr) {
+                        point.b = colorRow[col * 3];
+                        point.g = colorRow[col * 3 + 1];
+                        point.r = colorRow[col * 3 + 2];
+                    } else {
+                        point.b = 255;
+                        point.g = 255;
+                        point.r = 255;
+                    }
+                    point.a = 255;
+                    point.label = 0;
+
+                    destination.points.push_back(point);
+                }
+            }
+        }
+
+        int CPUBackend::deprojectImages(const cv::Mat& colorImage, const cv::Mat& depthImage, const Eigen::Matrix3d& K,
+                                        float minDepth, float maxDepth,
+                                        pcl::PointCloud<pcl::PointXYZRGBL>& destination, float depthUnit) {
+
+            if(depthImage.empty() || depthImage.channels() != 1 ||
+               (depthImage.depth() != CV_16U && depthImage.depth() != CV_32F)) {
+                std::cerr << "Unsupported depth image: expected one channel of 16-bit or float depth" << std::endl;
+                return -2;
+            }
+
+            if(!colorImage.empty() && (colorImage.type() != CV_8UC3 ||
+                                       colorImage.rows != depthImage.rows || colorImage.cols != depthImage.cols)) {
+                std::cerr << "The color image must be BGR8 and of the same size as the depth image" << std::endl;
+                return -3;
+            }
+
+            destination.points.clear();
+            destination.points.reserve(depthImage.total());
+
+            if(depthImage.depth() == CV_16U)
+                deprojectRows<unsigned short>(colorImage, depthImage, K, depthUnit, minDepth, maxDepth, destination);
+            else
+                deprojectRows<float>(colorImage, depthImage, K, 1.0f, minDepth, maxDepth, destination);
+
+            destination.width = destination.points.size();
+            destination.height = 1;
+            destination.is_dense = true;
+
+            return 0;
+        }
+
+    } // pcl_aggregator
+} // compute
@@ -0,0 +1,65 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#include <pcl_aggregator_core/compute/CPUBackend.h>
+#include <atomic>
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+#include <pcl_aggregator_core/cuda/CUDABackend.cuh>
+#endif
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        static std::atomic<BackendPreference> preference{BackendPreference::AUTO};
+        static std::atomic<std::size_t> cudaMinPoints{COMPUTE_DEFAULT_CUDA_MIN_POINTS};
+
+        ComputeBackend& ComputeBackend::getCPU() {
+            static CPUBackend cpu;
+            return cpu;
+        }
+
+        bool ComputeBackend::isCudaAvailable() {
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            return cuda::CUDABackend::isDeviceAvailable();
+#else
+            return false;
+#endif
+        }
+
+        ComputeBackend& ComputeBackend::select(std::size_t nPoints) {
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            static cuda::CUDABackend gpu;
+
+            BackendPreference current = preference.load(std::memory_order_relaxed);
+            if(current != BackendPreference::CPU && isCudaAvailable() &&
+               (current == BackendPreference::CUDA || nPoints >= cudaMinPoints.load(std::memory_order_relaxed)))
+                return gpu;
+#else
+            (void) nPoints;
+#endif
+
+            return getCPU();
+        }
+
+        void ComputeBackend::setPreference(BackendPreference p) {
+            preference.store(p, std::memory_order_relaxed);
+        }
+
+        BackendPreference ComputeBackend::getPreference() {
+            return preference.load(std::memory_order_relaxed);
+        }
+
+        void ComputeBackend::setCudaMinPoints(std::size_t nPoints) {
+            cudaMinPoints.store(nPoints, std::memory_order_relaxed);
+        }
+
+        std::size_t ComputeBackend::getCudaMinPoints() {
+            return cudaMinPoints.load(std::memory_order_relaxed);
+        }
+
+    } // pcl_aggregator
+} // compute
@@ -0,0 +1,51 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/compute/Deskew.h>
+#include <algorithm>
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        int Deskew::buildTable(const utils::PoseBuffer& poses, std::uint64_t stamp, const DeskewParams& params,
+                               const Eigen::Affine3d& prefix, const Eigen::Affine3d& sensorTransform,
+                               std::uint32_t width, std::size_t count, DeskewTable& table) {
+
+            Eigen::Affine3d reference;
+            if(!poses.getPose(stamp, reference))
+                return -1;
+
+            table.timing = params.timing;
+            table.width = width;
+            table.count = count;
+
+            // no more pieces than distinct point times
+            std::size_t steps = params.timing == DeskewTiming::COLUMN ? width : count;
+            table.segments = (std::uint32_t) std::clamp<std::size_t>(steps > 1 ? steps - 1 : 1, 1, DESKEW_MAX_SEGMENTS);
+
+            std::uint64_t start = stamp;
+            if(params.stampAtScanEnd)
+                start = stamp > params.scanDuration ? stamp - params.scanDuration : 0;
+
+            Eigen::Affine3d referenceInverse = reference.inverse();
+
+            for(std::uint32_t k = 0; k <= table.segments; k++) {
+
+                std::uint64_t t = start + params.scanDuration * k / table.segments;
+
+                Eigen::Affine3d pose = reference;
+                poses.getPose(t, pose);
+
+                Eigen::Matrix4f m = (prefix * referenceInverse * pose * sensorTransform).matrix().cast<float>();
+                for(int r = 0; r < 3; r++) {
+                    for(int c = 0; c < 4; c++)
+                        table.transforms[k][r][c] = m(r, c);
+                }
+            }
+
+            return 0;
+        }
+
+    } // pcl_aggregator
+} // compute
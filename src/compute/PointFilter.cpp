@@ -0,0 +1,80 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/compute/PointFilter.h>
+#include <iostream>
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        /*! \brief Bring a box of the robot base frame to the sensor frame. */
+        static FilterBox toSensorFrame(const Eigen::AlignedBox3f& box, const Eigen::Affine3d& sensorTransform) {
+
+            FilterBox result;
+
+            // from the sensor frame to the base frame, then to the center of the box
+            Eigen::Affine3d toBox = Eigen::Translation3d(-box.center().cast<double>()) * sensorTransform;
+            Eigen::Matrix4f m = toBox.matrix().cast<float>();
+            for(int r = 0; r < 3; r++) {
+                for(int c = 0; c < 4; c++)
+                    result.transform[r][c] = m(r, c);
+                result.halfExtents[r] = box.sizes()(r) * 0.5f;
+            }
+
+            return result;
+        }
+
+        bool PointFilter::isActive() const {
+            return this->minRangeSquared > 0.0f || this->maxRangeSquared > 0.0f || this->cropEnabled ||
+                   this->nMasks > 0 || this->outlierRadius > 0.0f;
+        }
+
+        int PointFilter::build(const PointFilterParams& params, const Eigen::Affine3d& sensorTransform,
+                               PointFilter& filter) {
+
+            if(params.minRange < 0.0f || params.maxRange < 0.0f ||
+               (params.maxRange > 0.0f && params.minRange >= params.maxRange)) {
+                std::cerr << "PointFilter::build: the range limits are not valid!" << std::endl;
+                return -1;
+            }
+
+            if(params.outlierRadius < 0.0f) {
+                std::cerr << "PointFilter::build: the outlier radius can't be negative!" << std::endl;
+                return -2;
+            }
+
+            std::size_t nMasks = 0;
+            for(const auto& mask : params.selfMasks) {
+                if(!mask.isEmpty())
+                    nMasks++;
+            }
+            if(nMasks > POINT_FILTER_MAX_MASKS) {
+                std::cerr << "PointFilter::build: at most " << POINT_FILTER_MAX_MASKS << " self masks!" << std::endl;
+                return -3;
+            }
+
+            filter = PointFilter();
+            filter.minRangeSquared = params.minRange * params.minRange;
+            filter.maxRangeSquared = params.maxRange * params.maxRange;
+
+            filter.cropEnabled = !params.cropBox.isEmpty();
+            if(filter.cropEnabled)
+                filter.cropBox = toSensorFrame(params.cropBox, sensorTransform);
+
+            for(const auto& mask : params.selfMasks) {
+                if(!mask.isEmpty())
+                    filter.masks[filter.nMasks++] = toSensorFrame(mask, sensorTransform);
+            }
+
+            // a point always has itself within the radius, so no neighbors is no filter
+            if(params.outlierMinNeighbors > 0) {
+                filter.outlierRadius = params.outlierRadius;
+                filter.outlierMinNeighbors = params.outlierMinNeighbors;
+            }
+
+            return 0;
+        }
+
+    } // pcl_aggregator
+} // compute
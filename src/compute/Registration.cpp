@@ -0,0 +1,121 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/compute/Registration.h>
+#include <pcl_aggregator_core/utils/Metrics.h>
+#include <cmath>
+#include <iostream>
+
+namespace pcl_aggregator {
+    namespace compute {
+
+        int Registration::iterate(const RegistrationParams& params, const Accumulate& accumulate,
+                                  RegistrationResult& result) {
+
+            utils::ScopedTimer registrationTimer(utils::HistogramMetric::REGISTRATION_TIME_NS);
+
+            auto start = std::chrono::steady_clock::now();
+
+            result.converged = false;
+            result.iterations = 0;
+
+            while(result.iterations < params.maxIterations) {
+
+                NormalEquations equations = zero();
+                if(accumulate(result.transform, equations) < 0)
+                    return -1;
+
+                result.iterations++;
+                result.correspondences = equations.count;
+                result.fitness = equations.count > 0 ? equations.error / equations.count : 0;
+
+                // too little overlap to trust an update
+                if(equations.count < REGISTRATION_MIN_CORRESPONDENCES)
+                    break;
+
+                Eigen::Matrix<double,6,6> H;
+                Eigen::Matrix<double,6,1> g;
+                int k = 0;
+                for(int r = 0; r < 6; r++) {
+                    g(r) = equations.gradient[r];
+                    for(int c = r; c < 6; c++) {
+                        H(r, c) = equations.hessian[k++];
+                        H(c, r) = H(r, c);
+                    }
+                }
+
+                Eigen::LDLT<Eigen::Matrix<double,6,6>> solver(H);
+                if(solver.info() != Eigen::Success) {
+                    std::cerr << "Registration::iterate: degenerate normal equations!" << std::endl;
+                    break;
+                }
+                Eigen::Matrix<double,6,1> delta = solver.solve(-g);
+                if(!delta.allFinite()) {
+                    std::cerr << "Registration::iterate: degenerate normal equations!" << std::endl;
+                    break;
+                }
+
+                // left update: rotation first, then translation
+                Eigen::Vector3d omega = delta.head<3>();
+                Eigen::Vector3d v = delta.tail<3>();
+                double angle = omega.norm();
+
+                Eigen::Affine3d update = Eigen::Affine3d::Identity();
+                if(angle > 0)
+                    update.linear() = Eigen::AngleAxisd(angle, omega / angle).toRotationMatrix();
+                update.translation() = v;
+                result.transform = update * result.transform;
+
+                if(angle < params.rotationEpsilon && v.norm() < params.translationEpsilon) {
+                    result.converged = true;
+                    break;
+                }
+
+                // stop with the pose reached as soon as the budget is over
+                if(std::chrono::steady_clock::now() - start >= params.timeBudget)
+                    break;
+            }
+
+            return 0;
+        }
+
+        void Registration::addCorrespondence(const Eigen::Vector3f& p, const Eigen::Vector3f& n, float residual,
+                                             NormalEquations& equations) {
+
+            Eigen::Vector3f pn = p.cross(n);
+            float J[6] = {pn.x(), pn.y(), pn.z(), n.x(), n.y(), n.z()};
+
+            int k = 0;
+            for(int r = 0; r < 6; r++) {
+                equations.gradient[r] += J[r] * residual;
+                for(int c = r; c < 6; c++)
+                    equations.hessian[k++] += J[r] * J[c];
+            }
+            equations.error += residual * residual;
+            equations.count++;
+        }
+
+        NormalEquations Registration::zero() {
+            NormalEquations equations{};
+            return equations;
+        }
+
+        Eigen::AlignedBox3f Registration::getSubmapBox(const pcl::PointCloud<pcl::PointXYZRGBL>& cloud, float margin) {
+
+            Eigen::AlignedBox3f box;
+            for(const auto& point : cloud.points) {
+                if(std::isfinite(point.x) && std::isfinite(point.y) && std::isfinite(point.z))
+                    box.extend(Eigen::Vector3f(point.x, point.y, point.z));
+            }
+
+            if(!box.isEmpty()) {
+                box.min().array() -= margin;
+                box.max().array() += margin;
+            }
+
+            return box;
+        }
+
+    } // pcl_aggregator
+} // compute
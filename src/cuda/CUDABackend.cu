@@ -0,0 +1,64 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/cuda/CUDABackend.cuh>
+#include <pcl_aggregator_core/cuda/CUDAPointClouds.cuh>
+#include <pcl_aggregator_core/cuda/CUDAVoxelGrid.cuh>
+#include <pcl_aggregator_core/cuda/CUDARegistration.cuh>
+#include <pcl_aggregator_core/cuda/CUDADevices.cuh>
+#include <cuda_runtime.h>
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        const char* CUDABackend::getName() const {
+            return "cuda";
+        }
+
+        void CUDABackend::setPointCloudLabel(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, std::uint32_t label) {
+            pointclouds::setPointCloudLabelCuda(cloud, label);
+        }
+
+        void CUDABackend::transformPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud,
+                                              const Eigen::Affine3d& transform) {
+            pointclouds::transformPointCloudCuda(cloud, transform);
+        }
+
+        int CUDABackend::concatenatePointClouds(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud1,
+                                                const pcl::PointCloud<pcl::PointXYZRGBL>& cloud2) {
+            return pointclouds::concatenatePointCloudsCuda(cloud1, cloud2);
+        }
+
+        int CUDABackend::ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                          const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                          std::uint32_t label, const Eigen::Affine3d& transform,
+                                          const compute::PointFilter *filter) {
+            return pointclouds::ingestPointCloudCuda(destination, source, label, transform, filter);
+        }
+
+        int CUDABackend::ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                          const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                          std::uint32_t label, const compute::DeskewTable& table,
+                                          const compute::PointFilter *filter) {
+            return pointclouds::ingestPointCloudCuda(destination, source, label, table, filter);
+        }
+
+        int CUDABackend::voxelDownsample(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, float leafSize,
+                                         std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns) {
+            return pointclouds::voxelDownsampleCuda(cloud, leafSize, labelRuns);
+        }
+
+        int CUDABackend::alignPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                         const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                         const compute::RegistrationParams& params,
+                                         compute::RegistrationResult& result) {
+            return pointclouds::alignPointCloudCuda(source, target, params, result);
+        }
+
+        bool CUDABackend::isDeviceAvailable() {
+            return getDeviceCount() > 0;
+        }
+
+    } // pcl_aggregator
+} // cuda
@@ -0,0 +1,104 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/cuda/CUDADevices.cuh>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <utility>
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        int getDeviceCount() {
+
+            static const int count = [] {
+                int nDevices = 0;
+                if(cudaGetDeviceCount(&nDevices) != cudaSuccess) {
+                    // no driver or no device: clear the error so it isn't reported by the next call
+                    cudaGetLastError();
+                    return 0;
+                }
+                return nDevices;
+            }();
+
+            return count;
+        }
+
+        int getCurrentDevice() {
+
+            if(getDeviceCount() == 0)
+                return 0;
+
+            int device = 0;
+            if(cudaGetDevice(&device) != cudaSuccess) {
+                cudaGetLastError();
+                return 0;
+            }
+
+            return device;
+        }
+
+        bool enablePeerAccess(int device, int peer) {
+
+            if(device == peer)
+                return true;
+
+            static std::mutex mutex;
+            // the pairs already tried, and the ones which succeeded
+            static std::set<std::pair<int,int>> tried;
+            static std::set<std::pair<int,int>> enabled;
+
+            std::lock_guard<std::mutex> lock(mutex);
+
+            std::pair<int,int> pair(device, peer);
+            if(tried.count(pair) > 0)
+                return enabled.count(pair) > 0;
+            tried.insert(pair);
+
+            int canAccess = 0;
+            if(cudaDeviceCanAccessPeer(&canAccess, device, peer) != cudaSuccess || !canAccess) {
+                cudaGetLastError();
+                return false;
+            }
+
+            DeviceScope deviceScope(device);
+            cudaError_t err = cudaDeviceEnablePeerAccess(peer, 0);
+            if(err != cudaSuccess && err != cudaErrorPeerAccessAlreadyEnabled) {
+                std::cerr << "Error enabling peer access from device " << device << " to " << peer << ": "
+                          << cudaGetErrorString(err) << std::endl;
+                return false;
+            }
+            // an already enabled pair is not an error for the next call
+            cudaGetLastError();
+
+            enabled.insert(pair);
+            return true;
+        }
+
+        DeviceScope::DeviceScope(int device) {
+
+            if(device < 0 || getDeviceCount() == 0)
+                return;
+
+            int current = getCurrentDevice();
+            if(current == device)
+                return;
+
+            cudaError_t err;
+            if((err = cudaSetDevice(device)) != cudaSuccess) {
+                std::cerr << "Error setting the CUDA device " << device << ": " << cudaGetErrorString(err) << std::endl;
+                return;
+            }
+
+            this->previous = current;
+        }
+
+        DeviceScope::~DeviceScope() {
+            if(this->previous >= 0)
+                cudaSetDevice(this->previous);
+        }
+
+    } // pcl_aggregator
+} // cuda
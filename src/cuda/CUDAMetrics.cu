@@ -0,0 +1,61 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/cuda/CUDAMetrics.cuh>
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        KernelTimer::KernelTimer(cudaStream_t stream) {
+
+            this->stream = stream;
+
+            if(!utils::Metrics::isEnabled() || utils::Metrics::getCurrent() == nullptr)
+                return;
+
+            if(cudaEventCreate(&this->startEvent) != cudaSuccess)
+                return;
+            if(cudaEventCreate(&this->stopEvent) != cudaSuccess) {
+                cudaEventDestroy(this->startEvent);
+                return;
+            }
+
+            if(cudaEventRecord(this->startEvent, this->stream) != cudaSuccess) {
+                cudaEventDestroy(this->startEvent);
+                cudaEventDestroy(this->stopEvent);
+                return;
+            }
+
+            this->registry = utils::Metrics::getCurrent();
+        }
+
+        KernelTimer::~KernelTimer() {
+
+            if(this->registry == nullptr)
+                return;
+
+            this->end();
+
+            float elapsedMs = 0.0f;
+            if(cudaEventSynchronize(this->stopEvent) == cudaSuccess &&
+               cudaEventElapsedTime(&elapsedMs, this->startEvent, this->stopEvent) == cudaSuccess) {
+                this->registry->record(utils::HistogramMetric::KERNEL_TIME_NS,
+                                       static_cast<std::uint64_t>(elapsedMs * 1e6f));
+            }
+
+            cudaEventDestroy(this->startEvent);
+            cudaEventDestroy(this->stopEvent);
+        }
+
+        void KernelTimer::end() {
+
+            if(this->registry == nullptr || this->ended)
+                return;
+
+            cudaEventRecord(this->stopEvent, this->stream);
+            this->ended = true;
+        }
+
+    } // pcl_aggregator
+} // cuda
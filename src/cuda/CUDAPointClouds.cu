@@ -3,266 +3,677 @@
 //
 
 #include <pcl_aggregator_core/cuda/CUDAPointClouds.cuh>
+#include <pcl_aggregator_core/cuda/CUDAVoxelGrid.cuh>
+#include <pcl_aggregator_core/cuda/CUDAMetrics.cuh>
+#include <pcl_aggregator_core/cuda/CUDAStreams.cuh>
+#include <pcl_aggregator_core/cuda/DeviceMemoryPool.cuh>
+#include <thrust/device_vector.h>
+#include <thrust/execution_policy.h>
+#include <thrust/scan.h>
+#include <thrust/sort.h>
+#include <thrust/system_error.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
 
 namespace pcl_aggregator {
     namespace cuda {
         namespace pointclouds {
 
             __host__ void setPointCloudLabelCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, std::uint32_t label) {
-                cudaError_t err = cudaSuccess;
-                cudaStream_t stream;
-
-                // declare the device input point array
-                pcl::PointXYZRGBL *d_cloud;
 
-                if((err = cudaSetDevice(0)) != cudaSuccess) {
-                    std::cerr << "Error setting the CUDA device: " << cudaGetErrorString(err) << std::endl;
+                if(cloud->empty())
                     return;
+
+                // label each chunk in-place as soon as it lands on the device
+                StreamContext& context = StreamContext::getCurrent();
+                if(context.processPoints(cloud->points.data(), cloud->points.data(), cloud->size(),
+                                         [label](pcl::PointXYZRGBL* d_chunk, std::size_t count, std::size_t, cudaStream_t stream) {
+                                             dim3 block(512);
+                                             dim3 grid((count + block.x - 1) / block.x);
+                                             setPointLabelKernel<<<grid, block, 0, stream>>>(d_chunk, label, count);
+                                         }) < 0) {
+                    std::cerr << "Error setting the pointcloud label on the device" << std::endl;
                 }
+            }
 
-                // create a stream
-                if ((err = cudaStreamCreate(&stream)) != cudaSuccess) {
-                    std::cerr << "Error creating the label-setting CUDA stream: " << cudaGetErrorString(err) << std::endl;
-                    return;
+            __global__ void setPointLabelKernel(pcl::PointXYZRGBL *points, std::uint32_t label, int num_points) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx < num_points) {
+                    points[idx].label = label;
                 }
+            }
+
+            __host__ void transformPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, const Eigen::Affine3d& tf) {
 
-                // allocate memory on the device to store the input pointcloud
-                if ((err = cudaMalloc(&d_cloud, cloud->size() * sizeof(pcl::PointXYZRGBL))) != cudaSuccess) {
-                    std::cerr << "Error allocating memory for the pointcloud: " << cudaGetErrorString(err) << std::endl;
+                if(cloud->empty())
                     return;
+
+                // single precision on the device: the points are float already
+                PointTransform transform = PointTransform::fromAffine(tf);
+
+                StreamContext& context = StreamContext::getCurrent();
+                if(context.processPoints(cloud->points.data(), cloud->points.data(), cloud->size(),
+                                         [transform](pcl::PointXYZRGBL* d_chunk, std::size_t count, std::size_t, cudaStream_t stream) {
+                                             dim3 block(512);
+                                             dim3 grid((count + block.x - 1) / block.x);
+                                             transformPointKernel<<<grid, block, 0, stream>>>(d_chunk, transform, count);
+                                         }) < 0) {
+                    std::cerr << "Error transforming the pointcloud on the device" << std::endl;
                 }
+            }
 
-                // copy the input pointcloud to the device
-                if ((err = cudaMemcpy(d_cloud, cloud->points.data(), cloud->size() * sizeof(pcl::PointXYZRGBL),
-                                      cudaMemcpyHostToDevice)) != cudaSuccess) {
-                    std::cerr << "Error copying the input pointcloud to the device (set label): " << cudaGetErrorString(err)
-                              << std::endl;
-                    return;
+            __global__ void transformPointKernel(pcl::PointXYZRGBL *points, PointTransform transform, int num_points) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx < num_points) {
+                    float4 p = transform.apply(make_float4(points[idx].x, points[idx].y, points[idx].z, 1.0f));
+                    points[idx].x = p.x;
+                    points[idx].y = p.y;
+                    points[idx].z = p.z;
                 }
+            }
+
+            __host__ int concatenatePointCloudsCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud1,
+                                                     const pcl::PointCloud<pcl::PointXYZRGBL>& cloud2) {
 
-                // call the kernel
-                dim3 block(512);
-                dim3 grid((cloud->size() + block.x - 1) / block.x);
-                setPointLabelKernel<<<grid, block, 0, stream>>>(d_cloud, label, cloud->size());
+                // both clouds are on the host and no point changes: a round trip through the device is only overhead
+                std::size_t cloud1OriginalSize = cloud1->size();
+                cloud1->resize(cloud1OriginalSize + cloud2.size());
+                std::copy(cloud2.points.begin(), cloud2.points.end(), cloud1->points.begin() + cloud1OriginalSize);
 
-                // wait for the stream
-                if ((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
-                    std::cerr << "Error waiting for the label-setting stream: " << cudaGetErrorString(err) << std::endl;
-                    return;
+                return 0;
+            }
+
+            __host__ int filterPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                              const compute::PointFilter& filter, float4 *d_xyz,
+                                              std::uint32_t *d_rgba, std::uint32_t *d_kept, std::size_t& nKept) {
+
+                nKept = 0;
+                std::size_t nPoints = source.size();
+                if(nPoints == 0)
+                    return 0;
+
+                cudaError_t err = cudaSuccess;
+                StreamContext& context = StreamContext::getCurrent();
+                cudaStream_t stream = context.getStream();
+
+                // the temporaries and the kernels go to the device of the context
+                DeviceScope deviceScope(context.getDevice());
+
+                try {
+                    ThrustTempAllocator tempAllocator;
+                    auto policy = thrust::cuda::par(tempAllocator).on(stream);
+
+                    PoolVector<std::uint32_t> keep(nPoints);
+                    std::uint32_t *d_keep = thrust::raw_pointer_cast(keep.data());
+
+                    // each chunk is tested as it lands, while the next one is uploaded
+                    if(context.uploadPoints(nullptr, source.points.data(), nPoints,
+                                            [filter, d_xyz, d_rgba, d_keep](pcl::PointXYZRGBL* d_chunk,
+                                                                            std::size_t count, std::size_t offset,
+                                                                            cudaStream_t chunkStream) {
+                                                dim3 block(512);
+                                                dim3 grid((count + block.x - 1) / block.x);
+                                                unpackFilterPointsKernel<<<grid, block, 0, chunkStream>>>(
+                                                        d_chunk, count, filter, d_xyz + offset, d_rgba + offset,
+                                                        d_keep + offset);
+                                            }) < 0) {
+                        std::cerr << "Error uploading the raw points to filter" << std::endl;
+                        return -1;
+                    }
+
+                    KernelTimer kernelTimer(stream);
+
+                    dim3 block(512);
+                    dim3 grid((nPoints + block.x - 1) / block.x);
+
+                    if(filter.outlierRadius > 0.0f) {
+                        float inverseCellSize = 1.0f / filter.outlierRadius;
+
+                        PoolVector<unsigned long long> keys(nPoints);
+                        PoolVector<std::uint32_t> indices(nPoints);
+                        PoolVector<std::uint32_t> inliers(nPoints);
+
+                        // the points by cell, the ones already dropped last
+                        filterCellKeysKernel<<<grid, block, 0, stream>>>(d_xyz, d_keep, nPoints, inverseCellSize,
+                                                                         thrust::raw_pointer_cast(keys.data()),
+                                                                         thrust::raw_pointer_cast(indices.data()));
+                        thrust::sort_by_key(policy, keys.begin(), keys.end(), indices.begin());
+
+                        countNeighborsKernel<<<grid, block, 0, stream>>>(d_xyz, thrust::raw_pointer_cast(keys.data()),
+                                                                         thrust::raw_pointer_cast(indices.data()),
+                                                                         nPoints, inverseCellSize,
+                                                                         filter.outlierRadius * filter.outlierRadius,
+                                                                         filter.outlierMinNeighbors,
+                                                                         thrust::raw_pointer_cast(inliers.data()));
+
+                        // only now, so every point counted its neighbors among the same points
+                        if((err = cudaMemcpyAsync(d_keep, thrust::raw_pointer_cast(inliers.data()),
+                                                  nPoints * sizeof(std::uint32_t), cudaMemcpyDeviceToDevice,
+                                                  stream)) != cudaSuccess) {
+                            std::cerr << "Error copying the outlier flags: " << cudaGetErrorString(err) << std::endl;
+                            cudaStreamSynchronize(stream);
+                            return -2;
+                        }
+
+                        // the temporaries go back to the pool when they leave the scope
+                        if((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
+                            std::cerr << "Error removing the radius outliers: " << cudaGetErrorString(err) << std::endl;
+                            return -3;
+                        }
+                    }
+
+                    PoolVector<std::uint32_t> positions(nPoints);
+                    thrust::exclusive_scan(policy, keep.begin(), keep.end(), positions.begin());
+
+                    nKept = (std::size_t) positions[nPoints - 1] + (std::size_t) keep[nPoints - 1];
+
+                    listKeptPointsKernel<<<grid, block, 0, stream>>>(d_keep, thrust::raw_pointer_cast(positions.data()),
+                                                                     nPoints, d_kept);
+
+                    if((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
+                        std::cerr << "Error listing the kept points: " << cudaGetErrorString(err) << std::endl;
+                        return -4;
+                    }
+
+                    kernelTimer.end();
+
+                } catch (thrust::system_error& e) {
+                    std::cerr << "Error filtering the pointcloud: " << e.what() << std::endl;
+                    return -5;
+                } catch (std::bad_alloc& e) {
+                    std::cerr << "Error allocating memory for the pointcloud filter: " << e.what() << std::endl;
+                    return -6;
                 }
 
-                // copy the output pointcloud back to the host
-                if ((err = cudaMemcpy(cloud->points.data(), d_cloud, cloud->size() * sizeof(pcl::PointXYZRGBL),
-                                      cudaMemcpyDeviceToHost)) != cudaSuccess) {
-                    std::cerr << "Error copying the output pointcloud to the host (labelling): " << cudaGetErrorString(err)
-                              << std::endl;
-                    return;
+                utils::Metrics::add(utils::CounterMetric::POINTS_FILTERED, nPoints - nKept);
+
+                return 0;
+            }
+
+            /*! \brief Filter a raw PointCloud on the device and append the kept points to a host PointCloud.
+             *
+             * @param destination The PointCloud which will receive the points.
+             * @param source The raw PointCloud, in the sensor frame.
+             * @param filter The filter.
+             * @param produce Queues the writing of a chunk of ingested points, from the raw coordinates, the raw
+             *                colors and the indices of the kept points of the chunk.
+             * @return 0 on success, negative on error.
+             */
+            static int ingestFilteredPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                                const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                                const compute::PointFilter& filter,
+                                                const std::function<void(const float4*, const std::uint32_t*,
+                                                                         const std::uint32_t*, pcl::PointXYZRGBL*,
+                                                                         std::size_t, cudaStream_t)>& produce) {
+
+                std::size_t destinationOriginalSize = destination->size();
+
+                try {
+                    PoolVector<float4> xyz(source.size());
+                    PoolVector<std::uint32_t> rgba(source.size());
+                    PoolVector<std::uint32_t> kept(source.size());
+
+                    std::size_t nKept;
+                    if(filterPointCloudCuda(source, filter, thrust::raw_pointer_cast(xyz.data()),
+                                            thrust::raw_pointer_cast(rgba.data()),
+                                            thrust::raw_pointer_cast(kept.data()), nKept) < 0)
+                        return -1;
+
+                    if(nKept == 0)
+                        return 0;
+
+                    destination->resize(destinationOriginalSize + nKept);
+
+                    const float4 *d_xyz = thrust::raw_pointer_cast(xyz.data());
+                    const std::uint32_t *d_rgba = thrust::raw_pointer_cast(rgba.data());
+                    const std::uint32_t *d_kept = thrust::raw_pointer_cast(kept.data());
+
+                    // only the kept points come back, each chunk produced while the previous one is downloaded
+                    if(StreamContext::getCurrent().downloadPoints(destination->points.data() + destinationOriginalSize,
+                                                                  nKept,
+                                                                  [&produce, d_xyz, d_rgba, d_kept](
+                                                                          pcl::PointXYZRGBL* d_chunk,
+                                                                          std::size_t count, std::size_t offset,
+                                                                          cudaStream_t stream) {
+                                                                      produce(d_xyz, d_rgba, d_kept + offset, d_chunk,
+                                                                              count, stream);
+                                                                  }) < 0) {
+                        destination->resize(destinationOriginalSize);
+                        return -2;
+                    }
+
+                } catch (thrust::system_error& e) {
+                    std::cerr << "Error ingesting the filtered pointcloud: " << e.what() << std::endl;
+                    destination->resize(destinationOriginalSize);
+                    return -3;
+                } catch (std::bad_alloc& e) {
+                    std::cerr << "Error allocating memory for the filtered pointcloud: " << e.what() << std::endl;
+                    destination->resize(destinationOriginalSize);
+                    return -4;
                 }
 
-                // free the memory
-                if ((err = cudaFree(d_cloud)) != cudaSuccess) {
-                    std::cerr << "Error freeing the pointcloud from device memory: " << cudaGetErrorString(err)
-                              << std::endl;
-                    return;
+                return 0;
+            }
+
+            __host__ int ingestPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                              const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                              std::uint32_t label, const Eigen::Affine3d& transform,
+                                              const compute::PointFilter *filter) {
+
+                if(source.empty())
+                    return 0;
+
+                if(filter != nullptr && filter->isActive()) {
+                    PointTransform pointTransform = PointTransform::fromAffine(transform);
+                    if(ingestFilteredPointCloud(destination, source, *filter,
+                                                [label, pointTransform](const float4 *xyz, const std::uint32_t *rgba,
+                                                                        const std::uint32_t *kept,
+                                                                        pcl::PointXYZRGBL *d_chunk, std::size_t count,
+                                                                        cudaStream_t stream) {
+                                                    dim3 block(512);
+                                                    dim3 grid((count + block.x - 1) / block.x);
+                                                    gatherIngestPointsKernel<<<grid, block, 0, stream>>>(
+                                                            xyz, rgba, kept, count, label, pointTransform, d_chunk);
+                                                }) < 0) {
+                        std::cerr << "Error ingesting the filtered pointcloud on the device" << std::endl;
+                        return -1;
+                    }
+                    return 0;
                 }
 
-                // destroy the stream
-                if ((err = cudaStreamDestroy(stream)) != cudaSuccess) {
-                    std::cerr << "Error destroying the CUDA stream: " << cudaGetErrorString(err) << std::endl;
-                    return;
+                // grow the destination and write the ingested points straight to its end
+                std::size_t destinationOriginalSize = destination->size();
+                destination->resize(destinationOriginalSize + source.size());
+
+                PointTransform pointTransform = PointTransform::fromAffine(transform);
+
+                // chunk i is uploaded while chunk i-1 is labelled and transformed and chunk i-2 is downloaded
+                StreamContext& context = StreamContext::getCurrent();
+                if(context.processPoints(source.points.data(), destination->points.data() + destinationOriginalSize,
+                                         source.size(),
+                                         [label, pointTransform](pcl::PointXYZRGBL* d_chunk, std::size_t count, std::size_t,
+                                                         cudaStream_t stream) {
+                                             dim3 block(512);
+                                             dim3 grid((count + block.x - 1) / block.x);
+                                             ingestPointsKernel<<<grid, block, 0, stream>>>(d_chunk, d_chunk, label,
+                                                                                            pointTransform, count);
+                                         }) < 0) {
+                    std::cerr << "Error ingesting the pointcloud on the device" << std::endl;
+                    destination->resize(destinationOriginalSize);
+                    return -1;
                 }
+
+                return 0;
             }
 
-            __global__ void setPointLabelKernel(pcl::PointXYZRGBL *points, std::uint32_t label, int num_points) {
-                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
-                if (idx < num_points) {
-                    points[idx].label = label;
+            __host__ int ingestPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& destination,
+                                              const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                              std::uint32_t label, const compute::DeskewTable& table,
+                                              const compute::PointFilter *filter) {
+
+                if(source.empty())
+                    return 0;
+
+                if(filter != nullptr && filter->isActive()) {
+                    if(ingestFilteredPointCloud(destination, source, *filter,
+                                                [label, &table](const float4 *xyz, const std::uint32_t *rgba,
+                                                                const std::uint32_t *kept, pcl::PointXYZRGBL *d_chunk,
+                                                                std::size_t count, cudaStream_t stream) {
+                                                    dim3 block(512);
+                                                    dim3 grid((count + block.x - 1) / block.x);
+                                                    gatherIngestDeskewPointsKernel<<<grid, block, 0, stream>>>(
+                                                            xyz, rgba, kept, count, label, table, d_chunk);
+                                                }) < 0) {
+                        std::cerr << "Error deskewing the filtered pointcloud on the device" << std::endl;
+                        return -1;
+                    }
+                    return 0;
                 }
-            }
 
-            __host__ void transformPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, const Eigen::Affine3d& tf) {
+                std::size_t destinationOriginalSize = destination->size();
+                destination->resize(destinationOriginalSize + source.size());
+
+                // the chunks keep their place on the scan, for the time of their points
+                StreamContext& context = StreamContext::getCurrent();
+                if(context.processPoints(source.points.data(), destination->points.data() + destinationOriginalSize,
+                                         source.size(),
+                                         [label, &table](pcl::PointXYZRGBL* d_chunk, std::size_t count,
+                                                         std::size_t firstIndex, cudaStream_t stream) {
+                                             dim3 block(512);
+                                             dim3 grid((count + block.x - 1) / block.x);
+                                             ingestDeskewPointsKernel<<<grid, block, 0, stream>>>(d_chunk, d_chunk, label,
+                                                                                                  table, firstIndex,
+                                                                                                  count);
+                                         }) < 0) {
+                    std::cerr << "Error deskewing the pointcloud on the device" << std::endl;
+                    destination->resize(destinationOriginalSize);
+                    return -1;
+                }
 
-                cudaError_t err = cudaSuccess;
-                cudaStream_t stream;
+                return 0;
+            }
 
-                if((err = cudaSetDevice(0)) != cudaSuccess) {
-                    std::cerr << "Error setting the CUDA device: " << cudaGetErrorString(err) << std::endl;
+            __global__ void ingestPointsKernel(const pcl::PointXYZRGBL *source, pcl::PointXYZRGBL *destination,
+                                               std::uint32_t label, PointTransform transform, std::size_t num_points) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
                     return;
-                }
 
-                if ((err = cudaStreamCreate(&stream)) != cudaSuccess) {
-                    std::cerr << "Error creating pointcloud transform stream: " << cudaGetErrorString(err) << std::endl;
+                // copy first: with in-place ingestion source and destination are the same point
+                destination[idx] = source[idx];
+
+                float4 p = transform.apply(make_float4(destination[idx].x, destination[idx].y, destination[idx].z, 1.0f));
+                destination[idx].x = p.x;
+                destination[idx].y = p.y;
+                destination[idx].z = p.z;
+
+                destination[idx].label = label;
+            }
+
+            __global__ void ingestDeskewPointsKernel(const pcl::PointXYZRGBL *source, pcl::PointXYZRGBL *destination,
+                                                     std::uint32_t label, compute::DeskewTable table,
+                                                     std::size_t first_index, std::size_t num_points) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
                     return;
-                }
 
-                // allocate device memory for the pointcloud
-                pcl::PointXYZRGBL *d_cloud;
-                if ((err = cudaMalloc(&d_cloud, cloud->size() * sizeof(pcl::PointXYZRGBL))) != cudaSuccess) {
-                    std::cerr << "Error allocating memory for the pointcloud: " << cudaGetErrorString(err) << std::endl;
+                destination[idx] = source[idx];
+
+                table.apply(first_index + idx, destination[idx].x, destination[idx].y, destination[idx].z);
+
+                destination[idx].label = label;
+            }
+
+            __global__ void unpackFilterPointsKernel(const pcl::PointXYZRGBL *points, std::size_t num_points,
+                                                     compute::PointFilter filter, float4 *xyz, std::uint32_t *rgba,
+                                                     std::uint32_t *keep) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
                     return;
-                }
 
-                // copy the pointcloud to the device
-                if ((err = cudaMemcpy(d_cloud, cloud->points.data(), cloud->size() * sizeof(pcl::PointXYZRGBL),
-                                      cudaMemcpyHostToDevice)) != cudaSuccess) {
-                    std::cerr << "Error copying the input pointcloud to the device (transform): " << cudaGetErrorString(err)
-                              << std::endl;
+                const pcl::PointXYZRGBL& p = points[idx];
+                xyz[idx] = make_float4(p.x, p.y, p.z, 1.0f);
+                rgba[idx] = p.rgba;
+                keep[idx] = filter.keep(p.x, p.y, p.z) ? 1 : 0;
+            }
+
+            __global__ void filterCellKeysKernel(const float4 *xyz, const std::uint32_t *keep, std::size_t num_points,
+                                                 float inverse_cell_size, unsigned long long *keys,
+                                                 std::uint32_t *indices) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
                     return;
-                }
 
-                // call the kernel
-                dim3 block(512);
-                dim3 grid((cloud->size() + block.x - 1) / block.x);
-                transformPointKernel<<<grid, block, 0, stream>>>(d_cloud, tf.matrix(), cloud->size());
+                indices[idx] = idx;
+                keys[idx] = VOXEL_KEY_INVALID;
 
-                // wait for the stream
-                if ((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
-                    std::cerr << "Error waiting for the transform stream: " << cudaGetErrorString(err) << std::endl;
+                // the kept points are finite
+                if(!keep[idx])
                     return;
-                }
 
-                // copy the output pointcloud back to the host
-                if ((err = cudaMemcpy(cloud->points.data(), d_cloud, cloud->size() * sizeof(pcl::PointXYZRGBL),
-                                      cudaMemcpyDeviceToHost)) != cudaSuccess) {
-                    std::cerr << "Error copying the output pointcloud to the host (transform): " << cudaGetErrorString(err)
-                              << std::endl;
+                float4 p = xyz[idx];
+                const long long offset = 1LL << (VOXEL_KEY_AXIS_BITS - 1);
+                const long long limit = 1LL << VOXEL_KEY_AXIS_BITS;
+                long long vx = (long long) floorf(p.x * inverse_cell_size) + offset;
+                long long vy = (long long) floorf(p.y * inverse_cell_size) + offset;
+                long long vz = (long long) floorf(p.z * inverse_cell_size) + offset;
+
+                if(vx < 0 || vx >= limit || vy < 0 || vy >= limit || vz < 0 || vz >= limit)
                     return;
-                }
 
-                // free the memory
-                if ((err = cudaFree(d_cloud)) != cudaSuccess) {
-                    std::cerr << "Error freeing the pointcloud from device memory: " << cudaGetErrorString(err)
-                              << std::endl;
+                keys[idx] = ((unsigned long long) vx << (2 * VOXEL_KEY_AXIS_BITS)) |
+                            ((unsigned long long) vy << VOXEL_KEY_AXIS_BITS) |
+                            (unsigned long long) vz;
+            }
+
+            __global__ void countNeighborsKernel(const float4 *xyz, const unsigned long long *keys,
+                                                 const std::uint32_t *indices, std::size_t num_points,
+                                                 float inverse_cell_size, float radius_squared,
+                                                 std::uint32_t min_neighbors, std::uint32_t *inliers) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
                     return;
-                }
 
-                // destroy the stream
-                if ((err = cudaStreamDestroy(stream)) != cudaSuccess) {
-                    std::cerr << "Error destroying the CUDA stream: " << cudaGetErrorString(err) << std::endl;
+                std::uint32_t point = indices[idx];
+
+                // dropped already, or too far to have neighbors
+                if(keys[idx] == VOXEL_KEY_INVALID) {
+                    inliers[point] = 0;
                     return;
                 }
-            }
 
-            __global__ void transformPointKernel(pcl::PointXYZRGBL *points, Eigen::Matrix4d transform, int num_points) {
-                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
-                if (idx < num_points) {
-                    Eigen::Vector4d p(points[idx].x, points[idx].y, points[idx].z, 1.0f);
-                    p = transform * p;
-                    points[idx].x = p(0);
-                    points[idx].y = p(1);
-                    points[idx].z = p(2);
+                float4 p = xyz[point];
+                const long long offset = 1LL << (VOXEL_KEY_AXIS_BITS - 1);
+                const long long limit = 1LL << VOXEL_KEY_AXIS_BITS;
+                long long vx = (long long) floorf(p.x * inverse_cell_size) + offset;
+                long long vy = (long long) floorf(p.y * inverse_cell_size) + offset;
+                long long vz = (long long) floorf(p.z * inverse_cell_size) + offset;
+
+                // the points of the 27 cells around, until there are enough
+                std::uint32_t neighbors = 0;
+                for(int dx = -1; dx <= 1 && neighbors < min_neighbors; dx++) {
+                    for(int dy = -1; dy <= 1 && neighbors < min_neighbors; dy++) {
+                        for(int dz = -1; dz <= 1 && neighbors < min_neighbors; dz++) {
+                            long long x = vx + dx;
+                            long long y = vy + dy;
+                            long long z = vz + dz;
+                            if(x < 0 || x >= limit || y < 0 || y >= limit || z < 0 || z >= limit)
+                                continue;
+
+                            unsigned long long key = ((unsigned long long) x << (2 * VOXEL_KEY_AXIS_BITS)) |
+                                                     ((unsigned long long) y << VOXEL_KEY_AXIS_BITS) |
+                                                     (unsigned long long) z;
+
+                            // first point of the cell, by binary search on the sorted keys
+                            std::size_t low = 0;
+                            std::size_t high = num_points;
+                            while(low < high) {
+                                std::size_t mid = (low + high) / 2;
+                                if(keys[mid] < key)
+                                    low = mid + 1;
+                                else
+                                    high = mid;
+                            }
+
+                            for(std::size_t j = low; j < num_points && keys[j] == key && neighbors < min_neighbors; j++) {
+                                if(indices[j] == point)
+                                    continue;
+                                float4 q = xyz[indices[j]];
+                                float ex = q.x - p.x;
+                                float ey = q.y - p.y;
+                                float ez = q.z - p.z;
+                                if(ex * ex + ey * ey + ez * ez <= radius_squared)
+                                    neighbors++;
+                            }
+                        }
+                    }
                 }
+
+                inliers[point] = neighbors >= min_neighbors ? 1 : 0;
             }
 
-            __host__ int concatenatePointCloudsCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud1,
-                                                     const pcl::PointCloud<pcl::PointXYZRGBL>& cloud2) {
+            __global__ void listKeptPointsKernel(const std::uint32_t *keep, const std::uint32_t *positions,
+                                                 std::size_t num_points, std::uint32_t *kept) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points || !keep[idx])
+                    return;
 
-                cudaError_t err = cudaSuccess;
-                cudaStream_t stream;
+                kept[positions[idx]] = idx;
+            }
 
-                if((err = cudaSetDevice(0)) != cudaSuccess) {
-                    std::cerr << "Error setting the CUDA device: " << cudaGetErrorString(err) << std::endl;
-                    return -1;
-                }
+            __global__ void gatherIngestPointsKernel(const float4 *xyz, const std::uint32_t *rgba,
+                                                     const std::uint32_t *kept, std::size_t num_points,
+                                                     std::uint32_t label, PointTransform transform,
+                                                     pcl::PointXYZRGBL *destination) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
 
-                // create a stream
-                if ((err = cudaStreamCreate(&stream)) != cudaSuccess) {
-                    std::cerr << "Error creating pointcloud concatenation stream: " << cudaGetErrorString(err) << std::endl;
-                    return -2;
-                }
+                std::uint32_t source = kept[idx];
+                float4 p = transform.apply(xyz[source]);
+                destination[idx].x = p.x;
+                destination[idx].y = p.y;
+                destination[idx].z = p.z;
+                destination[idx].data[3] = 1.0f;
+                destination[idx].rgba = rgba[source];
+                destination[idx].label = label;
+            }
 
-                // resize the cloud1
-                std::size_t cloud1OriginalSize = cloud1->size();
-                std::size_t cloud1NewSize = cloud1OriginalSize + cloud2.size();
-                cloud1->resize(cloud1NewSize);
+            __global__ void gatherIngestDeskewPointsKernel(const float4 *xyz, const std::uint32_t *rgba,
+                                                           const std::uint32_t *kept, std::size_t num_points,
+                                                           std::uint32_t label, compute::DeskewTable table,
+                                                           pcl::PointXYZRGBL *destination) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
 
-                // allocate cloud1 on the device - allocate with sufficient space to the concatenation
-                pcl::PointXYZRGBL *d_cloud1;
-                if ((err = cudaMalloc(&d_cloud1, cloud1NewSize * sizeof(pcl::PointXYZRGBL))) != cudaSuccess) {
-                    std::cerr << "Error allocating memory for cloud1: " << cudaGetErrorString(err) << std::endl;
-                    return -3;
-                }
+                std::uint32_t source = kept[idx];
+                float4 p = xyz[source];
+                table.apply(source, p.x, p.y, p.z);
+                destination[idx].x = p.x;
+                destination[idx].y = p.y;
+                destination[idx].z = p.z;
+                destination[idx].data[3] = 1.0f;
+                destination[idx].rgba = rgba[source];
+                destination[idx].label = label;
+            }
 
-                // copy cloud1 to the device
-                if ((err = cudaMemcpy(d_cloud1, cloud1->points.data(), cloud1NewSize * sizeof(pcl::PointXYZRGBL),
-                                      cudaMemcpyHostToDevice)) != cudaSuccess) {
-                    std::cerr << "Error copying cloud1 to the device: " << cudaGetErrorString(err)
-                              << std::endl;
-                    return -4;
-                }
+            __host__ int removePointsWithLabelsCuda(DevicePointCloud& cloud, const std::set<std::uint32_t>& labels) {
 
-                // allocate cloud2 on the device
-                pcl::PointXYZRGBL *d_cloud2;
-                if((err = cudaMalloc(&d_cloud2, cloud2.size() * sizeof(pcl::PointXYZRGBL))) != cudaSuccess) {
-                    std::cerr << "Error allocating memory for cloud2: " << cudaGetErrorString(err) << std::endl;
-                    return -5;
-                }
+                if(cloud.empty() || labels.empty())
+                    return 0;
 
-                // copy cloud2 to the device
-                if((err = cudaMemcpy(d_cloud2, cloud2.points.data(), cloud2.size() * sizeof(pcl::PointXYZRGBL),
-                                     cudaMemcpyHostToDevice)) != cudaSuccess) {
-                    std::cerr << "Error copying cloud2 to the device: " << cudaGetErrorString(err) << std::endl;
+                cudaError_t err = cudaSuccess;
+                cudaStream_t stream = cloud.getStream();
+                std::size_t nPoints = cloud.size();
+
+                // the temporaries and the kernels go to the device of the buffer
+                DeviceScope deviceScope(cloud.getDevice());
+
+                // the set iterates in ascending order, so the device array is ready for binary search
+                std::vector<std::uint32_t> sortedLabels(labels.begin(), labels.end());
+
+                std::size_t nKept;
+
+                KernelTimer kernelTimer(stream);
+
+                try {
+                    // the vectors and the scan's temporary storage come from the pool
+                    ThrustTempAllocator tempAllocator;
+                    auto policy = thrust::cuda::par(tempAllocator).on(stream);
+
+                    PoolVector<std::uint32_t> d_labels(sortedLabels.size());
+                    if((err = cudaMemcpyAsync(thrust::raw_pointer_cast(d_labels.data()), sortedLabels.data(),
+                                              sortedLabels.size() * sizeof(std::uint32_t), cudaMemcpyHostToDevice,
+                                              stream)) != cudaSuccess) {
+                        std::cerr << "Error copying the labels to the device: " << cudaGetErrorString(err) << std::endl;
+                        return -1;
+                    }
+                    utils::Metrics::add(utils::CounterMetric::H2D_BYTES, sortedLabels.size() * sizeof(std::uint32_t));
+
+                    PoolVector<std::uint32_t> keep(nPoints);
+                    PoolVector<std::uint32_t> positions(nPoints);
+
+                    dim3 block(512);
+                    dim3 grid((nPoints + block.x - 1) / block.x);
+                    markPointsToKeepKernel<<<grid, block, 0, stream>>>(cloud.getLabels(), nPoints,
+                                                                       thrust::raw_pointer_cast(d_labels.data()),
+                                                                       sortedLabels.size(),
+                                                                       thrust::raw_pointer_cast(keep.data()));
+
+                    thrust::exclusive_scan(policy, keep.begin(), keep.end(), positions.begin());
+
+                    nKept = (std::size_t) positions[nPoints - 1] + (std::size_t) keep[nPoints - 1];
+
+                    if(nKept == nPoints)
+                        return 0;
+
+                    if(nKept > 0) {
+                        // scatter out-of-place, then bring the kept points back to the start of the arrays
+                        PoolVector<float4> d_keptXYZ(nKept);
+                        PoolVector<std::uint32_t> d_keptRGBA(nKept);
+                        PoolVector<std::uint32_t> d_keptLabels(nKept);
+
+                        compactPointsKernel<<<grid, block, 0, stream>>>(cloud.getXYZ(), cloud.getRGBA(),
+                                                                        cloud.getLabels(), nPoints,
+                                                                        thrust::raw_pointer_cast(keep.data()),
+                                                                        thrust::raw_pointer_cast(positions.data()),
+                                                                        thrust::raw_pointer_cast(d_keptXYZ.data()),
+                                                                        thrust::raw_pointer_cast(d_keptRGBA.data()),
+                                                                        thrust::raw_pointer_cast(d_keptLabels.data()));
+
+                        if ((err = cudaMemcpyAsync(cloud.getXYZ(), thrust::raw_pointer_cast(d_keptXYZ.data()),
+                                                   nKept * sizeof(float4), cudaMemcpyDeviceToDevice,
+                                                   stream)) != cudaSuccess ||
+                            (err = cudaMemcpyAsync(cloud.getRGBA(), thrust::raw_pointer_cast(d_keptRGBA.data()),
+                                                   nKept * sizeof(std::uint32_t), cudaMemcpyDeviceToDevice,
+                                                   stream)) != cudaSuccess ||
+                            (err = cudaMemcpyAsync(cloud.getLabels(), thrust::raw_pointer_cast(d_keptLabels.data()),
+                                                   nKept * sizeof(std::uint32_t), cudaMemcpyDeviceToDevice,
+                                                   stream)) != cudaSuccess) {
+                            std::cerr << "Error copying the kept points: " << cudaGetErrorString(err) << std::endl;
+                            cudaStreamSynchronize(stream);
+                            return -3;
+                        }
+
+                        // the temporaries go back to the pool when they leave the scope
+                        if ((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
+                            std::cerr << "Error waiting for the compaction stream: " << cudaGetErrorString(err)
+                                      << std::endl;
+                            return -4;
+                        }
+                    }
+
+                } catch (thrust::system_error& e) {
+                    std::cerr << "Error compacting the pointcloud: " << e.what() << std::endl;
                     return -6;
-                }
-
-                // call the kernel
-                dim3 block(512);
-                // will be needed as much thread as the size of the cloud2, ideally
-                dim3 grid((cloud2.size() + block.x - 1) / block.x);
-                concatenatePointCloudsKernel<<<grid, block, 0, stream>>>(d_cloud1,
-                                                                         cloud1OriginalSize, d_cloud2,
-                                                                         cloud2.size());
-
-                // wait for the stream to synchronize the threads
-                if ((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
-                    std::cerr << "Error waiting for the concatenation stream: " << cudaGetErrorString(err) << std::endl;
+                } catch (std::bad_alloc& e) {
+                    std::cerr << "Error allocating memory for the pointcloud compaction: " << e.what() << std::endl;
                     return -7;
                 }
 
-                // copy cloud1 back to the host
-                if ((err = cudaMemcpy(cloud1->points.data(), d_cloud1, cloud1NewSize * sizeof(pcl::PointXYZRGBL),
-                                      cudaMemcpyDeviceToHost)) != cudaSuccess) {
-                    std::cerr << "Error copying cloud1 to the host: " << cudaGetErrorString(err)
-                              << std::endl;
-                    return -8;
-                }
+                kernelTimer.end();
 
-                // free cloud1
-                if ((err = cudaFree(d_cloud1)) != cudaSuccess) {
-                    std::cerr << "Error freeing cloud1 from device memory: " << cudaGetErrorString(err)
-                              << std::endl;
-                    return -9;
-                }
+                return cloud.resize(nKept);
+            }
 
-                // free cloud2
-                if ((err = cudaFree(d_cloud2)) != cudaSuccess) {
-                    std::cerr << "Error freeing cloud2 from device memory: " << cudaGetErrorString(err)
-                              << std::endl;
-                    return -10;
-                }
+            __global__ void markPointsToKeepKernel(const std::uint32_t *point_labels, std::size_t num_points,
+                                                   const std::uint32_t *labels, std::size_t num_labels,
+                                                   std::uint32_t *keep) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
 
-                // destroy the stream
-                if ((err = cudaStreamDestroy(stream)) != cudaSuccess) {
-                    std::cerr << "Error destroying the CUDA stream: " << cudaGetErrorString(err) << std::endl;
-                    return -11;
+                std::uint32_t label = point_labels[idx];
+
+                // binary search on the sorted labels
+                std::size_t low = 0;
+                std::size_t high = num_labels;
+                while (low < high) {
+                    std::size_t mid = (low + high) / 2;
+                    if (labels[mid] < label)
+                        low = mid + 1;
+                    else
+                        high = mid;
                 }
 
-                return 0;
-
+                keep[idx] = (low < num_labels && labels[low] == label) ? 0 : 1;
             }
 
-            __global__ void concatenatePointCloudsKernel(pcl::PointXYZRGBL* cloud1, std::size_t cloud1_original_size,
-                                                         pcl::PointXYZRGBL* cloud2, std::size_t cloud2_size) {
-                // calculate the index
+            __global__ void compactPointsKernel(const float4 *xyz, const std::uint32_t *rgba,
+                                                const std::uint32_t *labels, std::size_t num_points,
+                                                const std::uint32_t *keep, const std::uint32_t *positions,
+                                                float4 *output_xyz, std::uint32_t *output_rgba,
+                                                std::uint32_t *output_labels) {
                 std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
-
-                // check boundaries - should range between 0 and cloud2_size
-                if(idx >= cloud2_size)
+                if (idx >= num_points || !keep[idx])
                     return;
 
-                // copy the point from cloud2 to cloud1
-                // TODO: some illegal memory access here
-                cloud1[cloud1_original_size+idx] = cloud2[idx];
+                std::uint32_t position = positions[idx];
+                output_xyz[position] = xyz[idx];
+                output_rgba[position] = rgba[idx];
+                output_labels[position] = labels[idx];
             }
         }
     } // pcl_aggregator
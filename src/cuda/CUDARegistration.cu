@@ -0,0 +1,430 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/cuda/CUDARegistration.cuh>
+#include <pcl_aggregator_core/cuda/CUDAVoxelGrid.cuh>
+#include <pcl_aggregator_core/cuda/CUDAStreams.cuh>
+#include <pcl_aggregator_core/cuda/CUDADevices.cuh>
+#include <pcl_aggregator_core/cuda/DeviceMemoryPool.cuh>
+#include <pcl_aggregator_core/cuda/CUDAMetrics.cuh>
+#include <thrust/execution_policy.h>
+#include <thrust/functional.h>
+#include <thrust/iterator/counting_iterator.h>
+#include <thrust/reduce.h>
+#include <thrust/sort.h>
+#include <thrust/system_error.h>
+#include <thrust/transform_reduce.h>
+#include <iostream>
+
+namespace pcl_aggregator {
+    namespace cuda {
+        namespace pointclouds {
+
+            using compute::NormalEquations;
+
+            /*! \brief Sum the moments of the points of a cell. */
+            struct CellMomentsSum {
+                __host__ __device__ CellMoments operator()(const CellMoments& a, const CellMoments& b) const {
+                    CellMoments result;
+                    result.sx = a.sx + b.sx;
+                    result.sy = a.sy + b.sy;
+                    result.sz = a.sz + b.sz;
+                    result.sxx = a.sxx + b.sxx;
+                    result.sxy = a.sxy + b.sxy;
+                    result.sxz = a.sxz + b.sxz;
+                    result.syy = a.syy + b.syy;
+                    result.syz = a.syz + b.syz;
+                    result.szz = a.szz + b.szz;
+                    result.count = a.count + b.count;
+                    return result;
+                }
+            };
+
+            /*! \brief Sum the normal equations of two sets of correspondences. */
+            struct NormalEquationsSum {
+                __host__ __device__ NormalEquations operator()(const NormalEquations& a, const NormalEquations& b) const {
+                    NormalEquations result;
+                    for(int k = 0; k < 21; k++)
+                        result.hessian[k] = a.hessian[k] + b.hessian[k];
+                    for(int k = 0; k < 6; k++)
+                        result.gradient[k] = a.gradient[k] + b.gradient[k];
+                    result.error = a.error + b.error;
+                    result.count = a.count + b.count;
+                    return result;
+                }
+            };
+
+            /*! \brief Find a cell key on the sorted keys. Returns the number of cells when it is not there. */
+            __host__ __device__ static std::size_t findCell(const unsigned long long *keys, std::size_t num_cells,
+                                                   unsigned long long key) {
+                std::size_t low = 0;
+                std::size_t high = num_cells;
+                while(low < high) {
+                    std::size_t mid = (low + high) / 2;
+                    if(keys[mid] < key)
+                        low = mid + 1;
+                    else
+                        high = mid;
+                }
+                return (low < num_cells && keys[low] == key) ? low : num_cells;
+            }
+
+            /*! \brief Normal equations of the correspondence of a source point under a pose. */
+            struct PointToPlaneTerm {
+                const float4 *xyz;
+                const unsigned long long *keys;
+                const CellPlane *planes;
+                std::size_t num_cells;
+                PointTransform pose;
+                float inverseCellSize;
+                float maxDistanceSquared;
+
+                __host__ __device__ NormalEquations operator()(std::size_t idx) const {
+
+                    NormalEquations result;
+                    for(int k = 0; k < 21; k++)
+                        result.hessian[k] = 0;
+                    for(int k = 0; k < 6; k++)
+                        result.gradient[k] = 0;
+                    result.error = 0;
+                    result.count = 0;
+
+                    float4 p = xyz[idx];
+                    if(!isfinite(p.x) || !isfinite(p.y) || !isfinite(p.z))
+                        return result;
+                    p = pose.apply(p);
+
+                    const long long offset = 1LL << (VOXEL_KEY_AXIS_BITS - 1);
+                    const long long limit = 1LL << VOXEL_KEY_AXIS_BITS;
+                    long long vx = (long long) floorf(p.x * inverseCellSize) + offset;
+                    long long vy = (long long) floorf(p.y * inverseCellSize) + offset;
+                    long long vz = (long long) floorf(p.z * inverseCellSize) + offset;
+
+                    // the closest centroid of the 27 cells around the point
+                    const CellPlane *best = nullptr;
+                    float bestDistance = maxDistanceSquared;
+                    for(int dx = -1; dx <= 1; dx++) {
+                        for(int dy = -1; dy <= 1; dy++) {
+                            for(int dz = -1; dz <= 1; dz++) {
+                                long long x = vx + dx;
+                                long long y = vy + dy;
+                                long long z = vz + dz;
+                                if(x < 0 || x >= limit || y < 0 || y >= limit || z < 0 || z >= limit)
+                                    continue;
+
+                                unsigned long long key = ((unsigned long long) x << (2 * VOXEL_KEY_AXIS_BITS)) |
+                                                         ((unsigned long long) y << VOXEL_KEY_AXIS_BITS) |
+                                                         (unsigned long long) z;
+                                std::size_t cell = findCell(keys, num_cells, key);
+                                if(cell == num_cells || planes[cell].normal.w == 0.0f)
+                                    continue;
+
+                                float4 c = planes[cell].centroid;
+                                float ex = p.x - c.x;
+                                float ey = p.y - c.y;
+                                float ez = p.z - c.z;
+                                float distance = ex * ex + ey * ey + ez * ez;
+                                if(distance < bestDistance) {
+                                    bestDistance = distance;
+                                    best = &planes[cell];
+                                }
+                            }
+                        }
+                    }
+
+                    if(best == nullptr)
+                        return result;
+
+                    float4 n = best->normal;
+                    float residual = n.x * (p.x - best->centroid.x) + n.y * (p.y - best->centroid.y) +
+                                     n.z * (p.z - best->centroid.z);
+
+                    // Jacobian [p x n, n] of a left update
+                    float J[6] = {p.y * n.z - p.z * n.y, p.z * n.x - p.x * n.z, p.x * n.y - p.y * n.x,
+                                  n.x, n.y, n.z};
+                    int k = 0;
+                    for(int r = 0; r < 6; r++) {
+                        result.gradient[r] = J[r] * residual;
+                        for(int c = r; c < 6; c++)
+                            result.hessian[k++] = J[r] * J[c];
+                    }
+                    result.error = residual * residual;
+                    result.count = 1;
+
+                    return result;
+                }
+            };
+
+            /*! \brief Hash a device PointCloud into cells and fit a plane to each.
+             *
+             * @param d_xyz Device array of coordinates of the target.
+             * @param d_labels Device array of labels of the target, only there to fill the key kernel.
+             * @param nPoints Number of points of the target.
+             * @param cellSize The side of the cells.
+             * @param stream The stream to order the work on.
+             * @param cellKeys Receives the sorted keys of the cells.
+             * @param planes Receives the planes of the cells.
+             * @return 0 on success, negative on error.
+             */
+            static int buildCellPlanes(const float4 *d_xyz, const std::uint32_t *d_labels, std::size_t nPoints,
+                                       float cellSize, cudaStream_t stream,
+                                       PoolVector<unsigned long long>& cellKeys, PoolVector<CellPlane>& planes) {
+
+                ThrustTempAllocator tempAllocator;
+                auto policy = thrust::cuda::par(tempAllocator).on(stream);
+
+                PoolVector<unsigned long long> keys(nPoints);
+                PoolVector<std::uint32_t> labels(nPoints);
+                PoolVector<std::uint32_t> indices(nPoints);
+
+                dim3 block(512);
+                dim3 grid((nPoints + block.x - 1) / block.x);
+                computeVoxelKeysKernel<<<grid, block, 0, stream>>>(d_xyz, d_labels, nPoints, 1.0f / cellSize,
+                                                                   thrust::raw_pointer_cast(keys.data()),
+                                                                   thrust::raw_pointer_cast(labels.data()),
+                                                                   thrust::raw_pointer_cast(indices.data()));
+
+                thrust::sort_by_key(policy, keys.begin(), keys.end(), indices.begin());
+
+                PoolVector<CellMoments> moments(nPoints);
+                initCellMomentsKernel<<<grid, block, 0, stream>>>(d_xyz, thrust::raw_pointer_cast(indices.data()),
+                                                                  nPoints, cellSize,
+                                                                  thrust::raw_pointer_cast(moments.data()));
+
+                cellKeys.resize(nPoints);
+                PoolVector<CellMoments> cellMoments(nPoints);
+                auto cellEnd = thrust::reduce_by_key(policy, keys.begin(), keys.end(), moments.begin(),
+                                                     cellKeys.begin(), cellMoments.begin(),
+                                                     thrust::equal_to<unsigned long long>(), CellMomentsSum());
+                std::size_t nCells = cellEnd.first - cellKeys.begin();
+
+                // the invalid points sort last
+                if(nCells > 0 && cellKeys[nCells - 1] == VOXEL_KEY_INVALID)
+                    nCells--;
+                cellKeys.resize(nCells);
+                planes.resize(nCells);
+
+                if(nCells > 0) {
+                    dim3 cellGrid((nCells + block.x - 1) / block.x);
+                    cellPlanesKernel<<<cellGrid, block, 0, stream>>>(thrust::raw_pointer_cast(cellKeys.data()),
+                                                                     thrust::raw_pointer_cast(cellMoments.data()),
+                                                                     nCells, cellSize,
+                                                                     thrust::raw_pointer_cast(planes.data()));
+                }
+
+                // the moments are freed when leaving the scope
+                cudaError_t err;
+                if((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
+                    std::cerr << "Error waiting for the registration stream: " << cudaGetErrorString(err) << std::endl;
+                    return -2;
+                }
+
+                return 0;
+            }
+
+            __host__ int alignPointCloudCuda(const pcl::PointCloud<pcl::PointXYZRGBL>& source,
+                                             const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                             const compute::RegistrationParams& params,
+                                             compute::RegistrationResult& result) {
+
+                if(source.empty() || target.empty())
+                    return 0;
+
+                StreamContext& context = StreamContext::getCurrent();
+                DeviceScope deviceScope(context.getDevice());
+                DevicePointCloud deviceSource(context.getStream());
+                DevicePointCloud deviceTarget(context.getStream());
+
+                if(deviceSource.upload(source) < 0 || deviceTarget.upload(target) < 0)
+                    return -1;
+
+                return alignPointCloudCuda(deviceSource, deviceTarget, params, result);
+            }
+
+            __host__ int alignPointCloudCuda(const DevicePointCloud& source, const DevicePointCloud& target,
+                                             const compute::RegistrationParams& params,
+                                             compute::RegistrationResult& result) {
+
+                cudaError_t err;
+
+                if(source.size() == 0 || target.size() == 0)
+                    return 0;
+
+                if(params.cellSize <= 0.0f) {
+                    std::cerr << "alignPointCloudCuda: the cell size must be positive!" << std::endl;
+                    return -1;
+                }
+
+                if(source.getDevice() != target.getDevice()) {
+                    std::cerr << "alignPointCloudCuda: the clouds must live on the same device!" << std::endl;
+                    return -1;
+                }
+
+                DeviceScope deviceScope(target.getDevice());
+                cudaStream_t stream = target.getStream();
+
+                // the source may still be written on its own stream
+                if((err = cudaStreamSynchronize(source.getStream())) != cudaSuccess) {
+                    std::cerr << "Error waiting for the source stream: " << cudaGetErrorString(err) << std::endl;
+                    return -2;
+                }
+
+                try {
+                    ThrustTempAllocator tempAllocator;
+                    auto policy = thrust::cuda::par(tempAllocator).on(stream);
+
+                    PoolVector<unsigned long long> cellKeys;
+                    PoolVector<CellPlane> planes;
+                    {
+                        KernelTimer kernelTimer(stream);
+                        if(buildCellPlanes(target.getXYZ(), target.getLabels(), target.size(), params.cellSize,
+                                           stream, cellKeys, planes) < 0)
+                            return -2;
+                    }
+
+                    if(cellKeys.empty())
+                        return 0;
+
+                    PointToPlaneTerm term{};
+                    term.xyz = source.getXYZ();
+                    term.keys = thrust::raw_pointer_cast(cellKeys.data());
+                    term.planes = thrust::raw_pointer_cast(planes.data());
+                    term.num_cells = cellKeys.size();
+                    term.inverseCellSize = 1.0f / params.cellSize;
+                    term.maxDistanceSquared = params.maxCorrespondenceDistance * params.maxCorrespondenceDistance;
+
+                    std::size_t nSource = source.size();
+
+                    // each iteration brings back the 29 floats of the normal equations only
+                    auto accumulate = [&](const Eigen::Affine3d& pose, NormalEquations& equations) {
+                        term.pose = PointTransform::fromAffine(pose);
+                        KernelTimer kernelTimer(stream);
+                        equations = thrust::transform_reduce(policy, thrust::counting_iterator<std::size_t>(0),
+                                                             thrust::counting_iterator<std::size_t>(nSource),
+                                                             term, compute::Registration::zero(),
+                                                             NormalEquationsSum());
+                        return 0;
+                    };
+
+                    if(compute::Registration::iterate(params, accumulate, result) < 0)
+                        return -2;
+
+                } catch (thrust::system_error& e) {
+                    std::cerr << "Error registering the point clouds: " << e.what() << std::endl;
+                    return -3;
+                } catch (std::bad_alloc& e) {
+                    std::cerr << "Error allocating memory for the registration: " << e.what() << std::endl;
+                    return -4;
+                }
+
+                return 0;
+            }
+
+            __global__ void initCellMomentsKernel(const float4 *xyz, const std::uint32_t *indices,
+                                                  std::size_t num_points, float cellSize, CellMoments *moments) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
+
+                float4 p = xyz[indices[idx]];
+
+                // relative to the corner of the cell, so the squares keep their precision far from the origin
+                float inverseCellSize = 1.0f / cellSize;
+                float x = p.x - floorf(p.x * inverseCellSize) * cellSize;
+                float y = p.y - floorf(p.y * inverseCellSize) * cellSize;
+                float z = p.z - floorf(p.z * inverseCellSize) * cellSize;
+
+                CellMoments& m = moments[idx];
+                m.sx = x;
+                m.sy = y;
+                m.sz = z;
+                m.sxx = x * x;
+                m.sxy = x * y;
+                m.sxz = x * z;
+                m.syy = y * y;
+                m.syz = y * z;
+                m.szz = z * z;
+                m.count = 1;
+            }
+
+            __global__ void cellPlanesKernel(const unsigned long long *keys, const CellMoments *moments,
+                                             std::size_t num_cells, float cellSize, CellPlane *planes) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_cells)
+                    return;
+
+                const CellMoments& m = moments[idx];
+                CellPlane& plane = planes[idx];
+                plane.normal = make_float4(0.0f, 0.0f, 0.0f, 0.0f);
+
+                const long long offset = 1LL << (VOXEL_KEY_AXIS_BITS - 1);
+                const unsigned long long mask = (1ULL << VOXEL_KEY_AXIS_BITS) - 1;
+                unsigned long long key = keys[idx];
+                float cornerX = (float) ((long long) (key >> (2 * VOXEL_KEY_AXIS_BITS)) - offset) * cellSize;
+                float cornerY = (float) ((long long) ((key >> VOXEL_KEY_AXIS_BITS) & mask) - offset) * cellSize;
+                float cornerZ = (float) ((long long) (key & mask) - offset) * cellSize;
+
+                float inverseCount = 1.0f / m.count;
+                float mx = m.sx * inverseCount;
+                float my = m.sy * inverseCount;
+                float mz = m.sz * inverseCount;
+                plane.centroid = make_float4(cornerX + mx, cornerY + my, cornerZ + mz, 1.0f);
+
+                if(m.count < REGISTRATION_MIN_CELL_POINTS)
+                    return;
+
+                // covariance of the points
+                float a00 = m.sxx * inverseCount - mx * mx;
+                float a01 = m.sxy * inverseCount - mx * my;
+                float a02 = m.sxz * inverseCount - mx * mz;
+                float a11 = m.syy * inverseCount - my * my;
+                float a12 = m.syz * inverseCount - my * mz;
+                float a22 = m.szz * inverseCount - mz * mz;
+
+                // smallest eigenvalue, in closed form
+                float q = (a00 + a11 + a22) / 3.0f;
+                float p1 = a01 * a01 + a02 * a02 + a12 * a12;
+                float p2 = (a00 - q) * (a00 - q) + (a11 - q) * (a11 - q) + (a22 - q) * (a22 - q) + 2.0f * p1;
+                float p = sqrtf(p2 / 6.0f);
+                if(p < 1e-12f)
+                    return;
+
+                float b00 = (a00 - q) / p, b01 = a01 / p, b02 = a02 / p;
+                float b11 = (a11 - q) / p, b12 = a12 / p, b22 = (a22 - q) / p;
+                float r = 0.5f * (b00 * (b11 * b22 - b12 * b12) - b01 * (b01 * b22 - b12 * b02) +
+                                  b02 * (b01 * b12 - b11 * b02));
+                r = fminf(1.0f, fmaxf(-1.0f, r));
+                float phi = acosf(r) / 3.0f;
+                float lambda = q + 2.0f * p * cosf(phi + 2.0943951f);
+
+                // its eigenvector is orthogonal to the rows of A - lambda I: the largest cross product of two rows
+                float r0[3] = {a00 - lambda, a01, a02};
+                float r1[3] = {a01, a11 - lambda, a12};
+                float r2[3] = {a02, a12, a22 - lambda};
+                float c01[3] = {r0[1] * r1[2] - r0[2] * r1[1], r0[2] * r1[0] - r0[0] * r1[2], r0[0] * r1[1] - r0[1] * r1[0]};
+                float c02[3] = {r0[1] * r2[2] - r0[2] * r2[1], r0[2] * r2[0] - r0[0] * r2[2], r0[0] * r2[1] - r0[1] * r2[0]};
+                float c12[3] = {r1[1] * r2[2] - r1[2] * r2[1], r1[2] * r2[0] - r1[0] * r2[2], r1[0] * r2[1] - r1[1] * r2[0]};
+                float d01 = c01[0] * c01[0] + c01[1] * c01[1] + c01[2] * c01[2];
+                float d02 = c02[0] * c02[0] + c02[1] * c02[1] + c02[2] * c02[2];
+                float d12 = c12[0] * c12[0] + c12[1] * c12[1] + c12[2] * c12[2];
+
+                const float *n = c01;
+                float d = d01;
+                if(d02 > d) {
+                    n = c02;
+                    d = d02;
+                }
+                if(d12 > d) {
+                    n = c12;
+                    d = d12;
+                }
+                if(d <= 0.0f)
+                    return;
+
+                float inverseNorm = rsqrtf(d);
+                plane.normal = make_float4(n[0] * inverseNorm, n[1] * inverseNorm, n[2] * inverseNorm, 1.0f);
+            }
+        }
+    } // pcl_aggregator
+} // cuda
@@ -0,0 +1,526 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/cuda/CUDAStreams.cuh>
+#include <pcl_aggregator_core/cuda/DeviceMemoryPool.cuh>
+#include <pcl_aggregator_core/cuda/CUDABackend.cuh>
+#include <pcl_aggregator_core/cuda/CUDADevices.cuh>
+#include <pcl_aggregator_core/utils/Metrics.h>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <memory>
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        // the context set by a StreamScope on each thread
+        static thread_local StreamContext* currentContext = nullptr;
+
+        PinnedBufferPool::~PinnedBufferPool() {
+            this->trim();
+        }
+
+        PinnedBufferPool& PinnedBufferPool::getInstance() {
+            static PinnedBufferPool instance;
+            return instance;
+        }
+
+        void* PinnedBufferPool::acquire(std::size_t bytes, std::size_t* capacity) {
+
+            // round up to the size class
+            std::size_t size = PINNED_POOL_MIN_BUFFER_BYTES;
+            while(size < bytes)
+                size <<= 1;
+
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+
+                auto it = this->freeBuffers.find(size);
+                if(it != this->freeBuffers.end() && !it->second.empty()) {
+                    void* buffer = it->second.back();
+                    it->second.pop_back();
+                    this->cachedBytes -= size;
+                    *capacity = size;
+                    return buffer;
+                }
+            }
+
+            void* buffer = nullptr;
+            cudaError_t err;
+            // portable, as the buffers are shared by the contexts of all the devices
+            if((err = cudaHostAlloc(&buffer, size, cudaHostAllocPortable)) != cudaSuccess) {
+                std::cerr << "Error allocating pinned host memory: " << cudaGetErrorString(err) << std::endl;
+                *capacity = 0;
+                return nullptr;
+            }
+
+            *capacity = size;
+            return buffer;
+        }
+
+        void PinnedBufferPool::release(void* buffer, std::size_t capacity) {
+
+            if(buffer == nullptr)
+                return;
+
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+
+                if(this->cachedBytes + capacity <= PINNED_POOL_MAX_CACHED_BYTES) {
+                    this->freeBuffers[capacity].push_back(buffer);
+                    this->cachedBytes += capacity;
+                    return;
+                }
+            }
+
+            cudaFreeHost(buffer);
+        }
+
+        void PinnedBufferPool::trim() {
+
+            std::map<std::size_t, std::vector<void*>> buffers;
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                buffers.swap(this->freeBuffers);
+                this->cachedBytes = 0;
+            }
+
+            for(auto& sizeClass : buffers) {
+                for(void* buffer : sizeClass.second)
+                    cudaFreeHost(buffer);
+            }
+        }
+
+        std::size_t PinnedBufferPool::getCachedBytes() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->cachedBytes;
+        }
+
+        PinnedBuffer::~PinnedBuffer() {
+            PinnedBufferPool::getInstance().release(this->buffer, this->capacity);
+        }
+
+        PinnedBuffer::PinnedBuffer(PinnedBuffer&& other) noexcept {
+            this->buffer = other.buffer;
+            this->capacity = other.capacity;
+            other.buffer = nullptr;
+            other.capacity = 0;
+        }
+
+        PinnedBuffer& PinnedBuffer::operator=(PinnedBuffer&& other) noexcept {
+            if(this != &other) {
+                PinnedBufferPool::getInstance().release(this->buffer, this->capacity);
+                this->buffer = other.buffer;
+                this->capacity = other.capacity;
+                other.buffer = nullptr;
+                other.capacity = 0;
+            }
+            return *this;
+        }
+
+        int PinnedBuffer::reserve(std::size_t bytes) {
+
+            if(bytes <= this->capacity)
+                return 0;
+
+            PinnedBufferPool& pool = PinnedBufferPool::getInstance();
+            pool.release(this->buffer, this->capacity);
+            this->buffer = pool.acquire(bytes, &this->capacity);
+
+            return this->buffer == nullptr ? -1 : 0;
+        }
+
+        void* PinnedBuffer::data() const {
+            return this->buffer;
+        }
+
+        std::size_t PinnedBuffer::getCapacity() const {
+            return this->capacity;
+        }
+
+        // adapt the work on a chunk of points to the work on a chunk of bytes
+        static std::function<void(void*, std::size_t, std::size_t, cudaStream_t)> toChunkLaunch(
+                const StreamContext::PointsLaunch& launch) {
+
+            if(launch == nullptr)
+                return nullptr;
+
+            return [&launch](void* d_chunk, std::size_t length, std::size_t offset, cudaStream_t stream) {
+                launch(static_cast<pcl::PointXYZRGBL*>(d_chunk), length / sizeof(pcl::PointXYZRGBL),
+                       offset / sizeof(pcl::PointXYZRGBL), stream);
+            };
+        }
+
+        StreamContext::StreamContext(int device) {
+
+            cudaError_t err;
+
+            // on a host without a device the work goes to the CPU backend, the streams are never used
+            if(!CUDABackend::isDeviceAvailable())
+                return;
+
+            if(device < 0) {
+                device = getCurrentDevice();
+            } else if(device >= getDeviceCount()) {
+                std::cerr << "StreamContext: no CUDA device " << device << ", using device 0" << std::endl;
+                device = 0;
+            }
+            this->device = device;
+
+            // the streams belong to the device current on creation
+            DeviceScope deviceScope(this->device);
+
+            for(auto& stream : this->streams) {
+                // non-blocking, so the work of other contexts on the legacy stream doesn't serialize this one
+                if((err = cudaStreamCreateWithFlags(&stream, cudaStreamNonBlocking)) != cudaSuccess) {
+                    std::cerr << "Error creating a CUDA stream: " << cudaGetErrorString(err) << std::endl;
+                    stream = nullptr;
+                }
+            }
+        }
+
+        StreamContext::~StreamContext() {
+
+            DeviceScope deviceScope(this->device);
+
+            this->synchronize();
+
+            for(auto& buffer : this->d_staging)
+                DeviceMemoryPool::getInstance().release(buffer);
+
+            for(auto& stream : this->streams) {
+                if(stream != nullptr)
+                    cudaStreamDestroy(stream);
+            }
+        }
+
+        bool StreamContext::ensurePinnedStaging() {
+
+            for(auto& buffer : this->staging) {
+                if(buffer.reserve(CUDA_PIPELINE_CHUNK_BYTES) < 0)
+                    return false;
+            }
+
+            return true;
+        }
+
+        int StreamContext::ensureDeviceStaging() {
+
+            for(auto& buffer : this->d_staging) {
+                if(buffer != nullptr)
+                    continue;
+                if((buffer = DeviceMemoryPool::getInstance().allocate(CUDA_PIPELINE_CHUNK_BYTES)) == nullptr) {
+                    std::cerr << "Error allocating the device staging buffer" << std::endl;
+                    return -1;
+                }
+            }
+
+            return 0;
+        }
+
+        int StreamContext::synchronize() {
+
+            int rc = 0;
+            cudaError_t err;
+
+            for(auto& stream : this->streams) {
+                if(stream != nullptr && (err = cudaStreamSynchronize(stream)) != cudaSuccess) {
+                    std::cerr << "Error synchronizing a CUDA stream: " << cudaGetErrorString(err) << std::endl;
+                    rc = -1;
+                }
+            }
+
+            return rc;
+        }
+
+        cudaStream_t StreamContext::getStream() const {
+            return this->streams[0];
+        }
+
+        int StreamContext::getDevice() const {
+            return this->device;
+        }
+
+        std::size_t StreamContext::getStagingBytes() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            std::size_t bytes = 0;
+            for(const auto& buffer : this->staging)
+                bytes += buffer.getCapacity();
+            for(const auto& buffer : this->d_staging) {
+                if(buffer != nullptr)
+                    bytes += CUDA_PIPELINE_CHUNK_BYTES;
+            }
+            return bytes;
+        }
+
+        int StreamContext::pipeline(void* d_destination, const void* source, void* destination, std::size_t bytes,
+                                    std::size_t chunkBytes,
+                                    const std::function<void(void*, std::size_t, std::size_t, cudaStream_t)>& launch) {
+
+            if(bytes == 0)
+                return 0;
+
+            for(auto& stream : this->streams) {
+                if(stream == nullptr)
+                    return -1;
+            }
+
+            if(d_destination == nullptr && this->ensureDeviceStaging() < 0)
+                return -2;
+
+            // without pinned memory, the chunks are copied from and to the pageable memory directly
+            bool pinned = this->ensurePinnedStaging();
+
+            cudaError_t err;
+            auto src = static_cast<const unsigned char*>(source);
+            auto dst = static_cast<unsigned char*>(destination);
+            std::size_t nChunks = (bytes + chunkBytes - 1) / chunkBytes;
+
+            // wait for a chunk and copy it out of its staging buffer
+            auto finish = [&](std::size_t chunk) -> int {
+                std::size_t stage = chunk % CUDA_PIPELINE_STAGES;
+                std::size_t offset = chunk * chunkBytes;
+                std::size_t length = std::min(chunkBytes, bytes - offset);
+
+                if((err = cudaStreamSynchronize(this->streams[stage])) != cudaSuccess) {
+                    std::cerr << "Error waiting for a pipeline stage: " << cudaGetErrorString(err) << std::endl;
+                    return -1;
+                }
+
+                if(pinned && dst != nullptr)
+                    std::memcpy(dst + offset, this->staging[stage].data(), length);
+
+                return 0;
+            };
+
+            int rc = 0;
+            std::size_t chunk;
+            for(chunk = 0; chunk < nChunks && rc == 0; chunk++) {
+                std::size_t stage = chunk % CUDA_PIPELINE_STAGES;
+                std::size_t offset = chunk * chunkBytes;
+                std::size_t length = std::min(chunkBytes, bytes - offset);
+                cudaStream_t stream = this->streams[stage];
+
+                // the staging buffer of this stage is free once its previous chunk is done
+                if(chunk >= CUDA_PIPELINE_STAGES && finish(chunk - CUDA_PIPELINE_STAGES) < 0) {
+                    rc = -3;
+                    break;
+                }
+
+                const void* hostChunk = src + offset;
+                if(pinned) {
+                    std::memcpy(this->staging[stage].data(), src + offset, length);
+                    hostChunk = this->staging[stage].data();
+                }
+
+                void* d_chunk = d_destination != nullptr ?
+                        static_cast<void*>(static_cast<unsigned char*>(d_destination) + offset) :
+                        this->d_staging[stage];
+
+                if((err = cudaMemcpyAsync(d_chunk, hostChunk, length, cudaMemcpyHostToDevice, stream)) != cudaSuccess) {
+                    std::cerr << "Error copying a chunk to the device: " << cudaGetErrorString(err) << std::endl;
+                    rc = -4;
+                    break;
+                }
+
+                if(launch != nullptr) {
+                    launch(d_chunk, length, offset, stream);
+                    if((err = cudaGetLastError()) != cudaSuccess) {
+                        std::cerr << "Error launching the work on a chunk: " << cudaGetErrorString(err) << std::endl;
+                        rc = -5;
+                        break;
+                    }
+                }
+
+                if(dst != nullptr) {
+                    void* hostResult = pinned ? this->staging[stage].data() : static_cast<void*>(dst + offset);
+                    if((err = cudaMemcpyAsync(hostResult, d_chunk, length, cudaMemcpyDeviceToHost, stream)) != cudaSuccess) {
+                        std::cerr << "Error copying a chunk to the host: " << cudaGetErrorString(err) << std::endl;
+                        rc = -6;
+                        break;
+                    }
+                }
+            }
+
+            if(rc < 0) {
+                // the staging buffers may still be in use
+                this->synchronize();
+                return rc;
+            }
+
+            for(chunk = nChunks > CUDA_PIPELINE_STAGES ? nChunks - CUDA_PIPELINE_STAGES : 0; chunk < nChunks; chunk++) {
+                if(finish(chunk) < 0) {
+                    this->synchronize();
+                    return -3;
+                }
+            }
+
+            utils::Metrics::add(utils::CounterMetric::H2D_BYTES, bytes);
+            if(dst != nullptr)
+                utils::Metrics::add(utils::CounterMetric::D2H_BYTES, bytes);
+
+            return 0;
+        }
+
+        int StreamContext::upload(void* d_destination, const void* source, std::size_t bytes) {
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            DeviceScope deviceScope(this->device);
+
+            return this->pipeline(d_destination, source, nullptr, bytes, CUDA_PIPELINE_CHUNK_BYTES, nullptr);
+        }
+
+        int StreamContext::drain(void* destination, const void* d_source, std::size_t bytes, std::size_t chunkBytes,
+                                 const std::function<void(void*, std::size_t, std::size_t, cudaStream_t)>& produce) {
+
+            if(bytes == 0)
+                return 0;
+
+            for(auto& stream : this->streams) {
+                if(stream == nullptr)
+                    return -1;
+            }
+
+            if(d_source == nullptr && this->ensureDeviceStaging() < 0)
+                return -4;
+
+            bool pinned = this->ensurePinnedStaging();
+
+            cudaError_t err;
+            auto src = static_cast<const unsigned char*>(d_source);
+            auto dst = static_cast<unsigned char*>(destination);
+            std::size_t nChunks = (bytes + chunkBytes - 1) / chunkBytes;
+
+            auto finish = [&](std::size_t chunk) -> int {
+                std::size_t stage = chunk % CUDA_PIPELINE_STAGES;
+                std::size_t offset = chunk * chunkBytes;
+                std::size_t length = std::min(chunkBytes, bytes - offset);
+
+                if((err = cudaStreamSynchronize(this->streams[stage])) != cudaSuccess) {
+                    std::cerr << "Error waiting for a pipeline stage: " << cudaGetErrorString(err) << std::endl;
+                    return -1;
+                }
+
+                if(pinned)
+                    std::memcpy(dst + offset, this->staging[stage].data(), length);
+
+                return 0;
+            };
+
+            std::size_t chunk;
+            for(chunk = 0; chunk < nChunks; chunk++) {
+                std::size_t stage = chunk % CUDA_PIPELINE_STAGES;
+                std::size_t offset = chunk * chunkBytes;
+                std::size_t length = std::min(chunkBytes, bytes - offset);
+                cudaStream_t stream = this->streams[stage];
+
+                if(chunk >= CUDA_PIPELINE_STAGES && finish(chunk - CUDA_PIPELINE_STAGES) < 0) {
+                    this->synchronize();
+                    return -2;
+                }
+
+                const void* d_chunk = src + offset;
+                if(d_source == nullptr) {
+                    // the chunk is produced on the staging buffer of its stage, freed by the finish above
+                    produce(this->d_staging[stage], length, offset, stream);
+                    if((err = cudaGetLastError()) != cudaSuccess) {
+                        std::cerr << "Error launching the work on a chunk: " << cudaGetErrorString(err) << std::endl;
+                        this->synchronize();
+                        return -5;
+                    }
+                    d_chunk = this->d_staging[stage];
+                }
+
+                void* hostChunk = pinned ? this->staging[stage].data() : static_cast<void*>(dst + offset);
+                if((err = cudaMemcpyAsync(hostChunk, d_chunk, length, cudaMemcpyDeviceToHost, stream)) != cudaSuccess) {
+                    std::cerr << "Error copying a chunk to the host: " << cudaGetErrorString(err) << std::endl;
+                    this->synchronize();
+                    return -3;
+                }
+            }
+
+            for(chunk = nChunks > CUDA_PIPELINE_STAGES ? nChunks - CUDA_PIPELINE_STAGES : 0; chunk < nChunks; chunk++) {
+                if(finish(chunk) < 0) {
+                    this->synchronize();
+                    return -2;
+                }
+            }
+
+            utils::Metrics::add(utils::CounterMetric::D2H_BYTES, bytes);
+
+            return 0;
+        }
+
+        int StreamContext::download(void* destination, const void* d_source, std::size_t bytes) {
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            DeviceScope deviceScope(this->device);
+
+            if(d_source == nullptr)
+                return -1;
+
+            return this->drain(destination, d_source, bytes, CUDA_PIPELINE_CHUNK_BYTES, nullptr);
+        }
+
+        int StreamContext::downloadPoints(pcl::PointXYZRGBL* destination, std::size_t n, const PointsLaunch& produce) {
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            DeviceScope deviceScope(this->device);
+
+            if(produce == nullptr)
+                return -1;
+
+            std::size_t chunkBytes = (CUDA_PIPELINE_CHUNK_BYTES / sizeof(pcl::PointXYZRGBL)) * sizeof(pcl::PointXYZRGBL);
+
+            return this->drain(destination, nullptr, n * sizeof(pcl::PointXYZRGBL), chunkBytes, toChunkLaunch(produce));
+        }
+
+        int StreamContext::uploadPoints(pcl::PointXYZRGBL* d_destination, const pcl::PointXYZRGBL* source,
+                                        std::size_t n, const PointsLaunch& launch) {
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            DeviceScope deviceScope(this->device);
+
+            // chunks of whole points
+            std::size_t chunkBytes = (CUDA_PIPELINE_CHUNK_BYTES / sizeof(pcl::PointXYZRGBL)) * sizeof(pcl::PointXYZRGBL);
+
+            return this->pipeline(d_destination, source, nullptr, n * sizeof(pcl::PointXYZRGBL), chunkBytes,
+                                  toChunkLaunch(launch));
+        }
+
+        int StreamContext::processPoints(const pcl::PointXYZRGBL* source, pcl::PointXYZRGBL* destination,
+                                         std::size_t n, const PointsLaunch& launch) {
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+            DeviceScope deviceScope(this->device);
+
+            std::size_t chunkBytes = (CUDA_PIPELINE_CHUNK_BYTES / sizeof(pcl::PointXYZRGBL)) * sizeof(pcl::PointXYZRGBL);
+
+            return this->pipeline(nullptr, source, destination, n * sizeof(pcl::PointXYZRGBL), chunkBytes,
+                                  toChunkLaunch(launch));
+        }
+
+        StreamContext& StreamContext::getCurrent() {
+
+            if(currentContext != nullptr)
+                return *currentContext;
+
+            // threads outside any scope get their own long-lived context
+            static thread_local std::unique_ptr<StreamContext> threadContext;
+            if(threadContext == nullptr)
+                threadContext = std::make_unique<StreamContext>();
+
+            return *threadContext;
+        }
+
+        StreamContext* StreamContext::setCurrent(StreamContext* context) {
+            StreamContext* previous = currentContext;
+            currentContext = context;
+            return previous;
+        }
+
+    } // pcl_aggregator
+} // cuda
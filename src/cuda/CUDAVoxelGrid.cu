@@ -0,0 +1,329 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/cuda/CUDAVoxelGrid.cuh>
+#include <pcl_aggregator_core/cuda/CUDAStreams.cuh>
+#include <pcl_aggregator_core/cuda/DeviceMemoryPool.cuh>
+#include <pcl_aggregator_core/cuda/CUDAMetrics.cuh>
+#include <thrust/device_vector.h>
+#include <thrust/execution_policy.h>
+#include <thrust/functional.h>
+#include <thrust/iterator/constant_iterator.h>
+#include <thrust/iterator/zip_iterator.h>
+#include <thrust/reduce.h>
+#include <thrust/sort.h>
+#include <thrust/system_error.h>
+#include <thrust/transform.h>
+#include <thrust/copy.h>
+#include <thrust/tuple.h>
+
+namespace pcl_aggregator {
+    namespace cuda {
+        namespace pointclouds {
+
+            /*! \brief Sum the accumulators of points with the same voxel and label. */
+            struct SameLabelSum {
+                __host__ __device__ VoxelAccumulator operator()(const VoxelAccumulator& a,
+                                                                const VoxelAccumulator& b) const {
+                    VoxelAccumulator result;
+                    result.x = a.x + b.x;
+                    result.y = a.y + b.y;
+                    result.z = a.z + b.z;
+                    result.r = a.r + b.r;
+                    result.g = a.g + b.g;
+                    result.b = a.b + b.b;
+                    result.count = a.count + b.count;
+                    result.label = a.label;
+                    result.labelCount = a.labelCount + b.labelCount;
+                    return result;
+                }
+            };
+
+            /*! \brief Sum the accumulators of a voxel, keeping the label with most points. */
+            struct VoxelMerge {
+                __host__ __device__ VoxelAccumulator operator()(const VoxelAccumulator& a,
+                                                                const VoxelAccumulator& b) const {
+                    VoxelAccumulator result;
+                    result.x = a.x + b.x;
+                    result.y = a.y + b.y;
+                    result.z = a.z + b.z;
+                    result.r = a.r + b.r;
+                    result.g = a.g + b.g;
+                    result.b = a.b + b.b;
+                    result.count = a.count + b.count;
+                    // ties are kept by the first label, which keeps the reduction associative
+                    bool keepFirst = a.labelCount >= b.labelCount;
+                    result.label = keepFirst ? a.label : b.label;
+                    result.labelCount = keepFirst ? a.labelCount : b.labelCount;
+                    return result;
+                }
+            };
+
+            /*! \brief Get the label of a voxel accumulator. */
+            struct AccumulatorLabel {
+                __host__ __device__ std::uint32_t operator()(const VoxelAccumulator& a) const {
+                    return a.label;
+                }
+            };
+
+            /*! \brief Downsample the arrays of a device PointCloud in-place.
+             *
+             * The points are sorted by (voxel key, label), reduced first per label and then per voxel.
+             *
+             * @param d_xyz Device array of coordinates. Receives the centroids.
+             * @param d_rgba Device array of packed colors. Receives the colors of the centroids.
+             * @param d_labels Device array of labels. Receives the labels of the centroids.
+             * @param nPoints Number of points of the arrays.
+             * @param leafSize The voxel size.
+             * @param stream The stream to order the work on.
+             * @param nVoxels Receives the number of centroids written.
+             * @param labelRuns Optionally receives the (label, number of points) runs of the output.
+             * @return 0 on success, negative on error.
+             */
+            static int voxelDownsampleDevice(float4 *d_xyz, std::uint32_t *d_rgba, std::uint32_t *d_labels,
+                                             std::size_t nPoints, float leafSize,
+                                             cudaStream_t stream, std::size_t *nVoxels,
+                                             std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns) {
+
+                cudaError_t err = cudaSuccess;
+
+                *nVoxels = nPoints;
+
+                if(nPoints == 0)
+                    return 0;
+
+                if(leafSize <= 0.0f) {
+                    std::cerr << "voxelDownsampleCuda: the leaf size must be positive!" << std::endl;
+                    return -1;
+                }
+
+                try {
+                    // the vectors and the temporary storage of the sorts and reductions come from the pool
+                    ThrustTempAllocator tempAllocator;
+                    auto policy = thrust::cuda::par(tempAllocator).on(stream);
+
+                    PoolVector<unsigned long long> keys(nPoints);
+                    PoolVector<std::uint32_t> labels(nPoints);
+                    PoolVector<std::uint32_t> indices(nPoints);
+
+                    dim3 block(512);
+                    dim3 grid((nPoints + block.x - 1) / block.x);
+                    computeVoxelKeysKernel<<<grid, block, 0, stream>>>(d_xyz, d_labels, nPoints, 1.0f / leafSize,
+                                                                       thrust::raw_pointer_cast(keys.data()),
+                                                                       thrust::raw_pointer_cast(labels.data()),
+                                                                       thrust::raw_pointer_cast(indices.data()));
+
+                    // order the points by voxel, and by label inside each voxel
+                    auto sortKeys = thrust::make_zip_iterator(thrust::make_tuple(keys.begin(), labels.begin()));
+                    thrust::sort_by_key(policy, sortKeys, sortKeys + nPoints, indices.begin());
+
+                    PoolVector<VoxelAccumulator> accumulators(nPoints);
+                    initVoxelAccumulatorsKernel<<<grid, block, 0, stream>>>(d_xyz, d_rgba,
+                                                                            thrust::raw_pointer_cast(labels.data()),
+                                                                            thrust::raw_pointer_cast(indices.data()),
+                                                                            nPoints,
+                                                                            thrust::raw_pointer_cast(accumulators.data()));
+
+                    // count the points of each label on each voxel
+                    PoolVector<unsigned long long> pairKeys(nPoints);
+                    PoolVector<std::uint32_t> pairLabels(nPoints);
+                    PoolVector<VoxelAccumulator> pairAccumulators(nPoints);
+                    auto pairOut = thrust::make_zip_iterator(thrust::make_tuple(pairKeys.begin(), pairLabels.begin()));
+                    auto pairEnd = thrust::reduce_by_key(policy, sortKeys, sortKeys + nPoints, accumulators.begin(),
+                                                         pairOut, pairAccumulators.begin(),
+                                                         thrust::equal_to<thrust::tuple<unsigned long long, std::uint32_t>>(),
+                                                         SameLabelSum());
+                    std::size_t nPairs = pairEnd.second - pairAccumulators.begin();
+
+                    // merge the labels of each voxel, keeping the one with most points
+                    PoolVector<unsigned long long> voxelKeys(nPairs);
+                    PoolVector<VoxelAccumulator> voxelAccumulators(nPairs);
+                    auto voxelEnd = thrust::reduce_by_key(policy, pairKeys.begin(), pairKeys.begin() + nPairs,
+                                                          pairAccumulators.begin(), voxelKeys.begin(),
+                                                          voxelAccumulators.begin(),
+                                                          thrust::equal_to<unsigned long long>(), VoxelMerge());
+                    std::size_t nValidVoxels = voxelEnd.second - voxelAccumulators.begin();
+
+                    // the invalid points sort last and are dropped, like pcl::VoxelGrid does with non-finite points
+                    if(nValidVoxels > 0 && voxelKeys[nValidVoxels - 1] == VOXEL_KEY_INVALID)
+                        nValidVoxels--;
+
+                    if(labelRuns != nullptr)
+                        labelRuns->clear();
+
+                    if(nValidVoxels > 0) {
+                        // group the centroids by label, so removing a label touches a contiguous range
+                        PoolVector<std::uint32_t> voxelLabels(nValidVoxels);
+                        thrust::transform(policy, voxelAccumulators.begin(), voxelAccumulators.begin() + nValidVoxels,
+                                          voxelLabels.begin(), AccumulatorLabel());
+                        thrust::stable_sort_by_key(policy, voxelLabels.begin(), voxelLabels.end(),
+                                                   voxelAccumulators.begin());
+
+                        if(labelRuns != nullptr) {
+                            PoolVector<std::uint32_t> runLabels(nValidVoxels);
+                            PoolVector<std::uint32_t> runCounts(nValidVoxels);
+                            auto runEnd = thrust::reduce_by_key(policy, voxelLabels.begin(), voxelLabels.end(),
+                                                                thrust::make_constant_iterator<std::uint32_t>(1),
+                                                                runLabels.begin(), runCounts.begin());
+                            std::size_t nRuns = runEnd.first - runLabels.begin();
+
+                            std::vector<std::uint32_t> h_runLabels(nRuns);
+                            std::vector<std::uint32_t> h_runCounts(nRuns);
+                            thrust::copy(runLabels.begin(), runLabels.begin() + nRuns, h_runLabels.begin());
+                            thrust::copy(runCounts.begin(), runCounts.begin() + nRuns, h_runCounts.begin());
+
+                            labelRuns->reserve(nRuns);
+                            for(std::size_t i = 0; i < nRuns; i++)
+                                labelRuns->emplace_back(h_runLabels[i], h_runCounts[i]);
+                        }
+
+                        dim3 voxelGrid((nValidVoxels + block.x - 1) / block.x);
+                        voxelCentroidsKernel<<<voxelGrid, block, 0, stream>>>(
+                                thrust::raw_pointer_cast(voxelAccumulators.data()), nValidVoxels, d_xyz, d_rgba, d_labels);
+                    }
+
+                    // the temporaries are freed when leaving the scope, the work must be done by then
+                    if((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
+                        std::cerr << "Error waiting for the voxel grid stream: " << cudaGetErrorString(err) << std::endl;
+                        return -2;
+                    }
+
+                    *nVoxels = nValidVoxels;
+
+                } catch (thrust::system_error& e) {
+                    std::cerr << "Error running the voxel grid filter: " << e.what() << std::endl;
+                    return -3;
+                } catch (std::bad_alloc& e) {
+                    std::cerr << "Error allocating memory for the voxel grid filter: " << e.what() << std::endl;
+                    return -4;
+                }
+
+                return 0;
+            }
+
+            __host__ int voxelDownsampleCuda(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, float leafSize,
+                                             std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns) {
+
+                if(cloud == nullptr || cloud->empty())
+                    return 0;
+
+                // a temporary buffer on the long-lived stream of the thread, instead of a stream per call
+                StreamContext& context = StreamContext::getCurrent();
+                DeviceScope deviceScope(context.getDevice());
+                DevicePointCloud deviceCloud(context.getStream());
+
+                if(deviceCloud.upload(*cloud) < 0)
+                    return -1;
+
+                if(voxelDownsampleCuda(deviceCloud, leafSize, labelRuns) < 0)
+                    return -2;
+
+                if(deviceCloud.download(*cloud) < 0)
+                    return -3;
+
+                return 0;
+            }
+
+            __host__ int voxelDownsampleCuda(DevicePointCloud& cloud, float leafSize,
+                                             std::vector<std::pair<std::uint32_t,std::size_t>> *labelRuns) {
+
+                std::size_t nVoxels;
+
+                DeviceScope deviceScope(cloud.getDevice());
+
+                utils::ScopedTimer voxelizeTimer(utils::HistogramMetric::VOXELIZE_TIME_NS);
+
+                {
+                    KernelTimer kernelTimer(cloud.getStream());
+                    if(voxelDownsampleDevice(cloud.getXYZ(), cloud.getRGBA(), cloud.getLabels(), cloud.size(), leafSize,
+                                             cloud.getStream(), &nVoxels, labelRuns) < 0)
+                        return -1;
+                }
+
+                utils::Metrics::add(utils::CounterMetric::DOWNSAMPLE_POINTS_IN, cloud.size());
+                utils::Metrics::add(utils::CounterMetric::DOWNSAMPLE_POINTS_OUT, nVoxels);
+
+                // the centroids were written to the start of the buffer
+                return cloud.resize(nVoxels);
+            }
+
+            __global__ void computeVoxelKeysKernel(const float4 *xyz, const std::uint32_t *point_labels,
+                                                   std::size_t num_points, float inverseLeafSize,
+                                                   unsigned long long *keys, std::uint32_t *labels,
+                                                   std::uint32_t *indices) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
+
+                float4 p = xyz[idx];
+
+                indices[idx] = idx;
+                labels[idx] = point_labels[idx];
+
+                if(!isfinite(p.x) || !isfinite(p.y) || !isfinite(p.z)) {
+                    keys[idx] = VOXEL_KEY_INVALID;
+                    return;
+                }
+
+                // voxel coordinates, shifted to be positive
+                const long long offset = 1LL << (VOXEL_KEY_AXIS_BITS - 1);
+                const long long limit = 1LL << VOXEL_KEY_AXIS_BITS;
+                long long vx = (long long) floorf(p.x * inverseLeafSize) + offset;
+                long long vy = (long long) floorf(p.y * inverseLeafSize) + offset;
+                long long vz = (long long) floorf(p.z * inverseLeafSize) + offset;
+
+                if(vx < 0 || vx >= limit || vy < 0 || vy >= limit || vz < 0 || vz >= limit) {
+                    keys[idx] = VOXEL_KEY_INVALID;
+                    return;
+                }
+
+                keys[idx] = ((unsigned long long) vx << (2 * VOXEL_KEY_AXIS_BITS)) |
+                            ((unsigned long long) vy << VOXEL_KEY_AXIS_BITS) |
+                            (unsigned long long) vz;
+            }
+
+            __global__ void initVoxelAccumulatorsKernel(const float4 *xyz, const std::uint32_t *rgba,
+                                                        const std::uint32_t *sorted_labels,
+                                                        const std::uint32_t *indices, std::size_t num_points,
+                                                        VoxelAccumulator *accumulators) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
+
+                std::uint32_t source = indices[idx];
+                float4 p = xyz[source];
+                std::uint32_t color = rgba[source];
+
+                accumulators[idx].x = p.x;
+                accumulators[idx].y = p.y;
+                accumulators[idx].z = p.z;
+                // packed like pcl::PointXYZRGBL on little-endian: b, g, r, a from the low byte
+                accumulators[idx].r = (color >> 16) & 0xFF;
+                accumulators[idx].g = (color >> 8) & 0xFF;
+                accumulators[idx].b = color & 0xFF;
+                accumulators[idx].count = 1;
+                // the labels were sorted along with the keys, no need to gather them
+                accumulators[idx].label = sorted_labels[idx];
+                accumulators[idx].labelCount = 1;
+            }
+
+            __global__ void voxelCentroidsKernel(const VoxelAccumulator *accumulators, std::size_t num_voxels,
+                                                 float4 *xyz, std::uint32_t *rgba, std::uint32_t *labels) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_voxels)
+                    return;
+
+                const VoxelAccumulator& acc = accumulators[idx];
+                float inverseCount = 1.0f / acc.count;
+
+                xyz[idx] = make_float4(acc.x * inverseCount, acc.y * inverseCount, acc.z * inverseCount, 1.0f);
+                auto r = (std::uint32_t) (acc.r * inverseCount + 0.5f);
+                auto g = (std::uint32_t) (acc.g * inverseCount + 0.5f);
+                auto b = (std::uint32_t) (acc.b * inverseCount + 0.5f);
+                rgba[idx] = (255u << 24) | (r << 16) | (g << 8) | b;
+                labels[idx] = acc.label;
+            }
+        }
+    } // pcl_aggregator
+} // cuda
@@ -3,177 +3,237 @@
 //
 
 #include <pcl_aggregator_core/cuda/CUDA_RGBD.cuh>
+#include <pcl_aggregator_core/cuda/CUDAMetrics.cuh>
+#include <pcl_aggregator_core/cuda/DeviceMemoryPool.cuh>
+#include <iostream>
 
 namespace pcl_aggregator {
     namespace cuda {
         namespace rgbd {
 
-            __host__ void deprojectImages(const cv::Mat& colorImage, const cv::Mat& depthImage, const Eigen::Matrix3d& K, double minDepth, double maxDepth,
-                                 pcl::PointCloud<pcl::PointXYZRGBL>::Ptr destination) {
-                cudaError_t err;
-                cudaStream_t stream;
+            DeprojectionContext::DeprojectionContext() {
 
-                unsigned long long  nPixels = depthImage.total();
-                unsigned long long nValidPoints = 0;
-                pcl::PointXYZRGBL* pointArray;
+                this->d_nValidPoints = static_cast<unsigned int*>(
+                        DeviceMemoryPool::getInstance().allocate(sizeof(unsigned int)));
+                if(this->d_nValidPoints == nullptr)
+                    std::cerr << "Error allocating number of valid points on device" << std::endl;
+            }
 
-                // declare device variable
-                unsigned char *d_colorImage;
-                unsigned char *d_depthImage;
-                pcl::PointXYZRGBL *d_pointArray;
+            DeprojectionContext::~DeprojectionContext() {
 
-                unsigned long long *d_nValidPoints;
+                DeviceScope deviceScope(this->streams.getDevice());
 
-                // create the stream
-                if((err = cudaStreamCreate(&stream)) != cudaSuccess) {
-                    std::cerr << "Error creating the deprojection CUDA stream: " << cudaGetErrorString(err) << std::endl;
-                    return;
-                }
+                cudaStreamSynchronize(this->streams.getStream());
 
-                // allocate the color image on device
-                if((err = cudaMalloc(&d_colorImage, colorImage.total() * colorImage.elemSize())) != cudaSuccess) {
-                    std::cerr << "Error allocating color image on device: " << cudaGetErrorString(err) << std::endl;
-                    return;
-                }
+                DeviceMemoryPool& pool = DeviceMemoryPool::getInstance();
+                pool.release(this->d_colorImage);
+                pool.release(this->d_depthImage);
+                pool.release(this->d_points);
+                pool.release(this->d_nValidPoints);
+            }
 
-                // allocate the depth image on device
-                if((err = cudaMalloc(&d_depthImage, depthImage.total() * depthImage.elemSize())) != cudaSuccess) {
-                    std::cerr << "Error allocating depth image on device: " << cudaGetErrorString(err) << std::endl;
-                    return;
-                }
+            int DeprojectionContext::ensureCapacity(void **buffer, std::size_t *capacity, std::size_t bytes) {
 
-                // allocate the pointcloud on device
-                if((err = cudaMalloc(&d_pointArray, nPixels * sizeof(pcl::PointXYZRGBL))) != cudaSuccess) {
-                    std::cerr << "Error allocating pointcloud on device: " << cudaGetErrorString(err) << std::endl;
-                    return;
-                }
+                if(bytes <= *capacity)
+                    return 0;
 
-                // allocate the valid point counter on device
-                if((err = cudaMalloc(&d_nValidPoints, sizeof(size_t))) != cudaSuccess) {
-                    std::cerr << "Error allocating number of valid points on device: " << cudaGetErrorString(err) << std::endl;
-                    return;
-                }
+                DeviceMemoryPool& pool = DeviceMemoryPool::getInstance();
 
-                // copy the color image to the device
-                if((err = cudaMemcpy(d_colorImage, colorImage.data, colorImage.total() * colorImage.elemSize(),
-                                     cudaMemcpyHostToDevice)) != cudaSuccess) {
-                    std::cerr << "Error copying color image to device: " << cudaGetErrorString(err) << std::endl;
-                    return;
-                }
+                pool.release(*buffer);
+                *capacity = 0;
 
-                // copy the depth image to the device
-                if((err = cudaMemcpy(d_depthImage, depthImage.data, depthImage.total() * depthImage.elemSize(),
-                                     cudaMemcpyHostToDevice)) != cudaSuccess) {
-                    std::cerr << "Error copying depth image to device: " << cudaGetErrorString(err) << std::endl;
-                    return;
+                if((*buffer = pool.allocate(bytes)) == nullptr) {
+                    std::cerr << "Error allocating the deprojection buffer" << std::endl;
+                    return -1;
                 }
+                *capacity = bytes;
 
-                // copy the valid point counter to the device
-                if((err = cudaMemcpy(d_nValidPoints, &nValidPoints, sizeof(unsigned long long), cudaMemcpyHostToDevice)) != cudaSuccess) {
-                    std::cerr << "Error copying the valid point counter to the device: " << cudaGetErrorString(err) << std::endl;
-                    return;
-                }
+                return 0;
+            }
 
-                // call the kernel
-                dim3 threadsPerBlock(16, 16); // 256 threads per block
-                dim3 numBlocks(depthImage.rows / threadsPerBlock.x, depthImage.cols / threadsPerBlock.y);
-                deprojectImagesKernel<<<numBlocks, threadsPerBlock, 0, stream>>>(d_colorImage, d_depthImage,
-                                                                                 depthImage.cols, depthImage.rows,
-                                                                                 K.inverse(), minDepth, maxDepth,
-                                                                                 d_pointArray, d_nValidPoints);
-
-                // wait for the stream to finish all threads
-                if((err = cudaStreamSynchronize(stream)) != cudaSuccess) {
-                    std::cerr << "Error synchronizing the deprojection CUDA stream: " << cudaGetErrorString(err) << std::endl;
-                    return;
+            int DeprojectionContext::deproject(const cv::Mat& colorImage, const cv::Mat& depthImage,
+                                               const Eigen::Matrix3d& K, float minDepth, float maxDepth,
+                                               pcl::PointCloud<pcl::PointXYZRGBL>& destination, float depthUnit) {
+
+                cudaError_t err;
+
+                // the buffers were allocated on the device of the streams
+                DeviceScope deviceScope(this->streams.getDevice());
+
+                cudaStream_t stream = this->streams.getStream();
+
+                if(stream == nullptr || this->d_nValidPoints == nullptr)
+                    return -1;
+
+                if(depthImage.empty() || depthImage.channels() != 1 ||
+                   (depthImage.depth() != CV_16U && depthImage.depth() != CV_32F)) {
+                    std::cerr << "Unsupported depth image: expected one channel of 16-bit or float depth" << std::endl;
+                    return -2;
                 }
 
-                // copy the valid point counter back to the host
-                if((err = cudaMemcpy(&nValidPoints, d_nValidPoints, sizeof(unsigned long long), cudaMemcpyDeviceToHost)) != cudaSuccess) {
-                    std::cerr << "Error copying the number of valid points back to the host: " << cudaGetErrorString(err) << std::endl;
-                    return;
+                bool hasColor = !colorImage.empty();
+                if(hasColor && (colorImage.type() != CV_8UC3 ||
+                                colorImage.rows != depthImage.rows || colorImage.cols != depthImage.cols)) {
+                    std::cerr << "The color image must be BGR8 and of the same size as the depth image" << std::endl;
+                    return -3;
                 }
 
-                // allocate a host point array
-                if((pointArray = (pcl::PointXYZRGBL*) malloc(nValidPoints * sizeof(pcl::PointXYZRGBL))) == nullptr) {
-                    std::cerr << "Error allocating host memory for the points: " << strerror(errno) << std::endl;
-                    return;
+                auto width = (unsigned int) depthImage.cols;
+                auto height = (unsigned int) depthImage.rows;
+                std::size_t nPixels = (std::size_t) width * height;
+                std::size_t depthRowBytes = width * depthImage.elemSize();
+                std::size_t colorRowBytes = width * 3;
+
+                // grow the buffers if this frame is the largest yet
+                if(ensureCapacity((void **) &this->d_depthImage, &this->depthCapacity, depthRowBytes * height) < 0)
+                    return -4;
+                if(hasColor &&
+                   ensureCapacity((void **) &this->d_colorImage, &this->colorCapacity, colorRowBytes * height) < 0)
+                    return -4;
+                if(ensureCapacity((void **) &this->d_points, &this->pointsCapacity,
+                                  nPixels * sizeof(pcl::PointXYZRGBL)) < 0)
+                    return -4;
+
+                // the chunks go through pinned memory. padded images are packed first
+                cv::Mat depth = depthImage.isContinuous() ? depthImage : depthImage.clone();
+                if(this->streams.upload(this->d_depthImage, depth.data, depthRowBytes * height) < 0) {
+                    std::cerr << "Error copying depth image to device" << std::endl;
+                    return -5;
                 }
 
-                // copy the point array back to the host
-                if((err = cudaMemcpy(pointArray, d_pointArray, nPixels * sizeof(pcl::PointXYZRGBL), cudaMemcpyDeviceToHost)) != cudaSuccess) {
-                    std::cerr << "Error copying the point array back to the host: " << cudaGetErrorString(err) << std::endl;
-                    return;
+                if(hasColor) {
+                    cv::Mat color = colorImage.isContinuous() ? colorImage : colorImage.clone();
+                    if(this->streams.upload(this->d_colorImage, color.data, colorRowBytes * height) < 0) {
+                        std::cerr << "Error copying color image to device" << std::endl;
+                        return -5;
+                    }
                 }
 
-                // copy the points to the host pointcloud
-                for(size_t i = 0; i < nValidPoints; i++) {
-                    destination->push_back(pointArray[i]);
+                if((err = cudaMemsetAsync(this->d_nValidPoints, 0, sizeof(unsigned int), stream)) != cudaSuccess) {
+                    std::cerr << "Error resetting the valid point counter: " << cudaGetErrorString(err) << std::endl;
+                    return -5;
                 }
-                destination.reset();
 
-                // free the host point array
-                free(pointArray);
+                DeprojectionIntrinsics intrinsics{};
+                intrinsics.invFx = (float) (1.0 / K(0, 0));
+                intrinsics.invFy = (float) (1.0 / K(1, 1));
+                intrinsics.cx = (float) K(0, 2);
+                intrinsics.cy = (float) K(1, 2);
 
-                // free the color image from the device
-                if((err = cudaFree(d_colorImage)) != cudaSuccess) {
-                    std::cerr << "Error freeing the color image from the device: " << cudaGetErrorString(err) << std::endl;
-                    return;
+                const unsigned char *d_color = hasColor ? this->d_colorImage : nullptr;
+
+                KernelTimer kernelTimer(stream);
+
+                // one thread per pixel. the block size must be a multiple of the warp size
+                dim3 block(512);
+                dim3 grid((nPixels + block.x - 1) / block.x);
+                if(depthImage.depth() == CV_16U) {
+                    deprojectImagesKernel<unsigned short><<<grid, block, 0, stream>>>(
+                            d_color, (const unsigned short *) this->d_depthImage, width, height, intrinsics,
+                            depthUnit, minDepth, maxDepth, this->d_points, this->d_nValidPoints);
+                } else {
+                    deprojectImagesKernel<float><<<grid, block, 0, stream>>>(
+                            d_color, (const float *) this->d_depthImage, width, height, intrinsics,
+                            1.0f, minDepth, maxDepth, this->d_points, this->d_nValidPoints);
+                }
+                if((err = cudaGetLastError()) != cudaSuccess) {
+                    std::cerr << "Error launching the deprojection kernel: " << cudaGetErrorString(err) << std::endl;
+                    return -6;
                 }
 
-                // free the depth image from the device
-                if((err = cudaFree(d_depthImage)) != cudaSuccess) {
-                    std::cerr << "Error freeing the depth image from the device: " << cudaGetErrorString(err) << std::endl;
-                    return;
+                kernelTimer.end();
+
+                // ordered after the kernel, on the same stream
+                unsigned int nValidPoints = 0;
+                if(this->streams.download(&nValidPoints, this->d_nValidPoints, sizeof(unsigned int)) < 0) {
+                    std::cerr << "Error copying the number of valid points back to the host" << std::endl;
+                    return -7;
                 }
 
-                // free the point array from the device
-                if((err = cudaFree(d_pointArray)) != cudaSuccess) {
-                    std::cerr << "Error freeing the point array from the device: " << cudaGetErrorString(err) << std::endl;
-                    return;
+                // only the valid points cross the bus
+                destination.resize(nValidPoints);
+                if(this->streams.download(destination.points.data(), this->d_points,
+                                          nValidPoints * sizeof(pcl::PointXYZRGBL)) < 0) {
+                    std::cerr << "Error copying the point array back to the host" << std::endl;
+                    return -8;
                 }
 
-                // free the valid point counter
-                if((err = cudaFree(d_nValidPoints)) != cudaSuccess) {
-                    std::cerr << "Error freeing the valid point counter from the device: " << cudaGetErrorString(err) << std::endl;
+                destination.width = nValidPoints;
+                destination.height = 1;
+                destination.is_dense = true;
+
+                return 0;
+            }
+
+            __host__ void deprojectImages(const cv::Mat& colorImage, const cv::Mat& depthImage, const Eigen::Matrix3d& K,
+                                          double minDepth, double maxDepth,
+                                          pcl::PointCloud<pcl::PointXYZRGBL>::Ptr destination) {
+
+                if(destination == nullptr)
                     return;
-                }
+
+                DeprojectionContext context;
+                if(context.deproject(colorImage, depthImage, K, (float) minDepth, (float) maxDepth, *destination) < 0)
+                    std::cerr << "Error deprojecting the images" << std::endl;
             }
 
-            __global__ void deprojectImagesKernel(unsigned char *colorImage, unsigned char *depthImage, unsigned int width,
-                                                  unsigned int height, const Eigen::Matrix3d& K_inv,
-                                                  double minDepth, double maxDepth, pcl::PointXYZRGBL *pointArray,
-                                                  unsigned long long *nValidPoints) {
+            template <typename DepthT>
+            __global__ void deprojectImagesKernel(const unsigned char *colorImage, const DepthT *depthImage,
+                                                  unsigned int width, unsigned int height,
+                                                  DeprojectionIntrinsics intrinsics, float depthScale,
+                                                  float minDepth, float maxDepth, pcl::PointXYZRGBL *pointArray,
+                                                  unsigned int *nValidPoints) {
 
-                // x: row
-                // y: col
+                // no early return: the whole warp takes part in the ballot
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                bool inRange = idx < (std::size_t) width * height;
 
-                int row = blockIdx.x * blockDim.x + threadIdx.x;
-                int col = blockIdx.y * blockDim.y + threadIdx.y;
+                float z = 0.0f;
+                bool valid = false;
+                if(inRange) {
+                    z = (float) depthImage[idx] * depthScale;
+                    // also rejects NaN
+                    valid = z > 0.0f && z >= minDepth && z <= maxDepth && isfinite(z);
+                }
 
-                if(row >= height || col >= width)
+                // reserve room for the valid points of the warp with one atomic
+                unsigned int ballot = __ballot_sync(0xFFFFFFFFu, valid);
+                if(ballot == 0)
                     return;
 
-                unsigned long long index = row * width + col;
+                unsigned int lane = threadIdx.x & 31u;
+                int leader = __ffs(ballot) - 1;
+                unsigned int base = 0;
+                if(lane == (unsigned int) leader)
+                    base = atomicAdd(nValidPoints, (unsigned int) __popc(ballot));
+                base = __shfl_sync(0xFFFFFFFFu, base, leader);
 
-                // declare the pixel as [x,y,d]
-                Eigen::Vector3d pixel = {col, row, depthImage[index]};
+                if(!valid)
+                    return;
 
-                // deproject the point
-                Eigen::Vector3d world_point = K_inv * pixel;
+                // the valid lanes below this one go first
+                unsigned int slot = base + __popc(ballot & ((1u << lane) - 1u));
 
-                // place the point on the last free spot
-                pointArray[*nValidPoints].x = world_point.x();
-                pointArray[*nValidPoints].y = world_point.y();
-                pointArray[*nValidPoints].z = world_point.z();
+                auto row = (unsigned int) (idx / width);
+                auto col = (unsigned int) (idx % width);
 
-                pointArray[*nValidPoints].b = colorImage[index * 3];
-                pointArray[*nValidPoints].g = colorImage[index * 3 + 1];
-                pointArray[*nValidPoints].r = colorImage[index * 3 + 2];
+                pointArray[slot].x = ((float) col - intrinsics.cx) * z * intrinsics.invFx;
+                pointArray[slot].y = ((float) row - intrinsics.cy) * z * intrinsics.invFy;
+                pointArray[slot].z = z;
+                pointArray[slot].data[3] = 1.0f;
 
-                // increment the valid point counter
-                atomicAdd(nValidPoints, 1);
+                if(colorImage != nullptr) {
+                    pointArray[slot].b = colorImage[idx * 3];
+                    pointArray[slot].g = colorImage[idx * 3 + 1];
+                    pointArray[slot].r = colorImage[idx * 3 + 2];
+                } else {
+                    pointArray[slot].b = 255;
+                    pointArray[slot].g = 255;
+                    pointArray[slot].r = 255;
+                }
+                pointArray[slot].a = 255;
+                pointArray[slot].label = 0;
             }
         }
     } // pcl_aggregator
-} // cuda
\ No newline at end of file
+} // cuda
@@ -0,0 +1,151 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/cuda/DeviceMemoryPool.cuh>
+#include <pcl_aggregator_core/cuda/CUDADevices.cuh>
+#include <iostream>
+
+namespace pcl_aggregator {
+    namespace cuda {
+
+        DeviceMemoryPool::DeviceMemoryPool() {
+            this->stats.maxBytes = DEVICE_MEMORY_POOL_DEFAULT_MAX_BYTES;
+        }
+
+        DeviceMemoryPool::~DeviceMemoryPool() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->releaseCached();
+        }
+
+        DeviceMemoryPool& DeviceMemoryPool::getInstance() {
+            static DeviceMemoryPool instance;
+            return instance;
+        }
+
+        void DeviceMemoryPool::releaseCached() {
+
+            for(auto& sizeClass : this->freeBlocks) {
+                // each block is freed on the device it was allocated on
+                DeviceScope deviceScope(sizeClass.first.first);
+                for(void* block : sizeClass.second) {
+                    cudaFree(block);
+                    this->stats.allocatedBytes -= sizeClass.first.second;
+                }
+            }
+
+            this->freeBlocks.clear();
+            this->stats.cachedBytes = 0;
+        }
+
+        void* DeviceMemoryPool::allocate(std::size_t bytes) {
+
+            if(bytes == 0)
+                return nullptr;
+
+            // round up to the size class
+            std::size_t size = DEVICE_MEMORY_POOL_MIN_BLOCK_BYTES;
+            while(size < bytes)
+                size <<= 1;
+
+            int device = getCurrentDevice();
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            void* block = nullptr;
+
+            auto it = this->freeBlocks.find(std::make_pair(device, size));
+            if(it != this->freeBlocks.end() && !it->second.empty()) {
+                block = it->second.back();
+                it->second.pop_back();
+                this->stats.cachedBytes -= size;
+                this->stats.hits++;
+            } else {
+                this->stats.misses++;
+
+                // make room under the cap with the cached blocks first
+                if(this->stats.maxBytes > 0 && this->stats.allocatedBytes + size > this->stats.maxBytes)
+                    this->releaseCached();
+                if(this->stats.maxBytes > 0 && this->stats.allocatedBytes + size > this->stats.maxBytes) {
+                    std::cerr << "Device memory pool limit reached: " << this->stats.allocatedBytes << " + " << size
+                              << " > " << this->stats.maxBytes << " bytes" << std::endl;
+                    return nullptr;
+                }
+
+                cudaError_t err;
+                if(cudaMalloc(&block, size) != cudaSuccess) {
+                    // the cached blocks may be all that is missing
+                    cudaGetLastError();
+                    this->releaseCached();
+                    if((err = cudaMalloc(&block, size)) != cudaSuccess) {
+                        std::cerr << "Error allocating device memory: " << cudaGetErrorString(err) << std::endl;
+                        return nullptr;
+                    }
+                }
+
+                this->stats.allocatedBytes += size;
+                if(this->stats.allocatedBytes > this->stats.peakAllocatedBytes)
+                    this->stats.peakAllocatedBytes = this->stats.allocatedBytes;
+            }
+
+            this->usedBlocks[block] = std::make_pair(device, size);
+            this->stats.inUseBytes += size;
+            if(this->stats.inUseBytes > this->stats.peakInUseBytes)
+                this->stats.peakInUseBytes = this->stats.inUseBytes;
+
+            return block;
+        }
+
+        void DeviceMemoryPool::release(void* block) {
+
+            if(block == nullptr)
+                return;
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            auto it = this->usedBlocks.find(block);
+            if(it == this->usedBlocks.end()) {
+                std::cerr << "DeviceMemoryPool::release: unknown block!" << std::endl;
+                return;
+            }
+
+            std::pair<int,std::size_t> sizeClass = it->second;
+            std::size_t size = sizeClass.second;
+            this->usedBlocks.erase(it);
+            this->stats.inUseBytes -= size;
+
+            this->freeBlocks[sizeClass].push_back(block);
+            this->stats.cachedBytes += size;
+        }
+
+        void DeviceMemoryPool::setMaxBytes(std::size_t bytes) {
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            this->stats.maxBytes = bytes;
+            if(bytes > 0 && this->stats.allocatedBytes > bytes)
+                this->releaseCached();
+        }
+
+        void DeviceMemoryPool::trim() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->releaseCached();
+        }
+
+        DeviceMemoryPoolStats DeviceMemoryPool::getStats() {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            return this->stats;
+        }
+
+        void DeviceMemoryPool::resetStats() {
+
+            std::lock_guard<std::mutex> lock(this->mutex);
+
+            this->stats.hits = 0;
+            this->stats.misses = 0;
+            this->stats.peakAllocatedBytes = this->stats.allocatedBytes;
+            this->stats.peakInUseBytes = this->stats.inUseBytes;
+        }
+
+    } // pcl_aggregator
+} // cuda
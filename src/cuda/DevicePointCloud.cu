@@ -0,0 +1,586 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/cuda/DevicePointCloud.cuh>
+#include <pcl_aggregator_core/cuda/CUDAPointClouds.cuh>
+#include <pcl_aggregator_core/cuda/CUDAMetrics.cuh>
+#include <pcl_aggregator_core/cuda/CUDAStreams.cuh>
+#include <pcl_aggregator_core/cuda/DeviceMemoryPool.cuh>
+#include <pcl_aggregator_core/cuda/CUDADevices.cuh>
+#include <pcl_aggregator_core/utils/Metrics.h>
+#include <thrust/system_error.h>
+#include <algorithm>
+
+// minimum number of points allocated when the buffer first grows
+#define DEVICE_POINTCLOUD_MIN_CAPACITY 4096
+
+namespace pcl_aggregator {
+    namespace cuda {
+        namespace pointclouds {
+
+            DevicePointCloud::DevicePointCloud(cudaStream_t stream) {
+                cudaError_t err = cudaSuccess;
+
+                // the memory and the stream belong to the device of the caller, like the one of its StreamScope
+                this->device = getCurrentDevice();
+
+                if(stream != nullptr) {
+                    // borrowed from its owner, like a StreamContext outliving this buffer
+                    this->stream = stream;
+                    this->ownsStream = false;
+                    return;
+                }
+
+                if((err = cudaStreamCreate(&this->stream)) != cudaSuccess) {
+                    std::cerr << "Error creating the device pointcloud stream: " << cudaGetErrorString(err) << std::endl;
+                    this->stream = nullptr;
+                }
+            }
+
+            DevicePointCloud::~DevicePointCloud() {
+                cudaError_t err = cudaSuccess;
+
+                DeviceScope deviceScope(this->device);
+
+                if(this->stream != nullptr) {
+                    // let pending work finish before releasing the memory it uses
+                    cudaStreamSynchronize(this->stream);
+                }
+
+                // back to the pool, for the next buffer
+                DeviceMemoryPool& pool = DeviceMemoryPool::getInstance();
+                pool.release(this->d_xyz);
+                pool.release(this->d_rgba);
+                pool.release(this->d_labels);
+                this->d_xyz = nullptr;
+                this->d_rgba = nullptr;
+                this->d_labels = nullptr;
+
+                if(this->stream != nullptr && this->ownsStream) {
+                    if((err = cudaStreamDestroy(this->stream)) != cudaSuccess) {
+                        std::cerr << "Error destroying the CUDA stream: " << cudaGetErrorString(err) << std::endl;
+                    }
+                    this->stream = nullptr;
+                }
+            }
+
+            std::size_t DevicePointCloud::size() const {
+                return this->nPoints;
+            }
+
+            bool DevicePointCloud::empty() const {
+                return this->nPoints == 0;
+            }
+
+            std::size_t DevicePointCloud::getCapacity() const {
+                return this->capacity;
+            }
+
+            float4 *DevicePointCloud::getXYZ() const {
+                return this->d_xyz;
+            }
+
+            std::uint32_t *DevicePointCloud::getRGBA() const {
+                return this->d_rgba;
+            }
+
+            std::uint32_t *DevicePointCloud::getLabels() const {
+                return this->d_labels;
+            }
+
+            cudaStream_t DevicePointCloud::getStream() const {
+                return this->stream;
+            }
+
+            int DevicePointCloud::getDevice() const {
+                return this->device;
+            }
+
+            int DevicePointCloud::reserve(std::size_t n) {
+
+                if(n <= this->capacity)
+                    return 0;
+
+                cudaError_t err = cudaSuccess;
+
+                DeviceScope deviceScope(this->device);
+
+                // grow geometrically to amortize the reallocations
+                std::size_t newCapacity = std::max<std::size_t>(this->capacity * 2, DEVICE_POINTCLOUD_MIN_CAPACITY);
+                newCapacity = std::max(newCapacity, n);
+
+                DeviceMemoryPool& pool = DeviceMemoryPool::getInstance();
+
+                auto *d_newXYZ = static_cast<float4*>(pool.allocate(newCapacity * sizeof(float4)));
+                auto *d_newRGBA = static_cast<std::uint32_t*>(pool.allocate(newCapacity * sizeof(std::uint32_t)));
+                auto *d_newLabels = static_cast<std::uint32_t*>(pool.allocate(newCapacity * sizeof(std::uint32_t)));
+                if(d_newXYZ == nullptr || d_newRGBA == nullptr || d_newLabels == nullptr) {
+                    std::cerr << "Error allocating memory for the device pointcloud" << std::endl;
+                    pool.release(d_newXYZ);
+                    pool.release(d_newRGBA);
+                    pool.release(d_newLabels);
+                    return -1;
+                }
+
+                // move the points already on the device to the new allocation
+                if(this->nPoints > 0) {
+                    if ((err = cudaMemcpyAsync(d_newXYZ, this->d_xyz, this->nPoints * sizeof(float4),
+                                               cudaMemcpyDeviceToDevice, this->stream)) != cudaSuccess ||
+                        (err = cudaMemcpyAsync(d_newRGBA, this->d_rgba, this->nPoints * sizeof(std::uint32_t),
+                                               cudaMemcpyDeviceToDevice, this->stream)) != cudaSuccess ||
+                        (err = cudaMemcpyAsync(d_newLabels, this->d_labels, this->nPoints * sizeof(std::uint32_t),
+                                               cudaMemcpyDeviceToDevice, this->stream)) != cudaSuccess) {
+                        std::cerr << "Error moving the device pointcloud: " << cudaGetErrorString(err) << std::endl;
+                        cudaStreamSynchronize(this->stream);
+                        pool.release(d_newXYZ);
+                        pool.release(d_newRGBA);
+                        pool.release(d_newLabels);
+                        return -2;
+                    }
+
+                    if ((err = cudaStreamSynchronize(this->stream)) != cudaSuccess) {
+                        std::cerr << "Error waiting for the device pointcloud stream: " << cudaGetErrorString(err)
+                                  << std::endl;
+                        pool.release(d_newXYZ);
+                        pool.release(d_newRGBA);
+                        pool.release(d_newLabels);
+                        return -3;
+                    }
+                }
+
+                pool.release(this->d_xyz);
+                pool.release(this->d_rgba);
+                pool.release(this->d_labels);
+
+                this->d_xyz = d_newXYZ;
+                this->d_rgba = d_newRGBA;
+                this->d_labels = d_newLabels;
+                this->capacity = newCapacity;
+
+                return 0;
+            }
+
+            int DevicePointCloud::resize(std::size_t n) {
+
+                if(this->reserve(n) < 0)
+                    return -1;
+
+                this->nPoints = n;
+
+                return 0;
+            }
+
+            void DevicePointCloud::clear() {
+                this->nPoints = 0;
+            }
+
+            int DevicePointCloud::append(const pcl::PointCloud<pcl::PointXYZRGBL>& cloud) {
+
+                if(cloud.empty())
+                    return 0;
+
+                if(!this->isContextOnDevice())
+                    return -3;
+
+                std::size_t originalSize = this->nPoints;
+
+                if(this->reserve(originalSize + cloud.size()) < 0)
+                    return -1;
+
+                float4 *d_xyz = this->d_xyz + originalSize;
+                std::uint32_t *d_rgba = this->d_rgba + originalSize;
+                std::uint32_t *d_labels = this->d_labels + originalSize;
+
+                // only the new points cross the bus, staged through pinned memory and scattered to the arrays
+                if(StreamContext::getCurrent().uploadPoints(nullptr, cloud.points.data(), cloud.size(),
+                                                            [d_xyz, d_rgba, d_labels](pcl::PointXYZRGBL* d_chunk,
+                                                                                      std::size_t count,
+                                                                                      std::size_t offset,
+                                                                                      cudaStream_t stream) {
+                                                                dim3 block(512);
+                                                                dim3 grid((count + block.x - 1) / block.x);
+                                                                unpackPointsKernel<<<grid, block, 0, stream>>>(
+                                                                        d_chunk, count, d_xyz + offset,
+                                                                        d_rgba + offset, d_labels + offset);
+                                                            }) < 0) {
+                    std::cerr << "Error copying the new points to the device" << std::endl;
+                    return -2;
+                }
+
+                this->nPoints = originalSize + cloud.size();
+
+                return 0;
+            }
+
+            int DevicePointCloud::ingest(const pcl::PointCloud<pcl::PointXYZRGBL>& source, std::uint32_t label,
+                                         const Eigen::Affine3d& tf, const compute::PointFilter *filter) {
+
+                if(source.empty())
+                    return 0;
+
+                if(!this->isContextOnDevice())
+                    return -3;
+
+                std::size_t originalSize = this->nPoints;
+                PointTransform transform = PointTransform::fromAffine(tf);
+
+                if(filter != nullptr && filter->isActive()) {
+
+                    std::size_t nKept = 0;
+                    cudaError_t err;
+
+                    try {
+                        // the raw frame is a temporary: only the kept points take room on the buffer
+                        PoolVector<float4> rawXYZ(source.size());
+                        PoolVector<std::uint32_t> rawRGBA(source.size());
+                        PoolVector<std::uint32_t> kept(source.size());
+
+                        if(filterPointCloudCuda(source, *filter, thrust::raw_pointer_cast(rawXYZ.data()),
+                                                thrust::raw_pointer_cast(rawRGBA.data()),
+                                                thrust::raw_pointer_cast(kept.data()), nKept) < 0) {
+                            std::cerr << "Error filtering the raw points on the device" << std::endl;
+                            return -2;
+                        }
+
+                        if(nKept == 0)
+                            return 0;
+
+                        if(this->reserve(originalSize + nKept) < 0)
+                            return -1;
+
+                        dim3 block(512);
+                        dim3 grid((nKept + block.x - 1) / block.x);
+                        gatherIngestPointsSoAKernel<<<grid, block, 0, this->stream>>>(
+                                thrust::raw_pointer_cast(rawXYZ.data()), thrust::raw_pointer_cast(rawRGBA.data()),
+                                thrust::raw_pointer_cast(kept.data()), nKept, label, transform,
+                                this->d_xyz + originalSize, this->d_rgba + originalSize,
+                                this->d_labels + originalSize);
+
+                        // the temporaries go back to the pool when they leave the scope
+                        if((err = cudaStreamSynchronize(this->stream)) != cudaSuccess) {
+                            std::cerr << "Error ingesting the filtered points: " << cudaGetErrorString(err)
+                                      << std::endl;
+                            return -4;
+                        }
+                    } catch (thrust::system_error& e) {
+                        std::cerr << "Error ingesting the filtered points: " << e.what() << std::endl;
+                        return -5;
+                    } catch (std::bad_alloc& e) {
+                        std::cerr << "Error allocating memory for the filtered points: " << e.what() << std::endl;
+                        return -6;
+                    }
+
+                    this->nPoints = originalSize + nKept;
+
+                    return 0;
+                }
+
+                if(this->reserve(originalSize + source.size()) < 0)
+                    return -1;
+
+                float4 *d_xyz = this->d_xyz + originalSize;
+                std::uint32_t *d_rgba = this->d_rgba + originalSize;
+                std::uint32_t *d_labels = this->d_labels + originalSize;
+
+                // each chunk is labelled, transformed and scattered to the arrays while the next one is uploaded
+                if(StreamContext::getCurrent().uploadPoints(nullptr, source.points.data(), source.size(),
+                                                            [label, transform, d_xyz, d_rgba, d_labels](
+                                                                    pcl::PointXYZRGBL* d_chunk, std::size_t count,
+                                                                    std::size_t offset, cudaStream_t stream) {
+                                                                dim3 block(512);
+                                                                dim3 grid((count + block.x - 1) / block.x);
+                                                                ingestPointsSoAKernel<<<grid, block, 0, stream>>>(
+                                                                        d_chunk, count, label, transform,
+                                                                        d_xyz + offset, d_rgba + offset,
+                                                                        d_labels + offset);
+                                                            }) < 0) {
+                    std::cerr << "Error ingesting the raw points on the device" << std::endl;
+                    return -2;
+                }
+
+                this->nPoints = originalSize + source.size();
+
+                return 0;
+            }
+
+            int DevicePointCloud::upload(const pcl::PointCloud<pcl::PointXYZRGBL>& cloud) {
+
+                this->clear();
+
+                return this->append(cloud);
+            }
+
+            int DevicePointCloud::download(pcl::PointCloud<pcl::PointXYZRGBL>& cloud) const {
+
+                cloud.resize(this->nPoints);
+
+                if(this->nPoints == 0)
+                    return 0;
+
+                if(!this->isContextOnDevice())
+                    return -2;
+
+                const float4 *d_xyz = this->d_xyz;
+                const std::uint32_t *d_rgba = this->d_rgba;
+                const std::uint32_t *d_labels = this->d_labels;
+
+                // the points are gathered chunk by chunk on the device, each downloaded while the next is gathered
+                if(StreamContext::getCurrent().downloadPoints(cloud.points.data(), this->nPoints,
+                                                              [d_xyz, d_rgba, d_labels](pcl::PointXYZRGBL* d_chunk,
+                                                                                        std::size_t count,
+                                                                                        std::size_t offset,
+                                                                                        cudaStream_t stream) {
+                                                                  dim3 block(512);
+                                                                  dim3 grid((count + block.x - 1) / block.x);
+                                                                  packPointsKernel<<<grid, block, 0, stream>>>(
+                                                                          d_xyz + offset, d_rgba + offset,
+                                                                          d_labels + offset, count, d_chunk);
+                                                              }) < 0) {
+                    std::cerr << "Error copying the device pointcloud to the host" << std::endl;
+                    return -1;
+                }
+
+                return 0;
+            }
+
+            int DevicePointCloud::appendDevice(const DevicePointCloud& other) {
+
+                if(other.empty())
+                    return 0;
+
+                if(&other == this) {
+                    std::cerr << "DevicePointCloud::appendDevice: can't append a buffer to itself!" << std::endl;
+                    return -1;
+                }
+
+                std::size_t originalSize = this->nPoints;
+
+                if(this->reserve(originalSize + other.size()) < 0)
+                    return -2;
+
+                cudaError_t err = cudaSuccess;
+
+                DeviceScope deviceScope(this->device);
+
+                if(other.device == this->device) {
+                    if((err = cudaMemcpyAsync(this->d_xyz + originalSize, other.d_xyz, other.nPoints * sizeof(float4),
+                                              cudaMemcpyDeviceToDevice, this->stream)) != cudaSuccess ||
+                       (err = cudaMemcpyAsync(this->d_rgba + originalSize, other.d_rgba,
+                                              other.nPoints * sizeof(std::uint32_t), cudaMemcpyDeviceToDevice,
+                                              this->stream)) != cudaSuccess ||
+                       (err = cudaMemcpyAsync(this->d_labels + originalSize, other.d_labels,
+                                              other.nPoints * sizeof(std::uint32_t), cudaMemcpyDeviceToDevice,
+                                              this->stream)) != cudaSuccess) {
+                        std::cerr << "Error copying the points on the device: " << cudaGetErrorString(err) << std::endl;
+                        cudaStreamSynchronize(this->stream);
+                        return -3;
+                    }
+                } else {
+                    // over NVLink or PCIe when the devices are peers, else the driver stages through the host
+                    enablePeerAccess(this->device, other.device);
+
+                    if((err = cudaMemcpyPeerAsync(this->d_xyz + originalSize, this->device, other.d_xyz, other.device,
+                                                  other.nPoints * sizeof(float4), this->stream)) != cudaSuccess ||
+                       (err = cudaMemcpyPeerAsync(this->d_rgba + originalSize, this->device, other.d_rgba, other.device,
+                                                  other.nPoints * sizeof(std::uint32_t), this->stream)) != cudaSuccess ||
+                       (err = cudaMemcpyPeerAsync(this->d_labels + originalSize, this->device, other.d_labels,
+                                                  other.device, other.nPoints * sizeof(std::uint32_t),
+                                                  this->stream)) != cudaSuccess) {
+                        std::cerr << "Error copying the points between devices: " << cudaGetErrorString(err) << std::endl;
+                        cudaStreamSynchronize(this->stream);
+                        return -3;
+                    }
+
+                    utils::Metrics::add(utils::CounterMetric::PEER_BYTES,
+                                        other.nPoints * (sizeof(float4) + 2 * sizeof(std::uint32_t)));
+                }
+
+                if((err = cudaStreamSynchronize(this->stream)) != cudaSuccess) {
+                    std::cerr << "Error waiting for the device pointcloud stream: " << cudaGetErrorString(err) << std::endl;
+                    return -4;
+                }
+
+                this->nPoints = originalSize + other.nPoints;
+
+                return 0;
+            }
+
+            bool DevicePointCloud::isContextOnDevice() const {
+
+                int contextDevice = StreamContext::getCurrent().getDevice();
+                if(contextDevice != this->device) {
+                    std::cerr << "DevicePointCloud: the current stream context is on device " << contextDevice
+                              << ", the buffer on device " << this->device << "!" << std::endl;
+                    return false;
+                }
+
+                return true;
+            }
+
+            int DevicePointCloud::moveRanges(const std::vector<PointRangeMove>& moves) {
+
+                if(moves.empty())
+                    return 0;
+
+                cudaError_t err = cudaSuccess;
+
+                DeviceScope deviceScope(this->device);
+
+                for(const auto& move : moves) {
+
+                    if(move.source + move.count > this->nPoints || move.destination + move.count > this->nPoints) {
+                        std::cerr << "DevicePointCloud::moveRanges: range out of bounds!" << std::endl;
+                        return -1;
+                    }
+
+                    if((err = cudaMemcpyAsync(this->d_xyz + move.destination, this->d_xyz + move.source,
+                                              move.count * sizeof(float4), cudaMemcpyDeviceToDevice,
+                                              this->stream)) != cudaSuccess ||
+                       (err = cudaMemcpyAsync(this->d_rgba + move.destination, this->d_rgba + move.source,
+                                              move.count * sizeof(std::uint32_t), cudaMemcpyDeviceToDevice,
+                                              this->stream)) != cudaSuccess ||
+                       (err = cudaMemcpyAsync(this->d_labels + move.destination, this->d_labels + move.source,
+                                              move.count * sizeof(std::uint32_t), cudaMemcpyDeviceToDevice,
+                                              this->stream)) != cudaSuccess) {
+                        std::cerr << "Error moving points on the device: " << cudaGetErrorString(err) << std::endl;
+                        return -2;
+                    }
+                }
+
+                if((err = cudaStreamSynchronize(this->stream)) != cudaSuccess) {
+                    std::cerr << "Error waiting for the device pointcloud stream: " << cudaGetErrorString(err) << std::endl;
+                    return -3;
+                }
+
+                return 0;
+            }
+
+            int DevicePointCloud::setLabel(std::uint32_t label, std::size_t start, std::size_t count) {
+
+                if(start + count > this->nPoints) {
+                    std::cerr << "DevicePointCloud::setLabel: range out of bounds!" << std::endl;
+                    return -1;
+                }
+
+                if(count == 0)
+                    return 0;
+
+                cudaError_t err = cudaSuccess;
+
+                DeviceScope deviceScope(this->device);
+
+                dim3 block(512);
+                dim3 grid((count + block.x - 1) / block.x);
+                KernelTimer kernelTimer(this->stream);
+                // only the labels are touched
+                fillLabelsKernel<<<grid, block, 0, this->stream>>>(this->d_labels + start, label, count);
+                kernelTimer.end();
+
+                if((err = cudaStreamSynchronize(this->stream)) != cudaSuccess) {
+                    std::cerr << "Error waiting for the label-setting stream: " << cudaGetErrorString(err) << std::endl;
+                    return -2;
+                }
+
+                return 0;
+            }
+
+            int DevicePointCloud::transform(const Eigen::Affine3d& tf, std::size_t start, std::size_t count) {
+
+                if(start + count > this->nPoints) {
+                    std::cerr << "DevicePointCloud::transform: range out of bounds!" << std::endl;
+                    return -1;
+                }
+
+                if(count == 0)
+                    return 0;
+
+                cudaError_t err = cudaSuccess;
+
+                DeviceScope deviceScope(this->device);
+
+                dim3 block(512);
+                dim3 grid((count + block.x - 1) / block.x);
+                KernelTimer kernelTimer(this->stream);
+                // single precision, only the coordinates are read
+                transformXYZKernel<<<grid, block, 0, this->stream>>>(this->d_xyz + start, PointTransform::fromAffine(tf),
+                                                                     count);
+                kernelTimer.end();
+
+                if((err = cudaStreamSynchronize(this->stream)) != cudaSuccess) {
+                    std::cerr << "Error waiting for the transform stream: " << cudaGetErrorString(err) << std::endl;
+                    return -2;
+                }
+
+                return 0;
+            }
+
+            __global__ void unpackPointsKernel(const pcl::PointXYZRGBL *points, std::size_t num_points,
+                                               float4 *xyz, std::uint32_t *rgba, std::uint32_t *labels) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
+
+                const pcl::PointXYZRGBL& p = points[idx];
+                xyz[idx] = make_float4(p.x, p.y, p.z, p.data[3]);
+                rgba[idx] = p.rgba;
+                labels[idx] = p.label;
+            }
+
+            __global__ void packPointsKernel(const float4 *xyz, const std::uint32_t *rgba, const std::uint32_t *labels,
+                                             std::size_t num_points, pcl::PointXYZRGBL *points) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
+
+                float4 p = xyz[idx];
+                points[idx].x = p.x;
+                points[idx].y = p.y;
+                points[idx].z = p.z;
+                points[idx].data[3] = p.w;
+                points[idx].rgba = rgba[idx];
+                points[idx].label = labels[idx];
+            }
+
+            __global__ void ingestPointsSoAKernel(const pcl::PointXYZRGBL *points, std::size_t num_points,
+                                                  std::uint32_t label, PointTransform transform,
+                                                  float4 *xyz, std::uint32_t *rgba, std::uint32_t *labels) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
+
+                const pcl::PointXYZRGBL& p = points[idx];
+                xyz[idx] = transform.apply(make_float4(p.x, p.y, p.z, p.data[3]));
+                rgba[idx] = p.rgba;
+                labels[idx] = label;
+            }
+
+            __global__ void gatherIngestPointsSoAKernel(const float4 *raw_xyz, const std::uint32_t *raw_rgba,
+                                                        const std::uint32_t *kept, std::size_t num_points,
+                                                        std::uint32_t label, PointTransform transform,
+                                                        float4 *xyz, std::uint32_t *rgba, std::uint32_t *labels) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx >= num_points)
+                    return;
+
+                std::uint32_t source = kept[idx];
+                xyz[idx] = transform.apply(raw_xyz[source]);
+                rgba[idx] = raw_rgba[source];
+                labels[idx] = label;
+            }
+
+            __global__ void fillLabelsKernel(std::uint32_t *labels, std::uint32_t label, std::size_t num_points) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx < num_points)
+                    labels[idx] = label;
+            }
+
+            __global__ void transformXYZKernel(float4 *xyz, PointTransform transform, std::size_t num_points) {
+                std::size_t idx = blockIdx.x * blockDim.x + threadIdx.x;
+                if (idx < num_points)
+                    xyz[idx] = transform.apply(xyz[idx]);
+            }
+
+        }
+    } // pcl_aggregator
+} // cuda
@@ -0,0 +1,289 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/entities/SpatialIndex.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+// cell coordinates beyond this are clamped, so huge queries don't overflow the keys
+#define SPATIAL_INDEX_MAX_CELL 1073741824.0f
+
+namespace pcl_aggregator {
+    namespace entities {
+
+        Frustum Frustum::fromPerspective(const Eigen::Affine3d& cameraPose, double horizontalFov, double verticalFov,
+                                         double nearDistance, double farDistance) {
+
+            Frustum frustum;
+
+            double tanH = std::tan(horizontalFov / 2.0);
+            double tanV = std::tan(verticalFov / 2.0);
+
+            // inward planes on the camera frame: left, right, top, bottom, near, far
+            const Eigen::Vector4d cameraPlanes[6] = {
+                    Eigen::Vector4d(1, 0, tanH, 0),
+                    Eigen::Vector4d(-1, 0, tanH, 0),
+                    Eigen::Vector4d(0, 1, tanV, 0),
+                    Eigen::Vector4d(0, -1, tanV, 0),
+                    Eigen::Vector4d(0, 0, 1, -nearDistance),
+                    Eigen::Vector4d(0, 0, -1, farDistance)
+            };
+
+            const Eigen::Matrix3d rotation = cameraPose.linear();
+            const Eigen::Vector3d translation = cameraPose.translation();
+
+            for(int i = 0; i < 6; i++) {
+                Eigen::Vector3d n = cameraPlanes[i].head<3>();
+                double norm = n.norm();
+                Eigen::Vector3d worldNormal = rotation * (n / norm);
+                double d = cameraPlanes[i].w() / norm - worldNormal.dot(translation);
+                frustum.planes[i] = Eigen::Vector4f((float) worldNormal.x(), (float) worldNormal.y(),
+                                                    (float) worldNormal.z(), (float) d);
+            }
+
+            int c = 0;
+            for(double distance : {nearDistance, farDistance}) {
+                for(int sx = -1; sx <= 1; sx += 2) {
+                    for(int sy = -1; sy <= 1; sy += 2) {
+                        Eigen::Vector3d corner(sx * distance * tanH, sy * distance * tanV, distance);
+                        frustum.corners[c++] = (cameraPose * corner).cast<float>();
+                    }
+                }
+            }
+
+            return frustum;
+        }
+
+        bool Frustum::contains(const Eigen::Vector3f& p) const {
+            for(const auto& plane : this->planes) {
+                if(plane.head<3>().dot(p) + plane.w() < 0)
+                    return false;
+            }
+            return true;
+        }
+
+        std::size_t PointCloudView::size() const {
+            return this->indices.size();
+        }
+
+        bool PointCloudView::empty() const {
+            return this->indices.empty();
+        }
+
+        const pcl::PointXYZRGBL& PointCloudView::operator[](std::size_t i) const {
+            return this->cloud->points[this->indices[i]];
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL> PointCloudView::toPointCloud() const {
+
+            pcl::PointCloud<pcl::PointXYZRGBL> result;
+            result.points.reserve(this->indices.size());
+            for(std::uint32_t index : this->indices)
+                result.points.push_back(this->cloud->points[index]);
+            result.width = result.points.size();
+            result.height = 1;
+
+            return result;
+        }
+
+        SpatialIndex::SpatialIndex(pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr cloud, float cellSize) {
+
+            if(cellSize <= 0)
+                throw std::invalid_argument("The cell size must be positive!");
+            if(cloud == nullptr)
+                throw std::invalid_argument("The indexed PointCloud must not be null!");
+
+            this->cloud = std::move(cloud);
+            this->cellSize = cellSize;
+
+            const auto& points = this->cloud->points;
+
+            // count the points of each cell, then scatter them to the ranges
+            std::vector<VoxelKey> keys(points.size());
+            std::vector<bool> valid(points.size());
+            for(std::size_t i = 0; i < points.size(); i++) {
+                valid[i] = std::isfinite(points[i].x) && std::isfinite(points[i].y) && std::isfinite(points[i].z);
+                if(!valid[i])
+                    continue;
+                keys[i] = this->getKey(points[i].getVector3fMap());
+                this->cells[keys[i]].second++;
+            }
+
+            std::uint32_t offset = 0;
+            for(auto& cell : this->cells) {
+                cell.second.first = offset;
+                offset += cell.second.second;
+                cell.second.second = 0;
+            }
+
+            this->order.resize(offset);
+            for(std::size_t i = 0; i < points.size(); i++) {
+                if(!valid[i])
+                    continue;
+                auto& range = this->cells[keys[i]];
+                this->order[range.first + range.second++] = (std::uint32_t) i;
+            }
+        }
+
+        VoxelKey SpatialIndex::getKey(const Eigen::Vector3f& p) const {
+            auto axis = [this](float v) {
+                float cell = std::floor(v / this->cellSize);
+                return static_cast<std::int32_t>(std::max(-SPATIAL_INDEX_MAX_CELL, std::min(SPATIAL_INDEX_MAX_CELL, cell)));
+            };
+            return {axis(p.x()), axis(p.y()), axis(p.z())};
+        }
+
+        Eigen::AlignedBox3f SpatialIndex::getCellBox(const VoxelKey& key) const {
+            Eigen::Vector3f low(key.x * this->cellSize, key.y * this->cellSize, key.z * this->cellSize);
+            return {low, low + Eigen::Vector3f::Constant(this->cellSize)};
+        }
+
+        const pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr& SpatialIndex::getPointCloud() const {
+            return this->cloud;
+        }
+
+        float SpatialIndex::getCellSize() const {
+            return this->cellSize;
+        }
+
+        template <typename Classify, typename Contains>
+        void SpatialIndex::query(const VoxelKey& low, const VoxelKey& high, const Classify& classify,
+                                 const Contains& contains, PointCloudView& view) const {
+
+            view.cloud = this->cloud;
+
+            if(high.x < low.x || high.y < low.y || high.z < low.z)
+                return;
+
+            const auto& points = this->cloud->points;
+
+            auto visit = [&](const VoxelKey& key, const std::pair<std::uint32_t,std::uint32_t>& range) {
+                int side = classify(this->getCellBox(key));
+                if(side < 0)
+                    return;
+
+                auto begin = this->order.begin() + range.first;
+                auto end = begin + range.second;
+                if(side > 0) {
+                    // the whole cell is inside, no point needs a test
+                    view.indices.insert(view.indices.end(), begin, end);
+                    return;
+                }
+                for(auto it = begin; it != end; ++it) {
+                    if(contains(points[*it].getVector3fMap()))
+                        view.indices.push_back(*it);
+                }
+            };
+
+            double rangeCells = (double) (high.x - low.x + 1) * (high.y - low.y + 1) * (high.z - low.z + 1);
+
+            if(rangeCells < (double) this->cells.size()) {
+                // probe the cells of the range
+                for(std::int32_t x = low.x; x <= high.x; x++) {
+                    for(std::int32_t y = low.y; y <= high.y; y++) {
+                        for(std::int32_t z = low.z; z <= high.z; z++) {
+                            VoxelKey key = {x, y, z};
+                            auto it = this->cells.find(key);
+                            if(it != this->cells.end())
+                                visit(key, it->second);
+                        }
+                    }
+                }
+            } else {
+                // the occupied cells are fewer than the range
+                for(const auto& cell : this->cells) {
+                    const VoxelKey& key = cell.first;
+                    if(key.x >= low.x && key.x <= high.x && key.y >= low.y && key.y <= high.y &&
+                       key.z >= low.z && key.z <= high.z)
+                        visit(key, cell.second);
+                }
+            }
+        }
+
+        PointCloudView SpatialIndex::queryBox(const Eigen::AlignedBox3f& box) const {
+
+            PointCloudView view;
+            view.cloud = this->cloud;
+            if(box.isEmpty())
+                return view;
+
+            auto classify = [&box](const Eigen::AlignedBox3f& cell) {
+                if(!box.intersects(cell))
+                    return -1;
+                return box.contains(cell) ? 1 : 0;
+            };
+            auto contains = [&box](const Eigen::Vector3f& p) {
+                return box.contains(p);
+            };
+
+            this->query(this->getKey(box.min()), this->getKey(box.max()), classify, contains, view);
+            return view;
+        }
+
+        PointCloudView SpatialIndex::queryRadius(const Eigen::Vector3f& center, float radius) const {
+
+            PointCloudView view;
+            view.cloud = this->cloud;
+            if(radius < 0)
+                return view;
+
+            const float radiusSquared = radius * radius;
+
+            auto classify = [&center, radiusSquared](const Eigen::AlignedBox3f& cell) {
+                if(cell.squaredExteriorDistance(center) > radiusSquared)
+                    return -1;
+                // the farthest corner decides if the whole cell is inside
+                Eigen::Vector3f farthest = (center - cell.min()).cwiseAbs().cwiseMax((center - cell.max()).cwiseAbs());
+                return farthest.squaredNorm() <= radiusSquared ? 1 : 0;
+            };
+            auto contains = [&center, radiusSquared](const Eigen::Vector3f& p) {
+                return (p - center).squaredNorm() <= radiusSquared;
+            };
+
+            Eigen::Vector3f extent = Eigen::Vector3f::Constant(radius);
+            this->query(this->getKey(center - extent), this->getKey(center + extent), classify, contains, view);
+            return view;
+        }
+
+        PointCloudView SpatialIndex::queryFrustum(const Frustum& frustum) const {
+
+            PointCloudView view;
+            view.cloud = this->cloud;
+
+            Eigen::AlignedBox3f bounds;
+            for(const auto& corner : frustum.corners)
+                bounds.extend(corner);
+
+            auto classify = [&frustum](const Eigen::AlignedBox3f& cell) {
+                int side = 1;
+                for(const auto& plane : frustum.planes) {
+                    Eigen::Vector3f n = plane.head<3>();
+                    // the corners farthest along and against the normal
+                    Eigen::Vector3f positive = cell.min();
+                    Eigen::Vector3f negative = cell.max();
+                    for(int a = 0; a < 3; a++) {
+                        if(n[a] >= 0) {
+                            positive[a] = cell.max()[a];
+                            negative[a] = cell.min()[a];
+                        }
+                    }
+                    if(n.dot(positive) + plane.w() < 0)
+                        return -1;
+                    if(n.dot(negative) + plane.w() < 0)
+                        side = 0;
+                }
+                return side;
+            };
+            auto contains = [&frustum](const Eigen::Vector3f& p) {
+                return frustum.contains(p);
+            };
+
+            this->query(this->getKey(bounds.min()), this->getKey(bounds.max()), classify, contains, view);
+            return view;
+        }
+
+    } // pcl_aggregator
+} // entities
@@ -4,8 +4,16 @@
 
 #include <pcl_aggregator_core/entities/StampedPointCloud.h>
 #include <pcl_aggregator_core/utils/Utils.h>
+#include <pcl_aggregator_core/utils/LabelSet.h>
+#include <pcl_aggregator_core/utils/Metrics.h>
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#ifdef PCL_AGGREGATOR_WITH_CUDA
 #include <pcl_aggregator_core/cuda/CUDAPointClouds.cuh>
+#include <pcl_aggregator_core/cuda/CUDAVoxelGrid.cuh>
+#endif
 #include <utility>
+#include <algorithm>
+#include <unordered_map>
 
 namespace pcl_aggregator {
     namespace entities {
@@ -25,17 +33,25 @@ namespace pcl_aggregator {
             std::lock_guard<std::mutex> lock(cloudMutex);
             // the StampedPointCloud owns its cloud's pointer and should destroy it
             this->cloud.reset();
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            this->deviceCloud.reset();
+#endif
         }
 
         // generate a 32-bit label and assign
         std::uint32_t StampedPointCloud::generateLabel() {
+            return generateLabel(this->originTopicHash, this->timestamp);
+        }
 
-            std::string combined = this->originTopic + std::to_string(this->timestamp);
+        std::uint32_t StampedPointCloud::generateLabel(std::size_t topicHash, unsigned long long timestamp) {
 
-            std::hash<std::string> hasher;
-            std::uint32_t hash_value = hasher(combined);
+            // splitmix64 finalizer over the topic hash and the timestamp, folded to 32 bits
+            std::uint64_t h = (std::uint64_t) topicHash ^ (timestamp + 0x9e3779b97f4a7c15ULL);
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+            h ^= h >> 31;
 
-            return hash_value;
+            return (std::uint32_t) (h ^ (h >> 32));
         }
 
         unsigned long long StampedPointCloud::getTimestamp() const {
@@ -44,9 +60,239 @@ namespace pcl_aggregator {
 
         typename pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& StampedPointCloud::getPointCloud() {
             std::lock_guard<std::mutex> lock(cloudMutex);
+
+            this->syncHost();
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            // the caller may change the points, so the host copy becomes the authoritative one
+            if(this->deviceCloud != nullptr)
+                this->deviceStale = true;
+#endif
+            this->segmentsValid = false;
+
             return cloud;
         }
 
+        pcl::PointCloud<pcl::PointXYZRGBL> StampedPointCloud::getPointCloudCopy() {
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            this->syncHost();
+
+            return *this->cloud;
+        }
+
+        std::size_t StampedPointCloud::getSize() {
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            return this->getCurrentSize();
+        }
+
+        std::size_t StampedPointCloud::getMemoryUsage() {
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            // the reserved capacity is taken as much as the points are
+            std::size_t bytes = this->cloud->points.capacity() * sizeof(pcl::PointXYZRGBL) +
+                                this->segments.capacity() * sizeof(LabelSegment) +
+                                this->labelCounts.size() * (sizeof(std::uint32_t) + sizeof(std::size_t) + 2 * sizeof(void*)) +
+                                this->labelCounts.bucket_count() * sizeof(void*);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            // coordinates, color and label arrays
+            if(this->deviceCloud != nullptr)
+                bytes += this->deviceCloud->getCapacity() * (sizeof(float4) + 2 * sizeof(std::uint32_t));
+#endif
+            return bytes;
+        }
+
+        bool StampedPointCloud::getLabelSize(std::uint32_t label, std::size_t& count) {
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            if(!this->segmentsValid || this->getSegmentsEnd() != this->getCurrentSize())
+                return false;
+
+            auto labelCount = this->labelCounts.find(label);
+            count = labelCount != this->labelCounts.end() ? labelCount->second : 0;
+            return true;
+        }
+
+        std::size_t StampedPointCloud::getPointsMemoryUsage() {
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            std::size_t bytes = this->cloud->points.size() * sizeof(pcl::PointXYZRGBL) +
+                                this->segments.size() * sizeof(LabelSegment);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr)
+                bytes += this->deviceCloud->size() * (sizeof(float4) + 2 * sizeof(std::uint32_t));
+#endif
+            return bytes;
+        }
+
+        bool StampedPointCloud::shrinkToFit(float maxSlack) {
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            // the headroom the appends grow into is kept, or the next append would reallocate again
+            auto& points = this->cloud->points;
+            if((float) (points.capacity() - points.size()) <= maxSlack * (float) points.size())
+                return false;
+
+            points.shrink_to_fit();
+            this->segments.shrink_to_fit();
+            return true;
+        }
+
+        std::size_t StampedPointCloud::getCurrentSize() const {
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr && !this->deviceStale)
+                return this->deviceCloud->size();
+#endif
+
+            return this->cloud->size();
+        }
+
+        void StampedPointCloud::syncHost() {
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud == nullptr || !this->hostStale)
+                return;
+
+            if(this->deviceCloud->download(*this->cloud) < 0) {
+                std::cerr << "StampedPointCloud::syncHost: could not download the points!" << std::endl;
+                return;
+            }
+            this->hostStale = false;
+#endif
+        }
+
+        void StampedPointCloud::syncDevice() {
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud == nullptr || !this->deviceStale)
+                return;
+
+            if(this->deviceCloud->upload(*this->cloud) < 0) {
+                std::cerr << "StampedPointCloud::syncDevice: could not upload the points!" << std::endl;
+                return;
+            }
+            this->deviceStale = false;
+#endif
+        }
+
+        void StampedPointCloud::setDeviceResident(bool resident) {
+
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            if(resident && !compute::ComputeBackend::isCudaAvailable()) {
+                std::cerr << "StampedPointCloud::setDeviceResident: no CUDA device, the points stay on the host" << std::endl;
+                return;
+            }
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(resident == (this->deviceCloud != nullptr))
+                return;
+
+            if(resident) {
+                this->deviceCloud = std::make_unique<cuda::pointclouds::DevicePointCloud>();
+                // the first sync uploads the current points
+                this->deviceStale = true;
+                this->hostStale = false;
+                this->syncDevice();
+            } else {
+                this->syncHost();
+                this->deviceCloud.reset();
+                this->hostStale = false;
+                this->deviceStale = false;
+            }
+#endif
+        }
+
+        bool StampedPointCloud::isDeviceResident() {
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            std::lock_guard<std::mutex> lock(cloudMutex);
+            return this->deviceCloud != nullptr;
+#else
+            return false;
+#endif
+        }
+
+        int StampedPointCloud::appendPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& other) {
+
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            return this->appendHostPoints(other);
+        }
+
+        int StampedPointCloud::appendPointCloud(StampedPointCloud& other) {
+
+            if(&other == this) {
+                std::cerr << "StampedPointCloud::appendPointCloud: can't append a PointCloud to itself!" << std::endl;
+                return -1;
+            }
+
+            std::scoped_lock lock(this->cloudMutex, other.cloudMutex);
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr && other.deviceCloud != nullptr && !other.deviceStale) {
+                this->syncDevice();
+
+                // device to device, peer-to-peer when the two live on different GPUs
+                if(this->deviceCloud->appendDevice(*other.deviceCloud) < 0)
+                    return -1;
+                this->hostStale = true;
+
+                if(other.segmentsValid && other.getSegmentsEnd() == other.deviceCloud->size()) {
+                    for(const auto& segment : other.segments)
+                        this->pushSegment(segment.label, segment.count);
+                } else {
+                    this->clearSegments();
+                    this->segmentsValid = false;
+                }
+
+                return 0;
+            }
+#endif
+
+            other.syncHost();
+
+            return this->appendHostPoints(*other.cloud);
+        }
+
+        int StampedPointCloud::appendHostPoints(const pcl::PointCloud<pcl::PointXYZRGBL>& other) {
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr) {
+                this->syncDevice();
+
+                // only the new points are uploaded
+                if(this->deviceCloud->append(other) < 0)
+                    return -1;
+                this->hostStale = true;
+                this->indexSegments(other);
+
+                return 0;
+            }
+#endif
+
+            if(compute::ComputeBackend::select(other.size()).concatenatePointClouds(this->cloud, other) < 0)
+                return -1;
+            this->indexSegments(other);
+
+            return 0;
+        }
+
+        void StampedPointCloud::clear() {
+
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+            this->cloud->clear();
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr)
+                this->deviceCloud->clear();
+#endif
+            this->hostStale = false;
+            this->deviceStale = false;
+            this->clearSegments();
+            this->segmentsValid = true;
+        }
+
         std::string StampedPointCloud::getOriginTopic() const {
             return this->originTopic;
         }
@@ -73,18 +319,77 @@ namespace pcl_aggregator {
             // set the new
             this->cloud = std::move(c);
 
-            if(this->cloud != nullptr) {
-                if (assignGeneratedLabel)
-                    StampedPointCloud::assignLabelToPointCloud(this->cloud, this->label);
-            } else {
+            if(this->cloud == nullptr) {
                 std::cerr << "StampedPointCloud::setPointCloud: cloud is null!" << std::endl;
+                // keep the invariant of always having a cloud to work on
+                this->cloud = pcl::PointCloud<pcl::PointXYZRGBL>::Ptr(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            }
+
+            this->clearSegments();
+            this->segmentsValid = true;
+            if(assignGeneratedLabel)
+                this->pushSegment(this->label, this->cloud->size());
+            else
+                this->indexSegments(*this->cloud);
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr) {
+                // upload once and label on the device, the host copy is refreshed when read
+                if(this->deviceCloud->upload(*this->cloud) < 0) {
+                    std::cerr << "StampedPointCloud::setPointCloud: could not upload the points!" << std::endl;
+                    this->deviceStale = true;
+                    this->hostStale = false;
+                    if (assignGeneratedLabel)
+                        StampedPointCloud::assignLabelToPointCloud(this->cloud, this->label);
+                    return;
+                }
+                this->deviceStale = false;
+                this->hostStale = false;
+                if (assignGeneratedLabel) {
+                    this->deviceCloud->setLabel(this->label, 0, this->deviceCloud->size());
+                    this->hostStale = true;
+                }
+                return;
+            }
+#endif
+
+            if (assignGeneratedLabel)
+                StampedPointCloud::assignLabelToPointCloud(this->cloud, this->label);
+        }
+
+        int StampedPointCloud::ingestPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& source, std::uint32_t label,
+                                                const Eigen::Affine3d& tf, const compute::PointFilter *filter) {
+
+            std::lock_guard<std::mutex> lock(cloudMutex);
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr) {
+                this->syncDevice();
+
+                std::size_t originalSize = this->deviceCloud->size();
+                if(this->deviceCloud->ingest(source, label, tf, filter) < 0)
+                    return -1;
+                this->hostStale = true;
+                this->pushSegment(label, this->deviceCloud->size() - originalSize);
+
+                return 0;
             }
+#endif
+
+            // the filter may keep fewer points than the source has
+            std::size_t originalSize = this->cloud->size();
+            if(compute::ComputeBackend::select(source.size()).ingestPointCloud(this->cloud, source, label, tf,
+                                                                               filter) < 0)
+                return -1;
+            this->pushSegment(label, this->cloud->size() - originalSize);
+
+            return 0;
         }
 
         void StampedPointCloud::assignLabelToPointCloud(const typename pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud, std::uint32_t label) {
 
             if(cloud != nullptr) {
-                cuda::pointclouds::setPointCloudLabelCuda(cloud, label);
+                compute::ComputeBackend::select(cloud->size()).setPointCloudLabel(cloud, label);
             } else {
                 std::cerr << "StampedPointCloud::assignLabelToPointCloud: cloud is null!" << std::endl;
             }
@@ -92,6 +397,7 @@ namespace pcl_aggregator {
 
         void StampedPointCloud::setOriginTopic(const std::string& origin) {
             this->originTopic = origin;
+            this->originTopicHash = std::hash<std::string>()(origin);
         }
 
         bool StampedPointCloud::isTransformComputed() const {
@@ -102,10 +408,19 @@ namespace pcl_aggregator {
 
             std::lock_guard<std::mutex> lock(cloudMutex);
 
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr) {
+
+                // transform in-place on the device, nothing crosses the bus
+                this->syncDevice();
+                this->deviceCloud->transform(tf, 0, this->deviceCloud->size());
+                this->hostStale = true;
+            } else
+#endif
             if(this->cloud != nullptr) {
 
-                // call a CUDA thread to transform the pointcloud in-place
-                cuda::pointclouds::transformPointCloudCuda(this->cloud, tf);
+                // in-place, on the GPU or the CPU depending on the size
+                compute::ComputeBackend::select(this->cloud->size()).transformPointCloud(this->cloud, tf);
             } else {
                 std::cerr << "StampedPointCloud::applyTransform: cloud is null!" << std::endl;
             }
@@ -131,37 +446,315 @@ namespace pcl_aggregator {
 
             std::lock_guard<std::mutex> lock(this->cloudMutex);
 
-            auto it = this->cloud->begin();
-            while (it != this->cloud->end()) {
-                if (it->label == label)
-                    it = this->cloud->erase(it);
-                else
-                    ++it;
-            }
+            std::size_t sizeBefore = this->getCurrentSize();
+            this->compactLabels({label});
+            utils::Metrics::add(utils::CounterMetric::POINTS_AGED, sizeBefore - this->getCurrentSize());
         }
 
         void StampedPointCloud::removePointsWithLabels(const std::set<std::uint32_t>& labels) {
 
             std::lock_guard<std::mutex> lock(this->cloudMutex);
 
-            auto it = this->cloud->begin();
-            while (it != this->cloud->end()) {
-                // if the label is in the set, remove it
-                if (labels.find(it->label) != labels.end())
-                    it = this->cloud->erase(it);
-                else
-                    ++it;
+            std::size_t sizeBefore = this->getCurrentSize();
+            this->compactLabels(labels);
+            utils::Metrics::add(utils::CounterMetric::POINTS_AGED, sizeBefore - this->getCurrentSize());
+        }
+
+        std::size_t StampedPointCloud::getSegmentsEnd() const {
+
+            if(this->segments.empty())
+                return 0;
+
+            return this->segments.back().begin + this->segments.back().count;
+        }
+
+        void StampedPointCloud::clearSegments() {
+            this->segments.clear();
+            this->labelCounts.clear();
+        }
+
+        void StampedPointCloud::pushSegment(std::uint32_t label, std::size_t count) {
+
+            if(!this->segmentsValid || count == 0)
+                return;
+
+            if(!this->segments.empty() && this->segments.back().label == label) {
+                this->segments.back().count += count;
+                this->labelCounts[label] += count;
+                return;
+            }
+
+            if(this->segments.size() >= POINTCLOUD_MAX_LABEL_SEGMENTS) {
+                // too fragmented to be worth it
+                this->clearSegments();
+                this->segmentsValid = false;
+                return;
+            }
+
+            this->segments.push_back({label, this->getSegmentsEnd(), count});
+            this->labelCounts[label] += count;
+        }
+
+        void StampedPointCloud::indexSegments(const pcl::PointCloud<pcl::PointXYZRGBL>& appended) {
+
+            std::size_t runStart = 0;
+            for(std::size_t i = 1; i <= appended.size() && this->segmentsValid; i++) {
+                if(i == appended.size() || appended.points[i].label != appended.points[runStart].label) {
+                    this->pushSegment(appended.points[runStart].label, i - runStart);
+                    runStart = i;
+                }
+            }
+        }
+
+        void StampedPointCloud::regroupByLabel() {
+
+            // count the points of each label, keeping the order the labels first appear in
+            std::unordered_map<std::uint32_t,std::size_t> offsets;
+            std::vector<LabelSegment> groups;
+            for(const auto& point : this->cloud->points) {
+                auto group = offsets.find(point.label);
+                if(group == offsets.end()) {
+                    group = offsets.emplace(point.label, groups.size()).first;
+                    groups.push_back({point.label, 0, 0});
+                }
+                groups[group->second].count++;
+            }
+
+            std::size_t begin = 0;
+            for(std::size_t i = 0; i < groups.size(); i++) {
+                groups[i].begin = begin;
+                begin += groups[i].count;
+                // from now on the offsets hold the next free position of each group
+                offsets[groups[i].label] = groups[i].begin;
+            }
+
+            if(groups.size() > 1) {
+                std::vector<pcl::PointXYZRGBL, Eigen::aligned_allocator<pcl::PointXYZRGBL>> grouped(this->cloud->size());
+                for(const auto& point : this->cloud->points)
+                    grouped[offsets[point.label]++] = point;
+                this->cloud->points.swap(grouped);
+            }
+
+            this->segments = std::move(groups);
+            this->segmentsValid = this->segments.size() <= POINTCLOUD_MAX_LABEL_SEGMENTS;
+            this->labelCounts.clear();
+            if(!this->segmentsValid) {
+                this->clearSegments();
+                return;
+            }
+            for(const auto& segment : this->segments)
+                this->labelCounts[segment.label] = segment.count;
+        }
+
+        void StampedPointCloud::compactLabels(const std::set<std::uint32_t>& labels) {
+
+            if(labels.empty())
+                return;
+
+            // probed for each run, or for each point without the index
+            utils::LabelSet labelSet(labels);
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            bool onDevice = this->deviceCloud != nullptr && !this->deviceStale;
+#endif
+            std::size_t size = this->getCurrentSize();
+
+            if(!this->segmentsValid || this->getSegmentsEnd() != size) {
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                if(onDevice) {
+                    // no index to go by: compact where the points live in a single pass
+                    if(cuda::pointclouds::removePointsWithLabelsCuda(*this->deviceCloud, labels) < 0) {
+                        std::cerr << "StampedPointCloud::compactLabels: could not compact on the device!" << std::endl;
+                    }
+                    this->hostStale = true;
+                    this->clearSegments();
+                    this->segmentsValid = false;
+                    return;
+                }
+#endif
+
+                // pay one full pass now so the next removals only touch what they remove
+                this->regroupByLabel();
+
+                if(!this->segmentsValid) {
+                    // single stable pass, moving each kept point at most once
+                    auto newEnd = std::remove_if(this->cloud->begin(), this->cloud->end(),
+                                                 [&labelSet](const pcl::PointXYZRGBL& point) {
+                        return labelSet.contains(point.label);
+                    });
+                    this->cloud->erase(newEnd, this->cloud->end());
+                    return;
+                }
+            }
+
+            std::size_t nRemoved = 0;
+            for(const auto& segment : this->segments) {
+                if(labelSet.contains(segment.label))
+                    nRemoved += segment.count;
+            }
+
+            if(nRemoved == 0)
+                return;
+
+            std::size_t newSize = size - nRemoved;
+
+            // the removed ranges under the new size are the holes, the kept ranges over it fill them
+            std::vector<LabelSegment> kept;
+            std::vector<LabelSegment> holes;
+            std::vector<LabelSegment> fillers;
+            for(const auto& segment : this->segments) {
+
+                std::size_t end = segment.begin + segment.count;
+                std::size_t lowEnd = std::min(end, newSize);
+                std::size_t highBegin = std::max(segment.begin, newSize);
+
+                if(labelSet.contains(segment.label)) {
+                    if(segment.begin < lowEnd)
+                        holes.push_back({segment.label, segment.begin, lowEnd - segment.begin});
+                } else {
+                    if(segment.begin < lowEnd)
+                        kept.push_back({segment.label, segment.begin, lowEnd - segment.begin});
+                    if(highBegin < end)
+                        fillers.push_back({segment.label, highBegin, end - highBegin});
+                }
+            }
+
+            // both sides add up to the same number of points
+            std::vector<compute::PointRangeMove> moves;
+            std::size_t h = 0;
+            std::size_t f = 0;
+            while(h < holes.size() && f < fillers.size()) {
+
+                std::size_t count = std::min(holes[h].count, fillers[f].count);
+                moves.push_back({fillers[f].begin, holes[h].begin, count});
+                kept.push_back({fillers[f].label, holes[h].begin, count});
+
+                holes[h].begin += count;
+                holes[h].count -= count;
+                fillers[f].begin += count;
+                fillers[f].count -= count;
+                if(holes[h].count == 0)
+                    h++;
+                if(fillers[f].count == 0)
+                    f++;
+            }
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(onDevice) {
+                if(this->deviceCloud->moveRanges(moves) < 0 || this->deviceCloud->resize(newSize) < 0) {
+                    std::cerr << "StampedPointCloud::compactLabels: could not compact on the device!" << std::endl;
+                    this->clearSegments();
+                    this->segmentsValid = false;
+                    this->hostStale = true;
+                    return;
+                }
+                this->hostStale = true;
+            } else
+#endif
+            {
+                auto& points = this->cloud->points;
+                for(const auto& move : moves) {
+                    std::copy(points.begin() + move.source, points.begin() + move.source + move.count,
+                              points.begin() + move.destination);
+                }
+                this->cloud->resize(newSize);
+            }
+
+            // the moved ranges took the place of the holes, merge the runs again
+            std::sort(kept.begin(), kept.end(), [](const LabelSegment& a, const LabelSegment& b) {
+                return a.begin < b.begin;
+            });
+            this->clearSegments();
+            for(const auto& segment : kept)
+                this->pushSegment(segment.label, segment.count);
+        }
+
+        std::size_t StampedPointCloud::removeFarthestPoints(const Eigen::Vector3f& center, std::size_t n) {
+
+            std::lock_guard<std::mutex> lock(this->cloudMutex);
+
+            this->syncHost();
+
+            auto& points = this->cloud->points;
+            if(n == 0 || points.empty())
+                return 0;
+            if(n > points.size())
+                n = points.size();
+
+            std::vector<float> distances(points.size());
+            for(std::size_t i = 0; i < points.size(); i++)
+                distances[i] = (points[i].getVector3fMap() - center).squaredNorm();
+
+            // the distance of the closest point removed
+            std::vector<float> selection(distances);
+            std::size_t keep = points.size() - n;
+            std::nth_element(selection.begin(), selection.begin() + keep, selection.end());
+            float threshold = selection[keep];
+
+            // the points at the threshold go once the farther ones are gone, so exactly n leave
+            std::size_t farther = 0;
+            for(float d : distances)
+                farther += d > threshold;
+            std::size_t thresholdToRemove = n - farther;
+
+            std::size_t out = 0;
+            for(std::size_t i = 0; i < points.size(); i++) {
+                if(distances[i] > threshold)
+                    continue;
+                if(distances[i] == threshold && thresholdToRemove > 0) {
+                    thresholdToRemove--;
+                    continue;
+                }
+                points[out++] = points[i];
             }
+            this->cloud->resize(out);
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr)
+                this->deviceStale = true;
+#endif
+
+            // the order is kept, so the runs are only shortened
+            this->clearSegments();
+            this->segmentsValid = true;
+            this->indexSegments(*this->cloud);
+
+            return n;
         }
 
         void StampedPointCloud::downsample(float leafSize) {
 
             std::lock_guard<std::mutex> lock(this->cloudMutex);
 
-            pcl::VoxelGrid<pcl::PointXYZRGBL> voxelGrid;
-            voxelGrid.setInputCloud(this->cloud);
-            voxelGrid.setLeafSize(leafSize, leafSize, leafSize);
-            voxelGrid.filter(*this->cloud);
+            std::vector<std::pair<std::uint32_t,std::size_t>> labelRuns;
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(this->deviceCloud != nullptr) {
+                // filter where the points live, nothing crosses the bus
+                this->syncDevice();
+                if(cuda::pointclouds::voxelDownsampleCuda(*this->deviceCloud, leafSize, &labelRuns) < 0) {
+                    std::cerr << "StampedPointCloud::downsample: could not downsample on the device!" << std::endl;
+                    this->clearSegments();
+                    this->segmentsValid = false;
+                    this->hostStale = true;
+                    return;
+                }
+                this->hostStale = true;
+            } else
+#endif
+            if(compute::ComputeBackend::select(this->cloud->size()).voxelDownsample(this->cloud, leafSize, &labelRuns) < 0) {
+                std::cerr << "StampedPointCloud::downsample: could not downsample the pointcloud!" << std::endl;
+                this->clearSegments();
+                this->segmentsValid = false;
+                return;
+            }
+
+            // the centroids come out grouped by label
+            this->clearSegments();
+            this->segmentsValid = true;
+            for(const auto& run : labelRuns)
+                this->pushSegment(run.first, run.second);
         }
     } // pcl_aggregator
 } // entities
\ No newline at end of file
@@ -0,0 +1,529 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/entities/VoxelHashMap.h>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+
+namespace pcl_aggregator {
+    namespace entities {
+
+        /*! \brief Get the centroid point of a voxel. */
+        static pcl::PointXYZRGBL getCentroid(const Voxel& voxel) {
+
+            float inverseCount = 1.0f / voxel.count;
+
+            pcl::PointXYZRGBL point;
+            point.x = voxel.sumX * inverseCount;
+            point.y = voxel.sumY * inverseCount;
+            point.z = voxel.sumZ * inverseCount;
+            point.r = static_cast<std::uint8_t>(voxel.sumR * inverseCount + 0.5f);
+            point.g = static_cast<std::uint8_t>(voxel.sumG * inverseCount + 0.5f);
+            point.b = static_cast<std::uint8_t>(voxel.sumB * inverseCount + 0.5f);
+            point.a = 255;
+            point.label = voxel.label;
+
+            return point;
+        }
+
+        /*! \brief Build a flat PointCloud from the centroids of voxels. */
+        static pcl::PointCloud<pcl::PointXYZRGBL>::Ptr flattenVoxels(
+                const std::unordered_map<VoxelKey,Voxel,VoxelKeyHash>& voxels) {
+
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            cloud->points.reserve(voxels.size());
+
+            for(const auto& entry : voxels)
+                cloud->points.push_back(getCentroid(entry.second));
+            cloud->width = cloud->points.size();
+            cloud->height = 1;
+
+            return cloud;
+        }
+
+        /*! \brief Get the key of the block of a voxel, rounding towards negative infinity. */
+        static VoxelKey getBlockKey(const VoxelKey& key, std::uint32_t factor) {
+            auto divide = [factor](std::int32_t v) {
+                auto f = static_cast<std::int32_t>(factor);
+                return v >= 0 ? v / f : -((-v - 1) / f) - 1;
+            };
+            return {divide(key.x), divide(key.y), divide(key.z)};
+        }
+
+        VoxelHashMap::VoxelHashMap(float leafSize) {
+            if(leafSize <= 0)
+                throw std::invalid_argument("The voxel size must be positive!");
+
+            this->leafSize = leafSize;
+        }
+
+        float VoxelHashMap::getLeafSize() const {
+            return this->leafSize;
+        }
+
+        VoxelKey VoxelHashMap::getKey(const pcl::PointXYZRGBL& point) const {
+            float size = this->leafSize;
+            return {
+                    static_cast<std::int32_t>(std::floor(point.x / size)),
+                    static_cast<std::int32_t>(std::floor(point.y / size)),
+                    static_cast<std::int32_t>(std::floor(point.z / size))
+            };
+        }
+
+        void VoxelHashMap::setLeafSize(float leafSize) {
+
+            if(leafSize <= 0)
+                throw std::invalid_argument("The voxel size must be positive!");
+
+            pcl::PointCloud<pcl::PointXYZRGBL> centroids;
+            std::vector<std::uint32_t> factors;
+            {
+                std::lock_guard<std::mutex> lock(this->mapMutex);
+
+                if(leafSize == this->leafSize)
+                    return;
+
+                centroids = *flattenVoxels(this->voxels);
+                for(const auto& level : this->levels)
+                    factors.push_back(level.factor);
+
+                this->voxels.clear();
+                this->labelVoxels.clear();
+                this->levels.clear();
+                this->leafSize = leafSize;
+                this->flattenedStale = true;
+            }
+
+            this->insertPointCloud(centroids);
+            this->setLevels(factors);
+        }
+
+        void VoxelHashMap::setLevels(const std::vector<std::uint32_t>& factors) {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            this->levels.clear();
+            for(std::uint32_t factor : factors) {
+                if(factor <= 1)
+                    continue;
+                VoxelLevel level;
+                level.factor = factor;
+                this->levels.push_back(std::move(level));
+            }
+
+            for(const auto& entry : this->voxels)
+                this->addToLevels(entry.first, entry.second);
+        }
+
+        std::size_t VoxelHashMap::getLevelCount() {
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+            return this->levels.size() + 1;
+        }
+
+        float VoxelHashMap::getLevelLeafSize(std::size_t level) {
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            if(level == 0 || this->levels.empty())
+                return this->leafSize;
+
+            level = std::min(level, this->levels.size());
+            return this->leafSize * this->levels[level - 1].factor;
+        }
+
+        void VoxelHashMap::addToLevels(const VoxelKey& key, const Voxel& voxel) {
+
+            for(auto& level : this->levels) {
+                Voxel& block = level.voxels[getBlockKey(key, level.factor)];
+                block.sumX += voxel.sumX;
+                block.sumY += voxel.sumY;
+                block.sumZ += voxel.sumZ;
+                block.sumR += voxel.sumR;
+                block.sumG += voxel.sumG;
+                block.sumB += voxel.sumB;
+                block.count += voxel.count;
+                block.label = voxel.label;
+                level.flattenedStale = true;
+            }
+        }
+
+        void VoxelHashMap::removeFromLevels(const VoxelKey& key, const Voxel& voxel) {
+
+            for(auto& level : this->levels) {
+                auto it = level.voxels.find(getBlockKey(key, level.factor));
+                if(it == level.voxels.end())
+                    continue;
+
+                Voxel& block = it->second;
+                // the counts are exact, so an emptied block leaves no rounding residue behind
+                if(block.count <= voxel.count) {
+                    level.voxels.erase(it);
+                } else {
+                    block.sumX -= voxel.sumX;
+                    block.sumY -= voxel.sumY;
+                    block.sumZ -= voxel.sumZ;
+                    block.sumR -= voxel.sumR;
+                    block.sumG -= voxel.sumG;
+                    block.sumB -= voxel.sumB;
+                    block.count -= voxel.count;
+                }
+                level.flattenedStale = true;
+            }
+        }
+
+        std::size_t VoxelHashMap::size() {
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+            return this->voxels.size();
+        }
+
+        bool VoxelHashMap::empty() {
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+            return this->voxels.empty();
+        }
+
+        std::size_t VoxelHashMap::getMemoryUsage() {
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            // each voxel lives on the map node and on its label's set
+            std::size_t voxelBytes = sizeof(VoxelKey) + sizeof(Voxel) + 2 * sizeof(void*);
+            std::size_t indexBytes = sizeof(VoxelKey) + 2 * sizeof(void*);
+
+            std::size_t bytes = this->voxels.size() * (voxelBytes + indexBytes) +
+                                this->voxels.bucket_count() * sizeof(void*);
+            for(const auto& level : this->levels) {
+                bytes += level.voxels.size() * voxelBytes + level.voxels.bucket_count() * sizeof(void*);
+                if(level.flattened != nullptr)
+                    bytes += level.flattened->points.capacity() * sizeof(pcl::PointXYZRGBL);
+            }
+
+            // the node and the buckets of each label's set
+            bytes += this->labelVoxels.bucket_count() * sizeof(void*);
+            for(const auto& owned : this->labelVoxels) {
+                bytes += sizeof(std::uint32_t) + sizeof(owned.second) + 2 * sizeof(void*) +
+                         owned.second.bucket_count() * sizeof(void*);
+            }
+
+            // the flat version is cached along with the map
+            if(this->flattened != nullptr)
+                bytes += this->flattened->points.capacity() * sizeof(pcl::PointXYZRGBL);
+
+            return bytes;
+        }
+
+        std::size_t VoxelHashMap::getLabelSize(std::uint32_t label) {
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            auto owned = this->labelVoxels.find(label);
+            return owned != this->labelVoxels.end() ? owned->second.size() : 0;
+        }
+
+        void VoxelHashMap::setOwner(const VoxelKey& key, Voxel& voxel, std::uint32_t label) {
+
+            if(voxel.count > 0 && voxel.label != label) {
+                // leave the old owner's index
+                auto owner = this->labelVoxels.find(voxel.label);
+                if(owner != this->labelVoxels.end()) {
+                    owner->second.erase(key);
+                    if(owner->second.empty())
+                        this->labelVoxels.erase(owner);
+                }
+            }
+
+            voxel.label = label;
+            this->labelVoxels[label].insert(key);
+        }
+
+        void VoxelHashMap::insertPointCloud(const pcl::PointCloud<pcl::PointXYZRGBL>& cloud) {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            if(cloud.empty())
+                return;
+
+            this->generation++;
+
+            // voxels changed by this insertion, to update the coarser levels once they are final
+            std::vector<VoxelKey> touched;
+
+            for(const auto& point : cloud.points) {
+
+                if(!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+                    continue;
+
+                VoxelKey key = this->getKey(point);
+                Voxel& voxel = this->voxels[key];
+
+                // first point of this insertion on the voxel: its sums leave the levels until they are final
+                if(voxel.generation != this->generation) {
+                    if(!this->levels.empty()) {
+                        if(voxel.count > 0)
+                            this->removeFromLevels(key, voxel);
+                        touched.push_back(key);
+                    }
+                    voxel.generation = this->generation;
+                }
+
+                // the voxel now represents the scan of the point, also within an insertion of several scans,
+                // as if they were inserted one after the other
+                if(voxel.count == 0 || voxel.label != point.label) {
+                    this->setOwner(key, voxel, point.label);
+                    voxel.sumX = voxel.sumY = voxel.sumZ = 0;
+                    voxel.sumR = voxel.sumG = voxel.sumB = 0;
+                    voxel.count = 0;
+                }
+
+                voxel.sumX += point.x;
+                voxel.sumY += point.y;
+                voxel.sumZ += point.z;
+                voxel.sumR += point.r;
+                voxel.sumG += point.g;
+                voxel.sumB += point.b;
+                voxel.count++;
+            }
+
+            for(const auto& key : touched)
+                this->addToLevels(key, this->voxels[key]);
+
+            this->flattenedStale = true;
+        }
+
+        std::size_t VoxelHashMap::removeLabels(const std::set<std::uint32_t>& labels) {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            std::size_t nRemoved = 0;
+
+            for(const auto& label : labels) {
+
+                auto owned = this->labelVoxels.find(label);
+                if(owned == this->labelVoxels.end())
+                    continue;
+
+                // only the voxels owned by the label are visited
+                for(const auto& key : owned->second) {
+                    auto it = this->voxels.find(key);
+                    if(it == this->voxels.end())
+                        continue;
+                    this->removeFromLevels(key, it->second);
+                    this->voxels.erase(it);
+                    nRemoved++;
+                }
+
+                this->labelVoxels.erase(owned);
+            }
+
+            if(nRemoved > 0)
+                this->flattenedStale = true;
+
+            return nRemoved;
+        }
+
+        std::size_t VoxelHashMap::evictFarthest(const Eigen::Vector3f& center, std::size_t n) {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            if(n == 0 || this->voxels.empty())
+                return 0;
+
+            if(n > this->voxels.size())
+                n = this->voxels.size();
+
+            // squared distance of each centroid
+            std::vector<std::pair<float,VoxelKey>> distances;
+            distances.reserve(this->voxels.size());
+            for(const auto& entry : this->voxels) {
+                const Voxel& voxel = entry.second;
+                float inverseCount = 1.0f / voxel.count;
+                Eigen::Vector3f centroid(voxel.sumX * inverseCount, voxel.sumY * inverseCount, voxel.sumZ * inverseCount);
+                distances.emplace_back((centroid - center).squaredNorm(), entry.first);
+            }
+
+            // the farthest n go to the front, in no particular order
+            auto farther = [](const std::pair<float,VoxelKey>& a, const std::pair<float,VoxelKey>& b) {
+                return a.first > b.first;
+            };
+            if(n < distances.size())
+                std::nth_element(distances.begin(), distances.begin() + (n - 1), distances.end(), farther);
+
+            for(std::size_t i = 0; i < n; i++) {
+
+                auto it = this->voxels.find(distances[i].second);
+
+                auto owner = this->labelVoxels.find(it->second.label);
+                if(owner != this->labelVoxels.end()) {
+                    owner->second.erase(it->first);
+                    if(owner->second.empty())
+                        this->labelVoxels.erase(owner);
+                }
+
+                this->removeFromLevels(it->first, it->second);
+                this->voxels.erase(it);
+            }
+
+            this->flattenedStale = true;
+
+            return n;
+        }
+
+        void VoxelHashMap::clear() {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            this->voxels.clear();
+            this->labelVoxels.clear();
+            this->flattenedStale = true;
+
+            for(auto& level : this->levels) {
+                level.voxels.clear();
+                level.flattenedStale = true;
+            }
+        }
+
+        std::vector<VoxelRecord> VoxelHashMap::getVoxels() {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            std::vector<VoxelRecord> records;
+            records.reserve(this->voxels.size());
+            for(const auto& voxel : this->voxels)
+                records.push_back({voxel.first, voxel.second});
+
+            return records;
+        }
+
+        void VoxelHashMap::loadVoxels(const VoxelRecord* records, std::size_t count) {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            this->voxels.clear();
+            this->labelVoxels.clear();
+            for(auto& level : this->levels) {
+                level.voxels.clear();
+                level.flattenedStale = true;
+            }
+
+            this->voxels.reserve(count);
+            for(std::size_t i = 0; i < count; i++) {
+                const VoxelRecord& record = records[i];
+                if(record.voxel.count == 0 || !this->voxels.emplace(record.key, record.voxel).second)
+                    continue;
+                this->labelVoxels[record.voxel.label].insert(record.key);
+                this->addToLevels(record.key, record.voxel);
+                // later insertions must tell their voxels from the stored ones
+                this->generation = std::max(this->generation, record.voxel.generation);
+            }
+
+            this->flattenedStale = true;
+        }
+
+        void VoxelHashMap::flatten() {
+
+            if(!this->flattenedStale && this->flattened != nullptr)
+                return;
+
+            // a new cloud is built so the ones handed out before stay untouched
+            this->flattened = flattenVoxels(this->voxels);
+            this->flattenedStale = false;
+        }
+
+        const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& VoxelHashMap::flattenLevel(std::size_t level) {
+
+            if(level == 0 || this->levels.empty()) {
+                this->flatten();
+                return this->flattened;
+            }
+
+            VoxelLevel& voxelLevel = this->levels[std::min(level, this->levels.size()) - 1];
+            if(voxelLevel.flattenedStale || voxelLevel.flattened == nullptr) {
+                voxelLevel.flattened = flattenVoxels(voxelLevel.voxels);
+                voxelLevel.flattenedStale = false;
+            }
+
+            return voxelLevel.flattened;
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr VoxelHashMap::getPointCloud() {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            this->flatten();
+
+            return this->flattened;
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL> VoxelHashMap::getPointCloudCopy() {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            this->flatten();
+
+            return *this->flattened;
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr VoxelHashMap::getPointCloud(std::size_t level) {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            return this->flattenLevel(level);
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL> VoxelHashMap::getPointCloudCopy(std::size_t level) {
+
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            return *this->flattenLevel(level);
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL> VoxelHashMap::getPointsInBox(const Eigen::AlignedBox3f& box) {
+
+            pcl::PointCloud<pcl::PointXYZRGBL> result;
+
+            if(box.isEmpty())
+                return result;
+
+            // the keys are taken with the voxel size of the map they are looked up on
+            std::lock_guard<std::mutex> lock(this->mapMutex);
+
+            pcl::PointXYZRGBL corner;
+            corner.x = box.min().x();
+            corner.y = box.min().y();
+            corner.z = box.min().z();
+            VoxelKey low = this->getKey(corner);
+            corner.x = box.max().x();
+            corner.y = box.max().y();
+            corner.z = box.max().z();
+            VoxelKey high = this->getKey(corner);
+
+            double boxVoxels = (double) (high.x - low.x + 1) * (high.y - low.y + 1) * (high.z - low.z + 1);
+
+            if(boxVoxels < (double) this->voxels.size()) {
+                // probe the voxels of the box
+                for(std::int32_t x = low.x; x <= high.x; x++) {
+                    for(std::int32_t y = low.y; y <= high.y; y++) {
+                        for(std::int32_t z = low.z; z <= high.z; z++) {
+                            auto it = this->voxels.find({x, y, z});
+                            if(it != this->voxels.end())
+                                result.points.push_back(getCentroid(it->second));
+                        }
+                    }
+                }
+            } else {
+                for(const auto& entry : this->voxels) {
+                    const VoxelKey& key = entry.first;
+                    if(key.x >= low.x && key.x <= high.x && key.y >= low.y && key.y <= high.y &&
+                       key.z >= low.z && key.z <= high.z)
+                        result.points.push_back(getCentroid(entry.second));
+                }
+            }
+
+            result.width = result.points.size();
+            result.height = 1;
+
+            return result;
+        }
+
+    } // pcl_aggregator
+} // entities
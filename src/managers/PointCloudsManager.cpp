@@ -3,61 +3,132 @@
 //
 
 #include <pcl_aggregator_core/managers/PointCloudsManager.h>
+#include <pcl_aggregator_core/utils/MappedFile.h>
+#include <pcl_aggregator_core/utils/LabelSet.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <unordered_set>
 
 namespace pcl_aggregator {
     namespace managers {
 
-        void memoryMonitoringRoutine(PointCloudsManager *instance) {
+        // drop the points with any of the labels
+        static void removeLabelsFrom(pcl::PointCloud<pcl::PointXYZRGBL>& cloud, const std::set<std::uint32_t>& labels) {
+            // a flat probe per point instead of a tree walk
+            utils::LabelSet labelSet(labels);
+            auto end = std::remove_if(cloud.points.begin(), cloud.points.end(), [&labelSet](const pcl::PointXYZRGBL& p) {
+                return labelSet.contains(p.label);
+            });
+            cloud.points.erase(end, cloud.points.end());
+            cloud.width = cloud.points.size();
+            cloud.height = 1;
+        }
 
-            while(instance->keepThreadAlive) {
-                {
-                    std::lock_guard<std::mutex> lock(instance->cloudMutex);
+        // lay a section out after the previous ones, aligned so its records are usable right off the mapping
+        static entities::CheckpointSection placeSection(std::uint64_t& end, std::uint64_t count, std::uint64_t recordSize) {
+            entities::CheckpointSection section;
+            section.offset = (end + CHECKPOINT_SECTION_ALIGNMENT - 1) / CHECKPOINT_SECTION_ALIGNMENT * CHECKPOINT_SECTION_ALIGNMENT;
+            section.count = count;
+            section.recordSize = recordSize;
+            end = section.offset + count * recordSize;
+            return section;
+        }
+
+        // check a section lies on the file and holds records of this build
+        static bool isSectionValid(const entities::CheckpointSection& section, std::uint64_t recordSize, std::size_t fileSize) {
+            return section.recordSize == recordSize && section.offset % CHECKPOINT_SECTION_ALIGNMENT == 0 &&
+                   section.offset <= fileSize && section.count <= (fileSize - section.offset) / recordSize;
+        }
 
-                    // get size in MB
-                    size_t cloudSize = instance->mergedCloud.getPointCloud()->points.size() * sizeof(pcl::PointXYZRGBL) / 1e6;
+        void mergeFlushRoutine(PointCloudsManager *instance) {
 
-                    // how many points need to be removed to match the maximum size or less?
-                    ssize_t pointsToRemove = ceil(
-                            (float) (cloudSize - instance->maxMemory) * 1e6 / sizeof(pcl::PointXYZRGBL));
+            utils::MetricsScope metricsScope(&instance->metrics);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            cuda::StreamScope streamScope(&instance->streamContext);
+#endif
 
-                    if (pointsToRemove > 0) {
+            std::unique_lock<std::mutex> mergeLock(instance->mergeMutex);
 
-                        std::cerr << "Exceeded the memory limit: " << pointsToRemove << " points will be removed!" << std::endl;
+            while(instance->keepMergeFlushAlive) {
 
-                        // remove the points needed if the number of points exceed the maximum
-                        for (size_t i = 0; i < pointsToRemove; i++)
-                            instance->mergedCloud.getPointCloud()->points.pop_back();
-                    }
+                if(instance->pendingUpdates == 0) {
+                    instance->mergeCondition.wait(mergeLock, [instance] {
+                        return !instance->keepMergeFlushAlive || instance->pendingUpdates > 0;
+                    });
+                    continue;
                 }
 
-                // run the thread routine each second
-                std::this_thread::sleep_for(std::chrono::milliseconds (500));
+                // the batch may fill, or the window change, while waiting
+                auto deadline = instance->pendingSince + instance->mergeWindow;
+                std::size_t pending = instance->pendingUpdates;
+                bool woken = instance->mergeCondition.wait_until(mergeLock, deadline, [instance, pending] {
+                    return !instance->keepMergeFlushAlive || instance->pendingUpdates < pending;
+                });
+                if(woken || std::chrono::steady_clock::now() < instance->pendingSince + instance->mergeWindow)
+                    continue;
+
+                mergeLock.unlock();
+                instance->flushMergedUpdates();
+                mergeLock.lock();
             }
         }
 
         PointCloudsManager::PointCloudsManager(size_t nSources, double maxAge, size_t maxMemory):
-        mergedCloud("mergedCloud") {
+        threadPool(std::make_shared<utils::ThreadPool>()), mergedCloud("mergedCloud"), mergedVoxels(VOXEL_LEAF_SIZE) {
             this->nSources = nSources;
 
+            this->jobs = std::make_unique<utils::TaskGroup>(*this->threadPool);
+
             this->maxAge = maxAge;
             this->maxMemory = maxMemory;
 
-            // start the memory monitoring thread
-            this->memoryMonitoringThread = std::thread(memoryMonitoringRoutine, this);
-            pthread_setname_np(this->memoryMonitoringThread.native_handle(), "memory_monitoring_thread");
-            this->memoryMonitoringThread.detach();
+            // a single wheel expires the PointClouds of all the streams
+            this->agingWheel = std::make_shared<utils::TimingWheel>(std::bind(&PointCloudsManager::expirePointClouds,
+                                                                              this, std::placeholders::_1));
+
+            // readers always get a cloud, even before the first merge
+            this->snapshot = pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            this->registryCopies.push_back(std::make_unique<const std::unordered_map<std::string,StreamManager*>>());
+            this->streamRegistry = this->registryCopies.back().get();
+
+            // start the merge flush thread
+            this->mergeFlushThread = std::thread(mergeFlushRoutine, this);
+            pthread_setname_np(this->mergeFlushThread.native_handle(), "merge_flush_thread");
         }
 
         PointCloudsManager::~PointCloudsManager() {
 
-            // free all the stream managers
-            for(auto & streamManager : this->streamManagers) {
-                streamManager.second.reset();
+            // nothing expires anymore. the timers left are dropped with the wheel
+            this->agingWheel->stop();
+
+            // the expirations handed over to the pool
+            this->jobs->wait();
+
+            // the jobs still running may evict, handing scans over to any stream. after this they don't
+            {
+                std::lock_guard<std::mutex> governorLock(this->governorMutex);
+                this->stoppingStreams = true;
             }
 
-            // wait for the memory monitoring thread
-            this->keepThreadAlive = false;
-            this->memoryMonitoringThread.join();
+            // the streams only submit to themselves now, so once idle they stay idle
+            for(auto& streamManager : this->streamManagers)
+                streamManager.second->waitForJobs();
+
+            // no more updates can come, stop the merge flush thread
+            {
+                std::lock_guard<std::mutex> lock(this->mergeMutex);
+                this->keepMergeFlushAlive = false;
+            }
+            this->mergeCondition.notify_all();
+            this->mergeFlushThread.join();
+
+            // the memory usage walks the streams under the same lock
+            std::lock_guard<std::mutex> governorLock(this->governorMutex);
+            for(auto& streamManager : this->streamManagers)
+                streamManager.second.reset();
         }
 
         size_t PointCloudsManager::getNClouds() const {
@@ -74,17 +145,92 @@ namespace pcl_aggregator {
                 return;
             }
 
-            // the key is not present
-            this->initStreamManager(topicName, this->maxAge);
+            utils::MetricsScope metricsScope(&this->metrics);
+
+            StreamManager* streamManager = this->findStreamManager(topicName);
+
+            streamManager->addCloud(std::move(cloud));
+
+        }
+
+        StreamHandle PointCloudsManager::registerStream(const std::string& topicName) {
+            return StreamHandle(this->initStreamManager(topicName, this->maxAge));
+        }
+
+        void PointCloudsManager::addCloud(const StreamHandle& stream, pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud) {
+
+            if(!stream.isValid()) {
+                std::cerr << "PointCloudsManager::addCloud: the stream handle is not registered!" << std::endl;
+                return;
+            }
+
+            // check if the pointcloud is null or empty
+            if(cloud == nullptr || cloud->empty())
+                return;
+
+            utils::MetricsScope metricsScope(&this->metrics);
+
+            stream.stream->addCloud(std::move(cloud));
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL>::Ptr PointCloudsManager::acquireFrame(const StreamHandle& stream) {
 
-            this->streamManagers[topicName]->addCloud(std::move(cloud));
+            if(!stream.isValid()) {
+                std::cerr << "PointCloudsManager::acquireFrame: the stream handle is not registered!" << std::endl;
+                return pcl::PointCloud<pcl::PointXYZRGBL>::Ptr(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            }
 
+            return stream.stream->acquireFrame();
         }
 
         void PointCloudsManager::setTransform(const Eigen::Affine3d &transform, const std::string &topicName) {
-            this->initStreamManager(topicName, this->maxAge);
+            StreamManager* streamManager = this->findStreamManager(topicName);
+
+            streamManager->setSensorTransform(transform);
+        }
+
+        void PointCloudsManager::setTransform(const StreamHandle& stream, const Eigen::Affine3d& transform) {
+
+            if(!stream.isValid()) {
+                std::cerr << "PointCloudsManager::setTransform: the stream handle is not registered!" << std::endl;
+                return;
+            }
+
+            stream.stream->setSensorTransform(transform);
+        }
+
+        void PointCloudsManager::addPose(const Eigen::Affine3d& pose, std::uint64_t timestamp,
+                                         const std::string& topicName) {
+            StreamManager* streamManager = this->findStreamManager(topicName);
+
+            streamManager->addPose(pose, timestamp);
+        }
+
+        void PointCloudsManager::addPose(const StreamHandle& stream, const Eigen::Affine3d& pose,
+                                         std::uint64_t timestamp) {
+
+            if(!stream.isValid()) {
+                std::cerr << "PointCloudsManager::addPose: the stream handle is not registered!" << std::endl;
+                return;
+            }
+
+            stream.stream->addPose(pose, timestamp);
+        }
+
+        int PointCloudsManager::setPointFilter(const compute::PointFilterParams& params, const std::string& topicName) {
+            StreamManager* streamManager = this->findStreamManager(topicName);
+
+            return streamManager->setPointFilter(params);
+        }
+
+        int PointCloudsManager::setPointFilter(const StreamHandle& stream, const compute::PointFilterParams& params) {
+
+            if(!stream.isValid()) {
+                std::cerr << "PointCloudsManager::setPointFilter: the stream handle is not registered!" << std::endl;
+                return -1;
+            }
 
-            this->streamManagers[topicName]->setSensorTransform(transform);
+            return stream.stream->setPointFilter(params);
         }
 
         pcl::PointCloud<pcl::PointXYZRGBL> PointCloudsManager::getMergedCloud() {
@@ -110,105 +256,1195 @@ namespace pcl_aggregator {
             }
             this->managersMutex.unlock();*/
 
+            auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+
+            if(this->voxelMapEnabled)
+                return this->mergedVoxels.getPointCloudCopy();
+
+            return this->mergedCloud.getPointCloudCopy();
+        }
+
+        void PointCloudsManager::setResolutionLevels(const std::vector<float>& leafSizes) {
+
+            if(leafSizes.empty() || leafSizes[0] <= 0) {
+                std::cerr << "PointCloudsManager::setResolutionLevels: the voxel sizes must be positive!" << std::endl;
+                return;
+            }
+            for(std::size_t i = 1; i < leafSizes.size(); i++) {
+                if(leafSizes[i] <= leafSizes[i-1]) {
+                    std::cerr << "PointCloudsManager::setResolutionLevels: the levels must get coarser!" << std::endl;
+                    return;
+                }
+            }
+
+            // the voxel map aggregates whole blocks of the finest voxels
+            float finest = leafSizes[0];
+            std::vector<float> levels = {finest};
+            std::vector<std::uint32_t> factors;
+            for(std::size_t i = 1; i < leafSizes.size(); i++) {
+                auto factor = static_cast<std::uint32_t>(std::lround(leafSizes[i] / finest));
+                if(factor <= 1 || (!factors.empty() && factor <= factors.back()))
+                    continue;
+                factors.push_back(factor);
+                levels.push_back(finest * factor);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(this->cloudMutex);
+
+                this->resolutionLevels = levels;
+                this->mergeLeafSize = finest;
+                this->mergedVoxels.setLeafSize(finest);
+                this->mergedVoxels.setLevels(factors);
+
+                std::lock_guard<std::mutex> journalLock(this->journalMutex);
+                this->pendingJournal.resync = true;
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(this->levelsMutex);
+                this->levelClouds.clear();
+                this->levelsSource = nullptr;
+            }
+
+            this->publishSnapshot();
+        }
+
+        std::vector<float> PointCloudsManager::getResolutionLevels() {
             std::lock_guard<std::mutex> lock(this->cloudMutex);
-            return *(this->mergedCloud.getPointCloud());
+            return this->resolutionLevels;
         }
 
-        bool PointCloudsManager::appendToMerged(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& input) {
+        pcl::PointCloud<pcl::PointXYZRGBL> PointCloudsManager::getMergedCloud(std::size_t level) {
 
-            bool couldAlign = false;
+            if(level == 0)
+                return this->getMergedCloud();
 
-            // align the pointclouds
-            if (!input->empty()) {
+            return *this->getMergedCloudSnapshot(level);
+        }
 
-                {
-                    /* lock access to the pointcloud mutex by other threads.
-                    * will only be released after appending the input pointcloud. */
-                    std::lock_guard<std::mutex> lock(this->cloudMutex);
+        pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr PointCloudsManager::getMergedCloudSnapshot(std::size_t level) {
+
+            std::vector<float> levels;
+            {
+                std::lock_guard<std::mutex> lock(this->cloudMutex);
+
+                // precomputed with the map
+                if(this->voxelMapEnabled)
+                    return this->mergedVoxels.getPointCloud(level);
+
+                levels = this->resolutionLevels;
+            }
 
-                    if (!this->mergedCloud.getPointCloud()->empty()) {
+            pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr current = this->loadSnapshot();
 
+            level = std::min(level, levels.size() - 1);
+            if(level == 0)
+                return current;
 
-                        /*
-                        // create an ICP instance
-                        pcl::IterativeClosestPoint<pcl::PointXYZRGBL, pcl::PointXYZRGBL> icp;
-                        icp.setInputSource(input);
-                        icp.setInputTarget(this->mergedCloud.getPointCloud()); // "input" will align to "merged"
+            std::lock_guard<std::mutex> lock(this->levelsMutex);
 
-                        icp.setMaxCorrespondenceDistance(GLOBAL_ICP_MAX_CORRESPONDENCE_DISTANCE);
-                        icp.setMaximumIterations(GLOBAL_ICP_MAX_ITERATIONS);
+            if(this->levelsSource != current || this->levelClouds.size() != levels.size()) {
+                this->levelClouds.assign(levels.size(), nullptr);
+                this->levelClouds[0] = current;
+                this->levelsSource = current;
+            }
+
+            // each level is derived from the next finer one, which is smaller than the snapshot
+            for(std::size_t l = 1; l <= level; l++) {
+                if(this->levelClouds[l] != nullptr)
+                    continue;
+
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr coarser(
+                        new pcl::PointCloud<pcl::PointXYZRGBL>(*this->levelClouds[l-1]));
+                if(compute::ComputeBackend::select(coarser->size()).voxelDownsample(coarser, levels[l]) < 0) {
+                    std::cerr << "Could not build the level of detail at the PointCloudsManager!" << std::endl;
+                    return this->levelClouds[l-1];
+                }
+                this->levelClouds[l] = coarser;
+            }
 
-                        icp.align(
-                                *this->mergedCloud.getPointCloud()); // combine the aligned pointclouds on the "merged" instance
+            return this->levelClouds[level];
+        }
 
-                        couldAlign = icp.hasConverged(); // return true if alignment was possible
+        pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr PointCloudsManager::getMergedCloudSnapshot() {
+            return this->loadSnapshot();
+        }
 
-                        if (!couldAlign) {
-                            if (cuda::pointclouds::concatenatePointCloudsCuda(this->mergedCloud.getPointCloud(),
-                                                                              *input) <
-                                0) {
-                                std::cerr << "Could not concatenate the pointclouds at the PointCloudsManager!"
-                                          << std::endl;
-                            }
-                        }*/
+        std::uint64_t PointCloudsManager::getSnapshotVersion() const {
+            return this->snapshotVersion;
+        }
 
-                        if(cuda::pointclouds::concatenatePointCloudsCuda(this->mergedCloud.getPointCloud(), *input) < 0) {
-                            std::cerr << "Could not concatenate the pointclouds at the PointCloudsManager!" << std::endl;
-                        }
-                        couldAlign = false;
+        std::shared_ptr<const entities::SpatialIndex> PointCloudsManager::getSpatialIndex() {
 
+            pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr current = this->loadSnapshot();
+
+            std::lock_guard<std::mutex> lock(this->spatialIndexMutex);
+
+            // the snapshots are immutable, so the index holds until the next one
+            if(this->spatialIndex == nullptr || this->spatialIndex->getPointCloud() != current)
+                this->spatialIndex = std::make_shared<const entities::SpatialIndex>(current, this->spatialIndexCellSize);
+
+            return this->spatialIndex;
+        }
+
+        void PointCloudsManager::setSpatialIndexCellSize(float cellSize) {
+
+            if(cellSize <= 0) {
+                std::cerr << "PointCloudsManager::setSpatialIndexCellSize: the cell size must be positive!" << std::endl;
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(this->spatialIndexMutex);
+
+            this->spatialIndexCellSize = cellSize;
+            // rebuilt by the next query
+            this->spatialIndex = nullptr;
+        }
+
+        entities::PointCloudView PointCloudsManager::queryBox(const Eigen::AlignedBox3f& box) {
+            return this->getSpatialIndex()->queryBox(box);
+        }
+
+        entities::PointCloudView PointCloudsManager::queryRadius(const Eigen::Vector3f& center, float radius) {
+            return this->getSpatialIndex()->queryRadius(center, radius);
+        }
+
+        entities::PointCloudView PointCloudsManager::queryFrustum(const entities::Frustum& frustum) {
+            return this->getSpatialIndex()->queryFrustum(frustum);
+        }
+
+        void PointCloudsManager::publishSnapshot() {
+
+            auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+            std::lock_guard<std::mutex> journalLock(this->journalMutex);
+
+            this->closeSnapshot();
+        }
+
+        void PointCloudsManager::closeSnapshot() {
+
+            // the points are flattened or copied by the first read, so merges stay proportional to the update
+            this->snapshotStale = true;
+            this->closeJournal(++this->snapshotVersion);
+        }
+
+        void PointCloudsManager::buildSnapshot() {
+
+            if(!this->snapshotStale)
+                return;
+
+            // changes made since the version was closed are in the points, so they take a version of their own
+            const MergeJournalEntry& pending = this->pendingJournal;
+            if(this->journalMaxVersions > 0 &&
+               (pending.resync || !pending.addedPoints.empty() || !pending.removedLabels.empty()))
+                this->closeJournal(++this->snapshotVersion);
+
+            pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr newSnapshot;
+            if(this->voxelMapEnabled) {
+                // the map already hands out immutable clouds
+                newSnapshot = this->mergedVoxels.getPointCloud();
+            } else {
+                newSnapshot = pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr(
+                        new pcl::PointCloud<pcl::PointXYZRGBL>(this->mergedCloud.getPointCloudCopy()));
+            }
+
+            // readers holding the previous snapshot keep it alive until they let go
+            this->snapshot.store(std::move(newSnapshot));
+            this->snapshotStale = false;
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr PointCloudsManager::loadSnapshot(std::uint64_t* version) {
+
+            // a snapshot without its version may be one change behind, like any snapshot read
+            if(version == nullptr && !this->snapshotStale)
+                return this->snapshot.load();
+
+            {
+                // versions are closed under the journal lock
+                std::lock_guard<std::mutex> journalLock(this->journalMutex);
+                if(!this->snapshotStale) {
+                    if(version != nullptr)
+                        *version = this->snapshotVersion;
+                    return this->snapshot.load();
+                }
+            }
+
+            auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+            std::lock_guard<std::mutex> journalLock(this->journalMutex);
+
+            this->buildSnapshot();
+
+            if(version != nullptr)
+                *version = this->snapshotVersion;
+            return this->snapshot.load();
+        }
+
+        void PointCloudsManager::closeJournal(std::uint64_t version) {
+
+            if(this->journalMaxVersions == 0)
+                return;
+
+            MergeJournalEntry entry = std::move(this->pendingJournal);
+            this->pendingJournal = MergeJournalEntry();
+
+            if(entry.resync) {
+                this->journal.clear();
+                this->journalStart = version;
+                return;
+            }
+
+            entry.version = version;
+            this->journal.push_back(std::move(entry));
+
+            // a delta from the version of the dropped entry still only needs the newer ones
+            while(this->journal.size() > this->journalMaxVersions) {
+                this->journalStart = this->journal.front().version;
+                this->journal.pop_front();
+            }
+        }
+
+        void PointCloudsManager::setDeltaJournal(std::size_t maxVersions) {
+
+            std::lock_guard<std::mutex> lock(this->journalMutex);
+
+            this->journalMaxVersions = maxVersions;
+            this->journal.clear();
+            this->pendingJournal = MergeJournalEntry();
+
+            // the changes before now weren't journaled: deltas start at the next snapshot
+            this->pendingJournal.resync = true;
+            this->journalStart = std::numeric_limits<std::uint64_t>::max();
+        }
+
+        int PointCloudsManager::exportSnapshot(std::vector<std::uint8_t>& out, const utils::CloudEncoding& encoding) {
+
+            utils::MetricsScope metricsScope(&this->metrics);
+
+            utils::CloudMessageHeader header;
+            pcl::PointCloud<pcl::PointXYZRGBL>::ConstPtr points = this->loadSnapshot(&header.version);
+
+            int result = utils::CloudSerializer::encode(header, *points, {}, encoding, out);
+            if(result == 0)
+                utils::Metrics::add(utils::CounterMetric::EXPORTED_BYTES, out.size());
+            return result;
+        }
+
+        int PointCloudsManager::exportDelta(std::uint64_t sinceVersion, std::vector<std::uint8_t>& out,
+                                            const utils::CloudEncoding& encoding) {
+
+            utils::MetricsScope metricsScope(&this->metrics);
+
+            utils::CloudMessageHeader header;
+            pcl::PointCloud<pcl::PointXYZRGBL> addedPoints;
+            std::set<std::uint32_t> removedLabels;
+            {
+                std::unique_lock<std::mutex> lock(this->journalMutex);
+
+                header.version = this->snapshotVersion;
+
+                if(this->journalMaxVersions == 0 || sinceVersion < this->journalStart || sinceVersion > header.version) {
+                    // the journal doesn't cover it, a full export brings the receiver back in sync
+                    lock.unlock();
+                    return this->exportSnapshot(out, encoding);
+                }
+
+                header.delta = true;
+                header.baseVersion = sinceVersion;
+
+                for(const auto& entry : this->journal) {
+                    if(entry.version <= sinceVersion)
+                        continue;
+                    // each entry removes before it adds, like the receiver
+                    if(!entry.removedLabels.empty()) {
+                        removeLabelsFrom(addedPoints, entry.removedLabels);
+                        removedLabels.insert(entry.removedLabels.begin(), entry.removedLabels.end());
+                    }
+                    addedPoints += entry.addedPoints;
+                }
+            }
+
+            int result = utils::CloudSerializer::encode(header, addedPoints, removedLabels, encoding, out);
+            if(result == 0)
+                utils::Metrics::add(utils::CounterMetric::EXPORTED_BYTES, out.size());
+            return result;
+        }
+
+        void PointCloudsManager::setVoxelMapEnabled(bool enabled) {
+
+            {
+                std::lock_guard<std::mutex> lock(this->cloudMutex);
+
+                if(enabled != this->voxelMapEnabled) {
+                    // carry the current points over to the new storage
+                    if(enabled) {
+                        this->mergedVoxels.insertPointCloud(this->mergedCloud.getPointCloudCopy());
+                        this->mergedCloud.clear();
                     } else {
-                        if (cuda::pointclouds::concatenatePointCloudsCuda(this->mergedCloud.getPointCloud(), *input) <
-                            0) {
-                            std::cerr << "Could not concatenate the pointclouds at the PointCloudsManager!"
-                                      << std::endl;
-                        }
+                        pcl::PointCloud<pcl::PointXYZRGBL>::Ptr points(
+                                new pcl::PointCloud<pcl::PointXYZRGBL>(this->mergedVoxels.getPointCloudCopy()));
+                        // the points keep the labels of their scans, to age out
+                        this->mergedCloud.setPointCloud(points, false);
+                        this->mergedVoxels.clear();
+                    }
+                    this->voxelMapEnabled = enabled;
+
+                    // the points were voxelized anew
+                    std::lock_guard<std::mutex> journalLock(this->journalMutex);
+                    this->pendingJournal.resync = true;
+                }
+            }
+
+            this->publishSnapshot();
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            for(auto & streamManager : this->streamManagers) {
+                streamManager.second->setVoxelMapEnabled(enabled);
+            }
+        }
+
+        void PointCloudsManager::setDeviceResident(bool resident) {
+
+            {
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                cuda::StreamScope streamScope(&this->streamContext);
+#endif
+                std::lock_guard<std::mutex> lock(this->cloudMutex);
+                this->mergedCloud.setDeviceResident(resident);
+            }
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            this->deviceResident = resident;
+
+            for(auto & streamManager : this->streamManagers) {
+                streamManager.second->setDeviceResident(resident);
+            }
+        }
+
+        void PointCloudsManager::setGlobalRegistrationEnabled(bool enabled, const compute::RegistrationParams& params) {
+
+            std::lock_guard<std::mutex> lock(this->cloudMutex);
+
+            // the flat merged PointCloud is only cropped by visiting, and downloading, all of its points
+            if(enabled && !this->voxelMapEnabled) {
+                std::cerr << "PointCloudsManager::setGlobalRegistrationEnabled: the updates are only registered while "
+                             "the voxel map is enabled" << std::endl;
+            }
+
+            this->globalRegistrationParams = params;
+            this->globalRegistrationEnabled = enabled;
+        }
+
+        void PointCloudsManager::setStreamRegistrationEnabled(bool enabled, const compute::RegistrationParams& params) {
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            this->streamRegistrationEnabled = enabled;
+            this->streamRegistrationParams = params;
+
+            for(auto & streamManager : this->streamManagers) {
+                streamManager.second->setRegistrationEnabled(enabled, params);
+            }
+        }
+
+        void PointCloudsManager::setDeskewEnabled(bool enabled, const compute::DeskewParams& params) {
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            this->deskewEnabled = enabled;
+            this->deskewParams = params;
+
+            for(auto & streamManager : this->streamManagers) {
+                streamManager.second->setDeskewEnabled(enabled, params);
+            }
+        }
+
+        compute::RegistrationParams PointCloudsManager::getDefaultGlobalRegistrationParams() {
+            compute::RegistrationParams params;
+            params.maxCorrespondenceDistance = GLOBAL_ICP_MAX_CORRESPONDENCE_DISTANCE;
+            params.maxIterations = GLOBAL_ICP_MAX_ITERATIONS;
+            return params;
+        }
+
+        void PointCloudsManager::setAsyncIngest(bool enabled, std::size_t capacity, IngestOverflowPolicy policy) {
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            this->asyncIngest = enabled;
+            this->ingestQueueCapacity = capacity;
+            this->overflowPolicy = policy;
+
+            for(auto & streamManager : this->streamManagers) {
+                streamManager.second->setAsyncIngest(enabled, capacity, policy);
+            }
+        }
+
+        std::size_t PointCloudsManager::getDroppedFrames() {
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            std::size_t dropped = 0;
+            for(auto & streamManager : this->streamManagers) {
+                dropped += streamManager.second->getDroppedFrames();
+            }
+
+            return dropped;
+        }
+
+        int PointCloudsManager::saveCheckpoint(const std::string& path) {
+
+            std::vector<entities::CheckpointStream> streams;
+            std::unordered_map<const void*,std::uint32_t> streamIndex;
+            std::vector<float> levels;
+            std::vector<entities::VoxelRecord> voxels;
+            pcl::PointCloud<pcl::PointXYZRGBL> points;
+            std::vector<utils::WheelTimer> timers;
+            bool voxelMap;
+
+            {
+                // the streams can be walked under governorMutex
+                std::lock_guard<std::mutex> governorLock(this->governorMutex);
+
+                for(auto& streamManager : this->streamManagers) {
+                    if(streamManager.second == nullptr)
+                        continue;
+                    if(streamManager.first.size() >= CHECKPOINT_TOPIC_SIZE) {
+                        std::cerr << "PointCloudsManager::saveCheckpoint: the topic name " << streamManager.first
+                                  << " is too long, its scans are left out!" << std::endl;
+                        continue;
+                    }
+
+                    entities::CheckpointStream stream{};
+                    std::memcpy(stream.topic, streamManager.first.c_str(), streamManager.first.size() + 1);
+                    Eigen::Affine3d transform;
+                    stream.transformSet = streamManager.second->getSensorTransform(transform);
+                    if(stream.transformSet)
+                        std::memcpy(stream.transform, transform.matrix().data(), sizeof(stream.transform));
+
+                    streamIndex[streamManager.second.get()] = (std::uint32_t) streams.size();
+                    streams.push_back(stream);
+                }
+
+                auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+                // labels are only dropped under the journal lock
+                std::lock_guard<std::mutex> journalLock(this->journalMutex);
+
+                voxelMap = this->voxelMapEnabled;
+                levels = this->resolutionLevels;
+                if(voxelMap)
+                    voxels = this->mergedVoxels.getVoxels();
+                else
+                    points = this->mergedCloud.getPointCloudCopy();
+
+                // taken after the points: each of their labels is still on the wheel, unless expiring right now
+                this->agingWheel->getTimers(timers);
+            }
+
+            std::vector<entities::CheckpointScan> scans;
+            scans.reserve(timers.size());
+            for(const auto& timer : timers) {
+                auto stream = streamIndex.find(timer.owner);
+                if(stream != streamIndex.end())
+                    scans.push_back({timer.expiry, timer.label, stream->second});
+            }
+
+            entities::CheckpointHeader header;
+            header.headerSize = sizeof(entities::CheckpointHeader);
+            header.createdAt = utils::Utils::getCurrentTimeMillis();
+            header.voxelMap = voxelMap;
+
+            std::uint64_t end = sizeof(entities::CheckpointHeader);
+            header.levels = placeSection(end, levels.size(), sizeof(float));
+            header.voxels = placeSection(end, voxels.size(), sizeof(entities::VoxelRecord));
+            header.points = placeSection(end, points.size(), sizeof(pcl::PointXYZRGBL));
+            header.scans = placeSection(end, scans.size(), sizeof(entities::CheckpointScan));
+            header.streams = placeSection(end, streams.size(), sizeof(entities::CheckpointStream));
+
+            // written aside, so the previous checkpoint stays whole until this one is
+            std::string tempPath = path + ".tmp";
+            utils::MappedFile file;
+            if(file.create(tempPath, end) < 0)
+                return -1;
+
+            std::uint8_t* data = file.data();
+            std::memcpy(data, &header, sizeof(header));
+            auto copySection = [data](const entities::CheckpointSection& section, const void* records) {
+                if(section.count > 0)
+                    std::memcpy(data + section.offset, records, section.count * section.recordSize);
+            };
+            copySection(header.levels, levels.data());
+            copySection(header.voxels, voxels.data());
+            copySection(header.points, points.points.data());
+            copySection(header.scans, scans.data());
+            copySection(header.streams, streams.data());
+
+            if(file.sync() < 0) {
+                file.close();
+                std::remove(tempPath.c_str());
+                return -2;
+            }
+            file.close();
+
+            if(std::rename(tempPath.c_str(), path.c_str()) != 0) {
+                std::cerr << "PointCloudsManager::saveCheckpoint: could not replace " << path << "!" << std::endl;
+                std::remove(tempPath.c_str());
+                return -2;
+            }
+
+            return 0;
+        }
+
+        int PointCloudsManager::loadCheckpoint(const std::string& path) {
+
+            utils::MetricsScope metricsScope(&this->metrics);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            cuda::StreamScope streamScope(&this->streamContext);
+#endif
+
+            utils::MappedFile file;
+            if(file.openRead(path) < 0)
+                return -1;
+
+            const std::uint8_t* data = file.data();
+            const std::size_t size = file.size();
+
+            entities::CheckpointHeader header;
+            if(size < sizeof(header)) {
+                std::cerr << "PointCloudsManager::loadCheckpoint: " << path << " is not a checkpoint!" << std::endl;
+                return -2;
+            }
+            std::memcpy(&header, data, sizeof(header));
+
+            if(header.magic != CHECKPOINT_MAGIC || header.formatVersion != CHECKPOINT_FORMAT_VERSION ||
+               header.headerSize != sizeof(header) ||
+               !isSectionValid(header.levels, sizeof(float), size) ||
+               !isSectionValid(header.voxels, sizeof(entities::VoxelRecord), size) ||
+               !isSectionValid(header.points, sizeof(pcl::PointXYZRGBL), size) ||
+               !isSectionValid(header.scans, sizeof(entities::CheckpointScan), size) ||
+               !isSectionValid(header.streams, sizeof(entities::CheckpointStream), size)) {
+                std::cerr << "PointCloudsManager::loadCheckpoint: " << path
+                          << " is not a checkpoint of this build!" << std::endl;
+                return -2;
+            }
+
+            // the mapping is page-aligned and the sections aligned on it, so the records are read in place
+            const auto* levels = reinterpret_cast<const float*>(data + header.levels.offset);
+            const auto* voxels = reinterpret_cast<const entities::VoxelRecord*>(data + header.voxels.offset);
+            const auto* points = reinterpret_cast<const pcl::PointXYZRGBL*>(data + header.points.offset);
+            const auto* scans = reinterpret_cast<const entities::CheckpointScan*>(data + header.scans.offset);
+            const auto* streams = reinterpret_cast<const entities::CheckpointStream*>(data + header.streams.offset);
+
+            if(header.levels.count > 0)
+                this->setResolutionLevels(std::vector<float>(levels, levels + header.levels.count));
+            this->setVoxelMapEnabled(header.voxelMap != 0);
+
+            std::vector<StreamManager*> owners;
+            owners.reserve(header.streams.count);
+            for(std::uint64_t i = 0; i < header.streams.count; i++) {
+                const entities::CheckpointStream& stream = streams[i];
+                std::string topicName(stream.topic, strnlen(stream.topic, CHECKPOINT_TOPIC_SIZE));
+                StreamManager* streamManager = this->initStreamManager(topicName, this->maxAge);
+
+                // a transform set since startup is newer than the saved one
+                Eigen::Affine3d transform;
+                if(stream.transformSet && !streamManager->getSensorTransform(transform)) {
+                    std::memcpy(transform.matrix().data(), stream.transform, sizeof(stream.transform));
+                    streamManager->setSensorTransform(transform);
+                }
+                owners.push_back(streamManager);
+            }
+
+            std::unordered_set<std::uint32_t> agingLabels;
+            for(std::uint64_t i = 0; i < header.scans.count; i++) {
+                if(scans[i].stream < owners.size())
+                    agingLabels.insert(scans[i].label);
+            }
+
+            {
+                auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+                std::lock_guard<std::mutex> journalLock(this->journalMutex);
+
+                // labels without a scan were expiring as the checkpoint was taken
+                std::set<std::uint32_t> expiredLabels;
+
+                if(this->voxelMapEnabled) {
+                    this->mergedCloud.clear();
+                    this->mergedVoxels.loadVoxels(voxels, header.voxels.count);
+                    for(std::uint64_t i = 0; i < header.voxels.count; i++) {
+                        if(!agingLabels.count(voxels[i].voxel.label))
+                            expiredLabels.insert(voxels[i].voxel.label);
                     }
+                    if(!expiredLabels.empty())
+                        this->mergedVoxels.removeLabels(expiredLabels);
+                } else {
+                    this->mergedVoxels.clear();
+                    pcl::PointCloud<pcl::PointXYZRGBL>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZRGBL>());
+                    cloud->points.assign(points, points + header.points.count);
+                    cloud->width = cloud->points.size();
+                    cloud->height = 1;
+                    for(const auto& point : cloud->points) {
+                        if(!agingLabels.count(point.label))
+                            expiredLabels.insert(point.label);
+                    }
+                    this->mergedCloud.setPointCloud(cloud, false);
+                    if(!expiredLabels.empty())
+                        this->mergedCloud.removePointsWithLabels(expiredLabels);
                 }
+
+                this->pendingJournal.resync = true;
+            }
+
+            // after the points, so the scans due already find them to drop
+            for(std::uint64_t i = 0; i < header.scans.count; i++) {
+                if(scans[i].stream < owners.size())
+                    this->agingWheel->schedule(scans[i].expiry, scans[i].label, owners[scans[i].stream]);
+            }
+
+            this->publishSnapshot();
+            this->enforceMemoryBudget();
+
+            return 0;
+        }
+
+        void PointCloudsManager::setMetricsEnabled(bool enabled) {
+            utils::Metrics::setEnabled(enabled);
+        }
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+        void PointCloudsManager::setDeviceMemoryLimit(std::size_t bytes) {
+            cuda::DeviceMemoryPool::getInstance().setMaxBytes(bytes);
+        }
+
+        cuda::DeviceMemoryPoolStats PointCloudsManager::getDeviceMemoryStats() {
+            return cuda::DeviceMemoryPool::getInstance().getStats();
+        }
+
+        void PointCloudsManager::setDeviceAffinity(const std::string& topicName, int device) {
+
+            if(device < 0 || device >= cuda::getDeviceCount()) {
+                std::cerr << "PointCloudsManager::setDeviceAffinity: no CUDA device " << device << "!" << std::endl;
+                return;
+            }
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            if(this->streamManagers.find(topicName) != this->streamManagers.end()) {
+                std::cerr << "PointCloudsManager::setDeviceAffinity: the stream " << topicName
+                          << " already exists, its device is kept" << std::endl;
+                return;
+            }
+
+            this->deviceAffinity[topicName] = device;
+        }
+#endif
+
+        int PointCloudsManager::pickStreamDevice(const std::string& topicName) {
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            int nDevices = cuda::getDeviceCount();
+            if(nDevices <= 1)
+                return this->streamContext.getDevice();
+
+            auto affinity = this->deviceAffinity.find(topicName);
+            if(affinity != this->deviceAffinity.end())
+                return affinity->second;
+
+            int device = this->nextDevice;
+            this->nextDevice = (this->nextDevice + 1) % nDevices;
+            return device;
+#else
+            return -1;
+#endif
+        }
+
+        PointCloudsManagerMetrics PointCloudsManager::getMetrics() {
+
+            PointCloudsManagerMetrics result;
+            result.global = this->metrics.getSnapshot();
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            for(auto & streamManager : this->streamManagers) {
+                result.streams[streamManager.first] = streamManager.second->getMetrics().getSnapshot();
+                result.droppedFrames[streamManager.first] = streamManager.second->getDroppedFrames();
+            }
+
+            return result;
+        }
+
+        void PointCloudsManager::resetMetrics() {
+
+            this->metrics.reset();
+
+            std::lock_guard<std::mutex> lock(this->managersMutex);
+
+            for(auto & streamManager : this->streamManagers) {
+                streamManager.second->getMetrics().reset();
             }
+        }
 
-            // the points are no longer needed
-            input->clear();
+        bool PointCloudsManager::appendToMerged(entities::StampedPointCloud& input) {
+
+            bool couldAlign = false;
+
+            // align the pointclouds
+            if (input.getSize() > 0) {
+
+                /* lock access to the pointcloud mutex by other threads.
+                * will only be released after appending the input pointcloud. */
+                auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+
+                // "input" aligns to "merged". if it can't, it is appended as is
+                if(this->globalRegistrationEnabled && this->voxelMapEnabled)
+                    couldAlign = this->registerToMerged(input);
+
+                // no snapshot is published between the change and its journal entry
+                std::lock_guard<std::mutex> journalLock(this->journalMutex);
+
+                if(this->voxelMapEnabled) {
+                    // only the voxels the new points fall on are updated
+                    pcl::PointCloud<pcl::PointXYZRGBL> points = input.getPointCloudCopy();
+                    this->mergedVoxels.insertPointCloud(points);
+                    if(this->journalMaxVersions > 0)
+                        this->pendingJournal.addedPoints += points;
+                    return couldAlign;
+                }
+
+                if(this->journalMaxVersions > 0)
+                    this->pendingJournal.addedPoints += input.getPointCloudCopy();
+
+                // device-resident points are copied device to device, peer-to-peer from another GPU
+                if(this->mergedCloud.appendPointCloud(input) < 0) {
+                    std::cerr << "Could not concatenate the pointclouds at the PointCloudsManager!" << std::endl;
+                }
+            }
 
             return couldAlign;
         }
 
+        bool PointCloudsManager::registerToMerged(entities::StampedPointCloud& input) {
+
+            const compute::RegistrationParams& params = this->globalRegistrationParams;
+
+            // only the merged points around the update take part
+            pcl::PointCloud<pcl::PointXYZRGBL> source = input.getPointCloudCopy();
+            Eigen::AlignedBox3f box = compute::Registration::getSubmapBox(source, params.submapMargin);
+            pcl::PointCloud<pcl::PointXYZRGBL> target = this->mergedVoxels.getPointsInBox(box);
+
+            if(target.size() < REGISTRATION_MIN_CORRESPONDENCES)
+                return false;
+
+            compute::RegistrationResult result;
+            if(compute::ComputeBackend::select(source.size() + target.size()).alignPointCloud(source, target, params,
+                                                                                               result) < 0) {
+                std::cerr << "Could not register the pointclouds at the PointCloudsManager!" << std::endl;
+                return false;
+            }
+
+            if(result.correspondences < REGISTRATION_MIN_CORRESPONDENCES)
+                return false;
+
+            // where the points live, device-resident updates are not downloaded again
+            input.applyTransform(result.transform);
+
+            return result.converged;
+        }
+
         void PointCloudsManager::removePointsByLabel(const std::set<std::uint32_t>& labels) {
 
+            // the order of appendToMerged. the storage can't be switched while its points are removed
+            auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+            std::lock_guard<std::mutex> journalLock(this->journalMutex);
+
+            if(this->journalMaxVersions > 0) {
+                // points added and removed before the same snapshot are never sent
+                removeLabelsFrom(this->pendingJournal.addedPoints, labels);
+                this->pendingJournal.removedLabels.insert(labels.begin(), labels.end());
+            }
+
             // remove the points with the label
-            this->mergedCloud.removePointsWithLabels(labels);
+            if(this->voxelMapEnabled)
+                utils::Metrics::add(utils::CounterMetric::POINTS_AGED, this->mergedVoxels.removeLabels(labels));
+            else
+                this->mergedCloud.removePointsWithLabels(labels);
         }
 
-        void PointCloudsManager::addStreamPointCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& cloud) {
+        void PointCloudsManager::expirePointClouds(std::vector<utils::WheelTimer>& expired) {
+
+            /*
+             * run the removal and the flush it may trigger on the pool, so the wheel moves on to the next
+             * expirations and cancelling doesn't wait for a global downsample
+             */
+            this->jobs->submit([this, expired = std::move(expired)]() mutable {
+
+                utils::MetricsScope metricsScope(&this->metrics);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                cuda::StreamScope streamScope(&this->streamContext);
+#endif
 
-            this->appendToMerged(cloud);
-            this->mergedCloud.downsample(VOXEL_LEAF_SIZE);
+                {
+                    // the streams are only destroyed under it, so the owners of the timers stay alive
+                    std::lock_guard<std::mutex> governorLock(this->governorMutex);
+                    this->removeScans(expired);
+                }
+
+                this->commitMergeUpdate();
+            });
         }
 
-        void PointCloudsManager::initStreamManager(const std::string &topicName, double maxAge) {
-            std::lock_guard<std::mutex> lock(this->managersMutex);
+        void PointCloudsManager::removeScans(std::vector<utils::WheelTimer>& scans) {
+
+            // timers taken off the wheel can't be cancelled anymore, so their streams are kept alive by governorMutex
+            std::map<StreamManager*,std::set<std::uint32_t>> labelsByStream;
+            std::set<std::uint32_t> labels;
+            for(auto& timer : scans) {
+                labelsByStream[static_cast<StreamManager*>(timer.owner)].insert(timer.label);
+                labels.insert(timer.label);
+            }
+
+            for(auto& stream : labelsByStream)
+                stream.first->expirePointClouds(stream.second);
+
+            // one removal pass over the merged PointCloud for all the streams
+            this->removePointsByLabel(labels);
+        }
+
+        PointCloudsManagerMemory PointCloudsManager::computeMemoryUsage() {
+
+            PointCloudsManagerMemory usage;
+            usage.budget = this->maxMemory * 1000000;
+
+            usage.merged = this->voxelMapEnabled ? this->mergedVoxels.getMemoryUsage() : this->mergedCloud.getMemoryUsage();
+            usage.total = usage.merged;
+
+            for(auto& streamManager : this->streamManagers) {
+                // freed on destruction
+                if(streamManager.second == nullptr)
+                    continue;
+                std::size_t bytes = streamManager.second->getMemoryUsage();
+                usage.streams[streamManager.first] = bytes;
+                usage.total += bytes;
+            }
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            // the caches are kept for the whole process, beyond the points they held
+            usage.pools = cuda::DeviceMemoryPool::getInstance().getStats().cachedBytes +
+                          cuda::PinnedBufferPool::getInstance().getCachedBytes() +
+                          this->streamContext.getStagingBytes();
+            usage.total += usage.pools;
+#endif
+
+            return usage;
+        }
+
+        void PointCloudsManager::enforceMemoryBudget() {
+
+            if(this->maxMemory == 0)
+                return;
+
+            std::lock_guard<std::mutex> governorLock(this->governorMutex);
 
-            if(this->streamManagers.count(topicName) != 0)
+            // the streams are being destroyed
+            if(this->stoppingStreams)
                 return;
 
-            std::unique_ptr<StreamManager> newStreamManager = std::make_unique<StreamManager>(topicName, maxAge);
+            PointCloudsManagerMemory usage = this->computeMemoryUsage();
+            if(usage.total <= usage.budget)
+                return;
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            // the cached buffers go before any point does
+            if(usage.pools > 0) {
+                cuda::DeviceMemoryPool::getInstance().trim();
+                cuda::PinnedBufferPool::getInstance().trim();
+                usage = this->computeMemoryUsage();
+                if(usage.total <= usage.budget)
+                    return;
+            }
+#endif
+
+            // only the merged PointCloud can give memory back. the streams and the pools take their share of the
+            // budget first, and when they alone cross it evicting the merged points would not bring it under
+            std::size_t nonEvictable = usage.total - usage.merged;
+            if(nonEvictable >= usage.budget)
+                return;
+            std::size_t mergedBudget = usage.budget - nonEvictable;
 
-            // set the point removing method as a callback when some pointcloud ages on the stream manager
-            newStreamManager->setPointAgingCallback(std::bind(&PointCloudsManager::removePointsByLabel, this,
-                                                              std::placeholders::_1));
+            // evicting points doesn't bring the capacity beyond them down. the capacity left by large removals is
+            // given back, but not the headroom the appends grow into, which would reallocate on the next append
+            std::size_t mergedBytes = usage.merged;
+            {
+                auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+                if(!this->voxelMapEnabled) {
+                    if(this->mergedCloud.shrinkToFit(MEMORY_MAX_CAPACITY_SLACK) &&
+                       this->mergedCloud.getMemoryUsage() <= mergedBudget)
+                        return;
+                    mergedBytes = this->mergedCloud.getPointsMemoryUsage();
+                }
+            }
+            if(mergedBytes <= mergedBudget)
+                return;
+            std::size_t excess = mergedBytes - mergedBudget;
 
-            // add a pointcloud whenever the StreamManager has one ready
-            newStreamManager->setPointCloudReadyCallback(std::bind(&PointCloudsManager::addStreamPointCloud, this,
-                                                                   std::placeholders::_1));
+            bool farthest = false;
+            Eigen::Vector3f center;
+            if(this->evictionPolicy == EvictionPolicy::FARTHEST_FROM_ROBOT) {
+                std::lock_guard<std::mutex> poseLock(this->robotPoseMutex);
+                farthest = this->robotPoseSet;
+                center = this->robotPosition;
+            }
+
+            std::size_t evicted = 0;
+
+            if(farthest && mergedBytes > 0) {
+
+                auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+
+                // deltas only carry removals by label
+                std::lock_guard<std::mutex> journalLock(this->journalMutex);
+                this->pendingJournal.resync = true;
+
+                // the streams only hold their latest batch, so the excess comes off the merged PointCloud
+                if(this->voxelMapEnabled) {
+                    std::size_t voxelBytes = std::max<std::size_t>(mergedBytes / std::max<std::size_t>(this->mergedVoxels.size(), 1), 1);
+                    evicted = this->mergedVoxels.evictFarthest(center, (excess + voxelBytes - 1) / voxelBytes);
+                } else {
+                    std::size_t pointBytes = std::max<std::size_t>(mergedBytes / std::max<std::size_t>(this->mergedCloud.getSize(), 1), 1);
+                    evicted = this->mergedCloud.removeFarthestPoints(center, (excess + pointBytes - 1) / pointBytes);
+                    this->mergedCloud.shrinkToFit(MEMORY_MAX_CAPACITY_SLACK);
+                }
+
+            } else {
+
+                std::size_t nScans = this->agingWheel->size();
+                if(nScans == 0)
+                    return;
+
+                // the oldest scans which cover the excess, taken off the wheel in expiry order and evicted in a
+                // single bulk removal. only the merged PointCloud shrinks here, so each scan counts for its own
+                // points on it, read from the label index
+                std::vector<utils::WheelTimer> oldest;
+                std::size_t points;
+                {
+                    auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+                    bool voxelMap = this->voxelMapEnabled;
+                    points = voxelMap ? this->mergedVoxels.size() : this->mergedCloud.getSize();
+                    std::size_t pointBytes = std::max<std::size_t>(mergedBytes / std::max<std::size_t>(points, 1), 1);
+                    // without the label index each scan counts as an average one
+                    std::size_t averagePoints = points / nScans;
+
+                    std::size_t freed = 0;
+                    this->agingWheel->takeEarliest([&](const utils::WheelTimer& timer) {
+                        if(freed >= excess)
+                            return false;
+                        std::size_t scanPoints;
+                        if(voxelMap)
+                            scanPoints = this->mergedVoxels.getLabelSize(timer.label);
+                        else if(!this->mergedCloud.getLabelSize(timer.label, scanPoints))
+                            scanPoints = averagePoints;
+                        freed += scanPoints * pointBytes;
+                        return true;
+                    }, oldest);
+                }
+                if(oldest.empty())
+                    return;
+
+                std::size_t sizeBefore = points;
+                this->removeScans(oldest);
+
+                auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+                std::size_t sizeAfter = this->voxelMapEnabled ? this->mergedVoxels.size() : this->mergedCloud.getSize();
+                evicted = sizeBefore > sizeAfter ? sizeBefore - sizeAfter : 0;
+                if(!this->voxelMapEnabled)
+                    this->mergedCloud.shrinkToFit(MEMORY_MAX_CAPACITY_SLACK);
+            }
+
+            utils::Metrics::add(utils::CounterMetric::POINTS_EVICTED, evicted);
+        }
+
+        void PointCloudsManager::setEvictionPolicy(EvictionPolicy policy) {
+            this->evictionPolicy = policy;
+        }
 
-            this->streamManagers[topicName] = std::move(newStreamManager);
+        void PointCloudsManager::setRobotPose(const Eigen::Affine3d& pose) {
+            std::lock_guard<std::mutex> lock(this->robotPoseMutex);
+            this->robotPosition = pose.translation().cast<float>();
+            this->robotPoseSet = true;
+        }
+
+        PointCloudsManagerMemory PointCloudsManager::getMemoryUsage() {
+            std::lock_guard<std::mutex> governorLock(this->governorMutex);
+            return this->computeMemoryUsage();
+        }
+
+        void PointCloudsManager::applyStreamDelta(const StreamDelta& delta) {
+
+            // the merge is accounted to the manager, not to the stream handing the delta over
+            utils::MetricsScope metricsScope(&this->metrics);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            cuda::StreamScope streamScope(&this->streamContext);
+#endif
+            utils::ScopedTimer mergeTimer(utils::HistogramMetric::INGEST_TIME_NS);
+
+            bool changed = false;
+
+            if(!delta.removedLabels.empty()) {
+                this->removePointsByLabel(delta.removedLabels);
+                changed = true;
+            }
+
+            // the points stay on the stream, which empties them after the callback
+            if(delta.points != nullptr && delta.points->getSize() > 0) {
+                this->appendToMerged(*delta.points);
+                this->enforceMemoryBudget();
+                changed = true;
+            }
+
+            if(changed)
+                this->commitMergeUpdate();
+        }
+
+        void PointCloudsManager::commitMergeUpdate() {
+
+            bool flush;
+            {
+                std::lock_guard<std::mutex> lock(this->mergeMutex);
+
+                if(this->pendingUpdates == 0)
+                    this->pendingSince = std::chrono::steady_clock::now();
+                this->pendingUpdates++;
+
+                flush = this->pendingUpdates >= this->mergeMaxUpdates;
+            }
+
+            if(flush) {
+                this->flushMergedUpdates();
+                return;
+            }
+
+            // arm the window of the batch
+            this->mergeCondition.notify_all();
+        }
+
+        void PointCloudsManager::flushMergedUpdates() {
+
+            std::size_t batch;
+            {
+                std::lock_guard<std::mutex> lock(this->mergeMutex);
+                batch = this->pendingUpdates;
+                this->pendingUpdates = 0;
+            }
+            // let the flush thread know the batch is gone
+            this->mergeCondition.notify_all();
+
+            if(batch == 0)
+                return;
+
+            utils::Metrics::record(utils::HistogramMetric::MERGE_BATCH_SIZE, batch);
+
+            // no append, removal or registration sees the points halfway through the downsample
+            auto lock = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+            std::lock_guard<std::mutex> journalLock(this->journalMutex);
+
+            // the voxel map is already downsampled
+            if(!this->voxelMapEnabled)
+                this->mergedCloud.downsample(this->mergeLeafSize);
+
+            this->closeSnapshot();
+        }
+
+        void PointCloudsManager::setMergeBatching(std::size_t maxUpdates, std::chrono::milliseconds window) {
+
+            if(maxUpdates == 0) {
+                std::cerr << "PointCloudsManager::setMergeBatching: a batch takes at least one update!" << std::endl;
+                return;
+            }
+
+            bool flush;
+            {
+                std::lock_guard<std::mutex> lock(this->mergeMutex);
+                this->mergeMaxUpdates = maxUpdates;
+                this->mergeWindow = window;
+                flush = this->pendingUpdates >= maxUpdates;
+            }
+            this->mergeCondition.notify_all();
+
+            if(flush) {
+                utils::MetricsScope metricsScope(&this->metrics);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+                cuda::StreamScope streamScope(&this->streamContext);
+#endif
+                this->flushMergedUpdates();
+            }
+        }
+
+        StreamManager* PointCloudsManager::initStreamManager(const std::string &topicName, double maxAge) {
+            auto lock = utils::Metrics::lock(this->managersMutex, utils::HistogramMetric::MANAGERS_LOCK_WAIT_NS);
+
+            auto existing = this->streamManagers.find(topicName);
+            if(existing != this->streamManagers.end())
+                return existing->second.get();
+
+            std::unique_ptr<StreamManager> newStreamManager = std::make_unique<StreamManager>(topicName, maxAge,
+                                                                                              this->threadPool,
+                                                                                              this->pickStreamDevice(topicName),
+                                                                                              this->agingWheel);
+
+            if(this->deviceResident)
+                newStreamManager->setDeviceResident(true);
+            if(this->voxelMapEnabled)
+                newStreamManager->setVoxelMapEnabled(true);
+            if(this->asyncIngest)
+                newStreamManager->setAsyncIngest(true, this->ingestQueueCapacity, this->overflowPolicy);
+            if(this->streamRegistrationEnabled)
+                newStreamManager->setRegistrationEnabled(true, this->streamRegistrationParams);
+            if(this->deskewEnabled)
+                newStreamManager->setDeskewEnabled(true, this->deskewParams);
+
+            // only the changes are handed over: the new points of each batch. the aging goes through the wheel
+            newStreamManager->setDeltaCallback(std::bind(&PointCloudsManager::applyStreamDelta, this,
+                                                         std::placeholders::_1));
+
+            StreamManager* streamManager = newStreamManager.get();
+            {
+                std::lock_guard<std::mutex> governorLock(this->governorMutex);
+                this->streamManagers[topicName] = std::move(newStreamManager);
+            }
+
+            // streams are only ever added, so the registry is copied once per stream
+            auto registry = std::make_unique<std::unordered_map<std::string,StreamManager*>>(*this->streamRegistry.load());
+            (*registry)[topicName] = streamManager;
+            this->streamRegistry.store(registry.get());
+            this->registryCopies.push_back(std::move(registry));
+
+            return streamManager;
+        }
+
+        StreamManager* PointCloudsManager::findStreamManager(const std::string& topicName) {
+
+            const std::unordered_map<std::string,StreamManager*>* registry = this->streamRegistry.load();
+
+            auto existing = registry->find(topicName);
+            if(existing != registry->end())
+                return existing->second;
+
+            // first use of the topic
+            return this->initStreamManager(topicName, this->maxAge);
         }
 
         void PointCloudsManager::clearMergedCloud() {
 
             std::lock_guard<std::mutex> lock(this->cloudMutex);
+            std::lock_guard<std::mutex> journalLock(this->journalMutex);
+
+            this->mergedCloud.clear();
+            this->mergedVoxels.clear();
+
+            this->pendingJournal.resync = true;
 
-            this->mergedCloud.getPointCloud()->clear();
+            this->closeSnapshot();
         }
 
     } // pcl_aggregator
@@ -3,93 +3,57 @@
 //
 
 #include <pcl_aggregator_core/managers/StreamManager.h>
-#include "pcl_aggregator_core/cuda/CUDAPointClouds.cuh"
+#include <pcl_aggregator_core/compute/ComputeBackend.h>
+#include <algorithm>
 
 namespace pcl_aggregator {
     namespace managers {
 
-        void maxAgeWatchingRoutine(StreamManager* instance) {
-
-            // lambda function which removes a pointcloud from the merged version
-            auto pointCloudRemovalRoutine = [instance](std::set<std::uint32_t> labels) {
-                instance->removePointClouds(labels);
-            };
-
-            std::set<std::uint32_t> labelsToRemove;
-
-            while(instance->keepAgeWatcherAlive) {
-
-                {
-                    // lock access to the pointcloud set
-                    std::lock_guard<std::mutex> lock(instance->setMutex);
-
-                    for (auto &iter: instance->clouds) {
-
-                        /* the set is ordered by ascending timestamp.
-                         * When we find the first pointcloud which is not older than the max age, we can stop. */
-
-                        // this pointcloud is older than the max age
-                        if (iter->getTimestamp() <= utils::Utils::getMaxTimestampForAge(instance->maxAge)) {
-
-                            // add the label to the set to remove
-                            labelsToRemove.insert(iter->getLabel());
-                        } else {
-                            // the set is ordered by ascending timestamp, so we can stop here
-                            break;
-                        }
-
-                        // TODO: review what happens to the pointer, potential memory leak here
-                    }
-                }
-
-
-                // start a detached thread to the pointclouds
-                /*
-                 * using a deteched thread instead of sequentially to prevent from having this iteration
-                 * going for too long, keeping access to the set constantly locked
-                 */
-
-                std::thread pointCloudRemovalThread = std::thread(pointCloudRemovalRoutine, labelsToRemove);
-                pthread_setname_np(pointCloudRemovalThread.native_handle(), "pointCloudRemovalThread");
-                pointCloudRemovalThread.detach();
-
-                // the point aging callback was set
-                if(instance->pointAgingCallback != nullptr) {
-                    // call a thread to run the callback
-                    // if it was done in the same thread, it would delay the routine
-                    std::thread callbackThread = std::thread(instance->pointAgingCallback, labelsToRemove);
-                    callbackThread.detach();
-                }
-
-                // sleep for a second before repeating
-                std::this_thread::sleep_for(std::chrono::seconds(1));
-            }
-        }
-
-        StreamManager::StreamManager(const std::string& topicName, double maxAge) {
+        StreamManager::StreamManager(const std::string& topicName, double maxAge,
+                                     std::shared_ptr<utils::ThreadPool> threadPool, int device,
+                                     std::shared_ptr<utils::TimingWheel> agingWheel):
+        voxels(STREAM_DOWNSAMPLING_LEAF_SIZE), registrationSubmap(STREAM_DOWNSAMPLING_LEAF_SIZE), deltaPoints(topicName)
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+        , streamContext(device)
+#endif
+        {
             this->topicName = topicName;
+            this->topicHash = std::hash<std::string>()(topicName);
             this->cloud = std::make_shared<entities::StampedPointCloud>(topicName);
+            this->deltaPlaceholder = pcl::PointCloud<pcl::PointXYZRGBL>::Ptr(new pcl::PointCloud<pcl::PointXYZRGBL>());
+            this->deltaPoints.setPointCloud(this->deltaPlaceholder, false);
             this->maxAge = maxAge;
 
-            // start the age watcher thread
-            this->maxAgeWatcherThread = std::thread(maxAgeWatchingRoutine, this);
-            pthread_setname_np(this->maxAgeWatcherThread.native_handle(), "maxAgeWatcherThread");
-
-            // this thread can dettach from the main thread
-            this->maxAgeWatcherThread.detach();
+            // run on a private pool when none is shared
+            this->threadPool = threadPool != nullptr ? std::move(threadPool) : std::make_shared<utils::ThreadPool>(1);
+            this->jobs = std::make_unique<utils::TaskGroup>(*this->threadPool);
+
+            // run the aging on a private wheel when none is shared
+            this->ownsAgingWheel = agingWheel == nullptr;
+            if(this->ownsAgingWheel) {
+                this->agingWheel = std::make_shared<utils::TimingWheel>([this](std::vector<utils::WheelTimer>& expired) {
+                    this->onPointCloudsExpired(expired);
+                });
+            } else {
+                this->agingWheel = std::move(agingWheel);
+            }
         }
 
         StreamManager::~StreamManager() {
-            this->cloud.reset();
 
-            // signal the watcher to stop
-            this->keepAgeWatcherAlive = false;
-            // wait for the watcher to end
-            this->maxAgeWatcherThread.join();
+            // no more expirations reach this instance. a shared wheel keeps running for the other managers
+            if(this->ownsAgingWheel)
+                this->agingWheel->stop();
+            else
+                this->agingWheel->cancel(this);
 
-            for(const auto& c : this->clouds) {
-                this->clouds.erase(c);
-            }
+            // the jobs on the pool still point to this instance
+            this->jobs->wait();
+            this->jobs.reset();
+
+            this->cloud.reset();
+
+            this->scans.clear();
 
             while(!this->cloudsNotTransformed.empty()) {
                 this->cloudsNotTransformed.pop();
@@ -100,6 +64,10 @@ namespace pcl_aggregator {
             return this->topicName == other.topicName;
         }
 
+        void StreamManager::waitForJobs() {
+            this->jobs->wait();
+        }
+
         void StreamManager::computeTransform() {
             while(!this->cloudsNotTransformed.empty()) {
 
@@ -107,8 +75,8 @@ namespace pcl_aggregator {
                 std::shared_ptr<entities::StampedPointCloud> spcl = this->cloudsNotTransformed.front();
                 spcl->applyTransform(this->sensorTransform);
 
-                // add to the set
-                this->clouds.insert(std::move(spcl));
+                // only the label and timestamp are kept for aging
+                this->scheduleAging({spcl->getTimestamp(), spcl->getLabel()});
 
                 // remove from the queue
                 this->cloudsNotTransformed.pop();
@@ -117,54 +85,113 @@ namespace pcl_aggregator {
 
         void StreamManager::removePointCloud(std::uint32_t label) {
 
+            utils::MetricsScope metricsScope(&this->metrics);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            cuda::StreamScope streamScope(&this->streamContext);
+#endif
+
             {
-                std::lock_guard<std::mutex> cloudGuard(this->cloudMutex);
+                auto cloudGuard = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
 
                 // remove points with that label from the merged pointcloud
-                this->cloud->removePointsWithLabel(label);
+                if(this->voxelMapEnabled) {
+                    utils::Metrics::add(utils::CounterMetric::POINTS_AGED, this->voxels.removeLabels({label}));
+                } else {
+                    this->cloud->removePointsWithLabel(label);
+                    this->registrationSubmap.removeLabels({label});
+                }
             }
 
 
             // lock the set
-            std::lock_guard<std::mutex> guard(this->setMutex);
-
-            // iterate the set
-            for(auto c : this->clouds) {
-                if(c->getLabel() == label) {
-                    // remove the pointcloud from the set
-                    this->clouds.erase(c);
-                    c.reset();
-                    break;
-                }
-            }
+            auto guard = utils::Metrics::lock(this->setMutex, utils::HistogramMetric::SET_LOCK_WAIT_NS);
+
+            auto it = std::find_if(this->scans.begin(), this->scans.end(), [label](const ScanRecord& scan) {
+                return scan.label == label;
+            });
+            if(it != this->scans.end())
+                this->scans.erase(it);
 
         }
 
         void StreamManager::removePointClouds(std::set<std::uint32_t> labels) {
 
+            utils::MetricsScope metricsScope(&this->metrics);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            cuda::StreamScope streamScope(&this->streamContext);
+#endif
+
             {
-                std::lock_guard<std::mutex> cloudGuard(this->cloudMutex);
+                auto cloudGuard = utils::Metrics::lock(this->cloudMutex, utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
 
                 // remove points with that label from the merged pointcloud
-                this->cloud->removePointsWithLabels(labels);
+                if(this->voxelMapEnabled) {
+                    utils::Metrics::add(utils::CounterMetric::POINTS_AGED, this->voxels.removeLabels(labels));
+                } else {
+                    this->cloud->removePointsWithLabels(labels);
+                    this->registrationSubmap.removeLabels(labels);
+                }
             }
 
 
             // lock the set
-            std::lock_guard<std::mutex> guard(this->setMutex);
-
-            // iterate the set
-            for(auto c : this->clouds) {
-                if(labels.find(c->getLabel()) != labels.end()) {
-                    // remove the pointcloud from the set
-                    this->clouds.erase(c);
-                    // free the pointcloud pointer
-                    c.reset();
-                }
+            auto guard = utils::Metrics::lock(this->setMutex, utils::HistogramMetric::SET_LOCK_WAIT_NS);
+
+            // a single compaction pass, keeping the arrival order
+            this->scans.erase(std::remove_if(this->scans.begin(), this->scans.end(), [&labels](const ScanRecord& scan) {
+                return labels.find(scan.label) != labels.end();
+            }), this->scans.end());
+
+        }
+
+
+        void StreamManager::scheduleAging(const ScanRecord& scan) {
+            {
+                auto setGuard = utils::Metrics::lock(this->setMutex, utils::HistogramMetric::SET_LOCK_WAIT_NS);
+                this->scans.push_back(scan);
             }
+            this->agingWheel->schedule(scan.timestamp + (unsigned long long) (this->maxAge * 1000), scan.label, this);
+        }
+
+        void StreamManager::expirePointClouds(const std::set<std::uint32_t>& labels) {
+
+            if(labels.empty())
+                return;
 
+            /*
+             * run the removal and the callback on the pool, so the wheel moves on to the next expirations
+             */
+            this->jobs->submit([this, labels] {
+                this->removePointClouds(labels);
+            });
+
+            // the point aging callback was set
+            if(this->pointAgingCallback != nullptr) {
+                this->jobs->submit([this, labels] {
+                    this->pointAgingCallback(labels);
+                });
+            }
         }
 
+        void StreamManager::onPointCloudsExpired(std::vector<utils::WheelTimer>& expired) {
+
+            utils::MetricsScope metricsScope(&this->metrics);
+
+            std::set<std::uint32_t> labels;
+            for(auto& timer : expired)
+                labels.insert(timer.label);
+
+            this->expirePointClouds(labels);
+
+            // only the aged labels are handed over, the consumer drops them on its side
+            if(this->deltaCallback != nullptr) {
+                this->jobs->submit([this, labels] {
+                    StreamDelta delta;
+                    delta.removedLabels = labels;
+                    this->deltaCallback(delta);
+                });
+            }
+        }
         void StreamManager::addCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr newCloud) {
             // check the incoming pointcloud for null or empty
             if(newCloud == nullptr)
@@ -174,125 +201,320 @@ namespace pcl_aggregator {
                 return;
             }
 
-            // create a stamped point newCloud object to keep this pointcloud
-            std::shared_ptr<entities::StampedPointCloud> spcl =
-                    std::make_shared<entities::StampedPointCloud>(this->topicName);
-            // the new pointcloud is moved to the StampedPointCloud
-            spcl->setPointCloud(std::move(newCloud));
-
-            if(!this->sensorTransformSet) {
-                // add the pointcloud to the queue
-                // the ownership is moved to the queue
-                this->cloudsNotTransformed.push(std::move(spcl));
+            std::shared_ptr<utils::BoundedQueue<IngestFrame>> queue = this->ingestQueue.load();
+            if(queue != nullptr) {
+                // return to the caller right away, the frame is merged on the pool
+                this->enqueueCloud(queue, std::move(newCloud));
                 return;
             }
 
-            // transform the incoming pointcloud and add directly to the set
+            this->processCloud(std::move(newCloud), utils::Utils::getCurrentTimeMillis(), true);
+        }
 
-            // start a thread to transform the pointcloud
-            auto transformRoutine = [this] (const std::shared_ptr<entities::StampedPointCloud>& spcl, const Eigen::Affine3d& tf) {
-                applyTransformRoutine(this, spcl, tf);
-            };
+        void StreamManager::enqueueCloud(const std::shared_ptr<utils::BoundedQueue<IngestFrame>>& queue,
+                                         pcl::PointCloud<pcl::PointXYZRGBL>::Ptr newCloud) {
 
-            // pointcloud is passed as a const reference: ownership is not moved and no copy is made
-            std::thread transformationThread(transformRoutine, std::ref(spcl), sensorTransform);
+            IngestFrame frame;
+            frame.cloud = std::move(newCloud);
+            frame.timestamp = utils::Utils::getCurrentTimeMillis();
 
-            // start a thread to clear the pointclouds older than max age
-            // std::thread cleaningThread(clearPointCloudsRoutine, this);
+            while(!queue->tryPush(frame)) {
 
-            // wait for both threads to synchronize
-            transformationThread.join();
-            // cleaningThread.join();
+                IngestOverflowPolicy policy = this->overflowPolicy;
 
-            // add the new pointcloud to the set
-            /*
-            int startingIndex = this->clouds.size();
-            this->clouds.insert(spcl);
-            int endingIndex = this->clouds.size();
+                if(policy == IngestOverflowPolicy::DROP_NEWEST) {
+                    this->droppedFrames++;
+                    this->framePool.release(frame.cloud);
+                    return;
+                }
+
+                if(policy == IngestOverflowPolicy::DROP_OLDEST) {
+                    IngestFrame oldest;
+                    if(queue->tryPop(oldest)) {
+                        this->droppedFrames++;
+                        this->framePool.release(oldest.cloud);
+                    }
+                } else {
+                    // sleep until the drain makes room
+                    std::unique_lock<std::mutex> lock(this->ingestSpaceMutex);
+                    this->blockedProducers++;
+                    // pairs with the fence of the drain: either it sees this producer or this producer sees its pop
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    this->ingestSpaceCondition.wait(lock, [&queue] {
+                        return queue->getSize() < queue->getCapacity();
+                    });
+                    this->blockedProducers--;
+                }
+            }
+
+            if(utils::Metrics::isEnabled())
+                this->metrics.record(utils::HistogramMetric::QUEUE_DEPTH, queue->getSize());
+
+            // a single drain per stream keeps the frames in order
+            if(!this->drainScheduled.exchange(true)) {
+                this->jobs->submit([this, queue] {
+                    this->drainIngestQueue(queue);
+                });
+            }
+        }
+
+        void StreamManager::drainIngestQueue(std::shared_ptr<utils::BoundedQueue<IngestFrame>> queue) {
+
+            while(true) {
+
+                // fixed size, so draining doesn't allocate
+                IngestFrame batch[STREAM_INGEST_MAX_BATCH];
+                std::size_t batchSize = 0;
+                while(batchSize < STREAM_INGEST_MAX_BATCH && queue->tryPop(batch[batchSize]))
+                    batchSize++;
 
-            // store the indices in the merged cloud
-            for(int i = startingIndex; i < endingIndex; i++) {
-                spcl->addMergedIndex(i);
-            }*/
+                // wake the producers blocked on a full queue up, only taking the lock when there are some
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(batchSize > 0 && this->blockedProducers > 0) {
+                    { std::lock_guard<std::mutex> lock(this->ingestSpaceMutex); }
+                    this->ingestSpaceCondition.notify_all();
+                }
+
+                if(batchSize == 0) {
+                    // the queue may have been replaced while draining
+                    std::shared_ptr<utils::BoundedQueue<IngestFrame>> current = this->ingestQueue.load();
+                    if(current != nullptr && current != queue) {
+                        queue = std::move(current);
+                        continue;
+                    }
+
+                    this->drainScheduled = false;
+                    // a frame pushed after the last pop may have seen the drain still scheduled
+                    if(queue->empty() || this->drainScheduled.exchange(true))
+                        return;
+                    continue;
+                }
+
+                // downsample and hand over once per batch
+                for(std::size_t i = 0; i < batchSize; i++) {
+                    this->processCloud(std::move(batch[i].cloud), batch[i].timestamp, i + 1 == batchSize);
+                }
+            }
+        }
+
+        void StreamManager::processCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr newCloud,
+                                         unsigned long long timestamp, bool publish) {
+
+            utils::MetricsScope metricsScope(&this->metrics);
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            cuda::StreamScope streamScope(&this->streamContext);
+#endif
+            utils::ScopedTimer ingestTimer(utils::HistogramMetric::INGEST_TIME_NS);
+            utils::Metrics::add(utils::CounterMetric::FRAMES_IN, 1);
+            utils::Metrics::add(utils::CounterMetric::POINTS_IN, newCloud->size());
+
+            // only the label and timestamp of the scan are kept, its points go straight to the merged pointcloud
+            ScanRecord scan = {timestamp, entities::StampedPointCloud::generateLabel(this->topicHash, timestamp)};
+
+            Eigen::Affine3d tf;
+            bool deskewing;
+            compute::DeskewParams deskewParams;
+            compute::PointFilter filter;
+            {
+                std::lock_guard<std::mutex> tfGuard(this->sensorTransformMutex);
+
+                if (!this->sensorTransformSet) {
+                    // the new pointcloud is moved to a StampedPointCloud, until there is a transform to apply
+                    std::shared_ptr<entities::StampedPointCloud> spcl =
+                            std::make_shared<entities::StampedPointCloud>(this->topicName);
+                    spcl->setTimestamp(timestamp);
+                    spcl->setPointCloud(std::move(newCloud));
+                    // add the pointcloud to the queue
+                    // the ownership is moved to the queue
+                    this->cloudsNotTransformed.push(std::move(spcl));
+                    return;
+                }
+
+                tf = this->sensorTransform;
+                deskewing = this->deskewEnabled;
+                deskewParams = this->deskewParams;
+                filter = this->pointFilter;
+            }
+            const compute::PointFilter *filterPtr = filter.isActive() ? &filter : nullptr;
+
+            this->scheduleAging(scan);
+
+            // the frame starts from the correction of the last registration
+            bool registering = this->registrationEnabled;
+            compute::RegistrationParams registrationParams;
+            Eigen::Affine3d correction = Eigen::Affine3d::Identity();
+            if(registering) {
+                std::lock_guard<std::mutex> registrationGuard(this->registrationMutex);
+                registrationParams = this->registrationParams;
+                correction = this->registrationCorrection;
+            }
+
+            // the motion of the robot over the scan replaces the rigid transform, when there are poses for it
+            compute::DeskewTable deskewTable;
+            if(deskewing) {
+                // the stamp of the pcl header is in microseconds. frames without one take their arrival time
+                std::uint64_t stamp = newCloud->header.stamp != 0 ? newCloud->header.stamp : timestamp * 1000;
+                deskewing = compute::Deskew::buildTable(this->poseBuffer, stamp, deskewParams, correction, tf,
+                                                        newCloud->width, newCloud->size(), deskewTable) == 0;
+            }
+            tf = correction * tf;
+
+            // filter, label and transform the new points in a single pass, rigidly or over the scan
+            auto ingestFrame = [&](const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& frame) {
+                compute::ComputeBackend& backend = compute::ComputeBackend::select(newCloud->size());
+                int result = deskewing ?
+                        backend.ingestPointCloud(frame, *newCloud, scan.label, deskewTable, filterPtr) :
+                        backend.ingestPointCloud(frame, *newCloud, scan.label, tf, filterPtr);
+                if(result < 0)
+                    std::cerr << "Could not ingest the pointcloud at the StreamManager!" << std::endl;
+            };
 
             try {
-                if(!spcl->getPointCloud()->empty()) {
+                if(this->voxelMapEnabled) {
 
-                    {
-                        std::lock_guard<std::mutex> cloudGuard(this->cloudMutex);
+                    pcl::PointCloud<pcl::PointXYZRGBL>::Ptr frame = this->framePool.acquire();
+                    ingestFrame(frame);
+                    this->framePool.release(newCloud);
 
-                        if (!this->cloud->getPointCloud()->empty()) {
+                    // align to the voxels around the frame before they are updated
+                    if(registering) {
+                        Eigen::AlignedBox3f box = compute::Registration::getSubmapBox(*frame,
+                                                                                     registrationParams.submapMargin);
+                        this->registerFrame(frame, this->voxels.getPointsInBox(box), registrationParams);
+                    }
 
-                            /*
-                            pcl::IterativeClosestPoint<pcl::PointXYZRGBL,pcl::PointXYZRGBL> icp;
+                    // only the voxels of the new frame are updated
+                    this->voxels.insertPointCloud(*frame);
+
+                    // the frame alone is handed over, the merged version is not needed downstream
+                    if(this->deltaCallback != nullptr) {
+                        std::lock_guard<std::mutex> deltaGuard(this->deltaMutex);
+                        this->deltaPoints.setPointCloud(frame, false);
+                        StreamDelta delta;
+                        delta.points = &this->deltaPoints;
+                        this->deltaCallback(delta);
+                        // let go of the frame, keeping the label index capacity for the next one
+                        this->deltaPoints.setPointCloud(this->deltaPlaceholder, false);
+                    }
+                    if(this->pointCloudReadyCallback != nullptr)
+                        this->pointCloudReadyCallback(frame);
 
-                            icp.setInputSource(spcl->getPointCloud());
-                            icp.setInputTarget(this->cloud->getPointCloud());
+                    this->framePool.release(frame);
 
-                            icp.setMaxCorrespondenceDistance(STREAM_ICP_MAX_CORRESPONDENCE_DISTANCE);
-                            icp.setMaximumIterations(STREAM_ICP_MAX_ITERATIONS);
+                    return;
+                }
 
-                            icp.align(*this->cloud->getPointCloud());
+                {
+                    auto cloudGuard = utils::Metrics::lock(this->cloudMutex,
+                                                           utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
 
-                            if (!icp.hasConverged()) {
-                                *this->cloud->getPointCloud() += *spcl->getPointCloud(); // if alignment was not possible, just add the pointclouds
-                            }
+                    /*
+                    pcl::IterativeClosestPoint<pcl::PointXYZRGBL,pcl::PointXYZRGBL> icp;
 
-                            */
+                    icp.setInputSource(newCloud);
+                    icp.setInputTarget(this->cloud->getPointCloud());
 
-                            if (cuda::pointclouds::concatenatePointCloudsCuda(this->cloud->getPointCloud(),
-                                                                              *(spcl->getPointCloud())) < 0) {
-                                std::cerr << "Could not concatenate the pointclouds at the StreamManager!" << std::endl;
-                            }
+                    icp.setMaxCorrespondenceDistance(STREAM_ICP_MAX_CORRESPONDENCE_DISTANCE);
+                    icp.setMaximumIterations(STREAM_ICP_MAX_ITERATIONS);
 
-                        } else {
-                            if (cuda::pointclouds::concatenatePointCloudsCuda(this->cloud->getPointCloud(),
-                                                                              *(spcl->getPointCloud())) < 0) {
-                                std::cerr << "Could not concatenate the pointclouds at the StreamManager!" << std::endl;
-                            }
-                        }
+                    icp.align(*this->cloud->getPointCloud());
 
-                        // downsample the new merged pointcloud
-                        this->cloud->downsample(STREAM_DOWNSAMPLING_LEAF_SIZE);
+                    if (!icp.hasConverged()) {
+                        *this->cloud->getPointCloud() += *newCloud; // if alignment was not possible, just add the pointclouds
                     }
 
-                    // the points are no longer needed
-                    spcl->getPointCloud()->clear();
+                    */
 
-                    if(this->pointCloudReadyCallback != nullptr) {
+                    if(registering || deskewing) {
 
-                        std::lock_guard<std::mutex> cloudGuard1(this->cloudMutex);
+                        // the frame is aligned or deskewed on its own before joining the batch
+                        pcl::PointCloud<pcl::PointXYZRGBL>::Ptr frame = this->framePool.acquire();
+                        ingestFrame(frame);
 
-                        /*
-                        // call the callback on a new thread
-                         // WARNING: calling this thread as-is causes a race condition because the pointcloud is changed
-                        std::thread pointCloudCallbackThread = std::thread(this->pointCloudReadyCallback,
-                                                                           std::ref(*this->cloud->getPointCloud()));
-                        pointCloudCallbackThread.detach();
-                         */
+                        // the batch is emptied on each publish, so the frames align to the ones kept for it
+                        if(registering) {
+                            Eigen::AlignedBox3f box = compute::Registration::getSubmapBox(*frame,
+                                                                                         registrationParams.submapMargin);
+                            this->registerFrame(frame, this->registrationSubmap.getPointsInBox(box), registrationParams);
+                            this->registrationSubmap.insertPointCloud(*frame);
+                        }
 
-                        this->pointCloudReadyCallback(std::ref(this->cloud->getPointCloud()));
+                        if (this->cloud->appendPointCloud(*frame) < 0) {
+                            std::cerr << "Could not ingest the pointcloud at the StreamManager!" << std::endl;
+                        }
+                        this->framePool.release(frame);
+
+                    // label, transform and append the new points in a single GPU pass
+                    } else if (this->cloud->ingestPointCloud(*newCloud, scan.label, tf, filterPtr) < 0) {
+                        std::cerr << "Could not ingest the pointcloud at the StreamManager!" << std::endl;
                     }
 
+                    // downsample the new merged pointcloud
+                    if(publish)
+                        this->cloud->downsample(STREAM_DOWNSAMPLING_LEAF_SIZE);
+                }
+
+                // the points are no longer needed, the buffer goes to the next frame
+                this->framePool.release(newCloud);
+
+                if(publish && (this->pointCloudReadyCallback != nullptr || this->deltaCallback != nullptr)) {
+
+                    auto cloudGuard1 = utils::Metrics::lock(this->cloudMutex,
+                                                            utils::HistogramMetric::CLOUD_LOCK_WAIT_NS);
+
                     /*
-                    // start the pointcloud recycling thread
-                    auto autoRemoveRoutine = [this] (
-                                                 const std::shared_ptr<entities::StampedPointCloud>& spcl) {
-                        pointCloudAutoRemoveRoutine(this, spcl);
-                    };
-                    std::thread spclRecyclingThread(autoRemoveRoutine, spcl);
-                    // detach from the thread, this execution flow doesn't really care about it
-                    spclRecyclingThread.detach(); */
+                    // call the callback on a new thread
+                     // WARNING: calling this thread as-is causes a race condition because the pointcloud is changed
+                    std::thread pointCloudCallbackThread = std::thread(this->pointCloudReadyCallback,
+                                                                       std::ref(*this->cloud->getPointCloud()));
+                    pointCloudCallbackThread.detach();
+                     */
+
+                    // a device-resident PointCloud is handed over as is, so it isn't downloaded
+                    if(this->deltaCallback != nullptr) {
+                        StreamDelta delta;
+                        delta.points = this->cloud.get();
+                        this->deltaCallback(delta);
+                    }
+                    if(this->pointCloudReadyCallback != nullptr)
+                        this->pointCloudReadyCallback(std::ref(this->cloud->getPointCloud()));
+
+                    // the points were handed over, the next batch only carries the new ones
+                    this->cloud->clear();
                 }
 
+                /*
+                // start the pointcloud recycling thread
+                auto autoRemoveRoutine = [this] (
+                                             const std::shared_ptr<entities::StampedPointCloud>& spcl) {
+                    pointCloudAutoRemoveRoutine(this, spcl);
+                };
+                std::thread spclRecyclingThread(autoRemoveRoutine, spcl);
+                // detach from the thread, this execution flow doesn't really care about it
+                spclRecyclingThread.detach(); */
+
             } catch (std::exception &e) {
                 std::cerr << "Error performing sensor-wise ICP: " << e.what() << std::endl;
             }
 
         }
 
+        pcl::PointCloud<pcl::PointXYZRGBL>::Ptr StreamManager::acquireFrame() {
+            return this->framePool.acquire();
+        }
+
         const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& StreamManager::getCloud() {
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            cuda::StreamScope streamScope(&this->streamContext);
+#endif
             std::lock_guard<std::mutex> lock(this->cloudMutex);
+
+            if(this->voxelMapEnabled) {
+                // flatten the voxel map into the StampedPointCloud, which keeps the returned pointer alive
+                this->cloud->setPointCloud(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr(
+                        new pcl::PointCloud<pcl::PointXYZRGBL>(this->voxels.getPointCloudCopy())), false);
+            }
+
             return this->cloud->getPointCloud();
         }
 
@@ -303,9 +525,150 @@ namespace pcl_aggregator {
             // set the new transform
             this->sensorTransform = transform;
             this->sensorTransformSet = true;
+
+            // the boxes of the filter are on the base frame, so they move on the sensor frame
+            compute::PointFilter::build(this->filterParams, this->sensorTransform, this->pointFilter);
+
             this->computeTransform();
         }
 
+        bool StreamManager::getSensorTransform(Eigen::Affine3d& transform) {
+
+            std::lock_guard<std::mutex> lock(this->sensorTransformMutex);
+
+            if(this->sensorTransformSet)
+                transform = this->sensorTransform;
+            return this->sensorTransformSet;
+        }
+
+        void StreamManager::addPose(const Eigen::Affine3d& pose, std::uint64_t timestamp) {
+            this->poseBuffer.addPose(timestamp, pose);
+        }
+
+        void StreamManager::setDeskewEnabled(bool enabled, const compute::DeskewParams& params) {
+
+            std::lock_guard<std::mutex> lock(this->sensorTransformMutex);
+
+            this->deskewParams = params;
+            this->deskewEnabled = enabled;
+        }
+
+        int StreamManager::setPointFilter(const compute::PointFilterParams& params) {
+
+            std::lock_guard<std::mutex> lock(this->sensorTransformMutex);
+
+            // validated now even without a sensor transform, which only moves the boxes
+            compute::PointFilter filter;
+            if(compute::PointFilter::build(params, this->sensorTransformSet ? this->sensorTransform :
+                                                   Eigen::Affine3d::Identity(), filter) < 0) {
+                std::cerr << "Invalid point filter settings for the stream " << this->topicName << "!" << std::endl;
+                return -1;
+            }
+
+            this->filterParams = params;
+            this->pointFilter = filter;
+
+            return 0;
+        }
+
+        void StreamManager::setDeviceResident(bool resident) {
+
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            // the device copy goes to the device of the stream
+            cuda::StreamScope streamScope(&this->streamContext);
+#endif
+            std::lock_guard<std::mutex> lock(this->cloudMutex);
+
+            this->cloud->setDeviceResident(resident);
+        }
+
+        void StreamManager::setVoxelMapEnabled(bool enabled) {
+
+            std::lock_guard<std::mutex> lock(this->cloudMutex);
+
+            if(enabled == this->voxelMapEnabled)
+                return;
+
+            // carry the current points over to the new storage
+            if(enabled) {
+                this->voxels.insertPointCloud(this->cloud->getPointCloudCopy());
+                this->cloud->getPointCloud()->clear();
+                // the voxel map is the registration target now
+                this->registrationSubmap.clear();
+            } else {
+                *this->cloud->getPointCloud() = this->voxels.getPointCloudCopy();
+                this->voxels.clear();
+            }
+
+            this->voxelMapEnabled = enabled;
+        }
+
+        void StreamManager::registerFrame(const pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& frame,
+                                          const pcl::PointCloud<pcl::PointXYZRGBL>& target,
+                                          const compute::RegistrationParams& params) {
+
+            // the first frames have nothing to align to
+            if(frame->empty() || target.size() < REGISTRATION_MIN_CORRESPONDENCES)
+                return;
+
+            // the current correction was applied on ingest, so this one starts from identity
+            compute::RegistrationResult result;
+            if(compute::ComputeBackend::select(frame->size() + target.size()).alignPointCloud(*frame, target, params,
+                                                                                               result) < 0) {
+                std::cerr << "Could not register the pointcloud at the StreamManager!" << std::endl;
+                return;
+            }
+
+            // too little overlap, the frame keeps the previous correction
+            if(result.correspondences < REGISTRATION_MIN_CORRESPONDENCES)
+                return;
+
+            compute::ComputeBackend::select(frame->size()).transformPointCloud(frame, result.transform);
+
+            std::lock_guard<std::mutex> lock(this->registrationMutex);
+            this->registrationCorrection = result.transform * this->registrationCorrection;
+        }
+
+        void StreamManager::setRegistrationEnabled(bool enabled, const compute::RegistrationParams& params) {
+
+            std::lock_guard<std::mutex> cloudLock(this->cloudMutex);
+            std::lock_guard<std::mutex> lock(this->registrationMutex);
+
+            this->registrationParams = params;
+            if(!enabled) {
+                this->registrationCorrection = Eigen::Affine3d::Identity();
+                this->registrationSubmap.clear();
+            }
+            this->registrationEnabled = enabled;
+        }
+
+        compute::RegistrationParams StreamManager::getDefaultRegistrationParams() {
+            compute::RegistrationParams params;
+            params.maxCorrespondenceDistance = STREAM_ICP_MAX_CORRESPONDENCE_DISTANCE;
+            params.maxIterations = STREAM_ICP_MAX_ITERATIONS;
+            return params;
+        }
+
+        void StreamManager::setAsyncIngest(bool enabled, std::size_t capacity, IngestOverflowPolicy policy) {
+
+            this->overflowPolicy = policy;
+
+            std::shared_ptr<utils::BoundedQueue<IngestFrame>> queue = nullptr;
+            if(enabled)
+                queue = std::make_shared<utils::BoundedQueue<IngestFrame>>(capacity);
+
+            // a drain already scheduled keeps its own queue alive and empties it
+            this->ingestQueue.store(std::move(queue));
+        }
+
+        std::size_t StreamManager::getDroppedFrames() const {
+            return this->droppedFrames;
+        }
+
+        utils::MetricsRegistry& StreamManager::getMetrics() {
+            return this->metrics;
+        }
+
         double StreamManager::getMaxAge() const {
             return this->maxAge;
         }
@@ -335,6 +698,23 @@ namespace pcl_aggregator {
             spcl->applyIcpTransform(tf);
         }
 
+        std::size_t StreamManager::getMemoryUsage() {
+
+            std::size_t bytes = this->cloud->getMemoryUsage();
+            if(this->voxelMapEnabled)
+                bytes += this->voxels.getMemoryUsage();
+            else
+                bytes += this->registrationSubmap.getMemoryUsage();
+
+            // the recycled frames keep their buffers
+            bytes += this->framePool.getMemoryUsage();
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            bytes += this->streamContext.getStagingBytes();
+#endif
+
+            return bytes;
+        }
+
         std::function<void(std::set<std::uint32_t> labels)> StreamManager::getPointAgingCallback() const {
             return this->pointAgingCallback;
         }
@@ -353,6 +733,18 @@ namespace pcl_aggregator {
             this->pointCloudReadyCallback = func;
         }
 
+        void StreamManager::setDeltaCallback(const std::function<void(const StreamDelta &)> &func) {
+            this->deltaCallback = func;
+        }
+
+        int StreamManager::getDevice() const {
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            return this->streamContext.getDevice();
+#else
+            return 0;
+#endif
+        }
+
 
     } // pcl_aggregator
 } // managers
@@ -0,0 +1,345 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/utils/CloudSerializer.h>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <unordered_map>
+#ifdef PCL_AGGREGATOR_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+// bytes of the message header
+#define CLOUD_SERIALIZER_HEADER_SIZE 32
+// quantization steps per block axis
+#define CLOUD_SERIALIZER_BLOCK_STEPS 65536.0
+#define CLOUD_SERIALIZER_FLAG_DELTA 1
+#define CLOUD_SERIALIZER_FLAG_ZSTD 2
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        // the wire is little-endian whatever the host is
+        static void putBytes(std::vector<std::uint8_t>& out, std::uint64_t value, int bytes) {
+            for(int i = 0; i < bytes; i++)
+                out.push_back((std::uint8_t) (value >> (8 * i)));
+        }
+
+        static void putFloat(std::vector<std::uint8_t>& out, float value) {
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            putBytes(out, bits, 4);
+        }
+
+        /*! \brief Bounds-checked cursor over a message. Stays failed after the first overrun. */
+        struct ByteReader {
+            const std::uint8_t* data;
+            std::size_t size;
+            std::size_t offset = 0;
+            bool failed = false;
+
+            std::uint64_t get(int bytes) {
+                if(this->failed || this->size - this->offset < (std::size_t) bytes) {
+                    this->failed = true;
+                    return 0;
+                }
+                std::uint64_t value = 0;
+                for(int i = 0; i < bytes; i++)
+                    value |= (std::uint64_t) this->data[this->offset + i] << (8 * i);
+                this->offset += bytes;
+                return value;
+            }
+
+            float getFloat() {
+                auto bits = (std::uint32_t) this->get(4);
+                float value;
+                std::memcpy(&value, &bits, sizeof(value));
+                return value;
+            }
+
+            // a count is only believed if that many items of the given size are left
+            std::uint32_t getCount(std::size_t itemSize) {
+                auto count = (std::uint32_t) this->get(4);
+                if(!this->failed && (this->size - this->offset) / itemSize < count)
+                    this->failed = true;
+                return this->failed ? 0 : count;
+            }
+        };
+
+        static int getLabelIndexBytes(std::size_t nLabels) {
+            if(nLabels <= 256)
+                return 1;
+            if(nLabels <= 65536)
+                return 2;
+            return 4;
+        }
+
+        int CloudSerializer::encode(const CloudMessageHeader& header, const pcl::PointCloud<pcl::PointXYZRGBL>& points,
+                                    const std::set<std::uint32_t>& removedLabels, const CloudEncoding& encoding,
+                                    std::vector<std::uint8_t>& out) {
+
+            if(!(encoding.precision > 0) || !std::isfinite(encoding.precision)) {
+                std::cerr << "CloudSerializer::encode: the precision must be positive!" << std::endl;
+                return -1;
+            }
+            if(!isCompressionAvailable(encoding.compression)) {
+                std::cerr << "CloudSerializer::encode: the compression was not built in!" << std::endl;
+                return -2;
+            }
+
+            const double precision = encoding.precision;
+            const double blockSide = precision * CLOUD_SERIALIZER_BLOCK_STEPS;
+
+            // block of each finite point, sorted so each block is one run
+            std::vector<std::array<std::int32_t,3>> blocks;
+            std::vector<std::uint32_t> order;
+            blocks.resize(points.size());
+            order.reserve(points.size());
+            for(std::size_t i = 0; i < points.size(); i++) {
+                const auto& p = points.points[i];
+                if(!std::isfinite(p.x) || !std::isfinite(p.y) || !std::isfinite(p.z))
+                    continue;
+                const float coordinates[3] = {p.x, p.y, p.z};
+                for(int a = 0; a < 3; a++) {
+                    double block = std::floor(coordinates[a] / blockSide);
+                    block = std::max<double>(std::numeric_limits<std::int32_t>::min(),
+                                             std::min<double>(std::numeric_limits<std::int32_t>::max(), block));
+                    blocks[i][a] = (std::int32_t) block;
+                }
+                order.push_back((std::uint32_t) i);
+            }
+            std::sort(order.begin(), order.end(), [&blocks](std::uint32_t a, std::uint32_t b) {
+                return blocks[a] < blocks[b];
+            });
+
+            // the dictionary, sorted, so nearby labels compress well
+            std::vector<std::uint32_t> labels;
+            labels.reserve(order.size());
+            for(std::uint32_t i : order)
+                labels.push_back(points.points[i].label);
+            std::sort(labels.begin(), labels.end());
+            labels.erase(std::unique(labels.begin(), labels.end()), labels.end());
+            std::unordered_map<std::uint32_t,std::uint32_t> labelIndex;
+            labelIndex.reserve(labels.size());
+            for(std::size_t i = 0; i < labels.size(); i++)
+                labelIndex[labels[i]] = (std::uint32_t) i;
+            const int labelBytes = getLabelIndexBytes(labels.size());
+
+            std::vector<std::uint8_t> payload;
+            payload.reserve(16 + 4 * (labels.size() + removedLabels.size()) + order.size() * (9 + labelBytes));
+
+            putFloat(payload, encoding.precision);
+            putBytes(payload, labels.size(), 4);
+            for(std::uint32_t label : labels)
+                putBytes(payload, label, 4);
+            putBytes(payload, removedLabels.size(), 4);
+            for(std::uint32_t label : removedLabels)
+                putBytes(payload, label, 4);
+
+            std::size_t blockCountOffset = payload.size();
+            putBytes(payload, 0, 4);
+            std::uint32_t nBlocks = 0;
+
+            for(std::size_t begin = 0; begin < order.size(); ) {
+                const auto& block = blocks[order[begin]];
+                std::size_t end = begin;
+                while(end < order.size() && blocks[order[end]] == block)
+                    end++;
+
+                for(int a = 0; a < 3; a++)
+                    putBytes(payload, (std::uint32_t) block[a], 4);
+                putBytes(payload, end - begin, 4);
+
+                for(std::size_t k = begin; k < end; k++) {
+                    const auto& p = points.points[order[k]];
+                    const float coordinates[3] = {p.x, p.y, p.z};
+                    for(int a = 0; a < 3; a++) {
+                        double step = std::floor((coordinates[a] - block[a] * blockSide) / precision);
+                        putBytes(payload, (std::uint16_t) std::max(0.0, std::min(CLOUD_SERIALIZER_BLOCK_STEPS - 1, step)), 2);
+                    }
+                    payload.push_back(p.r);
+                    payload.push_back(p.g);
+                    payload.push_back(p.b);
+                    putBytes(payload, labelIndex[p.label], labelBytes);
+                }
+
+                nBlocks++;
+                begin = end;
+            }
+
+            for(int i = 0; i < 4; i++)
+                payload[blockCountOffset + i] = (std::uint8_t) (nBlocks >> (8 * i));
+
+            if(payload.size() > std::numeric_limits<std::uint32_t>::max()) {
+                std::cerr << "CloudSerializer::encode: the message is too large!" << std::endl;
+                return -1;
+            }
+
+            std::uint8_t flags = header.delta ? CLOUD_SERIALIZER_FLAG_DELTA : 0;
+            if(encoding.compression == CloudCompression::ZSTD)
+                flags |= CLOUD_SERIALIZER_FLAG_ZSTD;
+
+            out.clear();
+            putBytes(out, CLOUD_SERIALIZER_MAGIC, 4);
+            out.push_back(CLOUD_SERIALIZER_FORMAT_VERSION);
+            out.push_back(flags);
+            putBytes(out, 0, 2);
+            putBytes(out, header.version, 8);
+            putBytes(out, header.delta ? header.baseVersion : 0, 8);
+            putBytes(out, payload.size(), 4);
+
+            if(encoding.compression == CloudCompression::NONE) {
+                putBytes(out, payload.size(), 4);
+                out.insert(out.end(), payload.begin(), payload.end());
+                return 0;
+            }
+
+#ifdef PCL_AGGREGATOR_WITH_ZSTD
+            std::size_t bound = ZSTD_compressBound(payload.size());
+            putBytes(out, 0, 4);
+            out.resize(CLOUD_SERIALIZER_HEADER_SIZE + bound);
+            std::size_t compressed = ZSTD_compress(out.data() + CLOUD_SERIALIZER_HEADER_SIZE, bound,
+                                                   payload.data(), payload.size(), encoding.compressionLevel);
+            if(ZSTD_isError(compressed)) {
+                std::cerr << "CloudSerializer::encode: " << ZSTD_getErrorName(compressed) << std::endl;
+                out.clear();
+                return -3;
+            }
+            out.resize(CLOUD_SERIALIZER_HEADER_SIZE + compressed);
+            for(int i = 0; i < 4; i++)
+                out[CLOUD_SERIALIZER_HEADER_SIZE - 4 + i] = (std::uint8_t) (compressed >> (8 * i));
+#endif
+
+            return 0;
+        }
+
+        int CloudSerializer::decode(const std::uint8_t* data, std::size_t size, CloudMessage& message) {
+
+            ByteReader header{data, size};
+            auto magic = (std::uint32_t) header.get(4);
+            auto formatVersion = (std::uint8_t) header.get(1);
+            auto flags = (std::uint8_t) header.get(1);
+            header.get(2);
+            std::uint64_t version = header.get(8);
+            std::uint64_t baseVersion = header.get(8);
+            auto rawSize = (std::uint32_t) header.get(4);
+            auto payloadSize = (std::uint32_t) header.get(4);
+
+            if(header.failed || magic != CLOUD_SERIALIZER_MAGIC) {
+                std::cerr << "CloudSerializer::decode: not a PointCloud message!" << std::endl;
+                return -1;
+            }
+            if(formatVersion != CLOUD_SERIALIZER_FORMAT_VERSION) {
+                std::cerr << "CloudSerializer::decode: unsupported format version " << (int) formatVersion << "!" << std::endl;
+                return -2;
+            }
+            if(size - CLOUD_SERIALIZER_HEADER_SIZE < payloadSize) {
+                std::cerr << "CloudSerializer::decode: the message is truncated!" << std::endl;
+                return -1;
+            }
+
+            const std::uint8_t* payload = data + CLOUD_SERIALIZER_HEADER_SIZE;
+            std::vector<std::uint8_t> decompressed;
+
+            if(flags & CLOUD_SERIALIZER_FLAG_ZSTD) {
+#ifdef PCL_AGGREGATOR_WITH_ZSTD
+                decompressed.resize(rawSize);
+                std::size_t result = ZSTD_decompress(decompressed.data(), rawSize, payload, payloadSize);
+                if(ZSTD_isError(result) || result != rawSize) {
+                    std::cerr << "CloudSerializer::decode: could not decompress the message!" << std::endl;
+                    return -3;
+                }
+                payload = decompressed.data();
+                payloadSize = rawSize;
+#else
+                std::cerr << "CloudSerializer::decode: zstd was not built in!" << std::endl;
+                return -2;
+#endif
+            } else if(rawSize != payloadSize) {
+                std::cerr << "CloudSerializer::decode: the message is malformed!" << std::endl;
+                return -1;
+            }
+
+            ByteReader reader{payload, payloadSize};
+
+            message.header.version = version;
+            message.header.baseVersion = baseVersion;
+            message.header.delta = (flags & CLOUD_SERIALIZER_FLAG_DELTA) != 0;
+            message.points.clear();
+            message.removedLabels.clear();
+
+            const double precision = reader.getFloat();
+            const double blockSide = precision * CLOUD_SERIALIZER_BLOCK_STEPS;
+
+            std::vector<std::uint32_t> labels(reader.getCount(4));
+            for(auto& label : labels)
+                label = (std::uint32_t) reader.get(4);
+            const int labelBytes = getLabelIndexBytes(labels.size());
+
+            std::uint32_t nRemoved = reader.getCount(4);
+            for(std::uint32_t i = 0; i < nRemoved; i++)
+                message.removedLabels.insert((std::uint32_t) reader.get(4));
+
+            std::uint32_t nBlocks = reader.getCount(16);
+            for(std::uint32_t b = 0; b < nBlocks && !reader.failed; b++) {
+                double origin[3];
+                for(auto& o : origin)
+                    o = (std::int32_t) (std::uint32_t) reader.get(4) * blockSide;
+
+                std::uint32_t nPoints = reader.getCount(9 + labelBytes);
+                message.points.points.reserve(message.points.points.size() + nPoints);
+                for(std::uint32_t k = 0; k < nPoints; k++) {
+                    pcl::PointXYZRGBL p;
+                    // the center of the quantization step
+                    p.x = (float) (origin[0] + (reader.get(2) + 0.5) * precision);
+                    p.y = (float) (origin[1] + (reader.get(2) + 0.5) * precision);
+                    p.z = (float) (origin[2] + (reader.get(2) + 0.5) * precision);
+                    p.r = (std::uint8_t) reader.get(1);
+                    p.g = (std::uint8_t) reader.get(1);
+                    p.b = (std::uint8_t) reader.get(1);
+                    p.a = 255;
+                    std::uint64_t index = reader.get(labelBytes);
+                    if(index >= labels.size()) {
+                        reader.failed = true;
+                        break;
+                    }
+                    p.label = labels[index];
+                    message.points.points.push_back(p);
+                }
+            }
+
+            if(reader.failed) {
+                std::cerr << "CloudSerializer::decode: the message is malformed!" << std::endl;
+                message.points.clear();
+                message.removedLabels.clear();
+                return -1;
+            }
+
+            message.points.width = message.points.points.size();
+            message.points.height = 1;
+
+            return 0;
+        }
+
+        bool CloudSerializer::isCompressionAvailable(CloudCompression compression) {
+            switch(compression) {
+                case CloudCompression::NONE:
+                    return true;
+                case CloudCompression::ZSTD:
+#ifdef PCL_AGGREGATOR_WITH_ZSTD
+                    return true;
+#else
+                    return false;
+#endif
+                default:
+                    return false;
+            }
+        }
+
+    } // pcl_aggregator
+} // utils
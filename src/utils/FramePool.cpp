@@ -0,0 +1,69 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/utils/FramePool.h>
+#include <pcl_aggregator_core/utils/Metrics.h>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        FramePool::FramePool(std::size_t capacity) {
+            this->capacity = capacity;
+            // releasing never allocates
+            this->frames.reserve(capacity);
+        }
+
+        pcl::PointCloud<pcl::PointXYZRGBL>::Ptr FramePool::acquire() {
+
+            {
+                std::lock_guard<std::mutex> lock(this->framesMutex);
+
+                if(!this->frames.empty()) {
+                    pcl::PointCloud<pcl::PointXYZRGBL>::Ptr frame = std::move(this->frames.back());
+                    this->frames.pop_back();
+                    return frame;
+                }
+            }
+
+            Metrics::add(CounterMetric::FRAME_POOL_MISSES, 1);
+
+            return pcl::PointCloud<pcl::PointXYZRGBL>::Ptr(new pcl::PointCloud<pcl::PointXYZRGBL>());
+        }
+
+        void FramePool::release(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr& frame) {
+
+            // a consumer still holds it
+            if(frame == nullptr || frame.use_count() != 1) {
+                frame.reset();
+                return;
+            }
+
+            // the capacity of the points vector is kept
+            frame->clear();
+            frame->header = pcl::PCLHeader();
+            frame->is_dense = true;
+
+            std::lock_guard<std::mutex> lock(this->framesMutex);
+
+            if(this->frames.size() < this->capacity)
+                this->frames.push_back(std::move(frame));
+            frame.reset();
+        }
+
+        std::size_t FramePool::size() {
+            std::lock_guard<std::mutex> lock(this->framesMutex);
+            return this->frames.size();
+        }
+
+        std::size_t FramePool::getMemoryUsage() {
+            std::lock_guard<std::mutex> lock(this->framesMutex);
+
+            std::size_t bytes = 0;
+            for(const auto& frame : this->frames)
+                bytes += frame->points.capacity() * sizeof(pcl::PointXYZRGBL);
+            return bytes;
+        }
+
+    } // pcl_aggregator
+} // utils
@@ -0,0 +1,80 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/utils/LabelSet.h>
+
+// smallest slot count. must be a power of two
+#define LABEL_SET_MIN_SLOTS 16
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        LabelSet::LabelSet() {
+            this->slots.assign(LABEL_SET_MIN_SLOTS, LABEL_SET_EMPTY_SLOT);
+        }
+
+        LabelSet::LabelSet(const std::set<std::uint32_t>& labels) {
+
+            // keep the load factor under 1/2
+            std::size_t slotCount = LABEL_SET_MIN_SLOTS;
+            while(slotCount < labels.size() * 2)
+                slotCount *= 2;
+            this->slots.assign(slotCount, LABEL_SET_EMPTY_SLOT);
+
+            for(const auto& label : labels)
+                this->insert(label);
+        }
+
+        void LabelSet::rehash(std::size_t newSlotCount) {
+
+            std::vector<std::uint32_t> oldSlots = std::move(this->slots);
+            this->slots.assign(newSlotCount, LABEL_SET_EMPTY_SLOT);
+
+            std::size_t mask = newSlotCount - 1;
+            for(const auto& label : oldSlots) {
+                if(label == LABEL_SET_EMPTY_SLOT)
+                    continue;
+
+                std::size_t i = mix(label) & mask;
+                while(this->slots[i] != LABEL_SET_EMPTY_SLOT)
+                    i = (i + 1) & mask;
+                this->slots[i] = label;
+            }
+        }
+
+        void LabelSet::insert(std::uint32_t label) {
+
+            if(label == LABEL_SET_EMPTY_SLOT) {
+                if(!this->hasEmptyLabel) {
+                    this->hasEmptyLabel = true;
+                    this->count++;
+                }
+                return;
+            }
+
+            if((this->count + 1) * 2 > this->slots.size())
+                this->rehash(this->slots.size() * 2);
+
+            std::size_t mask = this->slots.size() - 1;
+            std::size_t i = mix(label) & mask;
+            while(this->slots[i] != LABEL_SET_EMPTY_SLOT) {
+                if(this->slots[i] == label)
+                    return;
+                i = (i + 1) & mask;
+            }
+
+            this->slots[i] = label;
+            this->count++;
+        }
+
+        std::size_t LabelSet::size() const {
+            return this->count;
+        }
+
+        bool LabelSet::empty() const {
+            return this->count == 0;
+        }
+
+    } // pcl_aggregator
+} // utils
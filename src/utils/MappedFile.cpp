@@ -0,0 +1,126 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/utils/MappedFile.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        MappedFile::~MappedFile() {
+            this->close();
+        }
+
+        int MappedFile::openRead(const std::string& path) {
+
+            this->close();
+
+            this->fd = ::open(path.c_str(), O_RDONLY);
+            if(this->fd < 0) {
+                std::cerr << "MappedFile::openRead: could not open " << path << ": " << std::strerror(errno) << std::endl;
+                return -1;
+            }
+
+            struct stat info{};
+            if(fstat(this->fd, &info) < 0 || info.st_size <= 0) {
+                std::cerr << "MappedFile::openRead: " << path << " is empty or unreadable!" << std::endl;
+                this->close();
+                return -2;
+            }
+
+            void* mapping = mmap(nullptr, (std::size_t) info.st_size, PROT_READ, MAP_PRIVATE, this->fd, 0);
+            if(mapping == MAP_FAILED) {
+                std::cerr << "MappedFile::openRead: could not map " << path << ": " << std::strerror(errno) << std::endl;
+                this->close();
+                return -2;
+            }
+
+            this->address = static_cast<std::uint8_t*>(mapping);
+            this->length = (std::size_t) info.st_size;
+            this->writable = false;
+
+            return 0;
+        }
+
+        int MappedFile::create(const std::string& path, std::size_t size) {
+
+            this->close();
+
+            if(size == 0) {
+                std::cerr << "MappedFile::create: can't map an empty file!" << std::endl;
+                return -2;
+            }
+
+            this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if(this->fd < 0) {
+                std::cerr << "MappedFile::create: could not create " << path << ": " << std::strerror(errno) << std::endl;
+                return -1;
+            }
+
+            if(ftruncate(this->fd, (off_t) size) < 0) {
+                std::cerr << "MappedFile::create: could not size " << path << ": " << std::strerror(errno) << std::endl;
+                this->close();
+                return -1;
+            }
+
+            void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+            if(mapping == MAP_FAILED) {
+                std::cerr << "MappedFile::create: could not map " << path << ": " << std::strerror(errno) << std::endl;
+                this->close();
+                return -2;
+            }
+
+            this->address = static_cast<std::uint8_t*>(mapping);
+            this->length = size;
+            this->writable = true;
+
+            return 0;
+        }
+
+        int MappedFile::sync() {
+
+            if(this->address == nullptr || !this->writable)
+                return -1;
+
+            if(msync(this->address, this->length, MS_SYNC) < 0 || fsync(this->fd) < 0) {
+                std::cerr << "MappedFile::sync: " << std::strerror(errno) << std::endl;
+                return -1;
+            }
+
+            return 0;
+        }
+
+        void MappedFile::close() {
+
+            if(this->address != nullptr)
+                munmap(this->address, this->length);
+            if(this->fd >= 0)
+                ::close(this->fd);
+
+            this->address = nullptr;
+            this->length = 0;
+            this->fd = -1;
+            this->writable = false;
+        }
+
+        std::uint8_t* MappedFile::data() {
+            return this->address;
+        }
+
+        const std::uint8_t* MappedFile::data() const {
+            return this->address;
+        }
+
+        std::size_t MappedFile::size() const {
+            return this->length;
+        }
+
+    } // pcl_aggregator
+} // utils
@@ -0,0 +1,149 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/utils/Metrics.h>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        std::atomic<bool> Metrics::enabled{false};
+
+        // the registry each thread records to
+        static thread_local MetricsRegistry* currentRegistry = nullptr;
+
+        double HistogramSnapshot::getMean() const {
+            if(this->count == 0)
+                return 0.0;
+            return (double) this->sum / (double) this->count;
+        }
+
+        std::uint64_t HistogramSnapshot::getQuantile(double q) const {
+
+            if(this->count == 0)
+                return 0;
+
+            auto target = (std::uint64_t) (q * (double) this->count);
+            std::uint64_t seen = 0;
+            for(std::size_t i = 0; i < this->buckets.size(); i++) {
+                seen += this->buckets[i];
+                if(seen > target) {
+                    // the upper bound of the bucket, but never more than what was seen
+                    std::uint64_t upper = i == 0 ? 0 : (i >= 64 ? UINT64_MAX : (1ULL << i) - 1);
+                    return upper < this->max ? upper : this->max;
+                }
+            }
+
+            return this->max;
+        }
+
+        void Histogram::record(std::uint64_t value) {
+
+            std::size_t bucket = 0;
+            for(std::uint64_t v = value; v != 0; v >>= 1)
+                bucket++;
+
+            this->buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+            this->count.fetch_add(1, std::memory_order_relaxed);
+            this->sum.fetch_add(value, std::memory_order_relaxed);
+
+            std::uint64_t currentMax = this->max.load(std::memory_order_relaxed);
+            while(value > currentMax &&
+                  !this->max.compare_exchange_weak(currentMax, value, std::memory_order_relaxed));
+        }
+
+        HistogramSnapshot Histogram::getSnapshot() const {
+
+            HistogramSnapshot snapshot;
+            snapshot.buckets.reserve(this->buckets.size());
+            for(const auto& bucket : this->buckets)
+                snapshot.buckets.push_back(bucket.load(std::memory_order_relaxed));
+            snapshot.count = this->count.load(std::memory_order_relaxed);
+            snapshot.sum = this->sum.load(std::memory_order_relaxed);
+            snapshot.max = this->max.load(std::memory_order_relaxed);
+
+            return snapshot;
+        }
+
+        void Histogram::reset() {
+
+            for(auto& bucket : this->buckets)
+                bucket.store(0, std::memory_order_relaxed);
+            this->count.store(0, std::memory_order_relaxed);
+            this->sum.store(0, std::memory_order_relaxed);
+            this->max.store(0, std::memory_order_relaxed);
+        }
+
+        MetricsSnapshot MetricsRegistry::getSnapshot() const {
+
+            MetricsSnapshot snapshot;
+
+            for(std::size_t i = 0; i < this->counters.size(); i++) {
+                snapshot.counters[getName(static_cast<CounterMetric>(i))] =
+                        this->counters[i].load(std::memory_order_relaxed);
+            }
+
+            for(std::size_t i = 0; i < this->histograms.size(); i++) {
+                snapshot.histograms[getName(static_cast<HistogramMetric>(i))] = this->histograms[i].getSnapshot();
+            }
+
+            return snapshot;
+        }
+
+        void MetricsRegistry::reset() {
+
+            for(auto& counter : this->counters)
+                counter.store(0, std::memory_order_relaxed);
+            for(auto& histogram : this->histograms)
+                histogram.reset();
+        }
+
+        const char* MetricsRegistry::getName(CounterMetric metric) {
+            switch(metric) {
+                case CounterMetric::H2D_BYTES: return "h2d_bytes";
+                case CounterMetric::D2H_BYTES: return "d2h_bytes";
+                case CounterMetric::PEER_BYTES: return "peer_bytes";
+                case CounterMetric::FRAMES_IN: return "frames_in";
+                case CounterMetric::POINTS_IN: return "points_in";
+                case CounterMetric::DOWNSAMPLE_POINTS_IN: return "downsample_points_in";
+                case CounterMetric::DOWNSAMPLE_POINTS_OUT: return "downsample_points_out";
+                case CounterMetric::POINTS_AGED: return "points_aged";
+                case CounterMetric::POINTS_EVICTED: return "points_evicted";
+                case CounterMetric::EXPORTED_BYTES: return "exported_bytes";
+                case CounterMetric::FRAME_POOL_MISSES: return "frame_pool_misses";
+                case CounterMetric::POINTS_FILTERED: return "points_filtered";
+                default: return "unknown";
+            }
+        }
+
+        const char* MetricsRegistry::getName(HistogramMetric metric) {
+            switch(metric) {
+                case HistogramMetric::KERNEL_TIME_NS: return "kernel_time_ns";
+                case HistogramMetric::VOXELIZE_TIME_NS: return "voxelize_time_ns";
+                case HistogramMetric::INGEST_TIME_NS: return "ingest_time_ns";
+                case HistogramMetric::CLOUD_LOCK_WAIT_NS: return "cloud_lock_wait_ns";
+                case HistogramMetric::SET_LOCK_WAIT_NS: return "set_lock_wait_ns";
+                case HistogramMetric::MANAGERS_LOCK_WAIT_NS: return "managers_lock_wait_ns";
+                case HistogramMetric::QUEUE_DEPTH: return "queue_depth";
+                case HistogramMetric::MERGE_BATCH_SIZE: return "merge_batch_size";
+                case HistogramMetric::REGISTRATION_TIME_NS: return "registration_time_ns";
+                default: return "unknown";
+            }
+        }
+
+        void Metrics::setEnabled(bool enable) {
+            enabled.store(enable, std::memory_order_relaxed);
+        }
+
+        MetricsRegistry* Metrics::getCurrent() {
+            return currentRegistry;
+        }
+
+        MetricsRegistry* Metrics::setCurrent(MetricsRegistry* registry) {
+            MetricsRegistry* previous = currentRegistry;
+            currentRegistry = registry;
+            return previous;
+        }
+
+    } // pcl_aggregator
+} // utils
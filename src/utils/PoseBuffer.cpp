@@ -0,0 +1,82 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/utils/PoseBuffer.h>
+#include <algorithm>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        PoseBuffer::PoseBuffer(std::size_t capacity) {
+            this->capacity = std::max<std::size_t>(capacity, 1);
+        }
+
+        void PoseBuffer::addPose(std::uint64_t timestamp, const Eigen::Affine3d& pose) {
+
+            StampedPose stamped = {timestamp, pose.translation(), Eigen::Quaterniond(pose.rotation()).normalized()};
+
+            std::lock_guard<std::mutex> lock(this->posesMutex);
+
+            // odometry comes in order, so this is almost always an append
+            if(this->poses.empty() || this->poses.back().timestamp <= timestamp) {
+                this->poses.push_back(stamped);
+            } else {
+                auto position = std::upper_bound(this->poses.begin(), this->poses.end(), timestamp,
+                                                 [](std::uint64_t t, const StampedPose& p) {
+                                                     return t < p.timestamp;
+                                                 });
+                this->poses.insert(position, stamped);
+            }
+
+            while(this->poses.size() > this->capacity)
+                this->poses.pop_front();
+        }
+
+        bool PoseBuffer::getPose(std::uint64_t timestamp, Eigen::Affine3d& pose) const {
+
+            std::lock_guard<std::mutex> lock(this->posesMutex);
+
+            if(this->poses.empty())
+                return false;
+
+            // the first pose after the time
+            auto after = std::upper_bound(this->poses.begin(), this->poses.end(), timestamp,
+                                          [](std::uint64_t t, const StampedPose& p) {
+                                              return t < p.timestamp;
+                                          });
+
+            const StampedPose* a;
+            const StampedPose* b;
+            if(after == this->poses.begin()) {
+                a = b = &this->poses.front();
+            } else if(after == this->poses.end()) {
+                a = b = &this->poses.back();
+            } else {
+                a = &*(after - 1);
+                b = &*after;
+            }
+
+            double w = 0;
+            if(b->timestamp > a->timestamp)
+                w = (double) (timestamp - a->timestamp) / (double) (b->timestamp - a->timestamp);
+
+            pose = Eigen::Affine3d::Identity();
+            pose.linear() = a->rotation.slerp(w, b->rotation).toRotationMatrix();
+            pose.translation() = (1.0 - w) * a->translation + w * b->translation;
+
+            return true;
+        }
+
+        std::size_t PoseBuffer::size() const {
+            std::lock_guard<std::mutex> lock(this->posesMutex);
+            return this->poses.size();
+        }
+
+        void PoseBuffer::clear() {
+            std::lock_guard<std::mutex> lock(this->posesMutex);
+            this->poses.clear();
+        }
+
+    } // pcl_aggregator
+} // utils
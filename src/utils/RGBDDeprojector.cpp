@@ -3,6 +3,8 @@
 //
 
 #include <pcl_aggregator_core/utils/RGBDDeprojector.h>
+#include <pcl_aggregator_core/compute/CPUBackend.h>
+#include <iostream>
 
 namespace pcl_aggregator {
     namespace utils {
@@ -38,19 +40,56 @@ namespace pcl_aggregator {
             this->isFrameIdSet = true;
         }
 
+        void RGBDDeprojector::setDepthRange(float minDepth, float maxDepth) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->minDepth = minDepth;
+            this->maxDepth = maxDepth;
+        }
+
+        void RGBDDeprojector::setDepthUnit(float unit) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->depthUnit = unit;
+        }
+
+        void RGBDDeprojector::setPointCloudCallback(
+                const std::function<void(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr)>& callback) {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->pointCloudCallback = callback;
+        }
+
         void RGBDDeprojector::addDepthImage(cv::Mat img) {
-            this->last_depth_image = img;
-            this->isDepthImageSet = true;
-            // TODO: start processing image
+
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr newCloud;
+            std::function<void(pcl::PointCloud<pcl::PointXYZRGBL>::Ptr)> callback;
+
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+
+                this->last_depth_image = img;
+                this->isDepthImageSet = true;
+
+                pcl::PointCloud<pcl::PointXYZRGBL>::Ptr previous = this->cloud;
+                this->deprojectImages();
+                if(this->cloud == previous)
+                    return;
+
+                newCloud = this->cloud;
+                callback = this->pointCloudCallback;
+            }
+
+            // outside the lock, the callback may take long
+            if(callback != nullptr)
+                callback(newCloud);
         }
 
         void RGBDDeprojector::addColorImage(cv::Mat img) {
+            std::lock_guard<std::mutex> lock(this->mutex);
             this->last_color_image = img;
             this->isColorImageSet = true;
-            // TODO: start processing image
         }
 
         pcl::PointCloud<pcl::PointXYZRGBL>::Ptr RGBDDeprojector::getPointCloud() const {
+            std::lock_guard<std::mutex> lock(this->mutex);
             return this->cloud;
         }
 
@@ -60,7 +99,43 @@ namespace pcl_aggregator {
             if(!this->isDepthImageSet)
                 return;
 
-            // TODO: create and call a CUDA kernel to deproject valid pixels into points
+            if(!this->isKSet) {
+                std::cerr << "The intrinsic matrix K was not set, can't deproject!" << std::endl;
+                return;
+            }
+
+            // a stale color image of another resolution is not used
+            cv::Mat color;
+            if(this->isColorImageSet && this->last_color_image.rows == this->last_depth_image.rows &&
+               this->last_color_image.cols == this->last_depth_image.cols)
+                color = this->last_color_image;
+
+            // a new cloud each frame, as the previous one may have been handed to a consumer
+            pcl::PointCloud<pcl::PointXYZRGBL>::Ptr newCloud(new pcl::PointCloud<pcl::PointXYZRGBL>());
+
+            int result;
+#ifdef PCL_AGGREGATOR_WITH_CUDA
+            if(compute::ComputeBackend::isCudaAvailable()) {
+                // the buffers are allocated on the first frame and then reused
+                if(this->context == nullptr)
+                    this->context = std::make_unique<cuda::rgbd::DeprojectionContext>();
+
+                result = this->context->deproject(color, this->last_depth_image, this->K, this->minDepth,
+                                                  this->maxDepth, *newCloud, this->depthUnit);
+            } else
+#endif
+            result = compute::CPUBackend::deprojectImages(color, this->last_depth_image, this->K, this->minDepth,
+                                                          this->maxDepth, *newCloud, this->depthUnit);
+
+            if(result < 0) {
+                std::cerr << "Error deprojecting the images" << std::endl;
+                return;
+            }
+
+            if(this->isFrameIdSet)
+                newCloud->header.frame_id = this->camera_frame_id;
+
+            this->cloud = newCloud;
         }
 
 
@@ -0,0 +1,118 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/utils/ThreadPool.h>
+#include <iostream>
+#include <exception>
+#include <utility>
+#include <pthread.h>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        ThreadPool::ThreadPool(std::size_t nThreads) {
+
+            if(nThreads == 0)
+                nThreads = std::thread::hardware_concurrency();
+            if(nThreads == 0)
+                nThreads = 1;
+
+            this->workers.reserve(nThreads);
+            for(std::size_t i = 0; i < nThreads; i++) {
+                this->workers.emplace_back(&ThreadPool::workerRoutine, this);
+                pthread_setname_np(this->workers.back().native_handle(), "poolWorkerThread");
+            }
+        }
+
+        ThreadPool::~ThreadPool() {
+
+            {
+                std::lock_guard<std::mutex> lock(this->jobsMutex);
+                this->stopping = true;
+            }
+            this->jobsCondition.notify_all();
+
+            // the workers drain the queue before leaving
+            for(auto& worker : this->workers)
+                worker.join();
+        }
+
+        void ThreadPool::workerRoutine() {
+
+            while(true) {
+
+                std::function<void()> job;
+
+                {
+                    std::unique_lock<std::mutex> lock(this->jobsMutex);
+                    this->jobsCondition.wait(lock, [this] {
+                        return this->stopping || !this->jobs.empty();
+                    });
+
+                    if(this->jobs.empty())
+                        return;
+
+                    job = std::move(this->jobs.front());
+                    this->jobs.pop_front();
+                }
+
+                try {
+                    job();
+                } catch (std::exception &e) {
+                    std::cerr << "Error running a job on the thread pool: " << e.what() << std::endl;
+                }
+            }
+        }
+
+        void ThreadPool::submit(std::function<void()> job) {
+
+            {
+                std::lock_guard<std::mutex> lock(this->jobsMutex);
+                this->jobs.push_back(std::move(job));
+            }
+            this->jobsCondition.notify_one();
+        }
+
+        std::size_t ThreadPool::getThreadCount() const {
+            return this->workers.size();
+        }
+
+        TaskGroup::TaskGroup(ThreadPool& pool): pool(pool) {
+        }
+
+        TaskGroup::~TaskGroup() {
+            this->wait();
+        }
+
+        void TaskGroup::submit(std::function<void()> job) {
+
+            {
+                std::lock_guard<std::mutex> lock(this->pendingMutex);
+                this->pending++;
+            }
+
+            this->pool.submit([this, job = std::move(job)] {
+
+                try {
+                    job();
+                } catch (std::exception &e) {
+                    std::cerr << "Error running a job on the thread pool: " << e.what() << std::endl;
+                }
+
+                std::lock_guard<std::mutex> lock(this->pendingMutex);
+                if(--this->pending == 0)
+                    this->pendingCondition.notify_all();
+            });
+        }
+
+        void TaskGroup::wait() {
+
+            std::unique_lock<std::mutex> lock(this->pendingMutex);
+            this->pendingCondition.wait(lock, [this] {
+                return this->pending == 0;
+            });
+        }
+
+    } // pcl_aggregator
+} // utils
@@ -0,0 +1,240 @@
+//
+// Created by carlostojal on 14-10-2026.
+//
+
+#include <pcl_aggregator_core/utils/TimingWheel.h>
+#include <pcl_aggregator_core/utils/Utils.h>
+#include <iostream>
+#include <exception>
+#include <algorithm>
+#include <iterator>
+#include <limits>
+#include <utility>
+#include <pthread.h>
+
+namespace pcl_aggregator {
+    namespace utils {
+
+        TimingWheel::TimingWheel(std::function<void(std::vector<WheelTimer>&)> onExpired,
+                                 unsigned long long tickMs, std::size_t slotCount) {
+
+            this->onExpired = std::move(onExpired);
+            this->tickMs = tickMs > 0 ? tickMs : 1;
+
+            // a power of two count turns the modulo into a mask
+            std::size_t n = 1;
+            while(n < slotCount)
+                n <<= 1;
+            this->slots.resize(n);
+
+            this->cursor = this->getCurrentTick();
+            this->wakeTick = std::numeric_limits<unsigned long long>::max();
+
+            this->wheelThread = std::thread(&TimingWheel::wheelRoutine, this);
+            pthread_setname_np(this->wheelThread.native_handle(), "timingWheelThread");
+        }
+
+        TimingWheel::~TimingWheel() {
+            this->stop();
+        }
+
+        unsigned long long TimingWheel::getCurrentTick() const {
+            return Utils::getCurrentTimeMillis() / this->tickMs;
+        }
+
+        void TimingWheel::collectExpired(unsigned long long tick, std::vector<WheelTimer>& expired) {
+
+            if(tick < this->cursor)
+                return;
+
+            // a late wake up visits each bucket once at most
+            std::size_t toVisit = this->slots.size();
+            if(tick - this->cursor + 1 < toVisit)
+                toVisit = (std::size_t) (tick - this->cursor + 1);
+
+            const std::size_t mask = this->slots.size() - 1;
+
+            for(std::size_t i = 0; i < toVisit; i++) {
+
+                std::deque<WheelTimer>& slot = this->slots[(this->cursor + i) & mask];
+
+                // the timers of later turns are behind the ones due, and stay on the bucket
+                while(!slot.empty() && slot.front().expiry / this->tickMs <= tick) {
+                    expired.push_back(slot.front());
+                    slot.pop_front();
+                }
+            }
+
+            this->count -= expired.size();
+            this->cursor = tick + 1;
+        }
+
+        unsigned long long TimingWheel::getNextBusyTick() const {
+
+            if(this->count == 0)
+                return std::numeric_limits<unsigned long long>::max();
+
+            const std::size_t mask = this->slots.size() - 1;
+
+            // the timers on the bucket may be for a later turn, then the wheel just wakes up on it again
+            for(std::size_t i = 0; i < this->slots.size(); i++) {
+                if(!this->slots[(this->cursor + i) & mask].empty())
+                    return this->cursor + i;
+            }
+
+            return std::numeric_limits<unsigned long long>::max();
+        }
+
+        void TimingWheel::wheelRoutine() {
+
+            std::unique_lock<std::mutex> lock(this->wheelMutex);
+
+            while(!this->stopping) {
+
+                std::vector<WheelTimer> expired;
+                this->collectExpired(this->getCurrentTick(), expired);
+
+                if(!expired.empty()) {
+
+                    // taken before releasing the buckets, so a cancel either drops the timers or waits for the callback
+                    std::unique_lock<std::mutex> fireLock(this->fireMutex);
+                    lock.unlock();
+
+                    try {
+                        this->onExpired(expired);
+                    } catch (std::exception &e) {
+                        std::cerr << "Error expiring timers on the timing wheel: " << e.what() << std::endl;
+                    }
+
+                    fireLock.unlock();
+                    lock.lock();
+                    continue;
+                }
+
+                this->wakeTick = this->getNextBusyTick();
+
+                // sleep until the next busy bucket, new earlier timers or stopping
+                if(this->wakeTick == std::numeric_limits<unsigned long long>::max()) {
+                    this->wheelCondition.wait(lock);
+                } else {
+                    this->wheelCondition.wait_until(lock, std::chrono::system_clock::time_point(
+                            std::chrono::milliseconds(this->wakeTick * this->tickMs)));
+                }
+            }
+        }
+
+        void TimingWheel::schedule(unsigned long long expiry, std::uint32_t label, void* owner) {
+
+            bool wake;
+            {
+                std::lock_guard<std::mutex> lock(this->wheelMutex);
+
+                // the buckets already visited are only seen again a turn later
+                unsigned long long tick = expiry / this->tickMs;
+                if(tick < this->cursor) {
+                    tick = this->cursor;
+                    expiry = tick * this->tickMs;
+                }
+
+                // the scans mostly come in expiry order, so the place is found from the back in a step or two
+                std::deque<WheelTimer>& slot = this->slots[tick & (this->slots.size() - 1)];
+                auto position = slot.end();
+                while(position != slot.begin() && std::prev(position)->expiry > expiry)
+                    --position;
+                slot.insert(position, {expiry, label, owner});
+                this->count++;
+
+                wake = tick < this->wakeTick;
+                if(wake)
+                    this->wakeTick = tick;
+            }
+
+            if(wake)
+                this->wheelCondition.notify_all();
+        }
+
+        void TimingWheel::cancel(const void* owner) {
+
+            {
+                std::lock_guard<std::mutex> lock(this->wheelMutex);
+
+                // keeping the order of the others
+                for(auto& slot : this->slots) {
+                    auto end = std::remove_if(slot.begin(), slot.end(), [owner](const WheelTimer& timer) {
+                        return timer.owner == owner;
+                    });
+                    this->count -= (std::size_t) (slot.end() - end);
+                    slot.erase(end, slot.end());
+                }
+            }
+
+            // the timers being expired may belong to the owner
+            std::lock_guard<std::mutex> fireLock(this->fireMutex);
+        }
+
+        std::size_t TimingWheel::takeEarliest(const std::function<bool(const WheelTimer&)>& take,
+                                              std::vector<WheelTimer>& taken) {
+
+            std::lock_guard<std::mutex> lock(this->wheelMutex);
+
+            const std::size_t mask = this->slots.size() - 1;
+            std::size_t n = 0;
+            unsigned long long tick = this->cursor;
+
+            while(this->count > 0) {
+
+                // a turn from the tick, taking the timers due on each tick from the front of its bucket
+                for(std::size_t i = 0; i < this->slots.size() && this->count > 0; i++, tick++) {
+                    std::deque<WheelTimer>& slot = this->slots[tick & mask];
+                    while(!slot.empty() && slot.front().expiry / this->tickMs <= tick) {
+                        if(!take(slot.front()))
+                            return n;
+                        taken.push_back(slot.front());
+                        slot.pop_front();
+                        this->count--;
+                        n++;
+                    }
+                }
+
+                if(this->count == 0)
+                    break;
+
+                // the timers left are turns away: skip straight to the earliest of them
+                tick = std::numeric_limits<unsigned long long>::max();
+                for(const auto& slot : this->slots) {
+                    if(!slot.empty())
+                        tick = std::min(tick, slot.front().expiry / this->tickMs);
+                }
+            }
+
+            return n;
+        }
+
+        void TimingWheel::getTimers(std::vector<WheelTimer>& timers) {
+
+            std::lock_guard<std::mutex> lock(this->wheelMutex);
+
+            timers.reserve(timers.size() + this->count);
+            for(const auto& slot : this->slots)
+                timers.insert(timers.end(), slot.begin(), slot.end());
+        }
+
+        void TimingWheel::stop() {
+
+            {
+                std::lock_guard<std::mutex> lock(this->wheelMutex);
+                this->stopping = true;
+            }
+            this->wheelCondition.notify_all();
+
+            if(this->wheelThread.joinable())
+                this->wheelThread.join();
+        }
+
+        std::size_t TimingWheel::size() {
+            std::lock_guard<std::mutex> lock(this->wheelMutex);
+            return this->count;
+        }
+
+    } // pcl_aggregator
+} // utils